@@ -0,0 +1,142 @@
+/**
+ * Region allocator for everything a parsed class references.
+ * Memory is handed out by bumping a pointer inside big blocks
+ * and is only ever given back all at once.
+ * 
+ */
+
+#include "arena.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "stats.h"
+
+#define ARENA_MIN_BLOCK_SIZE 4096
+
+/**
+ * Allocates a new block and makes it current
+ * 
+ * @param arena to grow
+ * @param minimal usable size of the block
+ */
+static void arena_grow(arena *a, size_t size)
+{
+    if (size < ARENA_MIN_BLOCK_SIZE)
+        size = ARENA_MIN_BLOCK_SIZE;
+
+    arena_block *block = malloc(sizeof(arena_block) + size);
+    if (!block)
+        abort();
+    stats_alloc(sizeof(arena_block) + size);
+
+    block->next = a->head;
+    block->size = size;
+    block->used = 0;
+    a->head = block;
+    a->total_size += size;
+}
+
+/**
+ * Prepares an arena with one block of the given size
+ * 
+ * @param arena to initialize
+ * @param expected amount of memory to be allocated
+ */
+void arena_init(arena *a, size_t size)
+{
+    a->head = NULL;
+    a->total_size = 0;
+    arena_grow(a, size);
+}
+
+/**
+ * Makes sure the next allocations of the given total size 
+ * are served from a single block
+ * 
+ * @param arena to reserve memory in
+ * @param size to reserve
+ */
+void arena_reserve(arena *a, size_t size)
+{
+    size += ARENA_ALIGNMENT;
+    if (!a->head || a->head->size - a->head->used < size)
+        arena_grow(a, size > a->total_size ? size : a->total_size);
+}
+
+/**
+ * Allocates aligned memory from the arena
+ * 
+ * @param arena to allocate from
+ * @param size of memory
+ * @return pointer to memory which lives until the arena is reset
+ */
+void *arena_alloc(arena *a, size_t size)
+{
+    size = (size + ARENA_ALIGNMENT - 1) & ~(size_t)(ARENA_ALIGNMENT - 1);
+
+    if (!a->head || a->head->size - a->head->used < size)
+        arena_grow(a, size > a->total_size ? size : a->total_size); // double on overflow
+
+    void *ptr = a->head->data + a->head->used;
+    a->head->used += size;
+    return ptr;
+}
+
+/**
+ * Allocates zeroed array from the arena
+ * 
+ * @param arena to allocate from
+ * @param count of elements
+ * @param size of one element
+ * @return pointer to zeroed memory
+ */
+void *arena_calloc(arena *a, size_t count, size_t size)
+{
+    void *ptr = arena_alloc(a, count * size);
+    memset(ptr, 0, count * size);
+    return ptr;
+}
+
+/**
+ * Forgets every allocation but keeps the memory for reuse.
+ * If the arena had to grow, its blocks are merged into one
+ * big block, so the next round of the same size fits at once.
+ * 
+ * @param arena to reset
+ */
+void arena_reset(arena *a)
+{
+    if (!a->head)
+        return;
+
+    if (a->head->next)
+    {
+        size_t size = a->total_size;
+        arena_release(a);
+        arena_grow(a, size);
+        return;
+    }
+
+    a->head->used = 0;
+}
+
+/**
+ * Gives all memory of the arena back to the system
+ * 
+ * @param arena to release
+ */
+void arena_release(arena *a)
+{
+    arena_block *block = a->head;
+
+    while (block)
+    {
+        arena_block *next = block->next;
+        free(block);
+        block = next;
+    }
+
+    a->head = NULL;
+    a->total_size = 0;
+}
@@ -0,0 +1,32 @@
+#ifndef ARENA_H
+#define ARENA_H
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+#define ARENA_ALIGNMENT 16
+
+typedef struct arena_block_s
+{
+    struct arena_block_s *next;
+    size_t size;
+    size_t used;
+    unsigned char data[];
+
+} arena_block;
+
+typedef struct arena_s
+{
+    arena_block *head; // block we are currently allocating from
+    size_t total_size; // sum of all block sizes
+
+} arena;
+
+void arena_init(arena *a, size_t size);
+void arena_reserve(arena *a, size_t size);
+void *arena_alloc(arena *a, size_t size);
+void *arena_calloc(arena *a, size_t count, size_t size);
+void arena_reset(arena *a);
+void arena_release(arena *a);
+
+#endif
@@ -0,0 +1,257 @@
+/**
+ * Parses and prints many class files at once.
+ * 
+ * Files and archive entries are processed (inflated, parsed and
+ * formatted) on a work-stealing thread pool, each one into its
+ * own memory buffer. A writer thread emits the buffers
+ * strictly in input order as soon as they are complete, so the
+ * output does not depend on the number of threads.
+ * 
+ */
+
+#define _GNU_SOURCE
+#include "batch.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "class_reader.h"
+#include "class_stream.h"
+#include "pretty_printer.h"
+#include "thread_pool.h"
+
+/**
+ * Parses one input: a file, an archive entry or the standard
+ * input ("-"), which is parsed as it arrives
+ * 
+ * @param input to parse
+ * @param arena to allocate from
+ * @param flags PARSE_* options
+ * @param cache of parsed pools, NULL for none
+ * @return class or NULL on error (see class_error)
+ */
+class *parse_class_input(class_input *input, arena *a, unsigned flags, parse_cache *cache)
+{
+    if (input->error)
+    {
+        set_class_error("%s", input->error);
+        return NULL;
+    }
+
+    if (!input->jar && strcmp(input->name, "-") == 0)
+        return read_class_stream(STDIN_FILENO, a, flags);
+    if (!input->jar)
+        return map_class_file(input->name, a, flags, cache);
+
+    size_t size;
+    const uint64_t start = stats_start();
+    const uint8_t *data = read_jar_entry(input->jar, input->entry, a, &size);
+
+    stats_stop(PHASE_OPEN, start);
+    if (data)
+        stats_read(size);
+    return data ? parse_class_buffer(data, size, a, flags, cache) : NULL;
+}
+
+/**
+ * Picks how much of a class to parse for the output asked for
+ * 
+ * @param options of the run
+ * @return PARSE_* flags
+ */
+unsigned batch_parse_flags(const batch_options *options)
+{
+    const bool members = options->summary || options->code;
+    return (options->constant_index || members ? PARSE_LAZY : 0) | (members ? 0 : PARSE_POOL_ONLY);
+}
+
+/**
+ * Formats the part of the class the user asked for
+ * 
+ * @param buffer to write to
+ * @param class struct
+ * @param name of the input
+ * @param options of the run
+ * @return false if the class turned out to be malformed (see class_error)
+ */
+bool print_class(out_buffer *out, class *cls, const char *name, const batch_options *options)
+{
+    if (options->constant_index)
+    {
+        if (!resolve_constant(cls, options->constant_index))
+            return false;
+
+        if (options->format != FORMAT_TEXT)
+            print_constant_record(out, options->format, cls, options->constant_index - 1, name);
+        else
+            print_constant(out, cls, options->constant_index - 1);
+        return true;
+    }
+
+    if (options->summary || options->code)
+        return print_class_summary(out, cls, options->code);
+
+    if (options->format != FORMAT_TEXT)
+    {
+        print_pool_records(out, options->format, cls, name);
+        return true;
+    }
+
+    print_version_info(out, cls);
+    print_constant_pool(out, cls);
+    return true;
+}
+
+/**
+ * Parses and formats one input into its output buffer
+ * 
+ * @param context batch being processed
+ * @param index of the input
+ * @param worker running the task
+ */
+static void process_file(void *context, size_t index, int worker)
+{
+    batch *b = context;
+    class_input *input = b->inputs + index;
+    batch_output *output = b->outputs + index;
+    arena *a = b->arenas + worker;
+    out_buffer *out = &output->text;
+
+    if (b->stats)
+    {
+        thread_stats = b->stats + worker;
+        thread_stats->file = input->name;
+        thread_stats->files++;
+    }
+
+    out_init(out, -1);
+
+    const unsigned flags = batch_parse_flags(b->options);
+    // A lazy parse touches less than hashing the file and loading a cache entry
+    class *cls = parse_class_input(input, a, flags, flags & PARSE_LAZY ? NULL : b->options->cache);
+    if (cls)
+    {
+        const uint64_t start = stats_start();
+
+        if (thread_stats)
+            count_constants(cls);
+        if (b->headers)
+        {
+            out_str(out, "Classfile ");
+            out_str(out, input->name);
+            out_char(out, '\n');
+        }
+        if (!print_class(out, cls, input->name, b->options))
+            output->error = strdup(class_error());
+        else if (b->headers)
+            out_char(out, '\n');
+        stats_stop(PHASE_PRINT, start);
+        free_class(cls);
+    }
+    else
+    {
+        output->error = strdup(class_error());
+    }
+
+    arena_reset(a);
+
+    if (thread_stats)
+    {
+        thread_stats->failed += output->error != NULL;
+        thread_stats = NULL;
+    }
+
+    pthread_mutex_lock(&b->lock);
+    output->done = true;
+    pthread_cond_broadcast(&b->ready);
+    pthread_mutex_unlock(&b->lock);
+}
+
+/**
+ * Writer thread: emits outputs in input order
+ * 
+ * @param context batch being processed
+ * @return number of failed files
+ */
+static void *write_outputs(void *context)
+{
+    batch *b = context;
+    size_t failed = 0;
+
+    for (size_t i = 0; i < b->count; i++)
+    {
+        batch_output *output = b->outputs + i;
+
+        pthread_mutex_lock(&b->lock);
+        while (!output->done)
+            pthread_cond_wait(&b->ready, &b->lock);
+        pthread_mutex_unlock(&b->lock);
+
+        output->text.fd = STDOUT_FILENO;
+        out_free(&output->text); // one write() for the whole file
+        if (output->error)
+        {
+            if (b->count > 1)
+                fprintf(stderr, "%s: %s\n", b->inputs[i].name, output->error);
+            else
+                fprintf(stderr, "%s\n", output->error);
+            failed++;
+        }
+
+        free(output->error);
+    }
+
+    return (void *)failed;
+}
+
+/**
+ * Parses and prints all inputs, in order, using a pool of threads
+ * 
+ * @param files to process
+ * @param options of the run
+ * @return number of inputs that could not be parsed
+ */
+int run_batch(file_list *files, const batch_options *options)
+{
+    const size_t count = files->count;
+    int thread_count = options->thread_count;
+    batch b = {files->inputs, count, count > 1 && options->format == FORMAT_TEXT, options};
+    pthread_t writer;
+    void *failed;
+
+    if (thread_count < 1)
+        thread_count = 1;
+
+    b.outputs = calloc(count ? count : 1, sizeof(batch_output));
+    b.arenas = calloc(thread_count, sizeof(arena));
+    b.stats = options->stats ? calloc(thread_count, sizeof(run_stats)) : NULL;
+    for (int i = 0; i < thread_count; i++)
+    {
+        thread_stats = b.stats ? b.stats + i : NULL; // first block of each worker
+        arena_init(b.arenas + i, 1 << 16);
+    }
+    thread_stats = NULL;
+
+    pthread_mutex_init(&b.lock, NULL);
+    pthread_cond_init(&b.ready, NULL);
+
+    pthread_create(&writer, NULL, write_outputs, &b);
+    run_thread_pool(count, thread_count, process_file, &b);
+    pthread_join(writer, &failed);
+
+    pthread_cond_destroy(&b.ready);
+    pthread_mutex_destroy(&b.lock);
+    for (int i = 0; i < thread_count; i++)
+    {
+        arena_release(b.arenas + i);
+        if (b.stats)
+            merge_stats(options->stats, b.stats + i);
+    }
+    free(b.arenas);
+    free(b.stats);
+    free(b.outputs);
+
+    return (int)(size_t)failed;
+}
@@ -0,0 +1,55 @@
+#ifndef BATCH_H
+#define BATCH_H
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <pthread.h>
+
+#include "arena.h"
+#include "class_reader.h"
+#include "file_list.h"
+#include "output.h"
+#include "record_printer.h"
+#include "stats.h"
+
+typedef struct batch_options_s
+{
+    int thread_count;
+    uint16_t constant_index; // print only this constant, parsing lazily; 0 for the whole pool
+    bool summary;            // print declarations like javap without -c instead of the pool
+    bool code;               // print declarations with disassembled bytecode like javap -c
+    parse_cache *cache;      // where resolved pools are kept between runs, NULL for none; not used by lazy parses
+    output_format format;    // of the constant pool output
+    run_stats *stats;        // counters of the run are added here, NULL to collect none
+
+} batch_options;
+
+typedef struct batch_output_s
+{
+    out_buffer text; // formatted output of the file
+    char *error;     // why the file couldn't be parsed, NULL on success
+    bool done;
+
+} batch_output;
+
+typedef struct batch_s
+{
+    class_input *inputs;
+    size_t count;
+    bool headers; // print the file name before its output (text format only)
+    const batch_options *options;
+
+    batch_output *outputs;
+    arena *arenas; // one per worker, reset after every file
+    run_stats *stats; // one per worker, NULL unless collected
+    pthread_mutex_t lock;
+    pthread_cond_t ready;
+
+} batch;
+
+class *parse_class_input(class_input *input, arena *a, unsigned flags, parse_cache *cache);
+unsigned batch_parse_flags(const batch_options *options);
+bool print_class(out_buffer *out, class *cls, const char *name, const batch_options *options);
+int run_batch(file_list *files, const batch_options *options);
+
+#endif
@@ -0,0 +1,525 @@
+/**
+ * Benchmark harness: times parsing and printing of .class files
+ * separately and prints one JSON object per file, so results of
+ * different commits can be compared with any JSON tool.
+ *
+ * Phases:
+ *   parse        open_class_file + parse_class_file + free_class, as the tool does it
+ *   parse_buffer parse_class_buffer from memory into a reused arena
+ *   parse_stream class_stream fed in 4 KB slices, as from a pipe
+ *   print        print_constant_pool into an in-memory buffer
+ *   print_fprintf the same text with one fprintf per line into a memory
+ *                stream, as the printer did before out_buffer; both
+ *                print phases are also reported in lines per second
+ *   print_jsonl  the same as --format=jsonl records
+ *   print_bin    the same as --format=bin records
+ *   decode       decode_instruction over the Code of every method,
+ *                reported per instruction and per byte of code
+ *   print_code   print_class_summary with the bytecode, as -c does
+ *
+ * The two code phases run only for classes that have code.
+ * Every phase runs in batches of at least -t seconds, the best
+ * of -r batches is reported.
+ *
+ */
+
+#define _GNU_SOURCE
+#include <inttypes.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/resource.h>
+
+#include "../class_reader.h"
+#include "../bytecode.h"
+#include "../class_stream.h"
+#include "../pretty_printer.h"
+#include "../record_printer.h"
+#include "../output.h"
+#include "../arena.h"
+#include "../java_number.h"
+
+typedef struct bench_file_s
+{
+    const char *path;
+    uint8_t *data;
+    size_t size;
+    size_t constants;
+    size_t lines; // of the constant pool output
+    size_t instructions; // in the Code of all methods
+    size_t code_bytes;
+    class *cls; // parsed once for the print phase
+    arena arena;
+    out_buffer out;
+    FILE *stream; // memory stream of print_fprintf
+    char *stream_data;
+    size_t stream_size;
+
+} bench_file;
+
+typedef bool (*bench_phase)(bench_file *file);
+
+static double now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static bool phase_parse(bench_file *file)
+{
+    FILE *f = open_class_file((char *)file->path);
+    class *cls = f ? parse_class_file(f) : NULL;
+
+    if (!cls)
+        return false;
+    free_class(cls);
+    return true;
+}
+
+static bool phase_parse_buffer(bench_file *file)
+{
+    class *cls = parse_class_buffer(file->data, file->size, &file->arena, 0, NULL);
+
+    if (!cls)
+        return false;
+    free_class(cls);
+    arena_reset(&file->arena);
+    return true;
+}
+
+static bool phase_parse_stream(bench_file *file)
+{
+    class_stream stream;
+    stream_status status = STREAM_MORE;
+
+    init_class_stream(&stream, &file->arena, 0);
+    for (size_t pos = 0; status == STREAM_MORE && pos < file->size; pos += 4096)
+        status = feed_class_stream(&stream, file->data + pos, file->size - pos < 4096 ? file->size - pos : 4096);
+
+    class *cls = status == STREAM_FAILED ? NULL : finish_class_stream(&stream);
+    if (!cls)
+    {
+        free_class_stream(&stream);
+        return false;
+    }
+    free_class(cls);
+    arena_reset(&file->arena);
+    return true;
+}
+
+static bool phase_print(bench_file *file)
+{
+    file->out.length = 0;
+    print_constant_pool(&file->out, file->cls);
+    return true;
+}
+
+/**
+ * Length of a Utf8 constant up to the first newline, as the
+ * printer cuts it
+ */
+static int line_length(utf_view view)
+{
+    const char *newline = memchr(view.bytes, '\n', view.length);
+    return newline ? (int)(newline - view.bytes) : view.length;
+}
+
+#define VIEW(view) line_length(view), (view).bytes
+
+/**
+ * The constant pool printed with one fprintf per line, the way
+ * print_constant_pool wrote it before out_buffer. The output is
+ * the same bytes.
+ *
+ * @param stream to write to
+ * @param cls class struct
+ */
+static void fprintf_constant_pool(FILE *stream, class *cls)
+{
+    for (int i = 1; i < cls->constant_pool_count; i++)
+    {
+        const resolved_constant *r = cls->resolved + i - 1;
+        constant_info c;
+        char text[JAVA_NUMBER_MAX];
+
+        if (!cls->tags[i - 1] || !get_constant(cls, i, &c))
+            continue;
+
+        switch (c.class_i.tag)
+        {
+        case CONSTANT_Class:
+        case CONSTANT_String:
+            fprintf(stream, "#%d = %s\t\t#%d\t\t// %.*s\n", i, c.class_i.tag == CONSTANT_Class ? "Class" : "String",
+                    c.class_i.name_index, VIEW(constant_utf(cls, r->utf)));
+            break;
+        case CONSTANT_Fieldref:
+        case CONSTANT_Methodref:
+        case CONSTANT_InterfaceMethodref:
+            fprintf(stream, "#%d = %s#%d.#%d\t\t// %.*s.%.*s:%.*s\n", i,
+                    c.class_i.tag == CONSTANT_Fieldref    ? "Fieldref\t\t"
+                    : c.class_i.tag == CONSTANT_Methodref ? "MethodRef\t\t"
+                                                          : "InterfaceMethodRef\t",
+                    c.ref_i.class_index, c.ref_i.name_and_type_index, VIEW(constant_utf(cls, r->owner)),
+                    VIEW(constant_utf(cls, r->name)), VIEW(constant_utf(cls, r->descriptor)));
+            break;
+        case CONSTANT_NameAndType:
+            fprintf(stream, "#%d = NameAndType\t#%d:#%d\t\t// %.*s:%.*s\n", i, c.ref_i.class_index,
+                    c.ref_i.name_and_type_index, VIEW(constant_utf(cls, r->name)), VIEW(constant_utf(cls, r->descriptor)));
+            break;
+        case CONSTANT_Integer:
+            fprintf(stream, "#%d = Integer\t\t%d\n", i, (int32_t)c.int_float_i.bytes);
+            break;
+        case CONSTANT_Float:
+            text[format_java_float(text, c.int_float_i.bytes)] = '\0';
+            fprintf(stream, "#%d = Float\t\t%sf\n", i, text);
+            break;
+        case CONSTANT_Long:
+            fprintf(stream, "#%d = Long\t\t%" PRId64 "l\n", i,
+                    (int64_t)((uint64_t)c.long_double_i.high_bytes << 32 | c.long_double_i.low_bytes));
+            break;
+        case CONSTANT_Double:
+            text[format_java_double(text, (uint64_t)c.long_double_i.high_bytes << 32 | c.long_double_i.low_bytes)] = '\0';
+            fprintf(stream, "#%d = Double\t\t%sd\n", i, text);
+            break;
+        case CONSTANT_Utf8:
+            fprintf(stream, "#%d = Utf8\t\t%.*s\n", i, VIEW(constant_utf(cls, r->utf)));
+            break;
+        case CONSTANT_MethodHandle:
+            fprintf(stream, "#%d = MethodHandle\t%d:#%d\t\t// %s %.*s.%.*s:%.*s\n", i, c.method_handle_i.reference_kind,
+                    c.method_handle_i.reference_index, reference_kind[c.method_handle_i.reference_kind - 1],
+                    VIEW(constant_utf(cls, r->owner)), VIEW(constant_utf(cls, r->name)), VIEW(constant_utf(cls, r->descriptor)));
+            break;
+        case CONSTANT_MethodType:
+            fprintf(stream, "#%d = MethodType\t\t%d\t\t// %.*s\n", i, c.method_type_i.descriptor_index,
+                    VIEW(constant_utf(cls, r->descriptor)));
+            break;
+        case CONSTANT_InvokeDynamic:
+            fprintf(stream, "#%d = InvokeDynamic\t#%d:#%d\t\t// #%d:%.*s:%.*s\n", i,
+                    c.invoke_dynamic_i.bootstrap_method_attr_index, c.invoke_dynamic_i.name_and_type_index,
+                    c.invoke_dynamic_i.bootstrap_method_attr_index, VIEW(constant_utf(cls, r->name)),
+                    VIEW(constant_utf(cls, r->descriptor)));
+            break;
+        }
+    }
+}
+
+static bool phase_print_fprintf(bench_file *file)
+{
+    rewind(file->stream);
+    fprintf_constant_pool(file->stream, file->cls);
+    return fflush(file->stream) == 0;
+}
+
+static bool phase_print_jsonl(bench_file *file)
+{
+    file->out.length = 0;
+    print_pool_records(&file->out, FORMAT_JSONL, file->cls, file->path);
+    return true;
+}
+
+static bool phase_print_bin(bench_file *file)
+{
+    file->out.length = 0;
+    print_pool_records(&file->out, FORMAT_BINARY, file->cls, file->path);
+    return true;
+}
+
+/**
+ * Decodes every instruction of every method
+ *
+ * @param file to decode
+ * @param instructions set to the number of instructions, may be NULL
+ * @param code_bytes set to the length of all code, may be NULL
+ * @return false on malformed code
+ */
+static bool decode_methods(bench_file *file, size_t *instructions, size_t *code_bytes)
+{
+    class *cls = file->cls;
+    size_t count = 0, bytes = 0;
+
+    for (int i = 0; i < cls->methods_count; i++)
+    {
+        const member_info *method = cls->methods + i;
+        const attribute_info *attribute = find_attribute(cls, method->attributes, method->attributes_count, "Code");
+        code_attribute code;
+        instruction ins;
+
+        if (!attribute)
+            continue;
+        if (!parse_code_attribute(cls, attribute, &code))
+            return false;
+
+        for (uint32_t pc = 0; pc < code.code_length; pc += ins.length, count++)
+        {
+            if (!decode_instruction(code.code, code.code_length, pc, &ins))
+                return false;
+        }
+        bytes += code.code_length;
+    }
+
+    if (instructions)
+        *instructions = count;
+    if (code_bytes)
+        *code_bytes = bytes;
+    return true;
+}
+
+static bool phase_decode(bench_file *file)
+{
+    return decode_methods(file, NULL, NULL);
+}
+
+static bool phase_print_code(bench_file *file)
+{
+    file->out.length = 0;
+    return print_class_summary(&file->out, file->cls, true);
+}
+
+/**
+ * Times one phase
+ *
+ * @param file to run the phase on
+ * @param phase to time
+ * @param repeats number of batches
+ * @param min_time of one batch in seconds
+ * @return best seconds per iteration, negative on a failure
+ */
+static double time_phase(bench_file *file, bench_phase phase, int repeats, double min_time)
+{
+    double best = -1;
+
+    for (int r = 0; r < repeats; r++)
+    {
+        long iterations = 0;
+        const double start = now();
+        double elapsed;
+
+        do
+        {
+            if (!phase(file))
+                return -1;
+            iterations++;
+        } while ((elapsed = now() - start) < min_time);
+
+        if (best < 0 || elapsed / iterations < best)
+            best = elapsed / iterations;
+    }
+    return best;
+}
+
+/**
+ * Reads the whole file into memory
+ *
+ * @param file with path set
+ * @return false if the file can't be read
+ */
+static bool load_file(bench_file *file)
+{
+    FILE *f = fopen(file->path, "rb");
+    long size;
+
+    if (!f || fseek(f, 0, SEEK_END) != 0 || (size = ftell(f)) < 0)
+    {
+        if (f)
+            fclose(f);
+        return false;
+    }
+    rewind(f);
+
+    file->size = size;
+    file->data = malloc(size ? size : 1);
+    bool ok = fread(file->data, 1, size, f) == (size_t)size;
+    fclose(f);
+    return ok;
+}
+
+static long peak_rss_kb(void)
+{
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    return usage.ru_maxrss;
+}
+
+/**
+ * Print one phase as JSON members
+ */
+static void print_phase(const char *name, double seconds, const bench_file *file)
+{
+    printf(", \"%s_ns\": %.0f, \"%s_mb_s\": %.2f, \"%s_constants_s\": %.0f",
+           name, seconds * 1e9,
+           name, file->size / seconds / 1e6,
+           name, file->constants / seconds);
+}
+
+/**
+ * Print lines per second of a print phase as a JSON member
+ */
+static void print_lines(const char *name, double seconds, const bench_file *file)
+{
+    printf(", \"%s_lines_s\": %.0f", name, file->lines / seconds);
+}
+
+/**
+ * Print one of the code phases as JSON members
+ */
+static void print_code_phase(const char *name, double seconds, const bench_file *file)
+{
+    printf(", \"%s_ns\": %.0f, \"%s_code_mb_s\": %.2f, \"%s_instructions_s\": %.0f",
+           name, seconds * 1e9,
+           name, file->code_bytes / seconds / 1e6,
+           name, file->instructions / seconds);
+}
+
+/**
+ * Print a JSON string, escaping quotes and backslashes
+ */
+static void print_json_cstring(const char *s)
+{
+    putchar('"');
+    for (; *s; s++)
+    {
+        if (*s == '"' || *s == '\\')
+            putchar('\\');
+        if ((unsigned char)*s >= 0x20)
+            putchar(*s);
+    }
+    putchar('"');
+}
+
+/**
+ * Print how to run the program
+ *
+ * @param name of the executable
+ */
+static void print_usage(const char *name)
+{
+    fprintf(stderr, "Usage: %s [-r repeats] [-t seconds] [-l label] file...\n", name);
+    fprintf(stderr, "  -r repeats  batches per phase, the best one is reported (default 5)\n");
+    fprintf(stderr, "  -t seconds  minimal duration of a batch (default 0.05)\n");
+    fprintf(stderr, "  -l label    added to every result, e.g. a commit hash\n");
+}
+
+int main(int argc, char *argv[])
+{
+    const char *label = "";
+    double min_time = 0.05;
+    int repeats = 5;
+    int failed = 0;
+    int option;
+
+    while ((option = getopt(argc, argv, "r:t:l:")) != -1)
+    {
+        switch (option)
+        {
+        case 'r':
+            repeats = atoi(optarg);
+            break;
+        case 't':
+            min_time = atof(optarg);
+            break;
+        case 'l':
+            label = optarg;
+            break;
+        default:
+            print_usage(argv[0]);
+            return EXIT_FAILURE;
+        }
+    }
+
+    if (optind == argc || repeats < 1)
+    {
+        print_usage(argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    for (int i = optind; i < argc; i++)
+    {
+        bench_file file = {argv[i]};
+        double parse, parse_buffer, parse_stream, print, print_fprintf, print_jsonl, print_bin, decode = 0, print_code = 0;
+
+        if (!load_file(&file))
+        {
+            fprintf(stderr, "%s: can't read the file\n", file.path);
+            failed++;
+            continue;
+        }
+
+        arena_init(&file.arena, 0);
+        out_init(&file.out, -1);
+        file.stream = open_memstream(&file.stream_data, &file.stream_size);
+
+        if (!(file.cls = parse_class_buffer(file.data, file.size, NULL, 0, NULL)))
+        {
+            fprintf(stderr, "%s: %s\n", file.path, class_error());
+            failed++;
+        }
+        else
+        {
+            file.constants = file.cls->constant_pool_count ? file.cls->constant_pool_count - 1 : 0;
+            for (size_t c = 0; c < file.constants; c++)
+                file.lines += file.cls->tags[c] != 0;
+
+            // The two printers have to write the same text
+            phase_print(&file);
+            phase_print_fprintf(&file);
+            const bool same = file.out.length == (size_t)ftell(file.stream) &&
+                              memcmp(file.out.data, file.stream_data, file.out.length) == 0;
+
+            if ((parse = time_phase(&file, phase_parse, repeats, min_time)) < 0 ||
+                (parse_buffer = time_phase(&file, phase_parse_buffer, repeats, min_time)) < 0 ||
+                (parse_stream = time_phase(&file, phase_parse_stream, repeats, min_time)) < 0 ||
+                (print = time_phase(&file, phase_print, repeats, min_time)) < 0 ||
+                (print_fprintf = time_phase(&file, phase_print_fprintf, repeats, min_time)) < 0 ||
+                (print_jsonl = time_phase(&file, phase_print_jsonl, repeats, min_time)) < 0 ||
+                (print_bin = time_phase(&file, phase_print_bin, repeats, min_time)) < 0 ||
+                !decode_methods(&file, &file.instructions, &file.code_bytes) ||
+                (file.instructions &&
+                 ((decode = time_phase(&file, phase_decode, repeats, min_time)) < 0 ||
+                  (print_code = time_phase(&file, phase_print_code, repeats, min_time)) < 0)))
+            {
+                fprintf(stderr, "%s: %s\n", file.path, class_error());
+                failed++;
+            }
+            else
+            {
+                printf("{\"label\": ");
+                print_json_cstring(label);
+                printf(", \"file\": ");
+                print_json_cstring(file.path);
+                printf(", \"bytes\": %zu, \"constants\": %zu", file.size, file.constants);
+                print_phase("parse", parse, &file);
+                print_phase("parse_buffer", parse_buffer, &file);
+                print_phase("parse_stream", parse_stream, &file);
+                print_phase("print", print, &file);
+                print_lines("print", print, &file);
+                print_phase("print_fprintf", print_fprintf, &file);
+                print_lines("print_fprintf", print_fprintf, &file);
+                printf(", \"print_fprintf_same\": %s", same ? "true" : "false");
+                print_phase("print_jsonl", print_jsonl, &file);
+                print_phase("print_bin", print_bin, &file);
+                if (file.instructions)
+                {
+                    printf(", \"instructions\": %zu, \"code_bytes\": %zu", file.instructions, file.code_bytes);
+                    print_code_phase("decode", decode, &file);
+                    print_code_phase("print_code", print_code, &file);
+                }
+                printf(", \"peak_rss_kb\": %ld}\n", peak_rss_kb());
+                fflush(stdout);
+            }
+            free_class(file.cls);
+        }
+
+        out_free(&file.out);
+        fclose(file.stream);
+        free(file.stream_data);
+        arena_release(&file.arena);
+        free(file.data);
+    }
+
+    return failed ? EXIT_FAILURE : 0;
+}
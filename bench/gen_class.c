@@ -0,0 +1,663 @@
+/**
+ * Generates synthetic .class files for benchmarking.
+ *
+ * The constant pool is filled with random constants of the asked
+ * tag mix, every reference points to a constant of the right kind,
+ * so the result is a valid class the parser accepts. The class
+ * has no fields or attributes; with -m it has methods whose Code is
+ * a random instruction stream of all operand layouts, with operands
+ * pointing to constants of the right kind and branches going back
+ * to the start of an earlier instruction.
+ *
+ */
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "../class_reader.h"
+#include "../bytecode.h"
+#include <math.h> // after class_reader.h, its inf_nan enum has a NAN member
+
+#define TAG_COUNT 14
+
+typedef struct tag_weight_s
+{
+    const char *name;
+    uint8_t tag;
+    double weight;
+
+} tag_weight;
+
+static tag_weight tag_mix[TAG_COUNT] = {
+    {"utf8", CONSTANT_Utf8, 40},
+    {"class", CONSTANT_Class, 10},
+    {"string", CONSTANT_String, 8},
+    {"int", CONSTANT_Integer, 3},
+    {"float", CONSTANT_Float, 2},
+    {"long", CONSTANT_Long, 2},
+    {"double", CONSTANT_Double, 2},
+    {"field", CONSTANT_Fieldref, 6},
+    {"method", CONSTANT_Methodref, 12},
+    {"imethod", CONSTANT_InterfaceMethodref, 2},
+    {"nat", CONSTANT_NameAndType, 10},
+    {"mh", CONSTANT_MethodHandle, 1},
+    {"mt", CONSTANT_MethodType, 1},
+    {"indy", CONSTANT_InvokeDynamic, 1},
+};
+
+typedef struct generator_s
+{
+    uint64_t seed;
+    int utf_min, utf_max;
+    double utf_skew; // > 1 makes short strings more likely
+
+    int methods;
+    int code_length; // of each method, about
+
+    uint8_t *tags; // 1-based like the pool
+    uint16_t *by_tag[19];
+    int by_tag_count[19];
+
+} generator;
+
+/**
+ * Code of one method being generated
+ */
+typedef struct code_buffer_s
+{
+    uint8_t *bytes;
+    uint32_t length;
+    uint32_t *starts; // offsets of the instructions so far
+    uint32_t count;
+    uint16_t last; // constants below it may be loaded
+
+} code_buffer;
+
+/**
+ * xorshift64* step
+ */
+static uint64_t next_random(generator *g)
+{
+    g->seed ^= g->seed >> 12;
+    g->seed ^= g->seed << 25;
+    g->seed ^= g->seed >> 27;
+    return g->seed * 0x2545F4914F6CDD1DULL;
+}
+
+static double next_unit(generator *g)
+{
+    return (next_random(g) >> 11) * (1.0 / 9007199254740992.0);
+}
+
+static void put_u1(FILE *f, uint8_t v)
+{
+    fputc(v, f);
+}
+
+static void put_u2(FILE *f, uint16_t v)
+{
+    put_u1(f, v >> 8);
+    put_u1(f, v & 0xff);
+}
+
+static void put_u4(FILE *f, uint32_t v)
+{
+    put_u2(f, v >> 16);
+    put_u2(f, v & 0xffff);
+}
+
+static void emit_u1(code_buffer *code, uint8_t v)
+{
+    code->bytes[code->length++] = v;
+}
+
+static void emit_u2(code_buffer *code, uint16_t v)
+{
+    emit_u1(code, v >> 8);
+    emit_u1(code, v & 0xff);
+}
+
+static void emit_u4(code_buffer *code, uint32_t v)
+{
+    emit_u2(code, v >> 16);
+    emit_u2(code, v & 0xffff);
+}
+
+/**
+ * Picks a random constant with the given tag
+ *
+ * @param g generator
+ * @param tag to look for
+ * @return index of the constant, 1-based
+ */
+static uint16_t pick(generator *g, uint8_t tag)
+{
+    return g->by_tag[tag][next_random(g) % g->by_tag_count[tag]];
+}
+
+/**
+ * Parses "name:weight,..." into the tag mix. Tags not
+ * mentioned get weight 0.
+ *
+ * @param spec of the mix
+ * @return false on an unknown tag name
+ */
+static bool parse_mix(const char *spec)
+{
+    char *copy = strdup(spec), *save = NULL;
+
+    for (int i = 0; i < TAG_COUNT; i++)
+        tag_mix[i].weight = 0;
+
+    for (char *item = strtok_r(copy, ",", &save); item; item = strtok_r(NULL, ",", &save))
+    {
+        char *colon = strchr(item, ':');
+        int i;
+
+        if (colon)
+            *colon = '\0';
+        for (i = 0; i < TAG_COUNT && strcmp(tag_mix[i].name, item) != 0; i++)
+            ;
+        if (i == TAG_COUNT)
+        {
+            fprintf(stderr, "Unknown tag in mix: %s\n", item);
+            free(copy);
+            return false;
+        }
+        tag_mix[i].weight = colon ? atof(colon + 1) : 1;
+    }
+
+    free(copy);
+    return true;
+}
+
+/**
+ * Makes Long and Double take the given share of all constants,
+ * scaling the other weights
+ *
+ * @param density share of Long/Double constants, 0..1
+ */
+static void set_wide_density(double density)
+{
+    double other = 0;
+
+    for (int i = 0; i < TAG_COUNT; i++)
+    {
+        if (tag_mix[i].tag != CONSTANT_Long && tag_mix[i].tag != CONSTANT_Double)
+            other += tag_mix[i].weight;
+    }
+
+    for (int i = 0; i < TAG_COUNT; i++)
+    {
+        if (tag_mix[i].tag == CONSTANT_Long || tag_mix[i].tag == CONSTANT_Double)
+            tag_mix[i].weight = density >= 1 ? 1 : other * density / (1 - density) / 2;
+        else if (density >= 1)
+            tag_mix[i].weight = 0;
+    }
+}
+
+/**
+ * Picks a random tag according to the mix
+ */
+static uint8_t random_tag(generator *g, double total)
+{
+    double r = next_unit(g) * total;
+
+    for (int i = 0; i < TAG_COUNT; i++)
+    {
+        if (r < tag_mix[i].weight)
+            return tag_mix[i].tag;
+        r -= tag_mix[i].weight;
+    }
+    return CONSTANT_Utf8;
+}
+
+/**
+ * Writes a random Utf8 payload, identifier-like ASCII
+ */
+static void put_random_utf(FILE *f, generator *g)
+{
+    static const char alphabet[] = "abcdefghijklmnopqrstuvwxyzABCDEFGHIJKLMNOPQRSTUVWXYZ0123456789_$/;()[";
+    const int length = g->utf_min + (int)((g->utf_max - g->utf_min) * pow(next_unit(g), g->utf_skew) + 0.5);
+
+    put_u2(f, (uint16_t)length);
+    for (int i = 0; i < length; i++)
+        put_u1(f, alphabet[next_random(g) % (sizeof(alphabet) - 1)]);
+}
+
+/**
+ * Offset from the instruction at pc to the start of a random
+ * earlier instruction, or to itself if that one is too far for
+ * a 16-bit branch
+ */
+static int32_t back_branch(generator *g, const code_buffer *code, uint32_t pc)
+{
+    const uint32_t target = code->starts[next_random(g) % (code->count + 1)];
+    return pc - target > INT16_MAX ? 0 : (int32_t)target - (int32_t)pc;
+}
+
+/**
+ * Appends one random instruction
+ *
+ * @param g generator
+ * @param code to append to, with room for the longest instruction
+ */
+static void emit_instruction(generator *g, code_buffer *code)
+{
+    // Simple ones: loads and stores of locals 0-3, arithmetic, stack ops
+    static const uint8_t simple[] = {0x01, 0x03, 0x04, 0x1a, 0x1b, 0x2a, 0x2b, 0x3b, 0x4b, 0x57, 0x59,
+                                     0x5f, 0x60, 0x64, 0x68, 0x7e, 0x85, 0x88, 0x94, 0xbe};
+    static const uint8_t branches[] = {0x99, 0x9a, 0x9f, 0xa0, 0xa7, 0xc6, 0xc7};
+    static const uint8_t class_operand[] = {0xbb, 0xbd, 0xc0, 0xc1}; // new, anewarray, checkcast, instanceof
+    const uint32_t pc = code->length;
+    uint16_t index;
+
+    code->starts[code->count] = pc;
+
+    switch (next_random(g) % 16)
+    {
+    case 0:
+        emit_u1(code, 0x10); // bipush
+        emit_u1(code, (uint8_t)next_random(g));
+        break;
+    case 1:
+        emit_u1(code, 0x11); // sipush
+        emit_u2(code, (uint16_t)next_random(g));
+        break;
+    case 2:
+        emit_u1(code, next_random(g) & 1 ? 0x15 : 0x36); // iload, istore
+        emit_u1(code, (uint8_t)next_random(g));
+        break;
+    case 3:
+        // ldc of a Class, String, Integer or Float among the first 255, ldc_w of any
+        do
+            index = (uint16_t)(1 + next_random(g) % (code->last < 256 ? code->last - 1 : 255));
+        while (g->tags[index] != CONSTANT_Class && g->tags[index] != CONSTANT_String &&
+               g->tags[index] != CONSTANT_Integer && g->tags[index] != CONSTANT_Float);
+        if (next_random(g) & 1)
+        {
+            emit_u1(code, 0x12);
+            emit_u1(code, (uint8_t)index);
+        }
+        else
+        {
+            emit_u1(code, 0x13);
+            emit_u2(code, pick(g, g->by_tag_count[CONSTANT_String] ? CONSTANT_String : CONSTANT_Class));
+        }
+        break;
+    case 4:
+        if (g->by_tag_count[CONSTANT_Long])
+        {
+            emit_u1(code, 0x14); // ldc2_w
+            emit_u2(code, pick(g, CONSTANT_Long));
+            break;
+        }
+        // fall through
+    case 5:
+        emit_u1(code, class_operand[next_random(g) % sizeof(class_operand)]);
+        emit_u2(code, pick(g, CONSTANT_Class));
+        break;
+    case 6:
+        if (g->by_tag_count[CONSTANT_Fieldref])
+        {
+            emit_u1(code, (uint8_t)(0xb2 + next_random(g) % 4)); // getstatic, putstatic, getfield, putfield
+            emit_u2(code, pick(g, CONSTANT_Fieldref));
+            break;
+        }
+        // fall through
+    case 7:
+        emit_u1(code, (uint8_t)(0xb6 + next_random(g) % 3)); // invokevirtual, invokespecial, invokestatic
+        emit_u2(code, pick(g, CONSTANT_Methodref));
+        break;
+    case 8:
+        if (g->by_tag_count[CONSTANT_InterfaceMethodref])
+        {
+            emit_u1(code, 0xb9); // invokeinterface
+            emit_u2(code, pick(g, CONSTANT_InterfaceMethodref));
+            emit_u1(code, (uint8_t)(1 + next_random(g) % 4));
+            emit_u1(code, 0);
+        }
+        else if (g->by_tag_count[CONSTANT_InvokeDynamic])
+        {
+            emit_u1(code, 0xba); // invokedynamic
+            emit_u2(code, pick(g, CONSTANT_InvokeDynamic));
+            emit_u2(code, 0);
+        }
+        else
+        {
+            emit_u1(code, 0xc5); // multianewarray
+            emit_u2(code, pick(g, CONSTANT_Class));
+            emit_u1(code, (uint8_t)(1 + next_random(g) % 3));
+        }
+        break;
+    case 9:
+        emit_u1(code, 0x84); // iinc
+        emit_u1(code, (uint8_t)next_random(g));
+        emit_u1(code, (uint8_t)next_random(g));
+        break;
+    case 10:
+        emit_u1(code, 0xbc); // newarray
+        emit_u1(code, (uint8_t)(4 + next_random(g) % 8));
+        break;
+    case 11:
+        emit_u1(code, branches[next_random(g) % sizeof(branches)]);
+        emit_u2(code, (uint16_t)back_branch(g, code, pc));
+        break;
+    case 12:
+        emit_u1(code, OPCODE_WIDE);
+        if (next_random(g) & 1)
+        {
+            emit_u1(code, 0x15); // iload
+            emit_u2(code, (uint16_t)next_random(g));
+        }
+        else
+        {
+            emit_u1(code, 0x84); // iinc
+            emit_u2(code, (uint16_t)next_random(g));
+            emit_u2(code, (uint16_t)next_random(g));
+        }
+        break;
+    case 13:
+    {
+        // Both switches are padded to a multiple of four from the start of the code
+        const bool table = next_random(g) & 1;
+        const int32_t count = 1 + (int32_t)(next_random(g) % 8);
+        const int32_t low = (int32_t)(next_random(g) % 100) - 50;
+
+        emit_u1(code, table ? 0xaa : 0xab);
+        while (code->length & 3)
+            emit_u1(code, 0);
+        emit_u4(code, (uint32_t)back_branch(g, code, pc));
+        if (table)
+        {
+            emit_u4(code, (uint32_t)low);
+            emit_u4(code, (uint32_t)(low + count - 1));
+        }
+        else
+            emit_u4(code, (uint32_t)count);
+        for (int32_t i = 0; i < count; i++)
+        {
+            if (!table)
+                emit_u4(code, (uint32_t)(low + i * 3)); // sorted keys
+            emit_u4(code, (uint32_t)back_branch(g, code, pc));
+        }
+        break;
+    }
+    default:
+        emit_u1(code, simple[next_random(g) % sizeof(simple)]);
+        break;
+    }
+
+    code->count++;
+}
+
+/**
+ * Writes the methods, each with a Code attribute of about
+ * g->code_length bytes ending in return
+ *
+ * @param f where to write them
+ * @param g generator
+ * @param code_name index of the "Code" Utf8
+ */
+static void put_methods(FILE *f, generator *g, uint16_t code_name)
+{
+    // The longest instruction is a lookupswitch of 8 cases: 1 + 3 padding + 8 + 8 * 8 bytes
+    code_buffer code = {malloc(g->code_length + 80), 0, malloc((g->code_length + 1) * sizeof(uint32_t)), 0, code_name};
+
+    put_u2(f, (uint16_t)g->methods);
+    for (int m = 0; m < g->methods; m++)
+    {
+        code.length = code.count = 0;
+        while (code.length + 1 < (uint32_t)g->code_length)
+            emit_instruction(g, &code);
+        emit_u1(&code, 0xb1); // return
+
+        put_u2(f, ACC_PUBLIC | ACC_STATIC);
+        put_u2(f, pick(g, CONSTANT_Utf8)); // name
+        put_u2(f, 4);                      // ()V
+        put_u2(f, 1);                      // attributes
+        put_u2(f, code_name);
+        put_u4(f, 12 + code.length);
+        put_u2(f, 16);     // max_stack
+        put_u2(f, 0xffff); // max_locals, wide ones go anywhere
+        put_u4(f, code.length);
+        fwrite(code.bytes, 1, code.length, f);
+        put_u2(f, 0); // exception table
+        put_u2(f, 0); // attributes of the code
+    }
+
+    free(code.bytes);
+    free(code.starts);
+}
+
+/**
+ * Generates the class
+ *
+ * @param f where to write it
+ * @param g generator
+ * @param count constant_pool_count of the class
+ */
+static void generate(FILE *f, generator *g, int count)
+{
+    static const char *fixed[] = {"Bench", "java/lang/Object", "run", "()V"};
+    double total = 0;
+
+    for (int i = 0; i < TAG_COUNT; i++)
+        total += tag_mix[i].weight;
+
+    // #1-#4 Utf8, #5 this, #6 super, #7 NameAndType, #8 Methodref:
+    // every kind of reference has at least one target. With methods
+    // the last constant is the "Code" Utf8.
+    const int last = g->methods ? count - 1 : count;
+    g->tags = calloc(count + 1, 1);
+    for (int i = 1; i <= 4; i++)
+        g->tags[i] = CONSTANT_Utf8;
+    g->tags[5] = g->tags[6] = CONSTANT_Class;
+    g->tags[7] = CONSTANT_NameAndType;
+    g->tags[8] = CONSTANT_Methodref;
+
+    for (int i = 9; i < last; i++)
+    {
+        uint8_t tag = random_tag(g, total);
+
+        if ((tag == CONSTANT_Long || tag == CONSTANT_Double) && i + 1 >= last)
+            tag = CONSTANT_Utf8;
+        g->tags[i] = tag;
+        if (tag == CONSTANT_Long || tag == CONSTANT_Double)
+            i++; // the next slot stays unusable
+    }
+    if (last < count)
+        g->tags[last] = CONSTANT_Utf8;
+
+    for (int i = 1; i < count; i++)
+    {
+        if (g->tags[i])
+            g->by_tag_count[g->tags[i]]++;
+    }
+    for (int t = 0; t < 19; t++)
+    {
+        g->by_tag[t] = malloc((g->by_tag_count[t] + 1) * sizeof(uint16_t));
+        g->by_tag_count[t] = 0;
+    }
+    for (int i = 1; i < count; i++)
+    {
+        if (g->tags[i])
+            g->by_tag[g->tags[i]][g->by_tag_count[g->tags[i]]++] = (uint16_t)i;
+    }
+
+    put_u4(f, 0xCAFEBABE);
+    put_u2(f, 0);
+    put_u2(f, 52);
+    put_u2(f, (uint16_t)count);
+
+    for (int i = 1; i < count; i++)
+    {
+        const uint8_t tag = g->tags[i];
+
+        if (!tag)
+            continue;
+        put_u1(f, tag);
+
+        switch (tag)
+        {
+        case CONSTANT_Utf8:
+            if (i <= 4)
+            {
+                put_u2(f, (uint16_t)strlen(fixed[i - 1]));
+                fputs(fixed[i - 1], f);
+            }
+            else if (i == last)
+            {
+                put_u2(f, 4);
+                fputs("Code", f);
+            }
+            else
+                put_random_utf(f, g);
+            break;
+        case CONSTANT_Class:
+            put_u2(f, i <= 6 ? (uint16_t)(i - 4) : pick(g, CONSTANT_Utf8));
+            break;
+        case CONSTANT_String:
+        case CONSTANT_MethodType:
+            put_u2(f, pick(g, CONSTANT_Utf8));
+            break;
+        case CONSTANT_Integer:
+        case CONSTANT_Float:
+            put_u4(f, (uint32_t)next_random(g));
+            break;
+        case CONSTANT_Long:
+        case CONSTANT_Double:
+            put_u4(f, (uint32_t)next_random(g) & 0x7fefffff); // finite doubles
+            put_u4(f, (uint32_t)next_random(g));
+            break;
+        case CONSTANT_Fieldref:
+        case CONSTANT_Methodref:
+        case CONSTANT_InterfaceMethodref:
+            put_u2(f, i == 8 ? 6 : pick(g, CONSTANT_Class));
+            put_u2(f, i == 8 ? 7 : pick(g, CONSTANT_NameAndType));
+            break;
+        case CONSTANT_NameAndType:
+            put_u2(f, i == 7 ? 3 : pick(g, CONSTANT_Utf8));
+            put_u2(f, i == 7 ? 4 : pick(g, CONSTANT_Utf8));
+            break;
+        case CONSTANT_MethodHandle:
+            put_u1(f, 6); // REF_invokeStatic
+            put_u2(f, pick(g, CONSTANT_Methodref));
+            break;
+        case CONSTANT_InvokeDynamic:
+            put_u2(f, 0);
+            put_u2(f, pick(g, CONSTANT_NameAndType));
+            break;
+        }
+    }
+
+    put_u2(f, ACC_PUBLIC | ACC_SUPER);
+    put_u2(f, 5); // this_class
+    put_u2(f, 6); // super_class
+    put_u2(f, 0); // interfaces
+    put_u2(f, 0); // fields
+    if (g->methods)
+        put_methods(f, g, (uint16_t)last);
+    else
+        put_u2(f, 0);
+    put_u2(f, 0); // attributes
+
+    for (int t = 0; t < 19; t++)
+        free(g->by_tag[t]);
+    free(g->tags);
+}
+
+/**
+ * Print how to run the program
+ *
+ * @param name of the executable
+ */
+static void print_usage(const char *name)
+{
+    fprintf(stderr, "Usage: %s [-n count] [-t mix] [-d density] [-u min:max[:skew]] [-m methods[:bytes]] [-s seed] -o file\n", name);
+    fprintf(stderr, "  -n count   constant_pool_count, 10..65535 (default 10000)\n");
+    fprintf(stderr, "  -t mix     tag weights, e.g. utf8:40,class:10,method:12,long:2\n");
+    fprintf(stderr, "             tags: utf8 class string int float long double field\n");
+    fprintf(stderr, "                   method imethod nat mh mt indy\n");
+    fprintf(stderr, "  -d density share of Long/Double constants, 0..1, overrides their weights\n");
+    fprintf(stderr, "  -u min:max[:skew]  Utf8 length range, skew > 1 favours short strings\n");
+    fprintf(stderr, "  -m methods[:bytes]  methods with random bytecode of about bytes each (default 1000)\n");
+    fprintf(stderr, "  -s seed    random seed (default 1)\n");
+}
+
+int main(int argc, char *argv[])
+{
+    generator g = {.seed = 1, .utf_min = 4, .utf_max = 48, .utf_skew = 2, .code_length = 1000};
+    const char *path = NULL;
+    double density = -1;
+    int count = 10000;
+    int option;
+
+    while ((option = getopt(argc, argv, "n:t:d:u:m:s:o:")) != -1)
+    {
+        switch (option)
+        {
+        case 'n':
+            count = atoi(optarg);
+            break;
+        case 't':
+            if (!parse_mix(optarg))
+                return EXIT_FAILURE;
+            break;
+        case 'd':
+            density = atof(optarg);
+            break;
+        case 'u':
+            if (sscanf(optarg, "%d:%d:%lf", &g.utf_min, &g.utf_max, &g.utf_skew) < 2)
+            {
+                fprintf(stderr, "Bad Utf8 length range: %s\n", optarg);
+                return EXIT_FAILURE;
+            }
+            break;
+        case 'm':
+            if (sscanf(optarg, "%d:%d", &g.methods, &g.code_length) < 1)
+            {
+                fprintf(stderr, "Bad method count: %s\n", optarg);
+                return EXIT_FAILURE;
+            }
+            break;
+        case 's':
+            g.seed = strtoull(optarg, NULL, 0) | 1;
+            break;
+        case 'o':
+            path = optarg;
+            break;
+        default:
+            print_usage(argv[0]);
+            return EXIT_FAILURE;
+        }
+    }
+
+    if (!path || count < 10 || count > UINT16_MAX || g.utf_min < 0 || g.utf_max < g.utf_min || g.utf_max > UINT16_MAX ||
+        g.methods < 0 || g.methods > UINT16_MAX || g.code_length < 1 || g.code_length > UINT16_MAX - 80)
+    {
+        print_usage(argv[0]);
+        return EXIT_FAILURE;
+    }
+    if (density >= 0)
+        set_wide_density(density);
+
+    FILE *f = fopen(path, "wb");
+    if (!f)
+    {
+        perror(path);
+        return EXIT_FAILURE;
+    }
+
+    generate(f, &g, count);
+    if (fclose(f) != 0)
+    {
+        perror(path);
+        return EXIT_FAILURE;
+    }
+    return 0;
+}
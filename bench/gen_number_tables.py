@@ -0,0 +1,56 @@
+#!/usr/bin/env python3
+"""
+Generates java_number_tables.h, the powers of 5 used by the Ryu
+formatter in java_number.c, each in two 64-bit halves, low first:
+
+  DOUBLE_POW5_INV_SPLIT[q]  2^(bits(5^q) - 1 + 125) / 5^q + 1
+  DOUBLE_POW5_SPLIT[i]      the top 125 bits of 5^i
+
+Floats are formatted with the same tables.
+
+Usage: python3 bench/gen_number_tables.py > java_number_tables.h
+"""
+
+DOUBLE_POW5_INV_BITCOUNT = 125
+DOUBLE_POW5_BITCOUNT = 125
+
+# Indices the formatter uses: q = log10(2^e2) - 1 up to the largest
+# exponent, i = -e2 - log10(5^-e2) + 1 down to the smallest one, and
+# one more for the extra digit of the smallest subnormals
+DOUBLE_INV_COUNT = 292
+DOUBLE_COUNT = 327
+
+
+def inv_split(q, bitcount):
+    power = 5 ** q
+    return (1 << (power.bit_length() - 1 + bitcount)) // power + 1
+
+
+def split(i, bitcount):
+    power = 5 ** i
+    shift = power.bit_length() - bitcount
+    return power >> shift if shift >= 0 else power << -shift
+
+
+def halves(value):
+    return "{0x%016xu, 0x%016xu}" % (value & (2 ** 64 - 1), value >> 64)
+
+
+print("// Generated by bench/gen_number_tables.py, do not edit")
+print("#ifndef JAVA_NUMBER_TABLES_H")
+print("#define JAVA_NUMBER_TABLES_H")
+print("#include <stdint.h>\n")
+print("#define DOUBLE_POW5_INV_BITCOUNT %d" % DOUBLE_POW5_INV_BITCOUNT)
+print("#define DOUBLE_POW5_BITCOUNT %d\n" % DOUBLE_POW5_BITCOUNT)
+
+print("static const uint64_t DOUBLE_POW5_INV_SPLIT[%d][2] =\n{" % DOUBLE_INV_COUNT)
+for q in range(DOUBLE_INV_COUNT):
+    print("    %s," % halves(inv_split(q, DOUBLE_POW5_INV_BITCOUNT)))
+print("};\n")
+
+print("static const uint64_t DOUBLE_POW5_SPLIT[%d][2] =\n{" % DOUBLE_COUNT)
+for i in range(DOUBLE_COUNT):
+    print("    %s," % halves(split(i, DOUBLE_POW5_BITCOUNT)))
+print("};\n")
+
+print("#endif")
@@ -0,0 +1,282 @@
+/**
+ * Checks and times the Float/Double formatter of java_number.c.
+ *
+ * Every line of the corpus (bench/numbers.txt) must come out as
+ * written there. Then -n values of every set are formatted, each
+ * text has to read back as the same value, and the time per value
+ * is compared with snprintf("%.17g") / snprintf("%.9g"), the
+ * shortest printf formats that read back the same:
+ *
+ *   double_random, float_random  random bit patterns, all exponents
+ *   double_table, float_table    i / 1000, like generated lookup tables
+ *
+ * Prints one JSON object for the corpus and one per set.
+ *
+ */
+
+#define _GNU_SOURCE
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "../java_number.h"
+
+typedef struct number_set_s
+{
+    const char *name;
+    bool is_double;
+    uint64_t *bits;
+    size_t count;
+
+} number_set;
+
+static double now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static uint64_t next_random(uint64_t *state)
+{
+    *state ^= *state << 13;
+    *state ^= *state >> 7;
+    *state ^= *state << 17;
+    return *state;
+}
+
+static size_t format_bits(char *buffer, bool is_double, uint64_t bits)
+{
+    return is_double ? format_java_double(buffer, bits) : format_java_float(buffer, (uint32_t)bits);
+}
+
+/**
+ * Formats every corpus line and reports the ones that differ
+ *
+ * @param path of the corpus
+ * @param cases set to the number of lines checked
+ * @return number of lines that differ, -1 if the corpus can't be read
+ */
+static int check_corpus(const char *path, int *cases)
+{
+    FILE *f = fopen(path, "r");
+    char line[256], text[JAVA_NUMBER_MAX];
+    int failed = 0;
+
+    if (!f)
+        return -1;
+
+    *cases = 0;
+    while (fgets(line, sizeof(line), f))
+    {
+        char kind, expected[64];
+        unsigned long long bits;
+
+        if (line[0] == '#' || sscanf(line, " %c %llx %63s", &kind, &bits, expected) != 3)
+            continue;
+
+        format_bits(text, kind == 'D', bits);
+        if (strcmp(text, expected) != 0)
+        {
+            fprintf(stderr, "%s: %c %llx is %s, expected %s\n", path, kind, bits, text, expected);
+            failed++;
+        }
+        (*cases)++;
+    }
+
+    fclose(f);
+    return failed;
+}
+
+static void fill_set(number_set *set, uint64_t *state)
+{
+    for (size_t i = 0; i < set->count; i++)
+    {
+        if (strstr(set->name, "table"))
+        {
+            const double value = (double)(i % 100000) / 1000;
+            const float single = (float)value;
+
+            if (set->is_double)
+                memcpy(set->bits + i, &value, sizeof(value));
+            else
+            {
+                uint32_t bits;
+                memcpy(&bits, &single, sizeof(bits));
+                set->bits[i] = bits;
+            }
+            continue;
+        }
+
+        // Random finite values
+        do
+            set->bits[i] = set->is_double ? next_random(state) : (uint32_t)next_random(state);
+        while (set->is_double ? (set->bits[i] >> 52 & 0x7ff) == 0x7ff : (set->bits[i] >> 23 & 0xff) == 0xff);
+    }
+}
+
+/**
+ * Reads every text of the set back
+ *
+ * @return number of values that didn't read back as themselves
+ */
+static size_t check_round_trip(const number_set *set)
+{
+    char text[JAVA_NUMBER_MAX];
+    size_t failed = 0;
+
+    for (size_t i = 0; i < set->count; i++)
+    {
+        uint64_t back = 0;
+
+        format_bits(text, set->is_double, set->bits[i]);
+        if (set->is_double)
+        {
+            const double value = strtod(text, NULL);
+            memcpy(&back, &value, sizeof(value));
+        }
+        else
+        {
+            const float value = strtof(text, NULL);
+            uint32_t bits;
+            memcpy(&bits, &value, sizeof(bits));
+            back = bits;
+        }
+
+        if (back != set->bits[i] && failed++ < 10)
+            fprintf(stderr, "%s: %llx is %s, reads back as %llx\n", set->name, (unsigned long long)set->bits[i], text,
+                    (unsigned long long)back);
+    }
+    return failed;
+}
+
+/**
+ * Times formatting the set, best of the repeats
+ *
+ * @param set of values
+ * @param with_printf use snprintf instead of the Java formatter
+ * @param repeats passes over the set
+ * @param length set to the total length of the texts
+ * @return best nanoseconds per value
+ */
+static double time_set(const number_set *set, bool with_printf, int repeats, size_t *length)
+{
+    char text[JAVA_NUMBER_MAX];
+    double best = -1;
+
+    for (int r = 0; r < repeats; r++)
+    {
+        const double start = now();
+        size_t total = 0;
+
+        for (size_t i = 0; i < set->count; i++)
+        {
+            if (!with_printf)
+                total += format_bits(text, set->is_double, set->bits[i]);
+            else if (set->is_double)
+            {
+                double value;
+                memcpy(&value, set->bits + i, sizeof(value));
+                total += snprintf(text, sizeof(text), "%.17g", value);
+            }
+            else
+            {
+                const uint32_t bits = (uint32_t)set->bits[i];
+                float value;
+                memcpy(&value, &bits, sizeof(value));
+                total += snprintf(text, sizeof(text), "%.9g", value);
+            }
+        }
+
+        const double elapsed = (now() - start) * 1e9 / set->count;
+        if (best < 0 || elapsed < best)
+            best = elapsed;
+        *length = total;
+    }
+    return best;
+}
+
+static void print_usage(const char *name)
+{
+    fprintf(stderr, "Usage: %s [-n values] [-r repeats] [-l label] numbers.txt\n", name);
+    fprintf(stderr, "  -n values   per set (default 1000000)\n");
+    fprintf(stderr, "  -r repeats  passes over a set, the best one is reported (default 5)\n");
+    fprintf(stderr, "  -l label    added to every result, e.g. a commit hash\n");
+}
+
+int main(int argc, char *argv[])
+{
+    number_set sets[] =
+    {
+        {"double_random", true},
+        {"double_table", true},
+        {"float_random", false},
+        {"float_table", false},
+    };
+    const char *label = "";
+    size_t count = 1000000;
+    uint64_t state = 88172645463325252ull;
+    int repeats = 5, cases = 0, failed, option;
+
+    while ((option = getopt(argc, argv, "n:r:l:")) != -1)
+    {
+        switch (option)
+        {
+        case 'n':
+            count = strtoul(optarg, NULL, 10);
+            break;
+        case 'r':
+            repeats = atoi(optarg);
+            break;
+        case 'l':
+            label = optarg;
+            break;
+        default:
+            print_usage(argv[0]);
+            return EXIT_FAILURE;
+        }
+    }
+
+    if (optind + 1 != argc || count < 1 || repeats < 1)
+    {
+        print_usage(argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    if ((failed = check_corpus(argv[optind], &cases)) < 0)
+    {
+        fprintf(stderr, "%s: can't read the file\n", argv[optind]);
+        return EXIT_FAILURE;
+    }
+    printf("{\"label\": \"%s\", \"corpus\": \"%s\", \"cases\": %d, \"failed\": %d}\n", label, argv[optind], cases, failed);
+    fflush(stdout);
+
+    for (size_t i = 0; i < sizeof(sets) / sizeof(sets[0]); i++)
+    {
+        number_set *set = sets + i;
+        size_t java_length, printf_length;
+
+        set->count = count;
+        set->bits = malloc(count * sizeof(uint64_t));
+        fill_set(set, &state);
+
+        const size_t round_trip_failed = check_round_trip(set);
+        const double java_ns = time_set(set, false, repeats, &java_length);
+        const double printf_ns = time_set(set, true, repeats, &printf_length);
+
+        printf("{\"label\": \"%s\", \"set\": \"%s\", \"values\": %zu, \"round_trip_failed\": %zu, "
+               "\"java_ns\": %.1f, \"printf_ns\": %.1f, \"speedup\": %.2f, \"java_chars\": %.2f, \"printf_chars\": %.2f}\n",
+               label, set->name, set->count, round_trip_failed, java_ns, printf_ns, printf_ns / java_ns,
+               (double)java_length / set->count, (double)printf_length / set->count);
+        fflush(stdout);
+
+        failed += round_trip_failed != 0;
+        free(set->bits);
+    }
+
+    return failed ? EXIT_FAILURE : 0;
+}
@@ -0,0 +1,293 @@
+/**
+ * Latency benchmark of the daemon mode: sends requests for the given
+ * .class files over -c connections to a running --serve process and
+ * prints one JSON object with the latency percentiles and throughput.
+ *
+ * With -b the same files are also run through a fresh process of the
+ * tool per file, the way it is used without a server, and a second
+ * object is printed for comparison.
+ *
+ */
+
+#define _GNU_SOURCE
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <spawn.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+
+#include "../class_client.h"
+
+extern char **environ;
+
+typedef struct bench_input_s
+{
+    char *path; // absolute, the server may run elsewhere
+    uint8_t *data;
+    size_t size;
+
+} bench_input;
+
+typedef struct bench_run_s
+{
+    const char *socket_path;
+    const char *binary; // spawned per request instead of asking the server, NULL for the server
+    bench_input *inputs;
+    size_t input_count;
+    bool send_data;     // send the class bytes instead of the path
+    size_t requests;    // per connection
+    uint64_t *latencies; // ns, requests per connection one after another
+    int failed;
+
+} bench_run;
+
+typedef struct bench_thread_s
+{
+    bench_run *run;
+    int id;
+
+} bench_thread;
+
+static uint64_t now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000u + ts.tv_nsec;
+}
+
+static bool load_input(bench_input *input, const char *path)
+{
+    FILE *f = fopen(path, "rb");
+    struct stat status;
+
+    if (!f || fstat(fileno(f), &status) < 0 || !(input->path = realpath(path, NULL)))
+    {
+        if (f)
+            fclose(f);
+        return false;
+    }
+
+    input->size = status.st_size;
+    input->data = malloc(input->size ? input->size : 1);
+    bool ok = fread(input->data, 1, input->size, f) == input->size;
+    fclose(f);
+    return ok;
+}
+
+/**
+ * Connects, waiting for a server that is just starting
+ */
+static int connect_retrying(const char *socket_path)
+{
+    int fd = -1;
+
+    for (int attempt = 0; attempt < 100 && (fd = connect_class_server(socket_path)) < 0; attempt++)
+        usleep(50000);
+    return fd;
+}
+
+static bool spawn_request(const char *binary, const char *path)
+{
+    posix_spawn_file_actions_t actions;
+    char *argv[] = {(char *)binary, (char *)path, NULL};
+    pid_t pid;
+    int status;
+
+    posix_spawn_file_actions_init(&actions);
+    posix_spawn_file_actions_addopen(&actions, STDOUT_FILENO, "/dev/null", O_WRONLY, 0);
+    bool ok = posix_spawn(&pid, binary, &actions, NULL, argv, environ) == 0 && waitpid(pid, &status, 0) == pid &&
+              WIFEXITED(status) && WEXITSTATUS(status) == 0;
+    posix_spawn_file_actions_destroy(&actions);
+    return ok;
+}
+
+static void *run_connection(void *argument)
+{
+    bench_thread *thread = argument;
+    bench_run *run = thread->run;
+    uint64_t *latencies = run->latencies + thread->id * run->requests;
+    class_response response = {0};
+    int fd = run->binary ? -1 : connect_retrying(run->socket_path);
+
+    if (!run->binary && fd < 0)
+    {
+        fprintf(stderr, "%s: %s\n", run->socket_path, strerror(errno));
+        __atomic_add_fetch(&run->failed, 1, __ATOMIC_RELAXED);
+        return NULL;
+    }
+
+    for (size_t i = 0; i < run->requests; i++)
+    {
+        bench_input *input = run->inputs + (thread->id + i) % run->input_count;
+        class_request request = {REQUEST_PATH, 0, MODE_POOL, 0, NULL, input->path, strlen(input->path)};
+        const uint64_t start = now_ns();
+        bool ok;
+
+        if (run->send_data)
+        {
+            request.kind = REQUEST_DATA;
+            request.payload = input->data;
+            request.length = input->size;
+        }
+
+        if (run->binary)
+            ok = spawn_request(run->binary, input->path);
+        else
+            ok = send_class_request(fd, &request, &response) && response.status == RESPONSE_OK;
+        latencies[i] = now_ns() - start;
+
+        if (!ok)
+        {
+            fprintf(stderr, "%s: %s\n", input->path, run->binary ? "failed" : response.body ? response.body : strerror(errno));
+            __atomic_add_fetch(&run->failed, 1, __ATOMIC_RELAXED);
+            break;
+        }
+    }
+
+    if (fd >= 0)
+        close(fd);
+    free_class_response(&response);
+    return NULL;
+}
+
+static int compare_u64(const void *a, const void *b)
+{
+    const uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+    return (x > y) - (x < y);
+}
+
+/**
+ * Runs requests on all connections at once and prints the results
+ *
+ * @return false if any request failed
+ */
+static bool run_bench(bench_run *run, int connections, const char *label)
+{
+    pthread_t *threads = calloc(connections, sizeof(pthread_t));
+    bench_thread *contexts = calloc(connections, sizeof(bench_thread));
+    const size_t total = run->requests * connections;
+
+    run->latencies = calloc(total ? total : 1, sizeof(uint64_t));
+    run->failed = 0;
+
+    const uint64_t start = now_ns();
+    for (int i = 0; i < connections; i++)
+    {
+        contexts[i] = (bench_thread){run, i};
+        pthread_create(threads + i, NULL, run_connection, contexts + i);
+    }
+    for (int i = 0; i < connections; i++)
+        pthread_join(threads[i], NULL);
+    const double seconds = (now_ns() - start) * 1e-9;
+
+    if (!run->failed && total)
+    {
+        qsort(run->latencies, total, sizeof(uint64_t), compare_u64);
+        printf("{\"label\": \"%s\", \"mode\": \"%s\", \"kind\": \"%s\", \"files\": %zu, \"requests\": %zu, "
+               "\"connections\": %d, \"p50_us\": %.1f, \"p99_us\": %.1f, \"max_us\": %.1f, \"requests_per_s\": %.0f}\n",
+               label, run->binary ? "spawn" : "server", run->binary || !run->send_data ? "path" : "data",
+               run->input_count, total, connections, run->latencies[total / 2] / 1e3,
+               run->latencies[total * 99 / 100] / 1e3, run->latencies[total - 1] / 1e3, total / seconds);
+        fflush(stdout);
+    }
+
+    free(run->latencies);
+    free(contexts);
+    free(threads);
+    return !run->failed;
+}
+
+static void print_usage(const char *name)
+{
+    fprintf(stderr, "Usage: %s -s socket [-n requests] [-c connections] [-d] [-b binary [-N spawns]] [-l label]\n"
+                    "       file.class...\n", name);
+    fprintf(stderr, "  -n requests     per connection, 2000 by default\n");
+    fprintf(stderr, "  -c connections  sending at the same time, 4 by default\n");
+    fprintf(stderr, "  -d              send the class bytes instead of the path\n");
+    fprintf(stderr, "  -b binary       also time one process of binary per file, -N per connection (100)\n");
+}
+
+int main(int argc, char *argv[])
+{
+    bench_run run = {0};
+    size_t requests = 2000, spawns = 100;
+    int connections = 4, option;
+    const char *label = "";
+
+    while ((option = getopt(argc, argv, "s:n:c:db:N:l:")) != -1)
+    {
+        switch (option)
+        {
+        case 's':
+            run.socket_path = optarg;
+            break;
+        case 'n':
+            requests = strtoul(optarg, NULL, 10);
+            break;
+        case 'c':
+            connections = atoi(optarg);
+            break;
+        case 'd':
+            run.send_data = true;
+            break;
+        case 'b':
+            run.binary = optarg;
+            break;
+        case 'N':
+            spawns = strtoul(optarg, NULL, 10);
+            break;
+        case 'l':
+            label = optarg;
+            break;
+        default:
+            print_usage(argv[0]);
+            return EXIT_FAILURE;
+        }
+    }
+
+    if (!run.socket_path || optind == argc || connections < 1)
+    {
+        print_usage(argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    run.input_count = argc - optind;
+    run.inputs = calloc(run.input_count, sizeof(bench_input));
+    for (size_t i = 0; i < run.input_count; i++)
+    {
+        if (!load_input(run.inputs + i, argv[optind + i]))
+        {
+            fprintf(stderr, "%s: can't read the file\n", argv[optind + i]);
+            return EXIT_FAILURE;
+        }
+    }
+
+    const char *binary = run.binary;
+    bool ok;
+
+    run.binary = NULL;
+    run.requests = requests;
+    ok = run_bench(&run, connections, label);
+    if (ok && binary)
+    {
+        run.binary = binary;
+        run.requests = spawns;
+        ok = run_bench(&run, connections, label);
+    }
+
+    for (size_t i = 0; i < run.input_count; i++)
+    {
+        free(run.inputs[i].path);
+        free(run.inputs[i].data);
+    }
+    free(run.inputs);
+    return ok ? 0 : EXIT_FAILURE;
+}
@@ -0,0 +1,419 @@
+/**
+ * Table-driven decoder of method bytecode.
+ * 
+ * Every opcode is described by one entry of a static table built
+ * at compile time: its mnemonic, the layout of its operands and
+ * the length of the whole instruction. Only tableswitch, lookupswitch
+ * and wide have a variable length and need more than a table lookup.
+ * 
+ */
+
+#include "bytecode.h"
+
+const opcode_info opcodes[256] = {
+    [0x00] = {"nop", OPERAND_NONE, 1},
+    [0x01] = {"aconst_null", OPERAND_NONE, 1},
+    [0x02] = {"iconst_m1", OPERAND_NONE, 1},
+    [0x03] = {"iconst_0", OPERAND_NONE, 1},
+    [0x04] = {"iconst_1", OPERAND_NONE, 1},
+    [0x05] = {"iconst_2", OPERAND_NONE, 1},
+    [0x06] = {"iconst_3", OPERAND_NONE, 1},
+    [0x07] = {"iconst_4", OPERAND_NONE, 1},
+    [0x08] = {"iconst_5", OPERAND_NONE, 1},
+    [0x09] = {"lconst_0", OPERAND_NONE, 1},
+    [0x0a] = {"lconst_1", OPERAND_NONE, 1},
+    [0x0b] = {"fconst_0", OPERAND_NONE, 1},
+    [0x0c] = {"fconst_1", OPERAND_NONE, 1},
+    [0x0d] = {"fconst_2", OPERAND_NONE, 1},
+    [0x0e] = {"dconst_0", OPERAND_NONE, 1},
+    [0x0f] = {"dconst_1", OPERAND_NONE, 1},
+    [0x10] = {"bipush", OPERAND_BYTE, 2},
+    [0x11] = {"sipush", OPERAND_SHORT, 3},
+    [0x12] = {"ldc", OPERAND_CP1, 2},
+    [0x13] = {"ldc_w", OPERAND_CP2, 3},
+    [0x14] = {"ldc2_w", OPERAND_CP2, 3},
+    [0x15] = {"iload", OPERAND_LOCAL, 2},
+    [0x16] = {"lload", OPERAND_LOCAL, 2},
+    [0x17] = {"fload", OPERAND_LOCAL, 2},
+    [0x18] = {"dload", OPERAND_LOCAL, 2},
+    [0x19] = {"aload", OPERAND_LOCAL, 2},
+    [0x1a] = {"iload_0", OPERAND_NONE, 1},
+    [0x1b] = {"iload_1", OPERAND_NONE, 1},
+    [0x1c] = {"iload_2", OPERAND_NONE, 1},
+    [0x1d] = {"iload_3", OPERAND_NONE, 1},
+    [0x1e] = {"lload_0", OPERAND_NONE, 1},
+    [0x1f] = {"lload_1", OPERAND_NONE, 1},
+    [0x20] = {"lload_2", OPERAND_NONE, 1},
+    [0x21] = {"lload_3", OPERAND_NONE, 1},
+    [0x22] = {"fload_0", OPERAND_NONE, 1},
+    [0x23] = {"fload_1", OPERAND_NONE, 1},
+    [0x24] = {"fload_2", OPERAND_NONE, 1},
+    [0x25] = {"fload_3", OPERAND_NONE, 1},
+    [0x26] = {"dload_0", OPERAND_NONE, 1},
+    [0x27] = {"dload_1", OPERAND_NONE, 1},
+    [0x28] = {"dload_2", OPERAND_NONE, 1},
+    [0x29] = {"dload_3", OPERAND_NONE, 1},
+    [0x2a] = {"aload_0", OPERAND_NONE, 1},
+    [0x2b] = {"aload_1", OPERAND_NONE, 1},
+    [0x2c] = {"aload_2", OPERAND_NONE, 1},
+    [0x2d] = {"aload_3", OPERAND_NONE, 1},
+    [0x2e] = {"iaload", OPERAND_NONE, 1},
+    [0x2f] = {"laload", OPERAND_NONE, 1},
+    [0x30] = {"faload", OPERAND_NONE, 1},
+    [0x31] = {"daload", OPERAND_NONE, 1},
+    [0x32] = {"aaload", OPERAND_NONE, 1},
+    [0x33] = {"baload", OPERAND_NONE, 1},
+    [0x34] = {"caload", OPERAND_NONE, 1},
+    [0x35] = {"saload", OPERAND_NONE, 1},
+    [0x36] = {"istore", OPERAND_LOCAL, 2},
+    [0x37] = {"lstore", OPERAND_LOCAL, 2},
+    [0x38] = {"fstore", OPERAND_LOCAL, 2},
+    [0x39] = {"dstore", OPERAND_LOCAL, 2},
+    [0x3a] = {"astore", OPERAND_LOCAL, 2},
+    [0x3b] = {"istore_0", OPERAND_NONE, 1},
+    [0x3c] = {"istore_1", OPERAND_NONE, 1},
+    [0x3d] = {"istore_2", OPERAND_NONE, 1},
+    [0x3e] = {"istore_3", OPERAND_NONE, 1},
+    [0x3f] = {"lstore_0", OPERAND_NONE, 1},
+    [0x40] = {"lstore_1", OPERAND_NONE, 1},
+    [0x41] = {"lstore_2", OPERAND_NONE, 1},
+    [0x42] = {"lstore_3", OPERAND_NONE, 1},
+    [0x43] = {"fstore_0", OPERAND_NONE, 1},
+    [0x44] = {"fstore_1", OPERAND_NONE, 1},
+    [0x45] = {"fstore_2", OPERAND_NONE, 1},
+    [0x46] = {"fstore_3", OPERAND_NONE, 1},
+    [0x47] = {"dstore_0", OPERAND_NONE, 1},
+    [0x48] = {"dstore_1", OPERAND_NONE, 1},
+    [0x49] = {"dstore_2", OPERAND_NONE, 1},
+    [0x4a] = {"dstore_3", OPERAND_NONE, 1},
+    [0x4b] = {"astore_0", OPERAND_NONE, 1},
+    [0x4c] = {"astore_1", OPERAND_NONE, 1},
+    [0x4d] = {"astore_2", OPERAND_NONE, 1},
+    [0x4e] = {"astore_3", OPERAND_NONE, 1},
+    [0x4f] = {"iastore", OPERAND_NONE, 1},
+    [0x50] = {"lastore", OPERAND_NONE, 1},
+    [0x51] = {"fastore", OPERAND_NONE, 1},
+    [0x52] = {"dastore", OPERAND_NONE, 1},
+    [0x53] = {"aastore", OPERAND_NONE, 1},
+    [0x54] = {"bastore", OPERAND_NONE, 1},
+    [0x55] = {"castore", OPERAND_NONE, 1},
+    [0x56] = {"sastore", OPERAND_NONE, 1},
+    [0x57] = {"pop", OPERAND_NONE, 1},
+    [0x58] = {"pop2", OPERAND_NONE, 1},
+    [0x59] = {"dup", OPERAND_NONE, 1},
+    [0x5a] = {"dup_x1", OPERAND_NONE, 1},
+    [0x5b] = {"dup_x2", OPERAND_NONE, 1},
+    [0x5c] = {"dup2", OPERAND_NONE, 1},
+    [0x5d] = {"dup2_x1", OPERAND_NONE, 1},
+    [0x5e] = {"dup2_x2", OPERAND_NONE, 1},
+    [0x5f] = {"swap", OPERAND_NONE, 1},
+    [0x60] = {"iadd", OPERAND_NONE, 1},
+    [0x61] = {"ladd", OPERAND_NONE, 1},
+    [0x62] = {"fadd", OPERAND_NONE, 1},
+    [0x63] = {"dadd", OPERAND_NONE, 1},
+    [0x64] = {"isub", OPERAND_NONE, 1},
+    [0x65] = {"lsub", OPERAND_NONE, 1},
+    [0x66] = {"fsub", OPERAND_NONE, 1},
+    [0x67] = {"dsub", OPERAND_NONE, 1},
+    [0x68] = {"imul", OPERAND_NONE, 1},
+    [0x69] = {"lmul", OPERAND_NONE, 1},
+    [0x6a] = {"fmul", OPERAND_NONE, 1},
+    [0x6b] = {"dmul", OPERAND_NONE, 1},
+    [0x6c] = {"idiv", OPERAND_NONE, 1},
+    [0x6d] = {"ldiv", OPERAND_NONE, 1},
+    [0x6e] = {"fdiv", OPERAND_NONE, 1},
+    [0x6f] = {"ddiv", OPERAND_NONE, 1},
+    [0x70] = {"irem", OPERAND_NONE, 1},
+    [0x71] = {"lrem", OPERAND_NONE, 1},
+    [0x72] = {"frem", OPERAND_NONE, 1},
+    [0x73] = {"drem", OPERAND_NONE, 1},
+    [0x74] = {"ineg", OPERAND_NONE, 1},
+    [0x75] = {"lneg", OPERAND_NONE, 1},
+    [0x76] = {"fneg", OPERAND_NONE, 1},
+    [0x77] = {"dneg", OPERAND_NONE, 1},
+    [0x78] = {"ishl", OPERAND_NONE, 1},
+    [0x79] = {"lshl", OPERAND_NONE, 1},
+    [0x7a] = {"ishr", OPERAND_NONE, 1},
+    [0x7b] = {"lshr", OPERAND_NONE, 1},
+    [0x7c] = {"iushr", OPERAND_NONE, 1},
+    [0x7d] = {"lushr", OPERAND_NONE, 1},
+    [0x7e] = {"iand", OPERAND_NONE, 1},
+    [0x7f] = {"land", OPERAND_NONE, 1},
+    [0x80] = {"ior", OPERAND_NONE, 1},
+    [0x81] = {"lor", OPERAND_NONE, 1},
+    [0x82] = {"ixor", OPERAND_NONE, 1},
+    [0x83] = {"lxor", OPERAND_NONE, 1},
+    [0x84] = {"iinc", OPERAND_IINC, 3},
+    [0x85] = {"i2l", OPERAND_NONE, 1},
+    [0x86] = {"i2f", OPERAND_NONE, 1},
+    [0x87] = {"i2d", OPERAND_NONE, 1},
+    [0x88] = {"l2i", OPERAND_NONE, 1},
+    [0x89] = {"l2f", OPERAND_NONE, 1},
+    [0x8a] = {"l2d", OPERAND_NONE, 1},
+    [0x8b] = {"f2i", OPERAND_NONE, 1},
+    [0x8c] = {"f2l", OPERAND_NONE, 1},
+    [0x8d] = {"f2d", OPERAND_NONE, 1},
+    [0x8e] = {"d2i", OPERAND_NONE, 1},
+    [0x8f] = {"d2l", OPERAND_NONE, 1},
+    [0x90] = {"d2f", OPERAND_NONE, 1},
+    [0x91] = {"i2b", OPERAND_NONE, 1},
+    [0x92] = {"i2c", OPERAND_NONE, 1},
+    [0x93] = {"i2s", OPERAND_NONE, 1},
+    [0x94] = {"lcmp", OPERAND_NONE, 1},
+    [0x95] = {"fcmpl", OPERAND_NONE, 1},
+    [0x96] = {"fcmpg", OPERAND_NONE, 1},
+    [0x97] = {"dcmpl", OPERAND_NONE, 1},
+    [0x98] = {"dcmpg", OPERAND_NONE, 1},
+    [0x99] = {"ifeq", OPERAND_BRANCH2, 3},
+    [0x9a] = {"ifne", OPERAND_BRANCH2, 3},
+    [0x9b] = {"iflt", OPERAND_BRANCH2, 3},
+    [0x9c] = {"ifge", OPERAND_BRANCH2, 3},
+    [0x9d] = {"ifgt", OPERAND_BRANCH2, 3},
+    [0x9e] = {"ifle", OPERAND_BRANCH2, 3},
+    [0x9f] = {"if_icmpeq", OPERAND_BRANCH2, 3},
+    [0xa0] = {"if_icmpne", OPERAND_BRANCH2, 3},
+    [0xa1] = {"if_icmplt", OPERAND_BRANCH2, 3},
+    [0xa2] = {"if_icmpge", OPERAND_BRANCH2, 3},
+    [0xa3] = {"if_icmpgt", OPERAND_BRANCH2, 3},
+    [0xa4] = {"if_icmple", OPERAND_BRANCH2, 3},
+    [0xa5] = {"if_acmpeq", OPERAND_BRANCH2, 3},
+    [0xa6] = {"if_acmpne", OPERAND_BRANCH2, 3},
+    [0xa7] = {"goto", OPERAND_BRANCH2, 3},
+    [0xa8] = {"jsr", OPERAND_BRANCH2, 3},
+    [0xa9] = {"ret", OPERAND_LOCAL, 2},
+    [0xaa] = {"tableswitch", OPERAND_TABLESWITCH, 0},
+    [0xab] = {"lookupswitch", OPERAND_LOOKUPSWITCH, 0},
+    [0xac] = {"ireturn", OPERAND_NONE, 1},
+    [0xad] = {"lreturn", OPERAND_NONE, 1},
+    [0xae] = {"freturn", OPERAND_NONE, 1},
+    [0xaf] = {"dreturn", OPERAND_NONE, 1},
+    [0xb0] = {"areturn", OPERAND_NONE, 1},
+    [0xb1] = {"return", OPERAND_NONE, 1},
+    [0xb2] = {"getstatic", OPERAND_CP2, 3},
+    [0xb3] = {"putstatic", OPERAND_CP2, 3},
+    [0xb4] = {"getfield", OPERAND_CP2, 3},
+    [0xb5] = {"putfield", OPERAND_CP2, 3},
+    [0xb6] = {"invokevirtual", OPERAND_CP2, 3},
+    [0xb7] = {"invokespecial", OPERAND_CP2, 3},
+    [0xb8] = {"invokestatic", OPERAND_CP2, 3},
+    [0xb9] = {"invokeinterface", OPERAND_INVOKEINTERFACE, 5},
+    [0xba] = {"invokedynamic", OPERAND_INVOKEDYNAMIC, 5},
+    [0xbb] = {"new", OPERAND_CP2, 3},
+    [0xbc] = {"newarray", OPERAND_NEWARRAY, 2},
+    [0xbd] = {"anewarray", OPERAND_CP2, 3},
+    [0xbe] = {"arraylength", OPERAND_NONE, 1},
+    [0xbf] = {"athrow", OPERAND_NONE, 1},
+    [0xc0] = {"checkcast", OPERAND_CP2, 3},
+    [0xc1] = {"instanceof", OPERAND_CP2, 3},
+    [0xc2] = {"monitorenter", OPERAND_NONE, 1},
+    [0xc3] = {"monitorexit", OPERAND_NONE, 1},
+    [0xc4] = {"wide", OPERAND_WIDE, 0},
+    [0xc5] = {"multianewarray", OPERAND_MULTIANEWARRAY, 4},
+    [0xc6] = {"ifnull", OPERAND_BRANCH2, 3},
+    [0xc7] = {"ifnonnull", OPERAND_BRANCH2, 3},
+    [0xc8] = {"goto_w", OPERAND_BRANCH4, 5},
+    [0xc9] = {"jsr_w", OPERAND_BRANCH4, 5},
+};
+
+/**
+ * Decodes the Code attribute of a method. Nested attributes
+ * of the Code attribute are not decoded.
+ * 
+ * @param class struct
+ * @param attribute Code attribute of the method
+ * @param code where to put the decoded attribute
+ * @return false if the attribute is truncated (see class_error)
+ */
+bool parse_code_attribute(class *cls, const attribute_info *attribute, code_attribute *code)
+{
+    byte_reader reader = attribute_reader(cls, attribute);
+
+    if (!parse_u2(&reader, &code->max_stack) ||
+        !parse_u2(&reader, &code->max_locals) ||
+        !parse_u4(&reader, &code->code_length) ||
+        code->code_length > reader.size - reader.pos)
+    {
+        set_class_error("Truncated Code attribute");
+        return false;
+    }
+    code->code = reader.data + reader.pos;
+    reader.pos += code->code_length;
+
+    if (!parse_u2(&reader, &code->exception_table_length) ||
+        (size_t)code->exception_table_length * 8 > reader.size - reader.pos)
+    {
+        set_class_error("Truncated Code attribute");
+        return false;
+    }
+    code->exception_table = reader.data + reader.pos;
+    return true;
+}
+
+/**
+ * Decodes the operands of a tableswitch or lookupswitch. The
+ * jump table starts at the next multiple of four after the opcode.
+ * 
+ * @param code of the method
+ * @param code_length of the method
+ * @param ins instruction with pc and opcode set
+ * @return false if the switch is malformed or truncated
+ */
+static bool decode_switch(const uint8_t *code, uint32_t code_length, instruction *ins)
+{
+    const uint32_t base = (ins->pc + 4) & ~3u;
+    const bool table = ins->opcode == 0xaa;
+    int64_t count;
+
+    if ((uint64_t)base + 12 > code_length)
+        return false;
+
+    ins->operand = (int32_t)(ins->pc + read_s4(code + base));
+    if (table)
+    {
+        ins->operand2 = read_s4(code + base + 4);
+        count = (int64_t)read_s4(code + base + 8) - ins->operand2 + 1;
+    }
+    else
+        count = read_s4(code + base + 4);
+
+    const uint32_t entry_size = table ? 4 : 8;
+    const uint32_t header_size = table ? 12 : 8;
+
+    if (count < 0 || (uint64_t)count * entry_size > code_length - base - header_size)
+        return false;
+
+    ins->count = (int32_t)count;
+    ins->table = code + base + header_size;
+    ins->length = base + header_size + (uint32_t)count * entry_size - ins->pc;
+    return true;
+}
+
+/**
+ * Decodes one instruction
+ * 
+ * @param code of the method
+ * @param code_length of the method
+ * @param pc offset of the instruction, less than code_length
+ * @param ins where to put the decoded instruction
+ * @return false on an unknown opcode or a truncated instruction (see class_error)
+ */
+bool decode_instruction(const uint8_t *code, uint32_t code_length, uint32_t pc, instruction *ins)
+{
+    const uint8_t *p = code + pc;
+    const opcode_info *info = opcodes + *p;
+    const uint32_t left = code_length - pc;
+
+    ins->pc = pc;
+    ins->opcode = *p;
+    ins->wide = false;
+    ins->length = info->length;
+
+    if (info->length > left)
+    {
+        set_class_error("Truncated %s at %u", info->mnemonic, pc);
+        return false;
+    }
+
+    switch (info->kind)
+    {
+    case OPERAND_NONE:
+        break;
+
+    case OPERAND_BYTE:
+        ins->operand = (int8_t)p[1];
+        break;
+
+    case OPERAND_SHORT:
+        ins->operand = (int16_t)read_u2(p + 1);
+        break;
+
+    case OPERAND_LOCAL:
+    case OPERAND_CP1:
+    case OPERAND_NEWARRAY:
+        ins->operand = p[1];
+        break;
+
+    case OPERAND_CP2:
+    case OPERAND_INVOKEDYNAMIC:
+        ins->operand = read_u2(p + 1);
+        break;
+
+    case OPERAND_INVOKEINTERFACE:
+    case OPERAND_MULTIANEWARRAY:
+        ins->operand = read_u2(p + 1);
+        ins->operand2 = p[3];
+        break;
+
+    case OPERAND_BRANCH2:
+        ins->operand = (int32_t)pc + (int16_t)read_u2(p + 1);
+        break;
+
+    case OPERAND_BRANCH4:
+        ins->operand = (int32_t)(pc + read_s4(p + 1));
+        break;
+
+    case OPERAND_IINC:
+        ins->operand = p[1];
+        ins->operand2 = (int8_t)p[2];
+        break;
+
+    case OPERAND_TABLESWITCH:
+    case OPERAND_LOOKUPSWITCH:
+        if (!decode_switch(code, code_length, ins))
+        {
+            set_class_error("Bad %s at %u", info->mnemonic, pc);
+            return false;
+        }
+        break;
+
+    case OPERAND_WIDE:
+        if (left < 2)
+        {
+            set_class_error("Truncated wide at %u", pc);
+            return false;
+        }
+
+        ins->opcode = p[1];
+        ins->wide = true;
+        ins->length = opcodes[p[1]].kind == OPERAND_IINC ? 6 : 4;
+
+        if ((opcodes[p[1]].kind != OPERAND_LOCAL && opcodes[p[1]].kind != OPERAND_IINC) || ins->length > left)
+        {
+            set_class_error("Bad wide %s at %u", opcodes[p[1]].kind ? opcodes[p[1]].mnemonic : "opcode", pc);
+            return false;
+        }
+
+        ins->operand = read_u2(p + 2);
+        if (ins->length == 6)
+            ins->operand2 = (int16_t)read_u2(p + 4);
+        break;
+
+    default:
+        set_class_error("Unknown opcode %d at %u", *p, pc);
+        return false;
+    }
+
+    return true;
+}
+
+/**
+ * Gets one case of a decoded tableswitch or lookupswitch
+ * 
+ * @param ins decoded switch instruction
+ * @param i index of the case, less than ins->count
+ * @param key matched by the case
+ * @param target absolute offset to jump to
+ */
+void switch_case(const instruction *ins, int32_t i, int32_t *key, int32_t *target)
+{
+    if (ins->opcode == 0xaa)
+    {
+        *key = ins->operand2 + i;
+        *target = (int32_t)(ins->pc + read_s4(ins->table + 4 * (size_t)i));
+    }
+    else
+    {
+        *key = read_s4(ins->table + 8 * (size_t)i);
+        *target = (int32_t)(ins->pc + read_s4(ins->table + 8 * (size_t)i + 4));
+    }
+}
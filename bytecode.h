@@ -0,0 +1,96 @@
+#ifndef BYTECODE_H
+#define BYTECODE_H
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+
+#include "class_reader.h"
+
+#define OPCODE_WIDE 0xc4
+
+typedef enum operand_kind_e
+{
+    OPERAND_INVALID = 0, // reserved or unassigned opcode
+    OPERAND_NONE,
+    OPERAND_BYTE,            // bipush: s1 value
+    OPERAND_SHORT,           // sipush: s2 value
+    OPERAND_LOCAL,           // u1 local variable index, u2 after wide
+    OPERAND_CP1,             // ldc: u1 constant index
+    OPERAND_CP2,             // u2 constant index
+    OPERAND_BRANCH2,         // s2 branch offset
+    OPERAND_BRANCH4,         // s4 branch offset
+    OPERAND_IINC,            // u1 local index, s1 increment; u2, s2 after wide
+    OPERAND_INVOKEINTERFACE, // u2 constant index, u1 count, u1 0
+    OPERAND_INVOKEDYNAMIC,   // u2 constant index, u1 0, u1 0
+    OPERAND_NEWARRAY,        // u1 array type
+    OPERAND_MULTIANEWARRAY,  // u2 constant index, u1 dimensions
+    OPERAND_TABLESWITCH,
+    OPERAND_LOOKUPSWITCH,
+    OPERAND_WIDE
+
+} operand_kind;
+
+typedef struct opcode_info_s
+{
+    const char *mnemonic;
+    uint8_t kind;   // operand_kind
+    uint8_t length; // of the whole instruction, 0 if it is variable
+
+} opcode_info;
+
+extern const opcode_info opcodes[256];
+
+/**
+ * One decoded instruction. Branch and switch targets are
+ * absolute offsets in the code.
+ */
+typedef struct instruction_s
+{
+    uint32_t pc;
+    uint32_t length;
+    uint8_t opcode; // the modified opcode for wide instructions
+    bool wide;
+    int32_t operand;  // index, value or branch target
+    int32_t operand2; // iinc increment, invokeinterface count, dimensions
+                      // or the tableswitch low key
+    int32_t count;    // number of switch cases
+    const uint8_t *table; // switch jump offsets or match-offset pairs
+
+} instruction;
+
+/**
+ * Code attribute of a method. Both the code and the exception
+ * table are views into the class data.
+ */
+typedef struct code_attribute_s
+{
+    uint16_t max_stack;
+    uint16_t max_locals;
+    uint32_t code_length;
+    const uint8_t *code;
+    uint16_t exception_table_length;
+    const uint8_t *exception_table; // start_pc, end_pc, handler_pc, catch_type; u2 each
+
+} code_attribute;
+
+bool parse_code_attribute(class *cls, const attribute_info *attribute, code_attribute *code);
+bool decode_instruction(const uint8_t *code, uint32_t code_length, uint32_t pc, instruction *ins);
+void switch_case(const instruction *ins, int32_t i, int32_t *key, int32_t *target);
+
+/**
+ * Reads a big-endian u2 without bounds checks
+ */
+static inline uint16_t read_u2(const uint8_t *p)
+{
+    return (uint16_t)(p[0] << 8 | p[1]);
+}
+
+/**
+ * Reads a big-endian s4 without bounds checks
+ */
+static inline int32_t read_s4(const uint8_t *p)
+{
+    return (int32_t)((uint32_t)p[0] << 24 | (uint32_t)p[1] << 16 | (uint32_t)p[2] << 8 | p[3]);
+}
+
+#endif
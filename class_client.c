@@ -0,0 +1,175 @@
+/**
+ * Client side of the daemon protocol (see class_client.h), small
+ * enough to be copied into other programs: it only needs libc.
+ *
+ * Errors are reported through errno, EPROTO for an answer that
+ * doesn't follow the protocol.
+ *
+ */
+
+#define _GNU_SOURCE
+#include "class_client.h"
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <sys/un.h>
+
+static void write_u16(uint8_t *p, uint16_t value)
+{
+    p[0] = (uint8_t)value;
+    p[1] = (uint8_t)(value >> 8);
+}
+
+static void write_u32(uint8_t *p, uint32_t value)
+{
+    write_u16(p, (uint16_t)value);
+    write_u16(p + 2, (uint16_t)(value >> 16));
+}
+
+/**
+ * Reads exactly size bytes
+ *
+ * @return false on an error or if the connection is closed first
+ */
+static bool read_full(int fd, void *buffer, size_t size)
+{
+    for (size_t done = 0; done < size;)
+    {
+        ssize_t count = read(fd, (char *)buffer + done, size - done);
+
+        if (count == 0)
+            errno = EPROTO;
+        if (count <= 0 && !(count < 0 && errno == EINTR))
+            return false;
+        if (count > 0)
+            done += count;
+    }
+    return true;
+}
+
+/**
+ * Connects to a server started with --serve
+ *
+ * @param socket_path of the server
+ * @return socket, -1 on error (see errno)
+ */
+int connect_class_server(const char *socket_path)
+{
+    struct sockaddr_un address = {.sun_family = AF_UNIX};
+
+    if (strlen(socket_path) >= sizeof(address.sun_path))
+    {
+        errno = ENAMETOOLONG;
+        return -1;
+    }
+    strcpy(address.sun_path, socket_path);
+
+    int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd < 0)
+        return -1;
+    if (connect(fd, (struct sockaddr *)&address, sizeof(address)) < 0)
+    {
+        int error = errno;
+        close(fd);
+        errno = error;
+        return -1;
+    }
+    return fd;
+}
+
+/**
+ * Sends one request and waits for its answer
+ *
+ * @param fd connected socket
+ * @param request to send
+ * @param response to fill, its body is reused
+ * @return false if the request couldn't be sent or answered (see errno);
+ *         a class the server can't parse is an error response, not a failure
+ */
+bool send_class_request(int fd, const class_request *request, class_response *response)
+{
+    uint8_t header[4 + CLASS_REQUEST_HEADER] = {0};
+    const size_t name_length = request->name ? strlen(request->name) : 0;
+
+    if (name_length > UINT16_MAX || request->length > CLASS_REQUEST_MAX - CLASS_REQUEST_HEADER - name_length)
+    {
+        errno = EMSGSIZE;
+        return false;
+    }
+
+    write_u32(header, (uint32_t)(CLASS_REQUEST_HEADER + name_length + request->length));
+    header[4] = (uint8_t)request->kind;
+    header[5] = request->format;
+    header[6] = (uint8_t)request->mode;
+    write_u16(header + 8, request->constant_index);
+    write_u16(header + 10, (uint16_t)name_length);
+
+    // Everything goes out in one call, without copying the payload
+    struct iovec parts[3] = {{header, sizeof(header)},
+                             {(void *)request->name, name_length},
+                             {(void *)request->payload, request->length}};
+    size_t left = sizeof(header) + name_length + request->length;
+    struct iovec *part = parts;
+
+    while (left)
+    {
+        ssize_t count = writev(fd, part, (int)(parts + 3 - part));
+
+        if (count < 0 && errno == EINTR)
+            continue;
+        if (count < 0)
+            return false;
+
+        left -= count;
+        for (; part < parts + 3 && (size_t)count >= part->iov_len; part++)
+            count -= part->iov_len;
+        if (part < parts + 3)
+        {
+            part->iov_base = (char *)part->iov_base + count;
+            part->iov_len -= count;
+        }
+    }
+
+    uint8_t answer[5];
+    if (!read_full(fd, answer, sizeof(answer)))
+        return false;
+
+    const size_t length = answer[0] | answer[1] << 8 | answer[2] << 16 | (size_t)answer[3] << 24;
+    if (length < 1 || answer[4] > RESPONSE_ERROR)
+    {
+        errno = EPROTO;
+        return false;
+    }
+
+    response->status = answer[4];
+    response->length = length - 1;
+    if (response->capacity < response->length + 1)
+    {
+        char *body = realloc(response->body, response->length + 1);
+        if (!body)
+            return false;
+        response->body = body;
+        response->capacity = response->length + 1;
+    }
+
+    if (!read_full(fd, response->body, response->length))
+        return false;
+    response->body[response->length] = '\0';
+    return true;
+}
+
+/**
+ * Releases the body of a response
+ *
+ * @param response to release
+ */
+void free_class_response(class_response *response)
+{
+    free(response->body);
+    response->body = NULL;
+    response->length = response->capacity = 0;
+}
@@ -0,0 +1,86 @@
+#ifndef CLASS_CLIENT_H
+#define CLASS_CLIENT_H
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * Protocol of the daemon (--serve), all numbers little-endian.
+ *
+ * A connection carries any number of requests, each answered in
+ * order before the next one is read:
+ *
+ *   request:  u32 length of the rest
+ *             u8  kind            'P' payload is a path, 'D' the class bytes
+ *             u8  format          0 text, 1 JSON Lines, 2 binary records
+ *             u8  mode            0 constant pool, 1 declarations (-m), 2 with bytecode (-c)
+ *             u8  reserved        0
+ *             u16 constant_index  print only this constant (-i), 0 for all
+ *             u16 name_length     of the name in front of the payload
+ *             name                for the records, the path or "-" if empty
+ *             payload
+ *
+ *   response: u32 length of the rest
+ *             u8  status          0 ok, 1 error
+ *             body                the output, or the error message
+ *
+ * A request that can't be parsed or printed gets an error response
+ * and the connection stays usable. A malformed frame gets one too,
+ * then the server closes the connection.
+ */
+
+#define CLASS_REQUEST_HEADER 8               // bytes after the length, before the payload
+#define CLASS_REQUEST_MAX ((size_t)256 << 20) // longest request accepted
+
+typedef enum request_kind_e
+{
+    REQUEST_PATH = 'P',
+    REQUEST_DATA = 'D'
+
+} request_kind;
+
+typedef enum request_mode_e
+{
+    MODE_POOL = 0,
+    MODE_SUMMARY,
+    MODE_CODE
+
+} request_mode;
+
+typedef enum response_status_e
+{
+    RESPONSE_OK = 0,
+    RESPONSE_ERROR
+
+} response_status;
+
+typedef struct class_request_s
+{
+    request_kind kind;
+    uint8_t format; // output_format
+    request_mode mode;
+    uint16_t constant_index;
+    const char *name; // NULL to name the output after the path
+    const void *payload;
+    size_t length;
+
+} class_request;
+
+/**
+ * Answer of the server. The body is kept between requests
+ * so a client reusing the struct allocates only to grow it.
+ */
+typedef struct class_response_s
+{
+    response_status status;
+    char *body; // output or NUL-terminated error message
+    size_t length;
+    size_t capacity;
+
+} class_response;
+
+int connect_class_server(const char *socket_path);
+bool send_class_request(int fd, const class_request *request, class_response *response);
+void free_class_response(class_response *response);
+
+#endif
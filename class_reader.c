@@ -10,14 +10,61 @@
  * 
  */
 
+#define _GNU_SOURCE
 #include "class_reader.h"
+#include "class_stream.h"
+#include "mutf8.h"
+#include "parse_cache.h"
+#include "stats.h"
+
+#include <errno.h>
+#include <stdarg.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+static __thread char error_message[256];
+
+/**
+ * Remembers why the last operation of this thread failed
+ * 
+ * @param format of the message, printf-like
+ */
+void set_class_error(const char *format, ...)
+{
+    va_list args;
+    va_start(args, format);
+    vsnprintf(error_message, sizeof(error_message), format, args);
+    va_end(args);
+}
+
+/**
+ * Remembers the current errno as the reason of the failure
+ */
+static void set_class_errno(void)
+{
+    char buffer[128];
+    set_class_error("Error : %s", strerror_r(errno, buffer, sizeof(buffer)));
+}
+
+/**
+ * Tells why the last call of this thread returned NULL or false.
+ * Every thread has its own message, so parsing is reentrant.
+ * 
+ * @return error message
+ */
+const char *class_error(void)
+{
+    return error_message;
+}
 
 /**
  * Attempts to open a file, on success checks 
  * if the file is a valid .class file.
  * 
  * @param path of the file to open
- * @return file if it is valid .class file
+ * @return file if it is valid .class file, NULL otherwise (see class_error)
  */
 FILE *open_class_file(char *path)
 {
@@ -25,14 +72,15 @@ FILE *open_class_file(char *path)
 
     if (!file)
     {
-        perror("Error ");
-        exit(EXIT_FAILURE);
+        set_class_errno();
+        return NULL;
     }
 
     if (!is_class_file(file))
     {
-        fprintf(stderr, "This file is not a .class file!\n");
-        exit(0);
+        set_class_error("This file is not a .class file!");
+        fclose(file);
+        return NULL;
     }
 
     return file;
@@ -53,151 +101,811 @@ bool is_class_file(FILE *file)
 }
 
 /**
- * Reads minor, major versions, constant pool size
- * and constant pool from a file
+ * Estimates how much memory a parsed class takes in its arena,
+ * so that it is allocated in one go.
  * 
- * @param file to read from
- * @return class struct filled with collected data
+ * @param constant_pool_count from the class header
+ * @param size of the class file
+ * @return size for the arena
  */
-class *parse_class_file(FILE *class_file)
+static size_t class_arena_size(uint16_t constant_pool_count, size_t size)
 {
-    class *cls = (class *)malloc(sizeof(class));
+    return sizeof(class) + ((size_t)constant_pool_count + 2) * (sizeof(uint8_t) + sizeof(uint32_t) + sizeof(pool_string) + sizeof(resolved_constant)) +
+           size / 4 + 8 * ARENA_ALIGNMENT;
+}
+
+/**
+ * Allocates an empty class with its header filled in, the rest
+ * is up to the caller
+ * 
+ * @param minor_version from the class header
+ * @param major_version from the class header
+ * @param constant_pool_count from the class header
+ * @param size of the class file, or a guess at it
+ * @param arena to allocate from, NULL to give the class its own
+ * @return class struct with no data yet
+ */
+class *new_class(uint16_t minor_version, uint16_t major_version, uint16_t constant_pool_count, size_t size, arena *a)
+{
+    const size_t arena_size = class_arena_size(constant_pool_count, size);
+    arena local_arena;
+    class *cls;
+
+    if (a)
+    {
+        arena_reserve(a, arena_size);
+        cls = arena_alloc(a, sizeof(class));
+        cls->arena = a;
+        cls->own_arena.head = NULL;
+    }
+    else
+    {
+        arena_init(&local_arena, arena_size);
+        cls = arena_alloc(&local_arena, sizeof(class));
+        cls->own_arena = local_arena;
+        cls->arena = &cls->own_arena;
+    }
+
+    cls->minor_version = minor_version;
+    cls->major_version = major_version;
+    cls->constant_pool_count = constant_pool_count;
+    cls->data = NULL;
+    cls->size = 0;
+    cls->data_owner = DATA_BORROWED;
+    cls->cached = NULL;
+    cls->cached_size = 0;
+    cls->tags = NULL;
+    cls->payload = NULL;
+    cls->strings = NULL;
+    cls->string_count = 0;
+    cls->decoded = NULL;
+    cls->decoded_length = cls->decoded_capacity = 0;
+    cls->resolved = NULL;
+    cls->pool_end = 0;
+    cls->access_flags = cls->this_class = cls->super_class = 0;
+    cls->interfaces_count = cls->fields_count = cls->methods_count = cls->attributes_count = 0;
+    cls->interfaces = NULL;
+    cls->fields = cls->methods = NULL;
+    cls->attributes = NULL;
+    return cls;
+}
+
+/**
+ * Reads minor, major versions, constant pool, class info,
+ * fields, methods and attributes from the class data. The class keeps
+ * pointers into the data, so it has to outlive the class.
+ * 
+ * @param data of the whole class file (or what's left of it)
+ * @param size of the data
+ * @param offset where the header starts, right after the magic value
+ * @param owner of the data, tells free_class how to release it
+ * @param arena to allocate from, NULL to give the class its own
+ * @param flags PARSE_* options
+ * @param cache to take the resolved pool from, or store it in; NULL for none
+ * @return class struct filled with collected data or NULL on error
+ */
+static class *parse_class_data(const uint8_t *data, size_t size, size_t offset,
+                               class_data_owner owner, arena *a, unsigned flags, parse_cache *cache)
+{
+    byte_reader reader = {data, size, offset};
+    uint16_t minor_version, major_version, constant_pool_count;
+    uint64_t start = stats_start();
 
     // Read header
-    parse_u2(class_file, &cls->minor_version);
-    parse_u2(class_file, &cls->major_version);
-    parse_u2(class_file, &cls->constant_pool_count);
+    if (!parse_u2(&reader, &minor_version) ||
+        !parse_u2(&reader, &major_version) ||
+        !parse_u2(&reader, &constant_pool_count))
+    {
+        set_class_error("Unexpected end of the class file header");
+        return NULL;
+    }
+
+    class *cls = new_class(minor_version, major_version, constant_pool_count, size, a);
+    cls->data = data;
+    cls->size = size;
+    cls->data_owner = owner;
+    stats_stop(PHASE_HEADER, start);
+
+    const uint64_t hash = cache ? hash_class_data(data, size) : 0;
+    bool ok;
+
+    start = stats_start();
+    if (cache && load_cached_pool(cache, hash, cls))
+    {
+        stats_stop(PHASE_CACHE, start);
+        reader.pos = cls->pool_end;
+        ok = true;
+    }
+    else
+    {
+        bool loaded = false;
+
+        // Only a fully loaded pool can be cached, so with a cache even
+        // a lazy parse loads everything, and starts over if that fails
+        ok = parse_constant_pool(&reader, cls);
+        stats_stop(PHASE_POOL, start);
+        if (ok && (cache || !(flags & PARSE_LAZY)))
+        {
+            start = stats_start();
+            loaded = load_constant_pool(cls);
+            stats_stop(PHASE_RESOLVE, start);
+        }
+
+        if (loaded && cache)
+            store_cached_pool(cache, hash, cls);
+        else if (ok && !loaded && (flags & PARSE_LAZY))
+            cls->resolved = arena_calloc(cls->arena, (size_t)constant_pool_count + 1, sizeof(resolved_constant));
+        else
+            ok = ok && loaded;
+    }
+
+    start = stats_start();
+    ok = ok && parse_class_members(&reader, cls);
+    stats_stop(PHASE_MEMBERS, start);
+
+    if (!ok)
+    {
+        cls->data_owner = DATA_BORROWED; // the caller still owns data on failure
+        free_class(cls);
+        return NULL;
+    }
+
+    return cls;
+}
+
+/**
+ * Releases a parsed class: its data and, unless the arena 
+ * was passed in by the caller, all memory it references.
+ * A caller-supplied arena is left for the caller to reset.
+ * 
+ * @param class struct to release
+ */
+void free_class(class *cls)
+{
+    if (!cls)
+        return;
+
+    switch (cls->data_owner)
+    {
+    case DATA_MAPPED:
+        munmap((void *)cls->data, cls->size);
+        break;
+    case DATA_HEAP:
+        free((void *)cls->data);
+        break;
+    case DATA_BORROWED:
+        break;
+    }
+
+    if (cls->cached)
+        munmap(cls->cached, cls->cached_size);
+
+    if (cls->arena == &cls->own_arena)
+    {
+        arena a = cls->own_arena; // the class itself lives in this arena
+        arena_release(&a);
+    }
+}
+
+/**
+ * Reads the rest of an already opened .class file. Regular files
+ * are mapped into memory as a whole, anything else (pipes) is
+ * read into a heap buffer.
+ * 
+ * @param file to read from, positioned right after the magic value
+ * @return class struct filled with collected data or NULL on error
+ */
+class *parse_class_file(FILE *class_file)
+{
+    struct stat st;
+    long offset = ftell(class_file);
+    int fd = fileno(class_file);
 
-    parse_constant_pool(class_file, cls);
+    if (offset >= 0 && fstat(fd, &st) == 0 && S_ISREG(st.st_mode) && st.st_size > offset)
+    {
+        void *data = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+
+        if (data != MAP_FAILED)
+        {
+            fclose(class_file);
+            class *cls = parse_class_data(data, st.st_size, offset, DATA_MAPPED, NULL, 0, NULL);
+            if (!cls)
+                munmap(data, st.st_size);
+            return cls;
+        }
+    }
+
+    // Not mappable, parse it as it is read
+    static const uint8_t magic[4] = {0xca, 0xfe, 0xba, 0xbe};
+    uint8_t chunk[4096];
+    size_t read_cnt;
+    class_stream stream;
+    stream_status status;
+
+    init_class_stream(&stream, NULL, 0);
+    status = feed_class_stream(&stream, magic, sizeof(magic)); // already consumed by is_class_file
+    while (status == STREAM_MORE && (read_cnt = fread(chunk, 1, sizeof(chunk), class_file)) > 0)
+        status = feed_class_stream(&stream, chunk, read_cnt);
     fclose(class_file);
+
+    if (status == STREAM_FAILED)
+    {
+        free_class_stream(&stream);
+        return NULL;
+    }
+    return finish_class_stream(&stream);
+}
+
+/**
+ * Checks the class data for a magic value 0xcafebabe
+ * 
+ * @param data of the class file
+ * @param size of the data
+ * @return true if data starts with the magic value
+ */
+static bool has_magic_number(const uint8_t *data, size_t size)
+{
+    byte_reader reader = {data, size, 0};
+    uint32_t magic_number;
+
+    if (!parse_u4(&reader, &magic_number) || magic_number != MAGIC_NUMBER)
+    {
+        set_class_error("This file is not a .class file!");
+        return false;
+    }
+
+    return true;
+}
+
+/**
+ * Maps a .class file into memory and parses it.
+ * 
+ * @param path of the file to open
+ * @param arena to allocate from, NULL to give the class its own
+ * @param flags PARSE_* options
+ * @param cache of parsed pools, NULL for none
+ * @return class struct or NULL if the file is not a valid .class file
+ */
+class *map_class_file(const char *path, arena *a, unsigned flags, parse_cache *cache)
+{
+    struct stat st;
+    const uint64_t start = stats_start();
+    int fd = open(path, O_RDONLY);
+
+    if (fd < 0)
+    {
+        set_class_errno();
+        return NULL;
+    }
+
+    if (fstat(fd, &st) != 0 || st.st_size < 4)
+    {
+        set_class_error("This file is not a .class file!");
+        close(fd);
+        return NULL;
+    }
+
+    uint8_t *data = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+
+    if (data == MAP_FAILED)
+    {
+        set_class_errno();
+        return NULL;
+    }
+    stats_stop(PHASE_OPEN, start);
+    stats_read(st.st_size);
+
+    class *cls = NULL;
+    const uint64_t magic_start = stats_start();
+    const bool magic = has_magic_number(data, st.st_size);
+
+    stats_stop(PHASE_MAGIC, magic_start);
+    if (magic)
+        cls = parse_class_data(data, st.st_size, 4, DATA_MAPPED, a, flags, cache);
+
+    if (!cls)
+        munmap(data, st.st_size);
     return cls;
 }
 
 /**
- * Reads an "unsigned two-byte quantity" from a file
+ * Parses a .class file from a caller-supplied buffer. The buffer
+ * is not copied and has to stay alive as long as the class does.
+ * 
+ * @param data of the whole class file, starting with the magic value
+ * @param size of the data
+ * @param arena to allocate from, NULL to give the class its own
+ * @param flags PARSE_* options
+ * @param cache of parsed pools, NULL for none
+ * @return class struct or NULL if data is not a valid .class file
+ */
+class *parse_class_buffer(const uint8_t *data, size_t size, arena *a, unsigned flags, parse_cache *cache)
+{
+    if (!has_magic_number(data, size))
+        return NULL;
+
+    return parse_class_data(data, size, 4, DATA_BORROWED, a, flags, cache);
+}
+
+/**
+ * Sizes of constants without the tag byte, 0 for unknown tags.
+ * Utf8 is followed by as many bytes as its length says.
+ */
+static const uint8_t constant_sizes[CONSTANT_InvokeDynamic + 1] =
+{
+    [CONSTANT_Utf8] = 2,
+    [CONSTANT_Integer] = 4,
+    [CONSTANT_Float] = 4,
+    [CONSTANT_Long] = 8,
+    [CONSTANT_Double] = 8,
+    [CONSTANT_Class] = 2,
+    [CONSTANT_String] = 2,
+    [CONSTANT_Fieldref] = 4,
+    [CONSTANT_Methodref] = 4,
+    [CONSTANT_InterfaceMethodref] = 4,
+    [CONSTANT_NameAndType] = 4,
+    [CONSTANT_MethodHandle] = 3,
+    [CONSTANT_MethodType] = 2,
+    [CONSTANT_InvokeDynamic] = 4,
+};
+
+static inline uint16_t read_be16(const uint8_t *p)
+{
+    return (uint16_t)((p[0] << 8) | p[1]);
+}
+
+static inline uint32_t read_be32(const uint8_t *p)
+{
+    return ((uint32_t)p[0] << 24) | ((uint32_t)p[1] << 16) | ((uint32_t)p[2] << 8) | p[3];
+}
+
+/**
+ * Parses one constant pool entry into the tags and payload arrays.
+ * A Utf8 gets the offset of its entry as the payload, the caller
+ * turns it into a string index.
  * 
- * @param file to read from
- * @param variable to write
+ * @param class struct with the pool arrays allocated
+ * @param index of the constant, 1-based
+ * @param data of the class file
+ * @param pos of the tag byte
+ * @param end of the data available so far
+ * @return size of the entry with its tag, 0 if the entry doesn't end
+ *         before end, -1 for an unknown tag (see class_error)
  */
-void parse_u2(FILE *class_file, uint16_t *cls)
+static inline int read_constant(class *cls, uint16_t index, const uint8_t *data, size_t pos, size_t end)
 {
-    fread(cls, sizeof(uint16_t), 1, class_file);
-    (*cls) = be16toh((*cls));
+    if (pos >= end)
+        return 0;
+
+    const uint8_t tag = data[pos];
+    size_t size = tag <= CONSTANT_InvokeDynamic ? constant_sizes[tag] : 0;
+
+    if (!size)
+    {
+        set_class_error("Don't know what to do with %d tag byte :(", tag);
+        return -1;
+    }
+
+    if (end - pos - 1 < size || (tag == CONSTANT_Utf8 && end - pos - 3 < read_be16(data + pos + 1)))
+        return 0;
+
+    const uint8_t *p = data + pos + 1;
+    uint32_t *payload = cls->payload + index - 1;
+
+    switch (tag)
+    {
+    case CONSTANT_Utf8:
+        *payload = (uint32_t)pos;
+        size += read_be16(p);
+        break;
+    case CONSTANT_Long:
+    case CONSTANT_Double:
+        payload[0] = read_be32(p);
+        payload[1] = read_be32(p + 4);
+        break;
+    case CONSTANT_MethodHandle:
+        *payload = (uint32_t)p[0] << 16 | read_be16(p + 1);
+        break;
+    default:
+        *payload = size == 2 ? read_be16(p) : read_be32(p);
+        break;
+    }
+
+    cls->tags[index - 1] = tag;
+    return (int)(1 + size);
+}
+
+/**
+ * Parses one constant pool entry, for parsers that get the pool
+ * piece by piece (see read_constant)
+ */
+int parse_constant(class *cls, uint16_t index, const uint8_t *data, size_t pos, size_t end)
+{
+    return read_constant(cls, index, data, pos, end);
+}
+
+/**
+ * Allocates the tags and payload arrays of a class
+ * 
+ * @param class struct with constant_pool_count set
+ */
+void alloc_constant_pool(class *cls)
+{
+    const uint16_t total_constants_count = cls->constant_pool_count ? cls->constant_pool_count - 1 : 0;
+
+    // One more slot, a Long/Double at the end puts its low bytes there
+    cls->tags = arena_calloc(cls->arena, total_constants_count + 2, sizeof(uint8_t));
+    cls->payload = arena_calloc(cls->arena, total_constants_count + 2, sizeof(uint32_t));
 }
 
 /**
  * Parse symbolic information from the "constant_pool" table
- * from a file
+ * into the tags and payload arrays of the class. Operands are
+ * packed as the class struct describes; a u4 read of a pair of
+ * u2 operands is already packed that way. Utf8 texts are not
+ * copied, the string table points into the data, and they are
+ * not validated until check_constant or load_constant_pool.
  * 
- * @param file to read from
+ * @param reader to read from
  * @param class struct to write
+ * @return false if the pool is truncated or has an unknown tag
  */
-void parse_constant_pool(FILE *class_file, class *cls)
+bool parse_constant_pool(byte_reader *reader, class *cls)
 {
-    const uint16_t total_constants_count = cls->constant_pool_count - 1;
-    cls->constant_pool = malloc(total_constants_count * sizeof(constant_info));
-    uint8_t tag;
+    const uint16_t total_constants_count = cls->constant_pool_count ? cls->constant_pool_count - 1 : 0;
+    const uint8_t *data = reader->data;
+    size_t pos = reader->pos;
+    uint16_t string_count = 0;
 
-    CONSTANT_Class_info class_info;
-    CONSTANT_Ref_info ref_info;
-    CONSTANT_String_info string_info;
-    CONSTANT_IntFloat_info int_float_info;
-    CONSTANT_LongDouble_info long_double_info;
-    CONSTANT_Utf8_info utf_info;
-    CONSTANT_MethodHandle_info method_handle_info;
-    CONSTANT_MethodType_info method_type_info;
-    CONSTANT_InvokeDynamic_info invoke_info;
+    alloc_constant_pool(cls);
 
     for (int i = 1; i <= total_constants_count; i++)
     {
-        constant_info *cur_constant_info = cls->constant_pool + (i - 1);
-        fread(&tag, sizeof(uint8_t), 1, class_file);
+        const int size = read_constant(cls, i, data, pos, reader->size);
 
-        switch (tag)
+        if (size <= 0)
         {
-        case CONSTANT_Class:
-            fread(&class_info.name_index, sizeof(class_info.name_index), 1, class_file);
-            class_info.tag = tag;
-            class_info.name_index = be16toh(class_info.name_index);
-            cur_constant_info->class_i = class_info;
-            break;
-
-        case CONSTANT_Fieldref:
-        case CONSTANT_InterfaceMethodref:
-        case CONSTANT_Methodref:
-        case CONSTANT_NameAndType:
-            fread(&ref_info.class_index, sizeof(ref_info.class_index), 1, class_file);
-            fread(&ref_info.name_and_type_index, sizeof(ref_info.name_and_type_index), 1, class_file);
-            ref_info.tag = tag;
-            ref_info.class_index = be16toh(ref_info.class_index);
-            ref_info.name_and_type_index = be16toh(ref_info.name_and_type_index);
-            cur_constant_info->ref_i = ref_info;
-            break;
-
-        case CONSTANT_String:
-            fread(&string_info.string_index, sizeof(string_info.string_index), 1, class_file);
-            string_info.tag = tag;
-            string_info.string_index = be16toh(string_info.string_index);
-            cur_constant_info->string_i = string_info;
-            break;
+            if (size == 0)
+                set_class_error("Unexpected end of the constant pool at #%d", i);
+            return false;
+        }
 
-        case CONSTANT_Integer:
-        case CONSTANT_Float:
-            fread(&int_float_info.bytes, sizeof(int_float_info.bytes), 1, class_file);
-            int_float_info.tag = tag;
-            int_float_info.bytes = be32toh(int_float_info.bytes);
-            cur_constant_info->int_float_i = int_float_info;
+        pos += size;
+        switch (cls->tags[i - 1])
+        {
+        case CONSTANT_Utf8:
+            string_count++;
             break;
-
         case CONSTANT_Long:
         case CONSTANT_Double:
-            fread(&long_double_info.high_bytes, sizeof(long_double_info.high_bytes), 1, class_file);
-            fread(&long_double_info.low_bytes, sizeof(long_double_info.low_bytes), 1, class_file);
-            long_double_info.tag = tag;
-            long_double_info.high_bytes = be32toh(long_double_info.high_bytes);
-            long_double_info.low_bytes = be32toh(long_double_info.low_bytes);
-            cur_constant_info->long_double_i = long_double_info;
-            i++; // Takes two entries
+            i++; // Takes two entries, the second one keeps tag 0
             break;
+        }
+    }
 
-        case CONSTANT_Utf8:
-            fread(&utf_info.length, sizeof(utf_info.length), 1, class_file);
-            utf_info.length = be16toh(utf_info.length);
-            utf_info.bytes = malloc(sizeof(char) * (utf_info.length + 1));
-            fread(utf_info.bytes, sizeof(char), utf_info.length, class_file);
-            utf_info.bytes[utf_info.length] = '\0';
-            utf_info.tag = tag;
-            cur_constant_info->utf_i = utf_info;
-            break;
+    // Texts get a table of their own, so the payload stays 32 bits
+    cls->strings = arena_alloc(cls->arena, ((size_t)string_count + 1) * sizeof(pool_string));
+    cls->string_count = string_count;
 
-        case CONSTANT_MethodHandle:
-            fread(&method_handle_info.reference_kind, sizeof(method_handle_info.reference_kind), 1, class_file);
-            fread(&method_handle_info.reference_index, sizeof(method_handle_info.reference_index), 1, class_file);
-            method_handle_info.reference_index = be16toh(method_handle_info.reference_index);
-            method_handle_info.tag = tag;
-            cur_constant_info->method_handle_i = method_handle_info;
-            break;
+    for (int i = 0, n = 0; i < total_constants_count; i++)
+    {
+        if (cls->tags[i] != CONSTANT_Utf8)
+            continue;
 
-        case CONSTANT_MethodType:
-            fread(&method_type_info.descriptor_index, sizeof(method_type_info.descriptor_index), 1, class_file);
-            method_type_info.descriptor_index = be16toh(method_type_info.descriptor_index);
-            method_type_info.tag = tag;
-            cur_constant_info->method_type_i = method_type_info;
-            break;
+        pool_string *string = cls->strings + n;
+        string->offset = cls->payload[i] + 3;
+        string->length = read_be16(data + cls->payload[i] + 1);
+        string->state = STRING_UNCHECKED;
+        cls->payload[i] = n++;
+    }
 
-        case CONSTANT_InvokeDynamic:
-            fread(&invoke_info.bootstrap_method_attr_index, sizeof(invoke_info.bootstrap_method_attr_index), 1, class_file);
-            fread(&invoke_info.name_and_type_index, sizeof(invoke_info.name_and_type_index), 1, class_file);
-            invoke_info.bootstrap_method_attr_index = be16toh(invoke_info.bootstrap_method_attr_index);
-            invoke_info.name_and_type_index = be16toh(invoke_info.name_and_type_index);
-            invoke_info.tag = tag;
-            cur_constant_info->invoke_dynamic_i = invoke_info;
-            break;
+    reader->pos = pos;
+    cls->pool_end = pos;
+    return true;
+}
 
-        default:
-            fprintf(stderr, "Don't know what to do with %d tag byte :(\n", tag);
-            cur_constant_info = NULL;
-            break;
+/**
+ * Converts a Utf8 text into the decoded strings of the class.
+ * The buffer grows by doubling; texts stored before keep living
+ * in the old buffer, so views handed out stay valid.
+ * 
+ * @param class struct
+ * @param string to convert, its offset and length get updated
+ */
+static void store_decoded(class *cls, pool_string *string)
+{
+    if (cls->decoded_capacity - cls->decoded_length < string->length)
+    {
+        uint32_t capacity = cls->decoded_capacity ? cls->decoded_capacity * 2 : 4096;
+        if (capacity < cls->decoded_length + string->length)
+            capacity = cls->decoded_length + string->length;
+
+        char *grown = arena_alloc(cls->arena, capacity);
+        if (cls->decoded_length)
+            memcpy(grown, cls->decoded, cls->decoded_length);
+        cls->decoded = grown;
+        cls->decoded_capacity = capacity;
+    }
+
+    const uint8_t *bytes = cls->data + string->offset;
+    string->offset = cls->decoded_length;
+    string->length = (uint16_t)decode_mutf8(bytes, string->length, (uint8_t *)cls->decoded + string->offset);
+    string->state = STRING_DECODED;
+    cls->decoded_length += string->length;
+}
+
+/**
+ * Slow path of check_constant: reports a bad index, validates
+ * the modified UTF-8 of an unchecked Utf8 and converts it if it
+ * differs from standard UTF-8. That writes into the class, so a
+ * lazy class must not be accessed from several threads at once.
+ * 
+ * @param class struct
+ * @param index of the constant, 1-based
+ * @return false for a bad index or malformed text (see class_error)
+ */
+bool validate_constant(class *cls, uint16_t index)
+{
+    if (index == 0 || index >= cls->constant_pool_count)
+    {
+        set_class_error("Constant index #%d is out of range", index);
+        return false;
+    }
+
+    const uint8_t tag = cls->tags[index - 1];
+
+    if (!tag)
+    {
+        set_class_error("Constant index #%d points into a Long or Double", index);
+        return false;
+    }
+
+    if (tag != CONSTANT_Utf8)
+        return true;
+
+    pool_string *string = cls->strings + cls->payload[index - 1];
+
+    if (string->state != STRING_UNCHECKED)
+        return true;
+
+    switch (check_mutf8(cls->data + string->offset, string->length))
+    {
+    case MUTF8_INVALID:
+        set_class_error("Malformed modified UTF-8 in #%d", index);
+        return false;
+    case MUTF8_CONVERT:
+        store_decoded(cls, string);
+        break;
+    default:
+        string->state = STRING_PLAIN;
+        break;
+    }
+
+    return true;
+}
+
+/**
+ * Gets a constant by its index, unpacked from the pool arrays
+ * 
+ * @param class struct
+ * @param index of the constant, 1-based
+ * @param info where to unpack the constant
+ * @return false for a bad index or malformed text (see class_error)
+ */
+bool get_constant(class *cls, uint16_t index, constant_info *info)
+{
+    if (!check_constant(cls, index))
+        return false;
+
+    const uint8_t tag = cls->tags[index - 1];
+    const uint32_t payload = cls->payload[index - 1];
+
+    switch (tag)
+    {
+    case CONSTANT_Utf8:
+    {
+        utf_view view = constant_utf(cls, index);
+        info->utf_i.bytes = view.bytes;
+        info->utf_i.length = view.length;
+        break;
+    }
+    case CONSTANT_Integer:
+    case CONSTANT_Float:
+        info->int_float_i.bytes = payload;
+        break;
+    case CONSTANT_Long:
+    case CONSTANT_Double:
+        info->long_double_i.high_bytes = payload;
+        info->long_double_i.low_bytes = cls->payload[index];
+        break;
+    case CONSTANT_MethodHandle:
+        info->method_handle_i.reference_kind = (uint8_t)(payload >> 16);
+        info->method_handle_i.reference_index = (uint16_t)payload;
+        break;
+    case CONSTANT_Fieldref:
+    case CONSTANT_Methodref:
+    case CONSTANT_InterfaceMethodref:
+    case CONSTANT_NameAndType:
+    case CONSTANT_InvokeDynamic:
+        // ref_i and invoke_dynamic_i share the layout
+        info->ref_i.class_index = (uint16_t)(payload >> 16);
+        info->ref_i.name_and_type_index = (uint16_t)payload;
+        break;
+    default: // Class, String, MethodType
+        info->class_i.name_index = (uint16_t)payload;
+        break;
+    }
+
+    info->class_i.tag = tag;
+    return true;
+}
+
+/**
+ * Checks every Utf8 constant and resolves the pool, after that
+ * a lazily parsed class can be used like an eagerly parsed one
+ * 
+ * @param class struct
+ * @return false on a malformed pool (see class_error)
+ */
+bool load_constant_pool(class *cls)
+{
+    const uint16_t total_constants_count = cls->constant_pool_count ? cls->constant_pool_count - 1 : 0;
+
+    for (int i = 1; i <= total_constants_count; i++)
+    {
+        if (cls->tags[i - 1] == CONSTANT_Utf8 && !check_constant(cls, i))
+            return false;
+    }
+
+    return resolve_constant_pool(cls);
+}
+
+/**
+ * Locates attributes without decoding them
+ * 
+ * @param reader positioned at attributes_count
+ * @param class struct to allocate in
+ * @param count of attributes read
+ * @return attributes, NULL on error
+ */
+static attribute_info *parse_attributes(byte_reader *reader, class *cls, uint16_t *count)
+{
+    if (!parse_u2(reader, count))
+        return NULL;
+
+    attribute_info *attributes = arena_alloc(cls->arena, (*count ? *count : 1) * sizeof(attribute_info));
+
+    for (int i = 0; i < *count; i++)
+    {
+        attribute_info *attribute = attributes + i;
+
+        if (!parse_u2(reader, &attribute->name_index) || !parse_u4(reader, &attribute->length) ||
+            reader->size - reader->pos < attribute->length)
+            return NULL;
+
+        attribute->offset = (uint32_t)reader->pos;
+        reader->pos += attribute->length; // the body is skipped until somebody asks for it
+    }
+
+    return attributes;
+}
+
+/**
+ * Reads fields or methods
+ * 
+ * @param reader positioned at fields_count or methods_count
+ * @param class struct to allocate in
+ * @param count of members read
+ * @return members, NULL on error
+ */
+static member_info *parse_members(byte_reader *reader, class *cls, uint16_t *count)
+{
+    if (!parse_u2(reader, count))
+        return NULL;
+
+    member_info *members = arena_alloc(cls->arena, (*count ? *count : 1) * sizeof(member_info));
+
+    for (int i = 0; i < *count; i++)
+    {
+        member_info *member = members + i;
+
+        if (!parse_u2(reader, &member->access_flags) || !parse_u2(reader, &member->name_index) ||
+            !parse_u2(reader, &member->descriptor_index) ||
+            !(member->attributes = parse_attributes(reader, cls, &member->attributes_count)))
+            return NULL;
+    }
+
+    return members;
+}
+
+/**
+ * Reads everything after the constant pool: access flags,
+ * this/super class, interfaces, fields, methods and attributes.
+ * Attribute bodies (Code in the first place) are only located,
+ * so this stays cheap even for classes with huge methods.
+ * 
+ * @param reader positioned right after the constant pool
+ * @param class struct to write
+ * @return false if the class file is truncated
+ */
+bool parse_class_members(byte_reader *reader, class *cls)
+{
+    bool ok = parse_u2(reader, &cls->access_flags) && parse_u2(reader, &cls->this_class) &&
+              parse_u2(reader, &cls->super_class) && parse_u2(reader, &cls->interfaces_count);
+
+    if (ok)
+    {
+        cls->interfaces = arena_alloc(cls->arena, (cls->interfaces_count ? cls->interfaces_count : 1) * sizeof(uint16_t));
+        for (int i = 0; ok && i < cls->interfaces_count; i++)
+            ok = parse_u2(reader, cls->interfaces + i);
+    }
+
+    ok = ok && (cls->fields = parse_members(reader, cls, &cls->fields_count)) &&
+         (cls->methods = parse_members(reader, cls, &cls->methods_count)) &&
+         (cls->attributes = parse_attributes(reader, cls, &cls->attributes_count));
+
+    if (!ok)
+        set_class_error("Unexpected end of the class file after the constant pool");
+    return ok;
+}
+
+/**
+ * Looks for an attribute by name
+ * 
+ * @param class struct
+ * @param attributes of the class, a field, a method or a Code attribute
+ * @param count of the attributes
+ * @param name of the attribute, e.g. "Code"
+ * @return attribute or NULL if there is none
+ */
+const attribute_info *find_attribute(class *cls, const attribute_info *attributes, uint16_t count, const char *name)
+{
+    const size_t length = strlen(name);
+
+    for (int i = 0; i < count; i++)
+    {
+        const uint16_t index = attributes[i].name_index;
+
+        if (constant_tag(cls, index) == CONSTANT_Utf8 && check_constant(cls, index))
+        {
+            utf_view view = constant_utf(cls, index);
+            if (view.length == length && memcmp(view.bytes, name, length) == 0)
+                return attributes + i;
         }
     }
+
+    return NULL;
+}
+
+/**
+ * Gives a reader over the body of an attribute only, so decoding
+ * it can't run past its end
+ * 
+ * @param class struct
+ * @param attribute to decode
+ * @return reader positioned at the start of the body
+ */
+byte_reader attribute_reader(const class *cls, const attribute_info *attribute)
+{
+    byte_reader reader = {cls->data, (size_t)attribute->offset + attribute->length, attribute->offset};
+    return reader;
+}
+
+/**
+ * Gets the name of a CONSTANT_Class, works for lazy classes too
+ * 
+ * @param class struct
+ * @param index of the Class constant, 1-based
+ * @return name in internal form or an empty view on a bad index
+ */
+utf_view class_name(class *cls, uint16_t index)
+{
+    utf_view empty = {"", 0};
+    const resolved_constant *resolved;
+
+    if (constant_tag(cls, index) != CONSTANT_Class || !(resolved = resolve_constant(cls, index)))
+        return empty;
+
+    return constant_utf(cls, resolved->utf);
 }
\ No newline at end of file
@@ -8,6 +8,8 @@
 
 #include <string.h>
 
+#include "arena.h"
+
 #define MAGIC_NUMBER 0xcafebabe
 
 typedef struct CONSTANT_Ref_info_s
@@ -51,7 +53,7 @@ typedef struct CONSTANT_Utf8_info_s
 {
     uint8_t tag;
     uint16_t length;
-    char *bytes;
+    const char *bytes; // view into the class file data or the decoded strings, not NUL-terminated
 
 } CONSTANT_Utf8_info;
 
@@ -78,6 +80,10 @@ typedef struct CONSTANT_InvokeDynamic_info_s
     
 } CONSTANT_InvokeDynamic_info;
 
+/**
+ * One constant unpacked from the pool by get_constant. The pool
+ * itself is not stored this way, see the class struct.
+ */
 typedef union constant_info_u
 {
     CONSTANT_Ref_info ref_i;
@@ -124,42 +130,298 @@ static char *reference_kind[] =
     "REF_invokeInterface" // 9
 };
 
-typedef enum inf_nan_e
+typedef struct utf_view_s
+{
+    const char *bytes; // not NUL-terminated
+    uint16_t length;
+
+} utf_view;
+
+typedef enum resolve_state_e
+{
+    UNRESOLVED = 0,
+    RESOLVING = 1,
+    RESOLVED = 2
+
+} resolve_state;
+
+/**
+ * Symbolic references of a constant resolved down to Utf8 entries.
+ * Every field is a 1-based index of a CONSTANT_Utf8, 0 if unused:
+ * 
+ *  utf        - end of the name_index chain as javap follows it
+ *               (Class name, String text, Ref owner, NameAndType name...)
+ *  owner      - class of a Fieldref/Methodref/InterfaceMethodref/MethodHandle
+ *  name       - member name of a Ref/NameAndType/MethodHandle/InvokeDynamic
+ *  descriptor - member descriptor of the same, or MethodType descriptor
+ */
+typedef struct resolved_constant_s
+{
+    uint16_t utf;
+    uint16_t owner;
+    uint16_t name;
+    uint16_t descriptor;
+    uint8_t state;
+
+} resolved_constant;
+
+typedef enum pool_string_state_e
+{
+    STRING_UNCHECKED = 0, // modified UTF-8 not validated yet
+    STRING_PLAIN,         // valid, offset is into the class data
+    STRING_DECODED        // converted, offset is into cls->decoded
+
+} pool_string_state;
+
+/**
+ * Text of a Utf8 constant
+ */
+typedef struct pool_string_s
+{
+    uint32_t offset;
+    uint16_t length;
+    uint8_t state;
+
+} pool_string;
+
+typedef struct byte_reader_s
+{
+    const uint8_t *data;
+    size_t size;
+    size_t pos;
+
+} byte_reader;
+
+typedef enum class_data_owner_e
+{
+    DATA_BORROWED = 0, // caller-supplied buffer
+    DATA_MAPPED = 1,   // mapping released by free_class
+    DATA_HEAP = 2      // heap buffer released by free_class
+
+} class_data_owner;
+
+typedef enum access_flag_e
+{
+    ACC_PUBLIC = 0x0001,
+    ACC_PRIVATE = 0x0002,
+    ACC_PROTECTED = 0x0004,
+    ACC_STATIC = 0x0008,
+    ACC_FINAL = 0x0010,
+    ACC_SUPER = 0x0020,        // classes
+    ACC_SYNCHRONIZED = 0x0020, // methods
+    ACC_VOLATILE = 0x0040,     // fields
+    ACC_BRIDGE = 0x0040,       // methods
+    ACC_TRANSIENT = 0x0080,    // fields
+    ACC_VARARGS = 0x0080,      // methods
+    ACC_NATIVE = 0x0100,
+    ACC_INTERFACE = 0x0200,
+    ACC_ABSTRACT = 0x0400,
+    ACC_STRICT = 0x0800,
+    ACC_SYNTHETIC = 0x1000,
+    ACC_ANNOTATION = 0x2000,
+    ACC_ENUM = 0x4000,
+    ACC_MODULE = 0x8000
+
+} access_flag;
+
+/**
+ * Attributes are not decoded while parsing, only located.
+ * Use attribute_reader to decode one on demand.
+ */
+typedef struct attribute_info_s
+{
+    uint16_t name_index;
+    uint32_t length;
+    uint32_t offset; // of the attribute body in the class data
+
+} attribute_info;
+
+typedef struct member_info_s
+{
+    uint16_t access_flags;
+    uint16_t name_index;
+    uint16_t descriptor_index;
+    uint16_t attributes_count;
+    attribute_info *attributes;
+
+} member_info; // field_info and method_info
+
+typedef enum parse_flags_e
 {
-    NORMAL = 0,
-    POSITIVE_INFINITY = 1,
-    NEGATIVE_INFINITY = 2,
-    NAN = 3
+    PARSE_LAZY = 1,     // check Utf8 and resolve constants on access
+    PARSE_POOL_ONLY = 2 // class_stream: check the rest of the class but keep only the pool
 
-} inf_nan;
+} parse_flags;
+
+typedef struct parse_cache_s parse_cache; // see parse_cache.h
 
 typedef struct class_s
 {
     uint16_t minor_version;
     uint16_t major_version;
+    // The constant pool is kept as parallel arrays indexed by
+    // constant index - 1. A payload packs the operands of a constant:
+    //  Class, String, MethodType   - the u2 index
+    //  Ref, NameAndType, InvokeDynamic - first u2 << 16 | second u2
+    //  MethodHandle                - reference_kind << 16 | reference_index
+    //  Integer, Float              - the u4 bytes
+    //  Long, Double                - high bytes, low bytes in the gap slot
+    //  Utf8                        - index into strings
     uint16_t constant_pool_count;
-    constant_info *constant_pool;
+    uint8_t *tags;               // 0 for Long/Double gaps
+    uint32_t *payload;
+    pool_string *strings;
+    uint16_t string_count;
+    char *decoded; // Utf8 texts converted from modified UTF-8
+    uint32_t decoded_length;
+    uint32_t decoded_capacity;
+    resolved_constant *resolved; // parallel to tags
+    size_t pool_end;             // offset right after the constant pool
+
+    uint16_t access_flags;
+    uint16_t this_class;
+    uint16_t super_class;
+    uint16_t interfaces_count;
+    uint16_t *interfaces;
+    uint16_t fields_count;
+    member_info *fields;
+    uint16_t methods_count;
+    member_info *methods;
+    uint16_t attributes_count;
+    attribute_info *attributes;
+
+    const uint8_t *data; // whole class file, Utf8 constants point into it
+    size_t size;
+    class_data_owner data_owner;
+    void *cached;       // mapped cache entry the pool arrays point into, released by free_class
+    size_t cached_size;
+
+    arena *arena;     // everything above is allocated from it
+    arena own_arena;  // used when the caller didn't pass an arena
 
 } class;
 
-typedef union double_cast_u
+/**
+ * Reads an "unsigned one-byte quantity" from the class data
+ * 
+ * @param reader to read from
+ * @param variable to write
+ * @return false if the data ends too early
+ */
+static inline bool parse_u1(byte_reader *reader, uint8_t *value)
 {
-    double d;
-    struct parts_s
-    {
-        uint64_t mantisa : 52;
-        uint32_t exponent : 11;
-        uint32_t sign : 1;
+    if (reader->size - reader->pos < 1)
+        return false;
+
+    *value = reader->data[reader->pos++];
+    return true;
+}
+
+/**
+ * Reads an "unsigned two-byte quantity" from the class data
+ * 
+ * @param reader to read from
+ * @param variable to write
+ * @return false if the data ends too early
+ */
+static inline bool parse_u2(byte_reader *reader, uint16_t *value)
+{
+    if (reader->size - reader->pos < 2)
+        return false;
+
+    const uint8_t *p = reader->data + reader->pos;
+    *value = (uint16_t)((p[0] << 8) | p[1]);
+    reader->pos += 2;
+    return true;
+}
+
+/**
+ * Reads an "unsigned four-byte quantity" from the class data
+ * 
+ * @param reader to read from
+ * @param variable to write
+ * @return false if the data ends too early
+ */
+static inline bool parse_u4(byte_reader *reader, uint32_t *value)
+{
+    if (reader->size - reader->pos < 4)
+        return false;
 
-    } parts;
-    
-} double_cast;
+    const uint8_t *p = reader->data + reader->pos;
+    *value = ((uint32_t)p[0] << 24) | ((uint32_t)p[1] << 16) | ((uint32_t)p[2] << 8) | p[3];
+    reader->pos += 4;
+    return true;
+}
 
 FILE *open_class_file(char *path);
+const char *class_error(void);
+void set_class_error(const char *format, ...);
 bool is_class_file(FILE *file);
 class *parse_class_file(FILE *class_file);
-void parse_u2(FILE *class_file, uint16_t *cls);
-void parse_constant_pool(FILE *class_file, class *cls);
-void print_constant_pool(FILE *stream, class *cls);
+class *map_class_file(const char *path, arena *a, unsigned flags, parse_cache *cache);
+class *parse_class_buffer(const uint8_t *data, size_t size, arena *a, unsigned flags, parse_cache *cache);
+void free_class(class *cls);
+class *new_class(uint16_t minor_version, uint16_t major_version, uint16_t constant_pool_count, size_t size, arena *a);
+void alloc_constant_pool(class *cls);
+int parse_constant(class *cls, uint16_t index, const uint8_t *data, size_t pos, size_t end);
+bool parse_constant_pool(byte_reader *reader, class *cls);
+bool validate_constant(class *cls, uint16_t index);
+bool get_constant(class *cls, uint16_t index, constant_info *info);
+bool load_constant_pool(class *cls);
+bool resolve_constant_pool(class *cls);
+const resolved_constant *resolve_constant(class *cls, uint16_t index);
+bool parse_class_members(byte_reader *reader, class *cls);
+const attribute_info *find_attribute(class *cls, const attribute_info *attributes, uint16_t count, const char *name);
+byte_reader attribute_reader(const class *cls, const attribute_info *attribute);
+utf_view class_name(class *cls, uint16_t index);
+
+/**
+ * Gets the text of a Utf8 constant, checked by check_constant
+ * 
+ * @param class struct
+ * @param index of the Utf8 constant, 1-based, 0 gives an empty view
+ * @return view of the string
+ */
+static inline utf_view constant_utf(const class *cls, uint16_t index)
+{
+    utf_view view = {NULL, 0};
+    if (index)
+    {
+        const pool_string *string = cls->strings + cls->payload[index - 1];
+
+        view.bytes = (string->state == STRING_DECODED ? cls->decoded : (const char *)cls->data) + string->offset;
+        view.length = string->length;
+    }
+    return view;
+}
+
+/**
+ * Gets the tag of a constant
+ * 
+ * @param class struct
+ * @param index of the constant, 1-based
+ * @return tag, 0 for an index out of range or a Long/Double gap
+ */
+static inline uint8_t constant_tag(const class *cls, uint16_t index)
+{
+    return index && index < cls->constant_pool_count ? cls->tags[index - 1] : 0;
+}
+
+/**
+ * Checks that a constant exists and, for a Utf8, that its text
+ * is valid. Only the first check of a Utf8 does any work.
+ * 
+ * @param class struct
+ * @param index of the constant, 1-based
+ * @return false for a bad index or malformed text (see class_error)
+ */
+static inline bool check_constant(class *cls, uint16_t index)
+{
+    const uint8_t tag = constant_tag(cls, index);
+
+    if (tag && (tag != CONSTANT_Utf8 || cls->strings[cls->payload[index - 1]].state != STRING_UNCHECKED))
+        return true;
+    return validate_constant(cls, index);
+}
 
 #endif
\ No newline at end of file
@@ -0,0 +1,454 @@
+/**
+ * Incremental parsing of a class that arrives in pieces: from a
+ * pipe, a socket or a decompressor.
+ *
+ * Bytes are pushed in slices of any size. The header and the
+ * constant pool are kept, since the texts of the pool point into
+ * them, and every constant is parsed as soon as its last byte is
+ * there. Everything after the pool is walked with a small state
+ * machine: with PARSE_POOL_ONLY it is only checked and dropped, so
+ * memory is bounded by the size of the pool, otherwise it is kept
+ * and the class gets its members like a mapped one does.
+ *
+ */
+
+#define _GNU_SOURCE
+#include "class_stream.h"
+
+#include <errno.h>
+#include <unistd.h>
+
+#include "stats.h"
+
+#define STREAM_CHUNK_SIZE (1 << 16)
+#define STREAM_HEADER_SIZE 10 // magic, minor, major, constant_pool_count
+
+static inline uint16_t field_u2(const class_stream *stream, int offset)
+{
+    return (uint16_t)(stream->field[offset] << 8 | stream->field[offset + 1]);
+}
+
+static inline uint32_t field_u4(const class_stream *stream, int offset)
+{
+    return (uint32_t)field_u2(stream, offset) << 16 | field_u2(stream, offset + 2);
+}
+
+/**
+ * Prepares a stream for a new class
+ *
+ * @param stream to initialize
+ * @param arena to allocate the class from, NULL to give the class its own
+ * @param flags PARSE_* options
+ */
+void init_class_stream(class_stream *stream, arena *a, unsigned flags)
+{
+    memset(stream, 0, sizeof(class_stream));
+    stream->arena = a;
+    stream->flags = flags;
+}
+
+/**
+ * Appends bytes to the kept data of the stream
+ */
+static void keep_bytes(class_stream *stream, const uint8_t *bytes, size_t length)
+{
+    if (stream->capacity - stream->length < length)
+    {
+        if (!stream->capacity)
+            stream->capacity = STREAM_CHUNK_SIZE;
+        while (stream->capacity - stream->length < length)
+            stream->capacity *= 2;
+        stream->data = realloc(stream->data, stream->capacity);
+        stats_alloc(stream->capacity);
+    }
+
+    memcpy(stream->data + stream->length, bytes, length);
+    stream->length += length;
+
+    if (stream->cls)
+    {
+        stream->cls->data = stream->data;
+        stream->cls->size = stream->length;
+    }
+}
+
+/**
+ * Parses the header once all of it is there and allocates the class
+ *
+ * @return false if the data is not a class file
+ */
+static bool parse_stream_header(class_stream *stream)
+{
+    const uint8_t *p = stream->data;
+
+    if (stream->length >= 4 &&
+        ((uint32_t)p[0] << 24 | (uint32_t)p[1] << 16 | (uint32_t)p[2] << 8 | p[3]) != MAGIC_NUMBER)
+    {
+        set_class_error("This file is not a .class file!");
+        return false;
+    }
+    if (stream->length < STREAM_HEADER_SIZE)
+        return true;
+
+    class *cls = new_class((uint16_t)(p[4] << 8 | p[5]), (uint16_t)(p[6] << 8 | p[7]),
+                           (uint16_t)(p[8] << 8 | p[9]), 0, stream->arena);
+    const uint16_t total_constants_count = cls->constant_pool_count ? cls->constant_pool_count - 1 : 0;
+
+    cls->data = stream->data;
+    cls->size = stream->length;
+    alloc_constant_pool(cls);
+    // The number of texts is not known up front
+    cls->strings = arena_alloc(cls->arena, ((size_t)total_constants_count + 1) * sizeof(pool_string));
+
+    stream->cls = cls;
+    stream->pos = STREAM_HEADER_SIZE;
+    stream->index = 1;
+    stream->state = STREAM_POOL;
+    return true;
+}
+
+/**
+ * Parses every constant that is complete
+ *
+ * @return false on a malformed pool (see class_error)
+ */
+static bool parse_stream_pool(class_stream *stream)
+{
+    class *cls = stream->cls;
+    const uint64_t pool_start = stats_start(); // counted once per slice of the pool
+
+    while (stream->index < cls->constant_pool_count)
+    {
+        const uint16_t index = (uint16_t)stream->index;
+        const int size = parse_constant(cls, index, stream->data, stream->pos, stream->length);
+
+        if (size <= 0)
+            stats_stop(PHASE_POOL, pool_start);
+        if (size < 0)
+            return false;
+        if (size == 0)
+            return true; // wait for the rest of the entry
+
+        switch (cls->tags[index - 1])
+        {
+        case CONSTANT_Utf8:
+        {
+            pool_string *string = cls->strings + cls->string_count;
+            string->offset = (uint32_t)stream->pos + 3;
+            string->length = (uint16_t)(size - 3);
+            string->state = STRING_UNCHECKED;
+            cls->payload[index - 1] = cls->string_count++;
+            break;
+        }
+        case CONSTANT_Long:
+        case CONSTANT_Double:
+            stream->index++; // the second slot keeps tag 0
+            break;
+        }
+
+        stream->pos += size;
+        stream->index++;
+        if (stream->on_constant)
+            stream->on_constant(stream->context, cls, index);
+    }
+
+    stats_stop(PHASE_POOL, pool_start);
+    cls->pool_end = stream->pos;
+    if (stream->flags & PARSE_LAZY)
+        cls->resolved = arena_calloc(cls->arena, (size_t)cls->constant_pool_count + 1, sizeof(resolved_constant));
+    else
+    {
+        const uint64_t start = stats_start();
+        const bool loaded = load_constant_pool(cls);
+
+        stats_stop(PHASE_RESOLVE, start);
+        if (!loaded)
+            return false;
+    }
+
+    stream->state = STREAM_CLASS_INFO;
+    stream->field_size = 8;
+    return true;
+}
+
+/**
+ * Moves on after the last attribute of a member or of the class
+ */
+static void end_attributes(class_stream *stream)
+{
+    if (stream->section == 2)
+    {
+        stream->state = STREAM_END;
+    }
+    else if (--stream->members_left)
+    {
+        stream->state = STREAM_MEMBER;
+        stream->field_size = 8;
+    }
+    else
+    {
+        stream->section++;
+        stream->state = stream->section == 1 ? STREAM_MEMBERS_COUNT : STREAM_ATTRIBUTES_COUNT;
+        stream->field_size = 2;
+    }
+}
+
+/**
+ * Acts on a complete step of the walk after the pool
+ */
+static void take_field(class_stream *stream)
+{
+    switch (stream->state)
+    {
+    case STREAM_CLASS_INFO: // interfaces are skipped whole
+        stream->skip = 2u * field_u2(stream, 6);
+        stream->state = STREAM_MEMBERS_COUNT;
+        stream->field_size = 2;
+        break;
+
+    case STREAM_MEMBERS_COUNT:
+        stream->members_left = field_u2(stream, 0);
+        if (stream->members_left)
+        {
+            stream->state = STREAM_MEMBER;
+            stream->field_size = 8;
+        }
+        else
+        {
+            stream->members_left = 1; // as if the last member just ended
+            end_attributes(stream);
+        }
+        break;
+
+    case STREAM_MEMBER:
+    case STREAM_ATTRIBUTES_COUNT:
+        stream->attributes_left = field_u2(stream, stream->state == STREAM_MEMBER ? 6 : 0);
+        if (stream->attributes_left)
+        {
+            stream->state = STREAM_ATTRIBUTE;
+            stream->field_size = 6;
+        }
+        else
+        {
+            end_attributes(stream);
+        }
+        break;
+
+    case STREAM_ATTRIBUTE:
+        stream->skip = field_u4(stream, 2);
+        if (!--stream->attributes_left)
+            end_attributes(stream);
+        break;
+
+    default:
+        break;
+    }
+}
+
+/**
+ * Walks the class after the pool
+ *
+ * @param stream positioned after the pool
+ * @param bytes that follow what was walked before
+ * @param length of the bytes
+ * @return bytes used, the rest is past the end of the class
+ */
+static size_t walk_rest(class_stream *stream, const uint8_t *bytes, size_t length)
+{
+    size_t used = 0;
+
+    for (;;)
+    {
+        if (stream->skip)
+        {
+            const size_t take = length - used < stream->skip ? length - used : stream->skip;
+            stream->skip -= take;
+            used += take;
+            if (stream->skip)
+                break;
+        }
+
+        if (stream->state == STREAM_END || used == length)
+            break;
+
+        const size_t take = length - used < (size_t)(stream->field_size - stream->field_length)
+                                ? length - used
+                                : (size_t)(stream->field_size - stream->field_length);
+        memcpy(stream->field + stream->field_length, bytes + used, take);
+        stream->field_length += take;
+        used += take;
+
+        if (stream->field_length == stream->field_size)
+        {
+            stream->field_length = 0;
+            take_field(stream);
+        }
+    }
+
+    return used;
+}
+
+/**
+ * Pushes the next bytes of the class into the parser
+ *
+ * @param stream to feed
+ * @param bytes that follow the ones fed before
+ * @param length of the bytes, any split is fine
+ * @return whether the class is complete, needs more or is malformed;
+ *         bytes after the end of the class are ignored
+ */
+stream_status feed_class_stream(class_stream *stream, const uint8_t *bytes, size_t length)
+{
+    const bool keep_all = !(stream->flags & PARSE_POOL_ONLY);
+
+    if (stream->failed)
+        return STREAM_FAILED;
+    if (stream->state == STREAM_END && !stream->skip)
+        return STREAM_DONE;
+
+    const bool kept = stream->state <= STREAM_POOL || keep_all;
+
+    if (kept)
+        keep_bytes(stream, bytes, length);
+
+    if ((stream->state == STREAM_HEADER && !parse_stream_header(stream)) ||
+        (stream->state == STREAM_POOL && !parse_stream_pool(stream)))
+    {
+        stream->failed = true;
+        return STREAM_FAILED;
+    }
+
+    if (stream->state <= STREAM_POOL)
+        return STREAM_MORE;
+
+    if (kept)
+    {
+        // Walk what is kept past the pool, then drop it unless the whole class is kept
+        stream->pos += walk_rest(stream, stream->data + stream->pos, stream->length - stream->pos);
+        stream->length = keep_all ? stream->pos : stream->cls->pool_end;
+        stream->cls->size = stream->length;
+    }
+    else
+    {
+        walk_rest(stream, bytes, length);
+    }
+
+    return stream->state == STREAM_END && !stream->skip ? STREAM_DONE : STREAM_MORE;
+}
+
+/**
+ * Takes the class out of a stream that has seen all of it. Unless
+ * PARSE_POOL_ONLY was given, the members are located like for any
+ * other class, otherwise the class has none.
+ *
+ * @param stream fed until STREAM_DONE, or until the input ended
+ * @return class struct, NULL if the input ended too early (see class_error);
+ *         the stream is released either way
+ */
+class *finish_class_stream(class_stream *stream)
+{
+    class *cls = stream->cls;
+
+    if (stream->failed)
+    {
+        free_class_stream(stream);
+        return NULL;
+    }
+    if (stream->state != STREAM_END || stream->skip)
+    {
+        if (stream->state == STREAM_HEADER)
+            set_class_error(stream->length < 4 ? "This file is not a .class file!" : "Unexpected end of the class file header");
+        else if (stream->state == STREAM_POOL)
+            set_class_error("Unexpected end of the constant pool at #%d", stream->index);
+        else
+            set_class_error("Unexpected end of the class file after the constant pool");
+
+        free_class_stream(stream);
+        return NULL;
+    }
+
+    if (!(stream->flags & PARSE_POOL_ONLY))
+    {
+        byte_reader reader = {stream->data, stream->length, cls->pool_end};
+        const uint64_t start = stats_start();
+        const bool parsed = parse_class_members(&reader, cls);
+
+        stats_stop(PHASE_MEMBERS, start);
+        if (!parsed)
+        {
+            free_class_stream(stream);
+            return NULL;
+        }
+    }
+
+    cls->data = stream->data;
+    cls->size = stream->length;
+    cls->data_owner = DATA_HEAP;
+    stream->cls = NULL;
+    stream->data = NULL;
+    return cls;
+}
+
+/**
+ * Releases a stream that still holds a class or data, e.g. after
+ * STREAM_FAILED
+ *
+ * @param stream to release
+ */
+void free_class_stream(class_stream *stream)
+{
+    free_class(stream->cls); // the data is borrowed until finish_class_stream
+    free(stream->data);
+    stream->cls = NULL;
+    stream->data = NULL;
+    stream->length = stream->capacity = 0;
+}
+
+/**
+ * Parses a class from a file descriptor as it is being written
+ * to it, e.g. a pipe. Reading stops at the end of the class.
+ *
+ * @param fd to read from
+ * @param arena to allocate from, NULL to give the class its own
+ * @param flags PARSE_* options
+ * @return class struct or NULL on error (see class_error)
+ */
+class *read_class_stream(int fd, arena *a, unsigned flags)
+{
+    uint8_t *buffer = malloc(STREAM_CHUNK_SIZE);
+    stream_status status = STREAM_MORE;
+    class_stream stream;
+
+    stats_alloc(STREAM_CHUNK_SIZE);
+
+    init_class_stream(&stream, a, flags);
+
+    while (status == STREAM_MORE)
+    {
+        const uint64_t start = stats_start();
+        const ssize_t count = read(fd, buffer, STREAM_CHUNK_SIZE);
+
+        stats_stop(PHASE_OPEN, start);
+
+        if (count < 0 && errno == EINTR)
+            continue;
+        if (count < 0)
+        {
+            set_class_error("Error : %s", strerror(errno));
+            status = STREAM_FAILED;
+        }
+        if (count <= 0)
+            break;
+
+        stats_read(count);
+        status = feed_class_stream(&stream, buffer, count);
+    }
+
+    free(buffer);
+    if (status == STREAM_FAILED)
+    {
+        free_class_stream(&stream);
+        return NULL;
+    }
+    return finish_class_stream(&stream);
+}
@@ -0,0 +1,78 @@
+#ifndef CLASS_STREAM_H
+#define CLASS_STREAM_H
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "class_reader.h"
+
+/**
+ * Called for every constant as soon as its last byte arrived. Only
+ * the constants before it are there too, so it can't be resolved
+ * yet; a Utf8 can be checked with check_constant. Views into the
+ * class data are valid until the next feed.
+ */
+typedef void (*constant_callback)(void *context, class *cls, uint16_t index);
+
+typedef enum stream_status_e
+{
+    STREAM_MORE = 0, // needs more bytes
+    STREAM_DONE,     // the class is complete, take it with finish_class_stream
+    STREAM_FAILED    // malformed, see class_error
+
+} stream_status;
+
+typedef enum stream_state_e
+{
+    STREAM_HEADER = 0,       // magic, versions and constant_pool_count
+    STREAM_POOL,             // constant pool entries
+    STREAM_CLASS_INFO,       // access flags, this/super class, interfaces_count
+    STREAM_MEMBERS_COUNT,    // fields_count or methods_count
+    STREAM_MEMBER,           // field_info or method_info up to attributes_count
+    STREAM_ATTRIBUTES_COUNT, // attributes_count of the class
+    STREAM_ATTRIBUTE,        // attribute_name_index and attribute_length
+    STREAM_END
+
+} stream_state;
+
+/**
+ * Push parser for a class arriving in pieces. The constant pool
+ * is parsed entry by entry as bytes come in, everything after it
+ * is walked field by field without looking back, so no byte is
+ * parsed twice however the input is split.
+ */
+typedef struct class_stream_s
+{
+    stream_state state;
+    bool failed;    // malformed, the error is in class_error
+    unsigned flags; // PARSE_* options
+    arena *arena;
+    class *cls;
+
+    uint8_t *data; // class file up to the end of the pool, or all of it
+    size_t length;
+    size_t capacity;
+    size_t pos;     // first byte of data not parsed yet
+    uint32_t index; // next constant
+
+    // Walking the rest of the class
+    uint8_t field[8]; // bytes of the current step
+    uint8_t field_length;
+    uint8_t field_size;
+    uint32_t skip; // bytes to drop before the next step
+    uint16_t members_left;
+    uint16_t attributes_left;
+    uint8_t section; // 0 fields, 1 methods, 2 attributes of the class
+
+    constant_callback on_constant; // NULL for none
+    void *context;
+
+} class_stream;
+
+void init_class_stream(class_stream *stream, arena *a, unsigned flags);
+stream_status feed_class_stream(class_stream *stream, const uint8_t *bytes, size_t length);
+class *finish_class_stream(class_stream *stream);
+void free_class_stream(class_stream *stream);
+class *read_class_stream(int fd, arena *a, unsigned flags);
+
+#endif
@@ -0,0 +1,598 @@
+/**
+ * Class dependency graph: which classes each class refers to.
+ *
+ * The edges of a class come from its constant pool and its members:
+ * every Class constant, and every class type in the descriptors of
+ * NameAndType and MethodType constants and of the declared fields
+ * and methods, "(Ljava/lang/String;[Lp/A;)V" gives java/lang/String
+ * and p/A. Arrays count as their element type, primitives and the
+ * class itself not at all.
+ *
+ * The inputs are parsed lazily on the thread pool. Every worker
+ * interns the names of its classes in its own hash table and keeps
+ * the edges as pairs of those names, so memory grows with the
+ * distinct names and edges, not with the classes. At the end the
+ * names of all workers are sorted together into the nodes and the
+ * edges into adjacency lists. Groups of classes that depend on each
+ * other are the strongly connected components (Tarjan) with more
+ * than one node.
+ *
+ * Output, nodes and dependencies sorted by name:
+ *
+ *   list: "p/A: java/lang/Object p/B" per input class, then a
+ *         "# cycle: p/A p/B" line per group with --cycles
+ *   dot:  a digraph, classes that are only referenced dashed, a
+ *         red cluster per group with --cycles
+ *
+ */
+
+#define _GNU_SOURCE
+#include "dep_graph.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "class_reader.h"
+#include "output.h"
+#include "thread_pool.h"
+
+#define UNVISITED UINT32_MAX
+
+typedef struct graph_build_s
+{
+    class_input *inputs;
+    const graph_options *options;
+    graph_worker *workers;
+    arena *arenas; // one per worker, reset after every file
+    char **errors; // why an input couldn't be read, NULL on success
+
+} graph_build;
+
+/**
+ * Merged graph, nodes sorted by name
+ */
+typedef struct dependency_graph_s
+{
+    intern_ref *nodes;
+    uint32_t node_count;
+    bool *defined;
+    uint32_t *first_edge; // adjacency of node v is targets[first_edge[v]..first_edge[v + 1])
+    uint32_t *targets;
+    size_t edge_count;
+
+} dependency_graph;
+
+static inline graph_name *worker_name(graph_worker *w, uint32_t name)
+{
+    return (graph_name *)w->names.records + name;
+}
+
+/**
+ * Finds a class or package of the worker or adds a new one
+ *
+ * @param w worker
+ * @param name of the class
+ * @param packages whether to take the package of the class instead
+ * @return name of the worker
+ */
+static uint32_t intern_node(graph_worker *w, utf_view name, bool packages)
+{
+    if (packages)
+    {
+        const char *slash = name.length ? memrchr(name.bytes, '/', name.length) : NULL;
+        name.length = slash ? (size_t)(slash - name.bytes) : 0;
+    }
+
+    return intern_text(&w->names, &name, 1, 0);
+}
+
+/**
+ * Records an edge of the current class, once per target
+ */
+static void add_edge(graph_worker *w, uint32_t from, uint32_t to)
+{
+    if (from == to || worker_name(w, to)->stamp == w->stamp)
+        return;
+    worker_name(w, to)->stamp = w->stamp;
+
+    if (w->edge_count == w->edge_capacity)
+    {
+        w->edge_capacity = w->edge_capacity ? w->edge_capacity * 2 : 4096;
+        w->edges = realloc(w->edges, w->edge_capacity * sizeof(graph_edge));
+    }
+    w->edges[w->edge_count++] = (graph_edge){from, to};
+}
+
+/**
+ * Records an edge to every class type of a field or method descriptor
+ */
+static void add_descriptor_edges(graph_worker *w, uint32_t from, utf_view descriptor, bool packages)
+{
+    const char *p = descriptor.bytes, *end = descriptor.bytes + descriptor.length;
+
+    while ((p = memchr(p, 'L', end - p)))
+    {
+        const char *semicolon = memchr(p + 1, ';', end - p - 1);
+
+        if (!semicolon)
+            return;
+        add_edge(w, from, intern_node(w, (utf_view){p + 1, semicolon - p - 1}, packages));
+        p = semicolon + 1;
+    }
+}
+
+/**
+ * Records an edge to the class of a Class constant, the element
+ * class for an array
+ */
+static void add_class_edge(graph_worker *w, uint32_t from, utf_view name, bool packages)
+{
+    if (name.length && name.bytes[0] == '[')
+        add_descriptor_edges(w, from, name, packages);
+    else if (name.length)
+        add_edge(w, from, intern_node(w, name, packages));
+}
+
+/**
+ * Records the edges of a class to the classes it refers to
+ *
+ * @param w worker
+ * @param cls class struct, parsed lazily
+ * @param packages whether nodes are packages instead of classes
+ * @return false on a malformed class (see class_error), nothing is recorded then
+ */
+static bool add_class_edges(graph_worker *w, class *cls, bool packages)
+{
+    const size_t first_edge = w->edge_count;
+    const utf_view self = class_name(cls, cls->this_class);
+    const resolved_constant *resolved;
+
+    if (!self.length)
+    {
+        set_class_error("Bad this_class #%d", cls->this_class);
+        return false;
+    }
+
+    const uint32_t from = intern_node(w, self, packages);
+    w->stamp++;
+
+    for (uint16_t i = 1; i < cls->constant_pool_count; i++)
+    {
+        const uint8_t tag = cls->tags[i - 1];
+
+        if (tag != CONSTANT_Class && tag != CONSTANT_NameAndType && tag != CONSTANT_MethodType)
+            continue;
+
+        if (!(resolved = resolve_constant(cls, i)))
+        {
+            w->edge_count = first_edge;
+            return false;
+        }
+
+        if (tag == CONSTANT_Class)
+            add_class_edge(w, from, constant_utf(cls, resolved->utf), packages);
+        else
+            add_descriptor_edges(w, from, constant_utf(cls, resolved->descriptor), packages);
+    }
+
+    for (int m = 0; m < cls->fields_count + cls->methods_count; m++)
+    {
+        const member_info *member = m < cls->fields_count ? cls->fields + m : cls->methods + m - cls->fields_count;
+
+        if (constant_tag(cls, member->descriptor_index) != CONSTANT_Utf8 || !check_constant(cls, member->descriptor_index))
+        {
+            set_class_error("Bad descriptor #%d of a %s", member->descriptor_index, m < cls->fields_count ? "field" : "method");
+            w->edge_count = first_edge;
+            return false;
+        }
+        add_descriptor_edges(w, from, constant_utf(cls, member->descriptor_index), packages);
+    }
+
+    worker_name(w, from)->defined = true;
+    return true;
+}
+
+/**
+ * Parses one input and records its edges
+ *
+ * @param context graph being built
+ * @param index of the input
+ * @param worker running the task
+ */
+static void graph_input(void *context, size_t index, int worker)
+{
+    graph_build *b = context;
+    arena *a = b->arenas + worker;
+    class *cls = parse_class_input(b->inputs + index, a, PARSE_LAZY, NULL);
+
+    if (!cls || !add_class_edges(b->workers + worker, cls, b->options->packages))
+        b->errors[index] = strdup(class_error());
+
+    free_class(cls);
+    arena_reset(a);
+}
+
+static int compare_entries(const void *a, const void *b)
+{
+    const intern_ref *x = a, *y = b;
+    const uint32_t length = x->entry->length < y->entry->length ? x->entry->length : y->entry->length;
+    const int result = length ? memcmp(x->text, y->text, length) : 0;
+
+    if (result)
+        return result;
+    return x->entry->length < y->entry->length ? -1 : x->entry->length > y->entry->length;
+}
+
+static int compare_edges(const void *a, const void *b)
+{
+    const graph_edge *x = a, *y = b;
+
+    if (x->from != y->from)
+        return x->from < y->from ? -1 : 1;
+    return x->to < y->to ? -1 : x->to > y->to;
+}
+
+/**
+ * Merges the names and edges of all workers into one graph
+ *
+ * @param g graph to fill
+ * @param workers with their names and edges, edges are renumbered
+ * @param worker_count number of workers
+ */
+static void merge_graph(dependency_graph *g, graph_worker *workers, int worker_count)
+{
+    intern_table **tables = malloc(worker_count * sizeof(intern_table *));
+    size_t edge_count = 0, n = 0;
+
+    for (int i = 0; i < worker_count; i++)
+    {
+        tables[i] = &workers[i].names;
+        edge_count += workers[i].edge_count;
+    }
+
+    // Equal names of all workers become one node
+    g->node_count = merge_interned(tables, worker_count, compare_entries, NULL, &g->nodes);
+    free(tables);
+
+    g->defined = calloc(g->node_count ? g->node_count : 1, sizeof(bool));
+    for (int i = 0; i < worker_count; i++)
+    {
+        for (uint32_t s = 0; s < workers[i].names.count; s++)
+        {
+            const graph_name *name = worker_name(workers + i, s);
+
+            g->defined[name->key.id] |= name->defined;
+        }
+    }
+
+    graph_edge *edges = malloc((edge_count ? edge_count : 1) * sizeof(graph_edge));
+    n = 0;
+    for (int i = 0; i < worker_count; i++)
+    {
+        for (size_t e = 0; e < workers[i].edge_count; e++)
+        {
+            edges[n].from = worker_name(workers + i, workers[i].edges[e].from)->key.id;
+            edges[n++].to = worker_name(workers + i, workers[i].edges[e].to)->key.id;
+        }
+        free(workers[i].edges);
+        workers[i].edges = NULL;
+    }
+    qsort(edges, edge_count, sizeof(graph_edge), compare_edges);
+
+    // Classes of one package or the same class in two inputs repeat edges
+    g->first_edge = calloc(g->node_count + 1, sizeof(uint32_t));
+    g->targets = malloc((edge_count ? edge_count : 1) * sizeof(uint32_t));
+    g->edge_count = 0;
+    for (size_t i = 0; i < edge_count; i++)
+    {
+        if (i && compare_edges(edges + i - 1, edges + i) == 0)
+            continue;
+        g->targets[g->edge_count++] = edges[i].to;
+        g->first_edge[edges[i].from + 1]++;
+    }
+    for (uint32_t v = 0; v < g->node_count; v++)
+        g->first_edge[v + 1] += g->first_edge[v];
+    free(edges);
+}
+
+/**
+ * Finds the groups of nodes that depend on each other, Tarjan's
+ * algorithm with an explicit stack
+ *
+ * @param g merged graph
+ * @param cycle set per node to its group, numbered from 1 in the
+ *        order of their first nodes, or 0 if it is in none
+ * @return number of groups
+ */
+static uint32_t find_cycles(const dependency_graph *g, uint32_t *cycle)
+{
+    const uint32_t n = g->node_count;
+    uint32_t *order = malloc((n ? n : 1) * sizeof(uint32_t));
+    uint32_t *low = malloc((n ? n : 1) * sizeof(uint32_t));
+    uint32_t *next = malloc((n ? n : 1) * sizeof(uint32_t)); // next edge to follow
+    uint32_t *calls = malloc((n ? n : 1) * sizeof(uint32_t));
+    uint32_t *stack = malloc((n ? n : 1) * sizeof(uint32_t));
+    bool *on_stack = calloc(n ? n : 1, sizeof(bool));
+    uint32_t visited = 0, depth = 0, stack_size = 0, found = 0;
+
+    for (uint32_t v = 0; v < n; v++)
+    {
+        order[v] = UNVISITED;
+        next[v] = g->first_edge[v];
+        cycle[v] = 0;
+    }
+
+    for (uint32_t root = 0; root < n; root++)
+    {
+        if (order[root] != UNVISITED)
+            continue;
+
+        order[root] = low[root] = visited++;
+        stack[stack_size++] = root;
+        on_stack[root] = true;
+        calls[depth++] = root;
+
+        while (depth)
+        {
+            const uint32_t v = calls[depth - 1];
+
+            if (next[v] < g->first_edge[v + 1])
+            {
+                const uint32_t w = g->targets[next[v]++];
+
+                if (order[w] == UNVISITED)
+                {
+                    order[w] = low[w] = visited++;
+                    stack[stack_size++] = w;
+                    on_stack[w] = true;
+                    calls[depth++] = w;
+                }
+                else if (on_stack[w] && order[w] < low[v])
+                {
+                    low[v] = order[w];
+                }
+                continue;
+            }
+
+            if (--depth && low[v] < low[calls[depth - 1]])
+                low[calls[depth - 1]] = low[v];
+
+            if (low[v] == order[v])
+            {
+                // v is the root of a component, the rest of it is above on the stack
+                const bool is_cycle = stack[stack_size - 1] != v;
+                uint32_t w;
+
+                if (is_cycle)
+                    found++;
+                do
+                {
+                    w = stack[--stack_size];
+                    on_stack[w] = false;
+                    cycle[w] = is_cycle ? found : 0;
+                } while (w != v);
+            }
+        }
+    }
+
+    // Number the groups by their first node, so the output is sorted
+    uint32_t *number = calloc(found + 1, sizeof(uint32_t));
+    uint32_t numbered = 0;
+    for (uint32_t v = 0; v < n; v++)
+    {
+        if (cycle[v] && !number[cycle[v]])
+            number[cycle[v]] = ++numbered;
+        cycle[v] = number[cycle[v]];
+    }
+
+    free(number);
+    free(order);
+    free(low);
+    free(next);
+    free(calls);
+    free(stack);
+    free(on_stack);
+    return found;
+}
+
+/**
+ * Print the name of a node, quoted for DOT
+ */
+static void print_node(out_buffer *out, const intern_ref *node, bool dot)
+{
+    const char *text = node->text;
+    const uint32_t length = node->entry->length;
+
+    if (!dot)
+    {
+        if (length)
+            out_bytes(out, text, length);
+        else
+            out_str(out, "<unnamed>");
+        return;
+    }
+
+    out_char(out, '"');
+    if (!length)
+        out_str(out, "<unnamed>");
+    for (uint32_t i = 0; i < length; i++)
+    {
+        if (text[i] == '"' || text[i] == '\\')
+            out_char(out, '\\');
+        out_char(out, text[i]);
+    }
+    out_char(out, '"');
+}
+
+/**
+ * Print the graph as a line per input class with its dependencies
+ */
+static void print_graph_list(out_buffer *out, const dependency_graph *g, const uint32_t *cycle, uint32_t cycle_count)
+{
+    for (uint32_t v = 0; v < g->node_count; v++)
+    {
+        if (!g->defined[v])
+            continue;
+
+        print_node(out, g->nodes + v, false);
+        out_char(out, ':');
+        for (uint32_t e = g->first_edge[v]; e < g->first_edge[v + 1]; e++)
+        {
+            out_char(out, ' ');
+            print_node(out, g->nodes + g->targets[e], false);
+        }
+        out_char(out, '\n');
+    }
+
+    for (uint32_t c = 1; c <= cycle_count; c++)
+    {
+        out_str(out, "# cycle:");
+        for (uint32_t v = 0; v < g->node_count; v++)
+        {
+            if (cycle[v] == c)
+            {
+                out_char(out, ' ');
+                print_node(out, g->nodes + v, false);
+            }
+        }
+        out_char(out, '\n');
+    }
+}
+
+/**
+ * Print the graph as a Graphviz digraph
+ */
+static void print_graph_dot(out_buffer *out, const dependency_graph *g, const uint32_t *cycle, uint32_t cycle_count)
+{
+    out_str(out, "digraph dependencies {\n");
+
+    for (uint32_t v = 0; v < g->node_count; v++)
+    {
+        // Nodes with edges show up anyway, only the style needs a line
+        if (g->defined[v] && g->first_edge[v] != g->first_edge[v + 1])
+            continue;
+
+        out_str(out, "    ");
+        print_node(out, g->nodes + v, true);
+        out_str(out, g->defined[v] ? ";\n" : " [style=dashed];\n");
+    }
+
+    for (uint32_t v = 0; v < g->node_count; v++)
+    {
+        for (uint32_t e = g->first_edge[v]; e < g->first_edge[v + 1]; e++)
+        {
+            out_str(out, "    ");
+            print_node(out, g->nodes + v, true);
+            out_str(out, " -> ");
+            print_node(out, g->nodes + g->targets[e], true);
+            out_str(out, ";\n");
+        }
+    }
+
+    for (uint32_t c = 1; c <= cycle_count; c++)
+    {
+        out_str(out, "    subgraph cluster_cycle_");
+        out_u64(out, c);
+        out_str(out, " {\n        label = \"cycle ");
+        out_u64(out, c);
+        out_str(out, "\";\n        color = red;\n");
+        for (uint32_t v = 0; v < g->node_count; v++)
+        {
+            if (cycle[v] == c)
+            {
+                out_str(out, "        ");
+                print_node(out, g->nodes + v, true);
+                out_str(out, ";\n");
+            }
+        }
+        out_str(out, "    }\n");
+    }
+
+    out_str(out, "}\n");
+}
+
+/**
+ * Builds the dependency graph of all inputs and prints it
+ *
+ * @param files to read
+ * @param options of the run, only thread_count is used
+ * @param graph what to print
+ * @return number of inputs that could not be read
+ */
+int run_dependency_graph(file_list *files, const batch_options *options, const graph_options *graph)
+{
+    const size_t count = files->count;
+    int thread_count = options->thread_count < 1 ? 1 : options->thread_count;
+    graph_build b = {files->inputs, graph};
+    dependency_graph g = {0};
+    uint32_t *cycle = NULL, cycle_count = 0, defined = 0, in_cycles = 0;
+    out_buffer out;
+    int failed = 0;
+
+    b.workers = calloc(thread_count, sizeof(graph_worker));
+    b.arenas = calloc(thread_count, sizeof(arena));
+    b.errors = calloc(count ? count : 1, sizeof(char *));
+    for (int i = 0; i < thread_count; i++)
+    {
+        arena_init(b.arenas + i, 1 << 16);
+        b.workers[i].names.record_size = sizeof(graph_name);
+    }
+
+    run_thread_pool(count, thread_count, graph_input, &b);
+
+    for (size_t i = 0; i < count; i++)
+    {
+        if (b.errors[i])
+        {
+            fprintf(stderr, "%s: %s\n", files->inputs[i].name, b.errors[i]);
+            free(b.errors[i]);
+            failed++;
+        }
+    }
+
+    merge_graph(&g, b.workers, thread_count);
+
+    if (graph->cycles)
+    {
+        cycle = malloc((g.node_count ? g.node_count : 1) * sizeof(uint32_t));
+        cycle_count = find_cycles(&g, cycle);
+    }
+
+    out_init(&out, STDOUT_FILENO);
+    if (graph->format == GRAPH_DOT)
+        print_graph_dot(&out, &g, cycle, cycle_count);
+    else
+        print_graph_list(&out, &g, cycle, cycle_count);
+    out_flush(&out);
+    out_free(&out);
+
+    for (uint32_t v = 0; v < g.node_count; v++)
+    {
+        defined += g.defined[v];
+        in_cycles += cycle && cycle[v];
+    }
+    fprintf(stderr, "Dependencies: %u %s, %u only referenced, %zu edges", defined,
+            graph->packages ? "packages" : "classes", g.node_count - defined, g.edge_count);
+    if (graph->cycles)
+        fprintf(stderr, ", %u cycles through %u %s", cycle_count, in_cycles, graph->packages ? "packages" : "classes");
+    fprintf(stderr, "\n");
+
+    for (int i = 0; i < thread_count; i++)
+    {
+        arena_release(b.arenas + i);
+        free_intern_table(&b.workers[i].names);
+        free(b.workers[i].edges);
+    }
+    free(b.workers);
+    free(b.arenas);
+    free(b.errors);
+    free(g.nodes);
+    free(g.defined);
+    free(g.first_edge);
+    free(g.targets);
+    free(cycle);
+
+    return failed;
+}
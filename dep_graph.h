@@ -0,0 +1,58 @@
+#ifndef DEP_GRAPH_H
+#define DEP_GRAPH_H
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "arena.h"
+#include "batch.h"
+#include "file_list.h"
+#include "intern_table.h"
+
+typedef enum graph_format_e
+{
+    GRAPH_LIST = 0, // a line per class: "name: dependency..."
+    GRAPH_DOT = 1   // Graphviz digraph
+
+} graph_format;
+
+typedef struct graph_options_s
+{
+    graph_format format;
+    bool packages; // collapse classes into their packages
+    bool cycles;   // report groups of classes that depend on each other
+
+} graph_options;
+
+/**
+ * Class or package while the graph is being built
+ */
+typedef struct graph_name_s
+{
+    intern_entry key; // text of the name, key.id is its node once merged
+    uint32_t stamp;   // of the last class that got an edge to it, to drop repeated edges
+    bool defined;     // one of the inputs, not only referenced
+
+} graph_name;
+
+typedef struct graph_edge_s
+{
+    uint32_t from;
+    uint32_t to;
+
+} graph_edge;
+
+typedef struct graph_worker_s
+{
+    intern_table names; // of graph_name records
+
+    graph_edge *edges; // names of the worker until the merge
+    size_t edge_count;
+    size_t edge_capacity;
+    uint32_t stamp;    // counts the classes of the worker
+
+} graph_worker;
+
+int run_dependency_graph(file_list *files, const batch_options *options, const graph_options *graph);
+
+#endif
@@ -0,0 +1,213 @@
+/**
+ * Collects .class files to process from the command line:
+ * plain files are taken as is, directories are walked
+ * recursively in sorted order so the output is deterministic,
+ * archives contribute their .class entries.
+ * 
+ */
+
+#define _DEFAULT_SOURCE
+#include "file_list.h"
+
+#include <dirent.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+
+#include "class_reader.h"
+
+/**
+ * Appends an input to the list
+ * 
+ * @param list to append to
+ * @param name of the input, the list takes ownership
+ * @return appended input
+ */
+static class_input *append_input(file_list *list, char *name)
+{
+    if (list->count == list->capacity)
+    {
+        list->capacity = list->capacity ? list->capacity * 2 : 16;
+        list->inputs = realloc(list->inputs, list->capacity * sizeof(class_input));
+    }
+
+    class_input *input = list->inputs + list->count++;
+    input->name = name;
+    input->jar = NULL;
+    input->entry = 0;
+    input->error = NULL;
+    return input;
+}
+
+/**
+ * Appends a plain file to the list
+ * 
+ * @param list to append to
+ * @param path of the file, the list takes ownership
+ */
+static void append_path(file_list *list, char *path)
+{
+    append_input(list, path);
+}
+
+/**
+ * Appends every .class entry of an archive that matches the glob
+ * 
+ * @param list to append to
+ * @param path of the archive
+ */
+static void add_archive(file_list *list, const char *path)
+{
+    jar_archive *jar = open_jar(path, list->glob);
+
+    if (!jar)
+    {
+        append_input(list, strdup(path))->error = strdup(class_error());
+        return;
+    }
+
+    list->archives = realloc(list->archives, (list->archive_count + 1) * sizeof(jar_archive *));
+    list->archives[list->archive_count++] = jar;
+
+    for (size_t i = 0; i < jar->entry_count; i++)
+    {
+        size_t length = strlen(path) + jar->entries[i].name_length + 3;
+        char *name = malloc(length);
+
+        snprintf(name, length, "%s!/%.*s", path, jar->entries[i].name_length, jar->entries[i].name);
+
+        class_input *input = append_input(list, name);
+        input->jar = jar;
+        input->entry = i;
+    }
+}
+
+/**
+ * Checks if the name ends with .class
+ * 
+ * @param name of the file
+ * @return true for .class files
+ */
+static bool has_class_extension(const char *name)
+{
+    size_t length = strlen(name);
+    return length > 6 && strcmp(name + length - 6, ".class") == 0;
+}
+
+/**
+ * Adds every .class file under the directory, without following
+ * symbolic links to directories
+ * 
+ * @param list to append to
+ * @param path of the directory
+ */
+static void add_directory(file_list *list, const char *path)
+{
+    struct dirent **entries;
+    int count = scandir(path, &entries, NULL, alphasort);
+
+    if (count < 0)
+    {
+        append_path(list, strdup(path)); // let the parser report the error in order
+        return;
+    }
+
+    for (int i = 0; i < count; i++)
+    {
+        const char *name = entries[i]->d_name;
+
+        if (strcmp(name, ".") != 0 && strcmp(name, "..") != 0)
+        {
+            size_t length = strlen(path) + strlen(name) + 2;
+            char *child = malloc(length);
+            struct stat st;
+
+            bool has_slash = path[0] && path[strlen(path) - 1] == '/';
+            snprintf(child, length, has_slash ? "%s%s" : "%s/%s", path, name);
+
+            // Symlinked directories are not followed, they may lead back up the tree
+            if (lstat(child, &st) == 0 && S_ISDIR(st.st_mode))
+            {
+                add_directory(list, child);
+                free(child);
+            }
+            else if (has_class_extension(name))
+                append_path(list, child);
+            else
+                free(child);
+        }
+
+        free(entries[i]);
+    }
+
+    free(entries);
+}
+
+/**
+ * Adds a file, all .class files of a directory tree
+ * or all .class entries of an archive
+ * 
+ * @param list to append to
+ * @param path from the command line
+ */
+void add_path(file_list *list, const char *path)
+{
+    struct stat st;
+
+    if (stat(path, &st) == 0 && S_ISDIR(st.st_mode))
+        add_directory(list, path);
+    else if (is_jar_path(path))
+        add_archive(list, path);
+    else
+        append_path(list, strdup(path));
+}
+
+/**
+ * Path of an input inside the tree it was found in: the entry name for
+ * an archive, the path below a directory, the file name for a class
+ * given by itself
+ * 
+ * @param name of the input
+ * @param root path from the command line the input was found under
+ * @return points into the name
+ */
+const char *relative_name(const char *name, const char *root)
+{
+    if (strcmp(name, root) == 0)
+    {
+        const char *slash = strrchr(name, '/');
+        return slash ? slash + 1 : name;
+    }
+
+    name += strlen(root);
+    if (name[0] == '!' && name[1] == '/') // archive entry
+        return name + 2;
+    while (*name == '/')
+        name++;
+    return name;
+}
+
+/**
+ * Releases the list, all names in it and the archives
+ * 
+ * @param list to release
+ */
+void free_file_list(file_list *list)
+{
+    for (size_t i = 0; i < list->count; i++)
+    {
+        free(list->inputs[i].name);
+        free(list->inputs[i].error);
+    }
+
+    for (size_t i = 0; i < list->archive_count; i++)
+        close_jar(list->archives[i]);
+
+    free(list->inputs);
+    free(list->archives);
+    list->inputs = NULL;
+    list->archives = NULL;
+    list->count = list->capacity = list->archive_count = 0;
+}
@@ -0,0 +1,32 @@
+#ifndef FILE_LIST_H
+#define FILE_LIST_H
+#include <stddef.h>
+
+#include "jar_reader.h"
+
+typedef struct class_input_s
+{
+    char *name;       // path, or archive path + "!/" + entry name
+    jar_archive *jar; // archive the class is in, NULL for plain files
+    size_t entry;     // index of the entry in the archive
+    char *error;      // set if the input couldn't be opened at all
+
+} class_input;
+
+typedef struct file_list_s
+{
+    class_input *inputs;
+    size_t count;
+    size_t capacity;
+
+    jar_archive **archives;
+    size_t archive_count;
+    const char *glob; // filter for archive entries, NULL for all
+
+} file_list;
+
+void add_path(file_list *list, const char *path);
+const char *relative_name(const char *name, const char *root);
+void free_file_list(file_list *list);
+
+#endif
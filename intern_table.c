@@ -0,0 +1,187 @@
+/**
+ * Per-worker intern tables for the passes that collect names on the
+ * thread pool (--deps, -x).
+ *
+ * Every worker keeps its texts in one growing buffer and finds them
+ * again through its own open addressing hash table, so the workers
+ * never lock. A record is the key (text, hash and an optional number
+ * that is not text) followed by whatever the caller counts for it.
+ * At the end the entries of all tables are sorted together and equal
+ * ones get the same id.
+ *
+ */
+
+#include "intern_table.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "parse_cache.h"
+
+static inline intern_entry *record_at(const intern_table *t, uint32_t index)
+{
+    return (intern_entry *)((char *)t->records + (size_t)index * t->record_size);
+}
+
+/**
+ * Appends bytes to the text of a table
+ */
+static void append_text(intern_table *t, const char *bytes, size_t length)
+{
+    // Allocated on the first call even for an empty text, so the
+    // text of an entry is never NULL
+    if (!t->text || t->text_capacity - t->text_length < length)
+    {
+        do
+            t->text_capacity = t->text_capacity ? t->text_capacity * 2 : 1 << 16;
+        while (t->text_capacity - t->text_length < length);
+        t->text = realloc(t->text, t->text_capacity);
+    }
+
+    if (length)
+        memcpy(t->text + t->text_length, bytes, length);
+    t->text_length += length;
+}
+
+/**
+ * Doubles the hash table
+ */
+static void grow_slots(intern_table *t)
+{
+    t->slot_count = t->slot_count ? t->slot_count * 2 : 1024;
+    free(t->slots);
+    t->slots = calloc(t->slot_count, sizeof(uint32_t));
+
+    for (uint32_t i = 0; i < t->count; i++)
+    {
+        uint32_t slot = record_at(t, i)->hash & (t->slot_count - 1);
+
+        while (t->slots[slot])
+            slot = (slot + 1) & (t->slot_count - 1);
+        t->slots[slot] = i + 1;
+    }
+}
+
+/**
+ * Finds an entry of the table or adds a new one
+ *
+ * @param t table of the worker
+ * @param parts of the text, joined in order, at least one
+ * @param part_count number of parts
+ * @param extra rest of the key, such as a kind and where the parts end
+ * @return position of the record of the entry
+ */
+uint32_t intern_text(intern_table *t, const utf_view *parts, int part_count, uint64_t extra)
+{
+    const size_t text = t->text_length;
+    utf_view key = parts[0];
+
+    // A key in several parts is joined in the text right away and
+    // dropped again if the entry is known
+    if (part_count > 1)
+    {
+        for (int i = 0; i < part_count; i++)
+            append_text(t, parts[i].bytes, parts[i].length);
+        key = (utf_view){t->text + text, t->text_length - text};
+    }
+
+    const uint32_t length = (uint32_t)key.length;
+    const uint32_t hash = (uint32_t)hash_class_data((const uint8_t *)key.bytes, length) ^
+                          (uint32_t)(extra >> 32) * 0x9e3779b9u ^ (uint32_t)extra;
+
+    if (t->count * 2 >= t->slot_count)
+        grow_slots(t);
+
+    uint32_t slot = hash & (t->slot_count - 1);
+    for (; t->slots[slot]; slot = (slot + 1) & (t->slot_count - 1))
+    {
+        const intern_entry *known = record_at(t, t->slots[slot] - 1);
+
+        if (known->hash == hash && known->extra == extra && known->length == length &&
+            (!length || memcmp(t->text + known->text, key.bytes, length) == 0))
+        {
+            t->text_length = text;
+            return t->slots[slot] - 1;
+        }
+    }
+
+    if (part_count == 1)
+        append_text(t, key.bytes, key.length);
+
+    if (t->count == t->capacity)
+    {
+        t->capacity = t->capacity ? t->capacity * 2 : 1024;
+        t->records = realloc(t->records, (size_t)t->capacity * t->record_size);
+    }
+
+    intern_entry *entry = record_at(t, t->count);
+    memset(entry, 0, t->record_size);
+    entry->text = text;
+    entry->length = length;
+    entry->hash = hash;
+    entry->extra = extra;
+    t->slots[slot] = t->count + 1;
+    return t->count++;
+}
+
+/**
+ * Sorts the entries of all tables together and numbers them, equal
+ * entries of different tables get the same id
+ *
+ * @param tables of the workers
+ * @param table_count number of tables
+ * @param compare orders two intern_ref, 0 for the same entry
+ * @param keep whether to merge an entry, NULL for all; the others get no id
+ * @param merged set to the sorted entries, the first one per id in
+ *        front; the caller frees it
+ * @return number of ids
+ */
+uint32_t merge_interned(intern_table **tables, int table_count, int (*compare)(const void *, const void *),
+                        bool (*keep)(const intern_entry *), intern_ref **merged)
+{
+    size_t total = 0, n = 0;
+    uint32_t id_count = 0;
+
+    for (int i = 0; i < table_count; i++)
+        total += tables[i]->count;
+
+    intern_ref *refs = malloc((total ? total : 1) * sizeof(intern_ref));
+    for (int i = 0; i < table_count; i++)
+    {
+        for (uint32_t r = 0; r < tables[i]->count; r++)
+        {
+            intern_entry *entry = record_at(tables[i], r);
+
+            if (!keep || keep(entry))
+                refs[n++] = (intern_ref){tables[i]->text + entry->text, entry};
+        }
+    }
+    qsort(refs, n, sizeof(intern_ref), compare);
+
+    for (size_t i = 0; i < n; i++)
+    {
+        if (i == 0 || compare(refs + id_count - 1, refs + i) != 0)
+            refs[id_count++] = refs[i]; // first of its run stands for the id
+        refs[i].entry->id = id_count - 1;
+    }
+
+    *merged = refs;
+    return id_count;
+}
+
+/**
+ * Releases the texts and records of a table
+ *
+ * @param t table to release
+ */
+void free_intern_table(intern_table *t)
+{
+    free(t->text);
+    free(t->records);
+    free(t->slots);
+    t->text = NULL;
+    t->records = NULL;
+    t->slots = NULL;
+    t->text_length = t->text_capacity = 0;
+    t->count = t->capacity = t->slot_count = 0;
+}
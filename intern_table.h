@@ -0,0 +1,58 @@
+#ifndef INTERN_TABLE_H
+#define INTERN_TABLE_H
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "class_reader.h"
+
+/**
+ * Key of an interned entry. The records of a table start with one,
+ * whatever follows is zeroed when the entry is added.
+ */
+typedef struct intern_entry_s
+{
+    size_t text;    // offset in the text of the table
+    uint32_t length;
+    uint32_t hash;
+    uint64_t extra; // part of the key that isn't text, 0 if unused
+    uint32_t id;    // position among the entries of all tables once merged
+
+} intern_entry;
+
+/**
+ * Texts of one worker and an open addressing hash table over them,
+ * no locks. Zeroed with record_size set is an empty table.
+ */
+typedef struct intern_table_s
+{
+    size_t record_size; // of the records, at least sizeof(intern_entry)
+
+    char *text;
+    size_t text_length;
+    size_t text_capacity;
+
+    void *records;
+    uint32_t count;
+    uint32_t capacity;
+    uint32_t *slots; // record + 1, 0 for a free slot
+    uint32_t slot_count;
+
+} intern_table;
+
+/**
+ * Entry of some table, as seen by the merge
+ */
+typedef struct intern_ref_s
+{
+    const char *text;
+    intern_entry *entry; // start of its record
+
+} intern_ref;
+
+uint32_t intern_text(intern_table *t, const utf_view *parts, int part_count, uint64_t extra);
+uint32_t merge_interned(intern_table **tables, int table_count, int (*compare)(const void *, const void *),
+                        bool (*keep)(const intern_entry *), intern_ref **merged);
+void free_intern_table(intern_table *t);
+
+#endif
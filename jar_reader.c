@@ -0,0 +1,388 @@
+/**
+ * Reads .class entries straight out of JAR/ZIP archives.
+ * 
+ * The archive is mapped into memory and its central directory
+ * is read once. Stored entries are handed to the parser as views
+ * into the mapping, deflated ones are inflated into the caller's
+ * arena, so no temporary files are involved.
+ * 
+ */
+
+#define _GNU_SOURCE
+#include "jar_reader.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <fnmatch.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <zlib.h>
+
+#include "class_reader.h"
+
+#define EOCD_SIGNATURE 0x06054b50
+#define EOCD_SIZE 22
+#define ZIP64_LOCATOR_SIGNATURE 0x07064b50
+#define ZIP64_LOCATOR_SIZE 20
+#define ZIP64_EOCD_SIGNATURE 0x06064b50
+#define CENTRAL_HEADER_SIGNATURE 0x02014b50
+#define CENTRAL_HEADER_SIZE 46
+#define LOCAL_HEADER_SIGNATURE 0x04034b50
+#define LOCAL_HEADER_SIZE 30
+#define ZIP64_EXTRA_ID 0x0001
+
+/**
+ * Little-endian readers, zip is little-endian unlike class files
+ */
+static inline uint16_t le16(const uint8_t *p)
+{
+    return (uint16_t)(p[0] | (p[1] << 8));
+}
+
+static inline uint32_t le32(const uint8_t *p)
+{
+    return (uint32_t)p[0] | ((uint32_t)p[1] << 8) | ((uint32_t)p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+static inline uint64_t le64(const uint8_t *p)
+{
+    return (uint64_t)le32(p) | ((uint64_t)le32(p + 4) << 32);
+}
+
+/**
+ * Checks the path for a .jar or .zip extension
+ * 
+ * @param path to check
+ * @return true if the path looks like an archive
+ */
+bool is_jar_path(const char *path)
+{
+    size_t length = strlen(path);
+    return length > 4 && (strcasecmp(path + length - 4, ".jar") == 0 || strcasecmp(path + length - 4, ".zip") == 0);
+}
+
+/**
+ * Looks for the end of central directory record, which is 
+ * followed by a comment of up to 64K
+ * 
+ * @param data of the archive
+ * @param size of the data
+ * @return offset of the record or -1
+ */
+static long find_end_of_central_directory(const uint8_t *data, size_t size)
+{
+    if (size < EOCD_SIZE)
+        return -1;
+
+    size_t lowest = size > EOCD_SIZE + 0xffff ? size - EOCD_SIZE - 0xffff : 0;
+
+    for (size_t offset = size - EOCD_SIZE + 1; offset-- > lowest;)
+    {
+        if (le32(data + offset) == EOCD_SIGNATURE && offset + EOCD_SIZE + le16(data + offset + 20) == size)
+            return (long)offset;
+    }
+
+    return -1;
+}
+
+/**
+ * Takes 64-bit sizes and offset from the zip64 extra field
+ * for the members of the entry that overflowed 32 bits
+ * 
+ * @param extra field of the central directory header
+ * @param length of the extra field
+ * @param entry to fix
+ */
+static void read_zip64_extra(const uint8_t *extra, uint16_t length, jar_entry *entry)
+{
+    while (length >= 4)
+    {
+        uint16_t id = le16(extra), size = le16(extra + 2);
+        if (size + 4 > length)
+            return;
+
+        if (id == ZIP64_EXTRA_ID)
+        {
+            const uint8_t *p = extra + 4, *end = p + size;
+
+            if (entry->size == 0xffffffff && p + 8 <= end)
+                entry->size = le64(p), p += 8;
+            if (entry->compressed_size == 0xffffffff && p + 8 <= end)
+                entry->compressed_size = le64(p), p += 8;
+            if (entry->header_offset == 0xffffffff && p + 8 <= end)
+                entry->header_offset = le64(p);
+            return;
+        }
+
+        extra += size + 4;
+        length -= size + 4;
+    }
+}
+
+/**
+ * Checks if the entry is a .class file matching the glob
+ * 
+ * @param name of the entry, not NUL-terminated
+ * @param length of the name
+ * @param glob to match, NULL matches everything
+ * @return true if the entry should be read
+ */
+static bool is_wanted_entry(const char *name, uint16_t length, const char *glob)
+{
+    if (length <= 6 || memcmp(name + length - 6, ".class", 6) != 0)
+        return false;
+
+    if (!glob)
+        return true;
+
+    char buffer[length + 1];
+    memcpy(buffer, name, length);
+    buffer[length] = '\0';
+    return fnmatch(glob, buffer, 0) == 0;
+}
+
+/**
+ * Reads the central directory of the archive
+ * 
+ * @param jar to fill with entries
+ * @param glob to filter entry names by, NULL for all .class entries
+ * @return false if the archive is malformed
+ */
+static bool read_central_directory(jar_archive *jar, const char *glob)
+{
+    const uint8_t *data = jar->data;
+    long eocd = find_end_of_central_directory(data, jar->size);
+
+    if (eocd < 0)
+    {
+        set_class_error("Can't find the zip central directory");
+        return false;
+    }
+
+    uint64_t count = le16(data + eocd + 10);
+    uint64_t directory_size = le32(data + eocd + 12);
+    uint64_t directory_offset = le32(data + eocd + 16);
+
+    if (eocd >= ZIP64_LOCATOR_SIZE && le32(data + eocd - ZIP64_LOCATOR_SIZE) == ZIP64_LOCATOR_SIGNATURE)
+    {
+        uint64_t zip64_eocd = le64(data + eocd - ZIP64_LOCATOR_SIZE + 8);
+
+        if (zip64_eocd + 56 <= jar->size && le32(data + zip64_eocd) == ZIP64_EOCD_SIGNATURE)
+        {
+            count = le64(data + zip64_eocd + 32);
+            directory_size = le64(data + zip64_eocd + 40);
+            directory_offset = le64(data + zip64_eocd + 48);
+        }
+    }
+
+    if (directory_offset > jar->size || directory_size > jar->size - directory_offset)
+    {
+        set_class_error("Zip central directory is out of the file");
+        return false;
+    }
+
+    // Every entry takes at least a header, a larger count is a lie
+    if (count > directory_size / CENTRAL_HEADER_SIZE)
+    {
+        set_class_error("Broken zip central directory");
+        return false;
+    }
+
+    jar->entries = malloc((count ? count : 1) * sizeof(jar_entry));
+    jar->entry_count = 0;
+    if (!jar->entries)
+    {
+        set_class_error("Not enough memory for %lu zip entries", (unsigned long)count);
+        return false;
+    }
+
+    const uint8_t *p = data + directory_offset, *end = p + directory_size;
+
+    for (uint64_t i = 0; i < count; i++)
+    {
+        if (end - p < CENTRAL_HEADER_SIZE || le32(p) != CENTRAL_HEADER_SIGNATURE)
+        {
+            set_class_error("Broken zip central directory entry #%lu", (unsigned long)i);
+            return false;
+        }
+
+        uint16_t name_length = le16(p + 28), extra_length = le16(p + 30), comment_length = le16(p + 32);
+        const uint8_t *name = p + CENTRAL_HEADER_SIZE;
+
+        if ((size_t)(end - name) < (size_t)name_length + extra_length + comment_length)
+        {
+            set_class_error("Broken zip central directory entry #%lu", (unsigned long)i);
+            return false;
+        }
+
+        if (is_wanted_entry((const char *)name, name_length, glob))
+        {
+            jar_entry *entry = jar->entries + jar->entry_count++;
+
+            entry->name = (const char *)name;
+            entry->name_length = name_length;
+            entry->method = le16(p + 10);
+            entry->crc = le32(p + 16);
+            entry->compressed_size = le32(p + 20);
+            entry->size = le32(p + 24);
+            entry->header_offset = le32(p + 42);
+            read_zip64_extra(name + name_length, extra_length, entry);
+        }
+
+        p = name + name_length + extra_length + comment_length;
+    }
+
+    return true;
+}
+
+/**
+ * Maps an archive and reads its central directory
+ * 
+ * @param path of the archive
+ * @param glob to filter entry names by, NULL for all .class entries
+ * @return archive or NULL on error (see class_error)
+ */
+jar_archive *open_jar(const char *path, const char *glob)
+{
+    struct stat st;
+    int fd = open(path, O_RDONLY);
+
+    if (fd < 0 || fstat(fd, &st) != 0)
+    {
+        char buffer[128];
+        set_class_error("Error : %s", strerror_r(errno, buffer, sizeof(buffer)));
+        if (fd >= 0)
+            close(fd);
+        return NULL;
+    }
+
+    void *data = st.st_size ? mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0) : MAP_FAILED;
+    close(fd);
+
+    if (data == MAP_FAILED)
+    {
+        set_class_error("This file is not a zip archive!");
+        return NULL;
+    }
+
+    jar_archive *jar = calloc(1, sizeof(jar_archive));
+    jar->data = data;
+    jar->size = st.st_size;
+
+    if (!read_central_directory(jar, glob))
+    {
+        close_jar(jar);
+        return NULL;
+    }
+
+    return jar;
+}
+
+/**
+ * Inflates raw deflate data into a buffer of known size
+ * 
+ * @param source compressed data
+ * @param source_size of compressed data
+ * @param destination buffer
+ * @param size of uncompressed data
+ * @return false if the data is corrupted
+ */
+static bool inflate_entry(const uint8_t *source, uint64_t source_size, uint8_t *destination, uint64_t size)
+{
+    z_stream stream = {0};
+
+    if (inflateInit2(&stream, -MAX_WBITS) != Z_OK)
+        return false;
+
+    stream.next_in = (Bytef *)source;
+    stream.avail_in = (uInt)source_size;
+    stream.next_out = destination;
+    stream.avail_out = (uInt)size;
+
+    int status = inflate(&stream, Z_FINISH);
+    bool ok = status == Z_STREAM_END && stream.total_out == size;
+
+    inflateEnd(&stream);
+    return ok;
+}
+
+/**
+ * Gets the uncompressed bytes of an entry. Stored entries are
+ * returned as is, deflated ones are inflated into the arena.
+ * Safe to call from several threads at once.
+ * 
+ * @param jar to read from
+ * @param index of the entry
+ * @param arena for the inflated data
+ * @param size of the returned data
+ * @return entry data or NULL on error (see class_error)
+ */
+const uint8_t *read_jar_entry(jar_archive *jar, size_t index, arena *a, size_t *size)
+{
+    jar_entry *entry = jar->entries + index;
+    const uint8_t *header = jar->data + entry->header_offset;
+
+    if (entry->header_offset > jar->size || jar->size - entry->header_offset < LOCAL_HEADER_SIZE ||
+        le32(header) != LOCAL_HEADER_SIGNATURE)
+    {
+        set_class_error("Broken zip local header");
+        return NULL;
+    }
+
+    uint64_t offset = entry->header_offset + LOCAL_HEADER_SIZE + le16(header + 26) + le16(header + 28);
+
+    if (offset > jar->size || jar->size - offset < entry->compressed_size || entry->size > UINT32_MAX ||
+        entry->compressed_size > UINT32_MAX)
+    {
+        set_class_error("Zip entry is out of the file");
+        return NULL;
+    }
+
+    const uint8_t *source = jar->data + offset;
+    uint8_t *data;
+
+    switch (entry->method)
+    {
+    case ZIP_STORED:
+        if (entry->compressed_size != entry->size)
+        {
+            set_class_error("Broken stored zip entry");
+            return NULL;
+        }
+        *size = entry->size;
+        return source;
+
+    case ZIP_DEFLATED:
+        data = arena_alloc(a, entry->size);
+        if (!inflate_entry(source, entry->compressed_size, data, entry->size) ||
+            crc32(0, data, (uInt)entry->size) != entry->crc)
+        {
+            set_class_error("Corrupted deflated zip entry");
+            return NULL;
+        }
+        *size = entry->size;
+        return data;
+
+    default:
+        set_class_error("Unsupported zip compression method %d", entry->method);
+        return NULL;
+    }
+}
+
+/**
+ * Unmaps the archive and releases its entries
+ * 
+ * @param jar to close
+ */
+void close_jar(jar_archive *jar)
+{
+    if (!jar)
+        return;
+
+    munmap((void *)jar->data, jar->size);
+    free(jar->entries);
+    free(jar);
+}
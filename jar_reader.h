@@ -0,0 +1,38 @@
+#ifndef JAR_READER_H
+#define JAR_READER_H
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+
+#include "arena.h"
+
+#define ZIP_STORED 0
+#define ZIP_DEFLATED 8
+
+typedef struct jar_entry_s
+{
+    const char *name; // view into the central directory, not NUL-terminated
+    uint16_t name_length;
+    uint16_t method;
+    uint32_t crc;
+    uint64_t compressed_size;
+    uint64_t size;
+    uint64_t header_offset;
+
+} jar_entry;
+
+typedef struct jar_archive_s
+{
+    const uint8_t *data; // the whole archive, mapped
+    size_t size;
+    jar_entry *entries; // only .class entries that passed the filter
+    size_t entry_count;
+
+} jar_archive;
+
+bool is_jar_path(const char *path);
+jar_archive *open_jar(const char *path, const char *glob);
+const uint8_t *read_jar_entry(jar_archive *jar, size_t index, arena *a, size_t *size);
+void close_jar(jar_archive *jar);
+
+#endif
@@ -0,0 +1,435 @@
+/**
+ * Float and Double constants written the way Java's toString()
+ * writes them (JDK 19 and later), without going through printf:
+ *
+ *   the shortest decimal that reads back as the same value, the
+ *   one closest to it if there are several, two digits if one
+ *   would do but two come closer (4.9E-324, not 5.0E-324);
+ *   plain for 10^-3 <= |v| < 10^7 (1.0, 0.001, 1234567.5),
+ *   computerized scientific notation otherwise (1.0E7, 1.0E-4);
+ *   NaN, Infinity, -Infinity, 0.0 and -0.0 spelled out.
+ *
+ * The digits come from Ryu (Ulf Adams, PLDI 2018): the bounds of
+ * the interval that rounds to the value are scaled by a power of 10
+ * taken from java_number_tables.h, digits are then dropped while
+ * the bounds still differ. Floats go through the same code with
+ * their own mantissa, exponent and interval.
+ *
+ */
+
+#include "java_number.h"
+#include "java_number_tables.h"
+
+#include <stdbool.h>
+
+#define DOUBLE_MANTISSA_BITS 52
+#define DOUBLE_EXPONENT_BIAS 1023
+#define FLOAT_MANTISSA_BITS 23
+#define FLOAT_EXPONENT_BIAS 127
+
+/**
+ * Value as digits * 10^exponent
+ */
+typedef struct java_decimal_s
+{
+    uint64_t digits;
+    int32_t exponent;
+
+} java_decimal;
+
+/**
+ * Interval of a value scaled by 10^-exponent: vr is the value,
+ * vm and vp the bounds, all rounded down
+ */
+typedef struct ryu_interval_s
+{
+    uint64_t vr;
+    uint64_t vp;
+    uint64_t vm;
+    int32_t exponent;
+    bool vr_is_trailing_zeros; // vr is exact
+    bool vm_is_trailing_zeros; // vm is exact
+    bool accept_bounds;        // the bounds themselves round to the value (even mantissa)
+
+} ryu_interval;
+
+// log2(5^e) rounded up, for 0 <= e <= 3528
+static inline int32_t pow5_bits(int32_t e)
+{
+    return (int32_t)(((uint32_t)e * 1217359) >> 19) + 1;
+}
+
+// log10(2^e) rounded down, for 0 <= e <= 1650
+static inline uint32_t log10_pow2(int32_t e)
+{
+    return ((uint32_t)e * 78913) >> 18;
+}
+
+// log10(5^e) rounded down, for 0 <= e <= 2620
+static inline uint32_t log10_pow5(int32_t e)
+{
+    return ((uint32_t)e * 732923) >> 20;
+}
+
+static inline bool multiple_of_pow5(uint64_t value, uint32_t p)
+{
+    uint32_t count = 0;
+
+    for (; value % 5 == 0; value /= 5)
+        count++;
+    return count >= p;
+}
+
+static inline bool multiple_of_pow2(uint64_t value, uint32_t p)
+{
+    return (value & ((1ull << p) - 1)) == 0;
+}
+
+/**
+ * (m * mul) >> shift with the 128-bit table entry mul, shift >= 64
+ */
+static inline uint64_t mul_shift(uint64_t m, const uint64_t *mul, int32_t shift)
+{
+    const __uint128_t low = (__uint128_t)m * mul[0];
+    const __uint128_t high = (__uint128_t)m * mul[1];
+
+    return (uint64_t)(((low >> 64) + high) >> (shift - 64));
+}
+
+/**
+ * Scales the value 4 * m2 * 2^e2 and its bounds by the power of 10
+ * that leaves enough digits to tell them apart
+ *
+ * @param interval to fill
+ * @param m2 mantissa with the implicit bit
+ * @param e2 binary exponent, minus 2 for the factor 4
+ * @param mm_shift 1 if the lower neighbour is as far as the upper one
+ * @param extra_digits to keep for e2 < 0, beyond what Ryu needs
+ */
+static void scale_interval(ryu_interval *interval, uint64_t m2, int32_t e2, uint32_t mm_shift, uint32_t extra_digits)
+{
+    const uint64_t mv = 4 * m2;
+
+    interval->accept_bounds = (m2 & 1) == 0;
+    interval->vr_is_trailing_zeros = false;
+    interval->vm_is_trailing_zeros = false;
+
+    if (e2 >= 0)
+    {
+        const uint32_t q = log10_pow2(e2) - (e2 > 3);
+        const int32_t k = DOUBLE_POW5_INV_BITCOUNT + pow5_bits(q) - 1;
+        const int32_t i = -e2 + (int32_t)q + k;
+
+        interval->exponent = q;
+        interval->vr = mul_shift(4 * m2, DOUBLE_POW5_INV_SPLIT[q], i);
+        interval->vp = mul_shift(4 * m2 + 2, DOUBLE_POW5_INV_SPLIT[q], i);
+        interval->vm = mul_shift(4 * m2 - 1 - mm_shift, DOUBLE_POW5_INV_SPLIT[q], i);
+
+        // Only small powers of 10 can divide the scaled values exactly
+        if (q <= 21)
+        {
+            if (mv % 5 == 0)
+                interval->vr_is_trailing_zeros = multiple_of_pow5(mv, q);
+            else if (interval->accept_bounds)
+                interval->vm_is_trailing_zeros = multiple_of_pow5(mv - 1 - mm_shift, q);
+            else
+                interval->vp -= multiple_of_pow5(mv + 2, q);
+        }
+    }
+    else
+    {
+        const uint32_t q = log10_pow5(-e2) - (-e2 > 1) - extra_digits;
+        const int32_t i = -e2 - (int32_t)q;
+        const int32_t k = pow5_bits(i) - DOUBLE_POW5_BITCOUNT;
+        const int32_t j = (int32_t)q - k;
+
+        interval->exponent = (int32_t)q + e2;
+        interval->vr = mul_shift(4 * m2, DOUBLE_POW5_SPLIT[i], j);
+        interval->vp = mul_shift(4 * m2 + 2, DOUBLE_POW5_SPLIT[i], j);
+        interval->vm = mul_shift(4 * m2 - 1 - mm_shift, DOUBLE_POW5_SPLIT[i], j);
+
+        if (q <= 1)
+        {
+            // mv has at least q trailing zero bits, the bounds are exact as well
+            interval->vr_is_trailing_zeros = true;
+            if (interval->accept_bounds)
+                interval->vm_is_trailing_zeros = mm_shift == 1;
+            else
+                interval->vp--;
+        }
+        else if (q < 63)
+        {
+            interval->vr_is_trailing_zeros = multiple_of_pow2(mv, q);
+        }
+    }
+}
+
+/**
+ * Rounds the scaled value to two digits, if it has more. Java takes
+ * this over a single digit whenever it lies in the interval, it is
+ * never farther from the value.
+ *
+ * @param interval scaled value, as scale_interval left it
+ * @param result set if a two-digit decimal rounds to the value
+ * @return false if none does
+ */
+static bool round_to_two_digits(ryu_interval interval, java_decimal *result)
+{
+    uint8_t last_removed = 0;
+    int32_t removed = 0;
+
+    if (interval.vr < 10)
+        return false;
+
+    while (interval.vr >= 100)
+    {
+        interval.vm_is_trailing_zeros &= interval.vm % 10 == 0;
+        interval.vr_is_trailing_zeros &= last_removed == 0;
+        last_removed = interval.vr % 10;
+        interval.vr /= 10;
+        interval.vp /= 10;
+        interval.vm /= 10;
+        removed++;
+    }
+
+    // Exactly halfway rounds to even
+    const bool tie = interval.vr_is_trailing_zeros && last_removed == 5;
+    const bool up = last_removed > 5 || (last_removed == 5 && (!tie || interval.vr % 2 == 1));
+    const bool vm_inside = interval.accept_bounds && interval.vm_is_trailing_zeros;
+
+    // The closest one first, then the one on the other side of the value
+    for (int attempt = 0; attempt < 2; attempt++)
+    {
+        const uint64_t digits = interval.vr + (up != (attempt == 1));
+
+        if (digits <= interval.vp && (digits > interval.vm || (digits == interval.vm && vm_inside)))
+        {
+            result->digits = digits;
+            result->exponent = interval.exponent + removed;
+            return true;
+        }
+    }
+    return false;
+}
+
+/**
+ * Finds the shortest decimal in the interval of the value
+ * m2 * 2^e2, the one closest to the value among those
+ *
+ * @param m2 mantissa with the implicit bit
+ * @param e2 binary exponent
+ * @param mm_shift 1 if the lower neighbour is as far as the upper one
+ * @return the decimal
+ */
+static java_decimal shortest_decimal(uint64_t m2, int32_t e2, uint32_t mm_shift)
+{
+    ryu_interval interval;
+    java_decimal result;
+    uint8_t last_removed = 0;
+    int32_t removed = 0;
+
+    scale_interval(&interval, m2, e2 - 2, mm_shift, 0);
+
+    uint64_t vr = interval.vr, vp = interval.vp, vm = interval.vm;
+    bool vr_is_trailing_zeros = interval.vr_is_trailing_zeros;
+    bool vm_is_trailing_zeros = interval.vm_is_trailing_zeros;
+
+    if (vm_is_trailing_zeros || vr_is_trailing_zeros)
+    {
+        // Rare: a bound or the value itself may be exact, track ties
+        for (; vp / 10 > vm / 10; removed++)
+        {
+            vm_is_trailing_zeros &= vm % 10 == 0;
+            vr_is_trailing_zeros &= last_removed == 0;
+            last_removed = vr % 10;
+            vr /= 10;
+            vp /= 10;
+            vm /= 10;
+        }
+        if (vm_is_trailing_zeros)
+        {
+            for (; vm % 10 == 0; removed++)
+            {
+                vr_is_trailing_zeros &= last_removed == 0;
+                last_removed = vr % 10;
+                vr /= 10;
+                vp /= 10;
+                vm /= 10;
+            }
+        }
+        if (vr_is_trailing_zeros && last_removed == 5 && vr % 2 == 0)
+            last_removed = 4;
+        result.digits = vr + ((vr == vm && (!interval.accept_bounds || !vm_is_trailing_zeros)) || last_removed >= 5);
+    }
+    else
+    {
+        // Common: nothing is exact, drop two digits at a time first
+        bool round_up = false;
+
+        if (vp / 100 > vm / 100)
+        {
+            round_up = vr % 100 >= 50;
+            vr /= 100;
+            vp /= 100;
+            vm /= 100;
+            removed += 2;
+        }
+        for (; vp / 10 > vm / 10; removed++)
+        {
+            round_up = vr % 10 >= 5;
+            vr /= 10;
+            vp /= 10;
+            vm /= 10;
+        }
+        result.digits = vr + (vr == vm || round_up);
+    }
+    result.exponent = interval.exponent + removed;
+
+    if (result.digits < 10)
+    {
+        // The smallest subnormals scale to just two digits, round from three
+        if (interval.vr < 100)
+            scale_interval(&interval, m2, e2 - 2, mm_shift, 1);
+        round_to_two_digits(interval, &result);
+    }
+    return result;
+}
+
+/**
+ * Lays a decimal out as Java does and terminates it with a NUL
+ *
+ * @param buffer of at least JAVA_NUMBER_MAX bytes
+ * @param negative whether to write a minus sign
+ * @param value decimal, not 0
+ * @return length of the text
+ */
+static size_t format_decimal(char *buffer, bool negative, java_decimal value)
+{
+    char digits[20];
+    int32_t length = 0;
+    char *p = buffer;
+
+    for (; value.digits % 10 == 0; value.digits /= 10)
+        value.exponent++;
+    for (uint64_t rest = value.digits; rest; rest /= 10)
+        digits[sizeof(digits) - 1 - length++] = '0' + rest % 10;
+
+    const char *first = digits + sizeof(digits) - length;
+    int32_t exponent = length - 1 + value.exponent; // of the first digit
+
+    if (negative)
+        *p++ = '-';
+
+    if (exponent >= 0 && exponent < 7)
+    {
+        for (int32_t i = 0; i <= exponent; i++)
+            *p++ = i < length ? first[i] : '0';
+        *p++ = '.';
+        if (length <= exponent + 1)
+            *p++ = '0';
+        for (int32_t i = exponent + 1; i < length; i++)
+            *p++ = first[i];
+    }
+    else if (exponent < 0 && exponent >= -3)
+    {
+        *p++ = '0';
+        *p++ = '.';
+        for (int32_t i = -1; i > exponent; i--)
+            *p++ = '0';
+        for (int32_t i = 0; i < length; i++)
+            *p++ = first[i];
+    }
+    else
+    {
+        *p++ = first[0];
+        *p++ = '.';
+        if (length == 1)
+            *p++ = '0';
+        for (int32_t i = 1; i < length; i++)
+            *p++ = first[i];
+        *p++ = 'E';
+        if (exponent < 0)
+        {
+            *p++ = '-';
+            exponent = -exponent;
+        }
+        if (exponent >= 100)
+            *p++ = '0' + exponent / 100;
+        if (exponent >= 10)
+            *p++ = '0' + exponent / 10 % 10;
+        *p++ = '0' + exponent % 10;
+    }
+
+    *p = '\0';
+    return p - buffer;
+}
+
+/**
+ * Copies a fixed text and terminates it with a NUL
+ */
+static size_t format_special(char *buffer, const char *text, size_t length)
+{
+    for (size_t i = 0; i <= length; i++)
+        buffer[i] = text[i];
+    return length;
+}
+
+/**
+ * Format a double like Double.toString()
+ *
+ * @param buffer of at least JAVA_NUMBER_MAX bytes
+ * @param bits of the value, as in a CONSTANT_Double
+ * @return length of the text, without the NUL
+ */
+size_t format_java_double(char *buffer, uint64_t bits)
+{
+    const bool negative = bits >> 63;
+    const uint32_t exponent = (bits >> DOUBLE_MANTISSA_BITS) & 0x7ff;
+    const uint64_t mantissa = bits & ((1ull << DOUBLE_MANTISSA_BITS) - 1);
+
+    if (exponent == 0x7ff)
+    {
+        if (mantissa)
+            return format_special(buffer, "NaN", 3);
+        return negative ? format_special(buffer, "-Infinity", 9) : format_special(buffer, "Infinity", 8);
+    }
+    if (exponent == 0 && mantissa == 0)
+        return negative ? format_special(buffer, "-0.0", 4) : format_special(buffer, "0.0", 3);
+
+    const java_decimal value = exponent == 0
+        ? shortest_decimal(mantissa, 1 - DOUBLE_EXPONENT_BIAS - DOUBLE_MANTISSA_BITS, 1)
+        : shortest_decimal(mantissa | 1ull << DOUBLE_MANTISSA_BITS,
+                           (int32_t)exponent - DOUBLE_EXPONENT_BIAS - DOUBLE_MANTISSA_BITS,
+                           mantissa != 0 || exponent <= 1);
+    return format_decimal(buffer, negative, value);
+}
+
+/**
+ * Format a float like Float.toString()
+ *
+ * @param buffer of at least JAVA_NUMBER_MAX bytes
+ * @param bits of the value, as in a CONSTANT_Float
+ * @return length of the text, without the NUL
+ */
+size_t format_java_float(char *buffer, uint32_t bits)
+{
+    const bool negative = bits >> 31;
+    const uint32_t exponent = (bits >> FLOAT_MANTISSA_BITS) & 0xff;
+    const uint32_t mantissa = bits & ((1u << FLOAT_MANTISSA_BITS) - 1);
+
+    if (exponent == 0xff)
+    {
+        if (mantissa)
+            return format_special(buffer, "NaN", 3);
+        return negative ? format_special(buffer, "-Infinity", 9) : format_special(buffer, "Infinity", 8);
+    }
+    if (exponent == 0 && mantissa == 0)
+        return negative ? format_special(buffer, "-0.0", 4) : format_special(buffer, "0.0", 3);
+
+    const java_decimal value = exponent == 0
+        ? shortest_decimal(mantissa, 1 - FLOAT_EXPONENT_BIAS - FLOAT_MANTISSA_BITS, 1)
+        : shortest_decimal(mantissa | 1u << FLOAT_MANTISSA_BITS,
+                           (int32_t)exponent - FLOAT_EXPONENT_BIAS - FLOAT_MANTISSA_BITS,
+                           mantissa != 0 || exponent <= 1);
+    return format_decimal(buffer, negative, value);
+}
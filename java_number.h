@@ -0,0 +1,12 @@
+#ifndef JAVA_NUMBER_H
+#define JAVA_NUMBER_H
+#include <stddef.h>
+#include <stdint.h>
+
+// Longest text with its NUL, e.g. "-2.2250738585072014E-308"
+#define JAVA_NUMBER_MAX 32
+
+size_t format_java_double(char *buffer, uint64_t bits);
+size_t format_java_float(char *buffer, uint32_t bits);
+
+#endif
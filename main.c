@@ -10,22 +10,311 @@
  * 
  */
 
+#include <getopt.h>
+#include <unistd.h>
+
 #include "class_reader.h"
 #include "pretty_printer.h"
+#include "file_list.h"
+#include "batch.h"
+#include "thread_pool.h"
+#include "parse_cache.h"
+#include "symbol_index.h"
+#include "stats.h"
+#include "server.h"
+#include "pool_diff.h"
+#include "dep_graph.h"
+#include "watch.h"
+#include "pool_compact.h"
+
+/**
+ * Print how to run the program
+ * 
+ * @param name of the executable
+ */
+static void print_usage(const char *name)
+{
+    printf("Usage: %s [-j threads] [-e glob] [-i index] [-m] [-c] [-C dir] [-x index_file] [--format=text|jsonl|bin] [--stats[=json]]\n"
+           "       [--connect=socket] file|directory|jar...\n", name);
+    printf("       %s -X index_file query...\n", name);
+    printf("       %s [-j threads] [-C dir] --serve=socket\n", name);
+    printf("       %s [-j threads] [-e glob] --diff[=brief] old new\n", name);
+    printf("       %s [-j threads] [-e glob] --deps[=list|dot] [--packages] [--cycles] file|directory|jar...\n", name);
+    printf("       %s [-j threads] [-i index] [-m] [-c] [--format=text|jsonl|bin] --watch[=brief] [--debounce=ms] directory...\n", name);
+    printf("       %s [-j threads] [-e glob] --compact[=dir] file|directory|jar...\n", name);
+    printf("  a file named - is read from the standard input\n");
+    printf("  -j threads  number of worker threads, all cores by default\n");
+    printf("  -e glob     only take archive entries matching glob\n");
+    printf("  -i index    print only constant #index, decoding nothing else\n");
+    printf("  -m          print class and member declarations instead of the constant pool\n");
+    printf("  -c          print declarations with disassembled method bytecode\n");
+    printf("  -C dir      keep parsed constant pools in dir and reuse them on the next run (full pool output only)\n");
+    printf("  --format=f  constant pool output: javap-like text (default), JSON Lines or binary records\n");
+    printf("  --stats     print time per phase, bytes, allocations and constants to stderr, as text or json\n");
+    printf("  -x file     save an index of the referenced classes, members and strings instead of printing\n");
+    printf("  -X file     print the references matching each query from a saved index:\n");
+    printf("              owner, owner.name[:descriptor] or \"string, any part may end with *\n");
+    printf("  --serve=socket    keep running and parse classes sent to the Unix domain socket,\n"
+           "                    the output is picked per request (see class_client.h)\n");
+    printf("  --connect=socket  have a running --serve process parse and print the files\n");
+    printf("  --diff      compare the constant pools of two classes, directory trees or archives by value:\n"
+           "              - removed, + added, < > changed constants; brief lists M/A/D classes only.\n"
+           "              Exits with 0 if all pools are the same, 1 if some differ, 2 on errors\n");
+    printf("  --deps      print the classes each class refers to, from Class constants and descriptors,\n"
+           "              as \"class: dependency...\" lines or a Graphviz digraph\n");
+    printf("  --packages  with --deps, collapse classes into their packages\n");
+    printf("  --cycles    with --deps, also report groups of classes that depend on each other\n");
+    printf("  --watch     print the classes under the directories, then keep printing the ones that are\n"
+           "              added (A), modified (M) or deleted (D); brief prints the events only\n");
+    printf("  --debounce  with --watch, milliseconds without changes before they are printed (default %d)\n",
+           WATCH_DEBOUNCE_MS);
+    printf("  --compact   drop the constants nothing refers to, merge equal ones and report the bytes saved;\n"
+           "              with a dir, write the compacted classes below it at their path inside the tree or jar\n");
+}
 
 int main(int argc, char *argv[])
 {
-    if (argc != 2)
+    batch_options options = {default_thread_count()};
+    file_list files = {0};
+    parse_cache cache;
+    run_stats stats = {0};
+    graph_options graph = {0};
+    bool stats_json = false, diff = false, diff_brief = false, deps = false, watch = false, watch_brief = false;
+    bool compact = false;
+    int debounce = -1;
+    const char *index_path = NULL, *query_path = NULL, *serve_path = NULL, *connect_path = NULL, *compact_path = NULL;
+    static const struct option long_options[] = {
+        {"format", required_argument, NULL, 'F'},
+        {"stats", optional_argument, NULL, 'S'},
+        {"serve", required_argument, NULL, 'D'},
+        {"connect", required_argument, NULL, 'K'},
+        {"diff", optional_argument, NULL, 'Y'},
+        {"deps", optional_argument, NULL, 'G'},
+        {"packages", no_argument, NULL, 'P'},
+        {"cycles", no_argument, NULL, 'R'},
+        {"watch", optional_argument, NULL, 'W'},
+        {"debounce", required_argument, NULL, 'B'},
+        {"compact", optional_argument, NULL, 'O'},
+        {NULL, 0, NULL, 0}};
+    int option;
+
+    while ((option = getopt_long(argc, argv, "j:e:i:mcC:x:X:", long_options, NULL)) != -1)
+    {
+        switch (option)
+        {
+        case 'j':
+            options.thread_count = atoi(optarg);
+            if (options.thread_count < 1)
+            {
+                fprintf(stderr, "Bad number of threads: %s\n", optarg);
+                return EXIT_FAILURE;
+            }
+            break;
+        case 'e':
+            files.glob = optarg;
+            break;
+        case 'i':
+        {
+            long index = atol(optarg);
+            if (index < 1 || index > UINT16_MAX)
+            {
+                fprintf(stderr, "Bad constant index: %s\n", optarg);
+                return EXIT_FAILURE;
+            }
+            options.constant_index = (uint16_t)index;
+            break;
+        }
+        case 'm':
+            options.summary = true;
+            break;
+        case 'c':
+            options.code = true;
+            break;
+        case 'C':
+            if (!open_parse_cache(&cache, optarg))
+            {
+                fprintf(stderr, "%s\n", class_error());
+                return EXIT_FAILURE;
+            }
+            options.cache = &cache;
+            break;
+        case 'F':
+            if (strcmp(optarg, "text") == 0)
+                options.format = FORMAT_TEXT;
+            else if (strcmp(optarg, "jsonl") == 0)
+                options.format = FORMAT_JSONL;
+            else if (strcmp(optarg, "bin") == 0)
+                options.format = FORMAT_BINARY;
+            else
+            {
+                fprintf(stderr, "Unknown output format: %s\n", optarg);
+                return EXIT_FAILURE;
+            }
+            break;
+        case 'S':
+            if (optarg && strcmp(optarg, "json") != 0 && strcmp(optarg, "text") != 0)
+            {
+                fprintf(stderr, "Unknown statistics format: %s\n", optarg);
+                return EXIT_FAILURE;
+            }
+            stats_json = optarg && strcmp(optarg, "json") == 0;
+            options.stats = &stats;
+            break;
+        case 'x':
+            index_path = optarg;
+            break;
+        case 'X':
+            query_path = optarg;
+            break;
+        case 'D':
+            serve_path = optarg;
+            break;
+        case 'K':
+            connect_path = optarg;
+            break;
+        case 'Y':
+            if (optarg && strcmp(optarg, "brief") != 0)
+            {
+                fprintf(stderr, "Unknown diff output: %s\n", optarg);
+                return EXIT_FAILURE;
+            }
+            diff = true;
+            diff_brief = optarg != NULL;
+            break;
+        case 'G':
+            if (optarg && strcmp(optarg, "list") != 0 && strcmp(optarg, "dot") != 0)
+            {
+                fprintf(stderr, "Unknown graph format: %s\n", optarg);
+                return EXIT_FAILURE;
+            }
+            deps = true;
+            graph.format = optarg && strcmp(optarg, "dot") == 0 ? GRAPH_DOT : GRAPH_LIST;
+            break;
+        case 'P':
+            graph.packages = true;
+            break;
+        case 'R':
+            graph.cycles = true;
+            break;
+        case 'W':
+            if (optarg && strcmp(optarg, "brief") != 0)
+            {
+                fprintf(stderr, "Unknown watch output: %s\n", optarg);
+                return EXIT_FAILURE;
+            }
+            watch = true;
+            watch_brief = optarg != NULL;
+            break;
+        case 'B':
+            debounce = atoi(optarg);
+            if (debounce < 1)
+            {
+                fprintf(stderr, "Bad debounce time: %s\n", optarg);
+                return EXIT_FAILURE;
+            }
+            break;
+        case 'O':
+            compact = true;
+            compact_path = optarg;
+            break;
+        default:
+            print_usage(argv[0]);
+            return EXIT_FAILURE;
+        }
+    }
+
+    if (options.stats && (serve_path || connect_path || diff || deps || index_path || query_path))
+    {
+        fprintf(stderr, "--stats is collected when printing classes, not with --serve, --connect, --diff, --deps, -x or -X\n");
+        return EXIT_FAILURE;
+    }
+
+    if (serve_path)
+    {
+        if (optind != argc)
+        {
+            fprintf(stderr, "--serve takes no files, they are named by the requests\n");
+            return EXIT_FAILURE;
+        }
+        run_server(serve_path, &options); // returns only if it can't listen
+        fprintf(stderr, "%s\n", class_error());
+        return EXIT_FAILURE;
+    }
+
+    if (diff)
+    {
+        if (argc - optind != 2)
+        {
+            fprintf(stderr, "--diff takes two classes, directories or archives\n");
+            return 2;
+        }
+        return run_diff(argv[optind], argv[optind + 1], files.glob, &options, diff_brief);
+    }
+
+    if (optind == argc)
     {
-        printf("Usage: %s filename\n", argv[0]);
+        print_usage(argv[0]);
+        return 0;
     }
-    else
+
+    if ((graph.packages || graph.cycles) && !deps)
+    {
+        fprintf(stderr, "--packages and --cycles apply to --deps\n");
+        return EXIT_FAILURE;
+    }
+
+    if (options.format != FORMAT_TEXT && (options.summary || options.code))
+    {
+        fprintf(stderr, "--format applies to the constant pool output, not to -m and -c\n");
+        return EXIT_FAILURE;
+    }
+
+    if (debounce > 0 && !watch)
+    {
+        fprintf(stderr, "--debounce applies to --watch\n");
+        return EXIT_FAILURE;
+    }
+
+    if (watch)
+    {
+        if (deps || index_path || query_path || connect_path || options.cache || options.stats)
+        {
+            fprintf(stderr, "--watch only prints classes, it takes -j, -i, -m, -c and --format\n");
+            return EXIT_FAILURE;
+        }
+        return run_watch(argv + optind, argc - optind, &options, watch_brief, debounce > 0 ? debounce : WATCH_DEBOUNCE_MS);
+    }
+
+    if (compact)
+    {
+        if (deps || index_path || query_path || connect_path || options.cache || options.stats ||
+            options.constant_index || options.summary || options.code || options.format != FORMAT_TEXT)
+        {
+            fprintf(stderr, "--compact only writes classes, it takes -j and -e\n");
+            return EXIT_FAILURE;
+        }
+        return run_compaction(argv + optind, argc - optind, files.glob, compact_path, &options) ? EXIT_FAILURE : 0;
+    }
+
+    if (query_path)
+        return query_symbol_index(query_path, argv + optind, argc - optind) ? EXIT_FAILURE : 0;
+
+    for (int i = optind; i < argc; i++)
+        add_path(&files, argv[i]);
+
+    int failed = index_path     ? build_symbol_index(&files, &options, index_path)
+                 : deps         ? run_dependency_graph(&files, &options, &graph)
+                 : connect_path ? run_client(connect_path, &files, &options)
+                                : run_batch(&files, &options);
+    if (options.stats)
+        print_stats(&stats, stats_json); // chains point to the names of the files
+    free_file_list(&files);
+
+    if (options.cache)
     {
-        FILE *class_file = open_class_file(argv[1]);
-        class *cls = parse_class_file(class_file);
-        print_version_info(stdout, cls);
-        print_constant_pool(stdout, cls);
+        fprintf(stderr, "Parse cache: %zu hits, %zu misses\n", cache.hits, cache.misses);
+        close_parse_cache(&cache);
     }
 
-    return 0;
+    return failed ? EXIT_FAILURE : 0;
 }
\ No newline at end of file
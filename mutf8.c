@@ -0,0 +1,298 @@
+/**
+ * Validation and decoding of the modified UTF-8 used by
+ * CONSTANT_Utf8 (JVMS 4.4.7).
+ *
+ * It differs from standard UTF-8 in two ways: NUL is encoded as
+ * 0xC0 0x80, and supplementary characters are encoded as a pair of
+ * 3-byte surrogates instead of one 4-byte sequence. Everything else
+ * is the same, so most strings are standard UTF-8 already and only
+ * need validating.
+ *
+ * Strings are mostly ASCII, so ASCII runs are skipped 32 (AVX2) or
+ * 16 (SSE2) bytes at a time and only multibyte sequences go through
+ * the scalar code.
+ *
+ */
+
+#include "mutf8.h"
+
+#include <stdbool.h>
+#include <string.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define MUTF8_X86 1
+#endif
+
+/**
+ * Finds the end of an ASCII run with 8 bytes at a time
+ *
+ * @param p start of the run
+ * @param end of the string
+ * @return first byte that is 0 or >= 0x80, end if there is none
+ */
+static inline const uint8_t *skip_ascii_scalar(const uint8_t *p, const uint8_t *end)
+{
+    while (end - p >= 8)
+    {
+        uint64_t word;
+        memcpy(&word, p, 8);
+        // High bit set for bytes >= 0x80 and for zero bytes
+        if (((word - 0x0101010101010101ULL) | word) & 0x8080808080808080ULL)
+            break;
+        p += 8;
+    }
+
+    while (p < end && *p - 1u < 0x7fu)
+        p++;
+    return p;
+}
+
+#ifdef MUTF8_X86
+/**
+ * Finds the end of an ASCII run with 16 bytes at a time
+ */
+static inline const uint8_t *skip_ascii_sse2(const uint8_t *p, const uint8_t *end)
+{
+    const __m128i zero = _mm_setzero_si128();
+
+    while (end - p >= 16)
+    {
+        __m128i chunk = _mm_loadu_si128((const __m128i *)p);
+        unsigned mask = _mm_movemask_epi8(chunk) | _mm_movemask_epi8(_mm_cmpeq_epi8(chunk, zero));
+
+        if (mask)
+            return p + __builtin_ctz(mask);
+        p += 16;
+    }
+    return skip_ascii_scalar(p, end);
+}
+
+/**
+ * Finds the end of an ASCII run with 32 bytes at a time
+ */
+__attribute__((target("avx2"))) static const uint8_t *skip_ascii_avx2(const uint8_t *p, const uint8_t *end)
+{
+    const __m256i zero = _mm256_setzero_si256();
+
+    while (end - p >= 32)
+    {
+        __m256i chunk = _mm256_loadu_si256((const __m256i *)p);
+        unsigned mask = (unsigned)_mm256_movemask_epi8(chunk) | (unsigned)_mm256_movemask_epi8(_mm256_cmpeq_epi8(chunk, zero));
+
+        if (mask)
+            return p + __builtin_ctz(mask);
+        p += 32;
+    }
+    return skip_ascii_sse2(p, end);
+}
+
+static const uint8_t *skip_ascii_sse2_call(const uint8_t *p, const uint8_t *end)
+{
+    return skip_ascii_sse2(p, end);
+}
+
+static const uint8_t *(*skip_ascii_wide)(const uint8_t *, const uint8_t *) = skip_ascii_sse2_call;
+
+/**
+ * Finds the end of an ASCII run. Runs shorter than an AVX2 vector
+ * are scanned inline, longer ones by the widest scanner available.
+ */
+static inline const uint8_t *skip_ascii(const uint8_t *p, const uint8_t *end)
+{
+    return end - p < 32 ? skip_ascii_sse2(p, end) : skip_ascii_wide(p, end);
+}
+
+/**
+ * Picks the widest ASCII scanner the CPU supports, once at startup
+ */
+__attribute__((constructor)) static void select_skip_ascii(void)
+{
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2"))
+        skip_ascii_wide = skip_ascii_avx2;
+}
+#else
+#define skip_ascii skip_ascii_scalar
+#endif
+
+/**
+ * Tells whether any byte of a word is 0 or >= 0x80
+ */
+static inline uint64_t non_ascii_word(const uint8_t *p)
+{
+    uint64_t word;
+    memcpy(&word, p, 8);
+    return ((word - 0x0101010101010101ULL) | word) & 0x8080808080808080ULL;
+}
+
+/**
+ * Tells whether any byte of a 4-byte word is 0 or >= 0x80
+ */
+static inline uint32_t non_ascii_half(const uint8_t *p)
+{
+    uint32_t word;
+    memcpy(&word, p, 4);
+    return ((word - 0x01010101u) | word) & 0x80808080u;
+}
+
+/**
+ * Tells whether the whole string is ASCII without NULs. The tail
+ * is checked with one overlapping load instead of a byte loop, so
+ * short strings, the bulk of any pool, cost a couple of branches.
+ *
+ * @param p start of the string
+ * @param length of the string
+ * @return true if all bytes are within 0x01..0x7f
+ */
+static inline bool is_ascii(const uint8_t *p, size_t length)
+{
+    if (length >= 16)
+    {
+        const uint8_t *end = p + length, *body_end = p + (length & ~(size_t)15);
+
+        // The body is a whole number of vectors, the rest is one more
+        // vector ending at the end of the string
+        return skip_ascii(p, body_end) == body_end &&
+               (body_end == end || !(non_ascii_word(end - 16) | non_ascii_word(end - 8)));
+    }
+    if (length >= 8)
+        return !(non_ascii_word(p) | non_ascii_word(p + length - 8));
+    if (length >= 4)
+        return !(non_ascii_half(p) | non_ascii_half(p + length - 4));
+
+    for (size_t i = 0; i < length; i++)
+    {
+        if (p[i] - 1u >= 0x7fu)
+            return false;
+    }
+    return true;
+}
+
+/**
+ * Checks a 3-byte sequence 1110xxxx 10xxxxxx 10xxxxxx
+ *
+ * @param p start of the sequence
+ * @param end of the string
+ * @return the encoded char, or -1 if the sequence is malformed or overlong
+ */
+static inline int three_byte_char(const uint8_t *p, const uint8_t *end)
+{
+    if (end - p < 3 || (p[1] & 0xc0) != 0x80 || (p[2] & 0xc0) != 0x80)
+        return -1;
+
+    int c = (p[0] & 0x0f) << 12 | (p[1] & 0x3f) << 6 | (p[2] & 0x3f);
+    return c < 0x800 ? -1 : c;
+}
+
+/**
+ * Tells whether a high surrogate at p is followed by a low one
+ */
+static inline bool is_surrogate_pair(const uint8_t *p, const uint8_t *end)
+{
+    return end - p >= 6 && p[0] == 0xed && (p[1] & 0xf0) == 0xa0 &&
+           p[3] == 0xed && (p[4] & 0xf0) == 0xb0 && three_byte_char(p + 3, end) >= 0;
+}
+
+/**
+ * Validates a modified UTF-8 string. Unpaired surrogates are
+ * accepted like the JVM does, raw NULs, 4-byte sequences and
+ * overlong forms other than the NUL one are not.
+ *
+ * @param bytes of the string
+ * @param length of the string
+ * @return whether the string is valid and has to be converted
+ */
+mutf8_status check_mutf8(const uint8_t *bytes, size_t length)
+{
+    const uint8_t *p = bytes, *end = bytes + length;
+    mutf8_status status = MUTF8_PLAIN;
+
+    if (is_ascii(bytes, length))
+        return MUTF8_PLAIN;
+
+    while ((p = skip_ascii(p, end)) < end)
+    {
+        const uint8_t c = *p;
+
+        if ((c & 0xe0) == 0xc0)
+        {
+            if (end - p < 2 || (p[1] & 0xc0) != 0x80)
+                return MUTF8_INVALID;
+            if (c < 0xc2)
+            {
+                if (c != 0xc0 || p[1] != 0x80)
+                    return MUTF8_INVALID; // overlong
+                status = MUTF8_CONVERT;
+            }
+            p += 2;
+        }
+        else if ((c & 0xf0) == 0xe0)
+        {
+            if (three_byte_char(p, end) < 0)
+                return MUTF8_INVALID;
+            if (is_surrogate_pair(p, end))
+            {
+                status = MUTF8_CONVERT;
+                p += 3;
+            }
+            p += 3;
+        }
+        else
+            return MUTF8_INVALID; // NUL, continuation byte or 4-byte lead
+    }
+
+    return status;
+}
+
+/**
+ * Converts a valid modified UTF-8 string into standard UTF-8.
+ * The result is never longer than the input.
+ *
+ * @param bytes of the string, checked by check_mutf8
+ * @param length of the string
+ * @param out where to write at least length bytes
+ * @return length of the converted string
+ */
+size_t decode_mutf8(const uint8_t *bytes, size_t length, uint8_t *out)
+{
+    const uint8_t *p = bytes, *end = bytes + length;
+    uint8_t *o = out;
+
+    while (p < end)
+    {
+        const uint8_t *run_end = skip_ascii(p, end);
+
+        memcpy(o, p, run_end - p);
+        o += run_end - p;
+        if ((p = run_end) == end)
+            break;
+
+        if (p[0] == 0xc0 && p[1] == 0x80)
+        {
+            *o++ = 0;
+            p += 2;
+        }
+        else if (is_surrogate_pair(p, end))
+        {
+            const uint32_t high = three_byte_char(p, end), low = three_byte_char(p + 3, end);
+            const uint32_t c = 0x10000 + ((high - 0xd800) << 10) + (low - 0xdc00);
+
+            *o++ = 0xf0 | c >> 18;
+            *o++ = 0x80 | (c >> 12 & 0x3f);
+            *o++ = 0x80 | (c >> 6 & 0x3f);
+            *o++ = 0x80 | (c & 0x3f);
+            p += 6;
+        }
+        else
+        {
+            const size_t size = (*p & 0xe0) == 0xc0 ? 2 : 3;
+
+            memcpy(o, p, size);
+            o += size;
+            p += size;
+        }
+    }
+
+    return o - out;
+}
@@ -0,0 +1,17 @@
+#ifndef MUTF8_H
+#define MUTF8_H
+#include <stddef.h>
+#include <stdint.h>
+
+typedef enum mutf8_status_e
+{
+    MUTF8_INVALID = 0,
+    MUTF8_PLAIN,  // the bytes are standard UTF-8 as they are
+    MUTF8_CONVERT // has an encoded NUL or surrogate pairs, needs decode_mutf8
+
+} mutf8_status;
+
+mutf8_status check_mutf8(const uint8_t *bytes, size_t length);
+size_t decode_mutf8(const uint8_t *bytes, size_t length, uint8_t *out);
+
+#endif
@@ -0,0 +1,183 @@
+/**
+ * Buffered output for the printers. Text is formatted with
+ * specialized emitters straight into one big reusable buffer
+ * instead of going through printf format parsing per line.
+ * 
+ */
+
+#include "output.h"
+
+#include <errno.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include "stats.h"
+
+static const char digit_pairs[201] =
+    "00010203040506070809"
+    "10111213141516171819"
+    "20212223242526272829"
+    "30313233343536373839"
+    "40414243444546474849"
+    "50515253545556575859"
+    "60616263646566676869"
+    "70717273747576777879"
+    "80818283848586878889"
+    "90919293949596979899";
+
+/**
+ * Prepares a buffer
+ * 
+ * @param buffer to initialize
+ * @param fd to flush to, -1 to keep everything in memory
+ */
+void out_init(out_buffer *out, int fd)
+{
+    out->capacity = OUT_BUFFER_SIZE;
+    out->data = malloc(out->capacity);
+    stats_alloc(out->capacity);
+    out->length = 0;
+    out->fd = fd;
+}
+
+/**
+ * Makes room for at least size more bytes: flushes a buffer
+ * bound to a file, grows an in-memory one
+ * 
+ * @param buffer to make room in
+ * @param size needed
+ */
+void out_reserve(out_buffer *out, size_t size)
+{
+    if (out->capacity - out->length >= size)
+        return;
+
+    if (out->fd >= 0)
+        out_flush(out);
+
+    if (out->capacity - out->length < size)
+    {
+        while (out->capacity - out->length < size)
+            out->capacity *= 2;
+        out->data = realloc(out->data, out->capacity);
+        stats_alloc(out->capacity);
+    }
+}
+
+/**
+ * Writes everything collected so far to the file descriptor
+ * 
+ * @param buffer to flush
+ */
+void out_flush(out_buffer *out)
+{
+    size_t written = 0;
+
+    if (out->fd < 0)
+        return;
+
+    while (written < out->length)
+    {
+        ssize_t count = write(out->fd, out->data + written, out->length - written);
+        if (count < 0)
+        {
+            if (errno == EINTR)
+                continue;
+            break; // nobody to report to, e.g. closed pipe
+        }
+        written += count;
+    }
+
+    out->length = 0;
+}
+
+/**
+ * Flushes and releases a buffer
+ * 
+ * @param buffer to release
+ */
+void out_free(out_buffer *out)
+{
+    out_flush(out);
+    free(out->data);
+    out->data = NULL;
+    out->length = out->capacity = 0;
+}
+
+/**
+ * Append a 64-bit unsigned number in decimal, two digits at a time
+ * 
+ * @param buffer to append to
+ * @param value to format
+ */
+void out_u64(out_buffer *out, uint64_t value)
+{
+    char digits[20];
+    char *p = digits + sizeof(digits);
+
+    while (value >= 100)
+    {
+        const char *pair = digit_pairs + (value % 100) * 2;
+        value /= 100;
+        *--p = pair[1];
+        *--p = pair[0];
+    }
+
+    if (value >= 10)
+    {
+        const char *pair = digit_pairs + value * 2;
+        *--p = pair[1];
+        *--p = pair[0];
+    }
+    else
+        *--p = (char)('0' + value);
+
+    out_bytes(out, p, digits + sizeof(digits) - p);
+}
+
+/**
+ * Append a 64-bit signed number in decimal
+ * 
+ * @param buffer to append to
+ * @param value to format
+ */
+void out_i64(out_buffer *out, int64_t value)
+{
+    if (value < 0)
+    {
+        out_char(out, '-');
+        out_u64(out, (uint64_t)0 - (uint64_t)value);
+    }
+    else
+        out_u64(out, (uint64_t)value);
+}
+
+/**
+ * Append printf-formatted text. Slow path for the rare cases
+ * that have no specialized emitter.
+ * 
+ * @param buffer to append to
+ * @param format printf-like
+ */
+void out_format(out_buffer *out, const char *format, ...)
+{
+    va_list args;
+    va_start(args, format);
+    int length = vsnprintf(out->data + out->length, out->capacity - out->length, format, args);
+    va_end(args);
+
+    if (length < 0)
+        return;
+
+    if ((size_t)length >= out->capacity - out->length)
+    {
+        out_reserve(out, length + 1);
+        va_start(args, format);
+        vsnprintf(out->data + out->length, out->capacity - out->length, format, args);
+        va_end(args);
+    }
+
+    out->length += length;
+}
@@ -0,0 +1,78 @@
+#ifndef OUTPUT_H
+#define OUTPUT_H
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+#define OUT_BUFFER_SIZE (1 << 16)
+
+/**
+ * Growable text buffer with hand-rolled emitters. A buffer with
+ * a file descriptor is flushed with one write() whenever it fills
+ * up, a buffer without one (fd = -1) just collects everything.
+ */
+typedef struct out_buffer_s
+{
+    char *data;
+    size_t length;
+    size_t capacity;
+    int fd;
+
+} out_buffer;
+
+void out_init(out_buffer *out, int fd);
+void out_reserve(out_buffer *out, size_t size);
+void out_flush(out_buffer *out);
+void out_free(out_buffer *out);
+void out_u64(out_buffer *out, uint64_t value);
+void out_i64(out_buffer *out, int64_t value);
+void out_format(out_buffer *out, const char *format, ...);
+
+/**
+ * Append raw bytes
+ */
+static inline void out_bytes(out_buffer *out, const char *bytes, size_t length)
+{
+    if (out->capacity - out->length < length)
+        out_reserve(out, length);
+
+    memcpy(out->data + out->length, bytes, length);
+    out->length += length;
+}
+
+/**
+ * Append a NUL-terminated string
+ */
+static inline void out_str(out_buffer *out, const char *str)
+{
+    out_bytes(out, str, strlen(str));
+}
+
+/**
+ * Append a single character
+ */
+static inline void out_char(out_buffer *out, char c)
+{
+    if (out->length == out->capacity)
+        out_reserve(out, 1);
+
+    out->data[out->length++] = c;
+}
+
+/**
+ * Append a 32-bit unsigned number in decimal
+ */
+static inline void out_u32(out_buffer *out, uint32_t value)
+{
+    out_u64(out, value);
+}
+
+/**
+ * Append a 32-bit signed number in decimal
+ */
+static inline void out_i32(out_buffer *out, int32_t value)
+{
+    out_i64(out, value);
+}
+
+#endif
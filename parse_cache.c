@@ -0,0 +1,394 @@
+/**
+ * On-disk cache of parsed constant pools.
+ *
+ * An entry is named after a hash of the whole class file and holds
+ * the pool arrays of the class struct exactly as they are in memory,
+ * after every Utf8 was checked and every constant resolved:
+ *
+ *   header
+ *   payload   u4 per slot
+ *   strings   pool_string per Utf8
+ *   resolved  resolved_constant per slot, plus one
+ *   tags      u1 per slot
+ *   decoded   converted Utf8 texts
+ *
+ * Every array starts at a multiple of 8, so a mapped entry is used
+ * in place. The layout depends on the host, the header tells
+ * whether an entry was written by a compatible build, and a
+ * checksum catches damaged ones. Entries are written to a temporary
+ * file and renamed, so readers never see a partial one.
+ *
+ */
+
+#define _GNU_SOURCE
+#include "parse_cache.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "stats.h"
+
+#define CACHE_MAGIC 0x43504a43 // "CJPC"
+#define CACHE_VERSION 1
+#define CACHE_LAYOUT (0x01020304u ^ (uint32_t)sizeof(pool_string) << 8 ^ (uint32_t)sizeof(resolved_constant))
+#define CACHE_MAP_THRESHOLD (64 * 1024) // smaller entries are read, bigger ones mapped
+
+typedef struct cache_header_s
+{
+    uint32_t magic;
+    uint16_t version;
+    uint16_t constant_pool_count;
+    uint32_t layout; // byte order and struct sizes of the writer
+    uint32_t pool_end;
+    uint64_t hash;
+    uint64_t class_size;
+    uint64_t checksum; // hash of everything after the header
+    uint32_t decoded_length;
+    uint16_t string_count;
+    uint16_t reserved;
+
+} cache_header;
+
+typedef struct cache_layout_s
+{
+    size_t payload;
+    size_t strings;
+    size_t resolved;
+    size_t tags;
+    size_t decoded;
+    size_t size;
+
+} cache_layout;
+
+/**
+ * Opens a cache directory, creating it if needed
+ *
+ * @param cache to initialize
+ * @param path of the directory
+ * @return false if the directory can't be used (see class_error)
+ */
+bool open_parse_cache(parse_cache *cache, const char *path)
+{
+    cache->hits = cache->misses = 0;
+
+    if (mkdir(path, 0777) != 0 && errno != EEXIST)
+    {
+        set_class_error("Can't create cache directory %s: %s", path, strerror(errno));
+        return false;
+    }
+
+    if ((cache->dir_fd = open(path, O_RDONLY | O_DIRECTORY)) < 0)
+    {
+        set_class_error("Can't open cache directory %s: %s", path, strerror(errno));
+        return false;
+    }
+
+    return true;
+}
+
+void close_parse_cache(parse_cache *cache)
+{
+    if (cache->dir_fd >= 0)
+        close(cache->dir_fd);
+    cache->dir_fd = -1;
+}
+
+static inline uint64_t read_u64(const uint8_t *p)
+{
+    uint64_t value;
+    memcpy(&value, p, 8);
+    return value;
+}
+
+static inline uint64_t read_u32(const uint8_t *p)
+{
+    uint32_t value;
+    memcpy(&value, p, 4);
+    return value;
+}
+
+/**
+ * Multiplies and folds the 128-bit product
+ */
+static inline uint64_t mix(uint64_t a, uint64_t b)
+{
+    __uint128_t product = (__uint128_t)a * b;
+    return (uint64_t)product ^ (uint64_t)(product >> 64);
+}
+
+/**
+ * Hashes a class file or any other bytes, 16 bytes per
+ * multiplication. Not meant to resist crafted collisions, the
+ * cache has the size in the key too.
+ *
+ * @param data to hash
+ * @param size of the data
+ * @return 64-bit hash
+ */
+uint64_t hash_class_data(const uint8_t *data, size_t size)
+{
+    const uint64_t k0 = 0xa0761d6478bd642full, k1 = 0xe7037ed1a0b428dbull, k2 = 0x8ebc6af09c88c6e3ull;
+    const uint8_t *p = data, *end = data + size;
+    uint64_t h = size ^ k0;
+
+    for (; end - p > 16; p += 16)
+        h = mix(read_u64(p) ^ k1, read_u64(p + 8) ^ h);
+
+    // The last block overlaps the previous one unless the data is short
+    uint64_t a = 0, b = 0;
+    if (size >= 16)
+    {
+        a = read_u64(end - 16);
+        b = read_u64(end - 8);
+    }
+    else if (size >= 8)
+    {
+        a = read_u64(p);
+        b = read_u64(end - 8);
+    }
+    else if (size >= 4)
+    {
+        a = read_u32(p) << 32 | read_u32(end - 4);
+    }
+    else if (size > 0)
+    {
+        a = (uint64_t)p[0] << 16 | (uint64_t)p[size / 2] << 8 | end[-1];
+    }
+
+    h = mix(a ^ k1, b ^ h);
+    return mix(h ^ k2, size ^ k1);
+}
+
+static inline size_t align8(size_t offset)
+{
+    return (offset + 7) & ~(size_t)7;
+}
+
+/**
+ * Computes where the arrays of an entry start
+ */
+static cache_layout entry_layout(uint16_t constant_pool_count, uint16_t string_count, uint32_t decoded_length)
+{
+    const size_t slots = constant_pool_count ? constant_pool_count - 1 : 0;
+    cache_layout layout;
+
+    layout.payload = sizeof(cache_header);
+    layout.strings = align8(layout.payload + slots * sizeof(uint32_t));
+    layout.resolved = align8(layout.strings + string_count * sizeof(pool_string));
+    layout.tags = align8(layout.resolved + (slots + 1) * sizeof(resolved_constant));
+    layout.decoded = layout.tags + slots;
+    layout.size = layout.decoded + decoded_length;
+    return layout;
+}
+
+/**
+ * Entry file name: hash and size of the class file
+ */
+static void entry_name(char *name, size_t length, uint64_t hash, size_t size)
+{
+    snprintf(name, length, "%016llx-%zx", (unsigned long long)hash, size);
+}
+
+/**
+ * Tells whether a Utf8 index taken from an entry is usable
+ */
+static inline bool is_utf_index(const class *cls, uint16_t index)
+{
+    return index == 0 || (index < cls->constant_pool_count && cls->tags[index - 1] == CONSTANT_Utf8);
+}
+
+/**
+ * Checks that nothing in a loaded entry points outside of the
+ * class, so an entry that passed the checksum by chance or was
+ * written by a broken build can't crash the printer
+ *
+ * @param class struct with the pool arrays set
+ * @return true if the entry is consistent
+ */
+static bool check_entry(const class *cls)
+{
+    const uint16_t slots = cls->constant_pool_count ? cls->constant_pool_count - 1 : 0;
+
+    if (cls->pool_end > cls->size)
+        return false;
+
+    for (uint16_t i = 0; i < cls->string_count; i++)
+    {
+        const pool_string *string = cls->strings + i;
+        const size_t limit = string->state == STRING_DECODED ? cls->decoded_length
+                             : string->state == STRING_PLAIN ? cls->size
+                                                             : 0;
+
+        if ((size_t)string->offset + string->length > limit)
+            return false;
+    }
+
+    for (uint16_t i = 0; i < slots; i++)
+    {
+        const resolved_constant *resolved = cls->resolved + i;
+
+        if (cls->tags[i] == CONSTANT_Utf8 && cls->payload[i] >= cls->string_count)
+            return false;
+        if (!is_utf_index(cls, resolved->utf) || !is_utf_index(cls, resolved->owner) ||
+            !is_utf_index(cls, resolved->name) || !is_utf_index(cls, resolved->descriptor))
+            return false;
+    }
+
+    return true;
+}
+
+/**
+ * Reads a small entry into the class arena, maps a big one.
+ * A mapping is released by free_class.
+ *
+ * @param fd of the entry
+ * @param size of the entry
+ * @param cls to allocate in and attach the mapping to
+ * @return entry contents, NULL on failure
+ */
+static uint8_t *read_entry(int fd, size_t size, class *cls)
+{
+    if (size >= CACHE_MAP_THRESHOLD)
+    {
+        // Private and writable: the class may still update its arrays
+        uint8_t *map = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+        if (map == MAP_FAILED)
+            return NULL;
+
+        cls->cached = map;
+        cls->cached_size = size;
+        return map;
+    }
+
+    uint8_t *buffer = arena_alloc(cls->arena, size);
+    return pread(fd, buffer, size, 0) == (ssize_t)size ? buffer : NULL;
+}
+
+/**
+ * Fills the pool arrays of a class from its cache entry. The class
+ * must have its data, size and constant_pool_count set. Counts
+ * a hit or a miss.
+ *
+ * @param cache to look in
+ * @param hash of the class data
+ * @param cls to fill
+ * @return false if there is no usable entry, the class is left as it was
+ */
+bool load_cached_pool(parse_cache *cache, uint64_t hash, class *cls)
+{
+    char name[64];
+    struct stat st;
+    cache_header header;
+    uint8_t *entry = NULL;
+
+    entry_name(name, sizeof(name), hash, cls->size);
+    int fd = openat(cache->dir_fd, name, O_RDONLY);
+
+    if (fd >= 0 && fstat(fd, &st) == 0 && (size_t)st.st_size >= sizeof(header) &&
+        pread(fd, &header, sizeof(header), 0) == sizeof(header) &&
+        header.magic == CACHE_MAGIC && header.version == CACHE_VERSION && header.layout == CACHE_LAYOUT &&
+        header.hash == hash && header.class_size == cls->size && header.constant_pool_count == cls->constant_pool_count &&
+        entry_layout(header.constant_pool_count, header.string_count, header.decoded_length).size == (size_t)st.st_size)
+    {
+        entry = read_entry(fd, st.st_size, cls);
+        if (entry && hash_class_data(entry + sizeof(header), st.st_size - sizeof(header)) != header.checksum)
+        {
+            if (cls->cached)
+                munmap(cls->cached, cls->cached_size);
+            cls->cached = NULL;
+            entry = NULL;
+        }
+    }
+    if (fd >= 0)
+        close(fd);
+
+    if (entry)
+    {
+        const cache_layout layout = entry_layout(header.constant_pool_count, header.string_count, header.decoded_length);
+
+        cls->payload = (uint32_t *)(entry + layout.payload);
+        cls->strings = (pool_string *)(entry + layout.strings);
+        cls->string_count = header.string_count;
+        cls->resolved = (resolved_constant *)(entry + layout.resolved);
+        cls->tags = entry + layout.tags;
+        cls->decoded = (char *)entry + layout.decoded;
+        cls->decoded_length = cls->decoded_capacity = header.decoded_length;
+        cls->pool_end = header.pool_end;
+
+        if (check_entry(cls))
+        {
+            __atomic_fetch_add(&cache->hits, 1, __ATOMIC_RELAXED);
+            return true;
+        }
+
+        cls->tags = NULL;
+        cls->payload = NULL;
+        cls->strings = NULL;
+        cls->string_count = 0;
+        cls->decoded = NULL;
+        cls->decoded_length = cls->decoded_capacity = 0;
+        cls->resolved = NULL;
+        cls->pool_end = 0;
+        if (cls->cached)
+            munmap(cls->cached, cls->cached_size);
+        cls->cached = NULL;
+    }
+
+    __atomic_fetch_add(&cache->misses, 1, __ATOMIC_RELAXED);
+    return false;
+}
+
+/**
+ * Writes the pool of a fully loaded class into the cache. Failures
+ * are ignored, the class will just be parsed again next time.
+ *
+ * @param cache to write to
+ * @param hash of the class data
+ * @param cls with every constant checked and resolved
+ */
+void store_cached_pool(parse_cache *cache, uint64_t hash, const class *cls)
+{
+    static unsigned sequence;
+    const uint16_t slots = cls->constant_pool_count ? cls->constant_pool_count - 1 : 0;
+    const cache_layout layout = entry_layout(cls->constant_pool_count, cls->string_count, cls->decoded_length);
+    cache_header header = {
+        CACHE_MAGIC, CACHE_VERSION, cls->constant_pool_count, CACHE_LAYOUT, (uint32_t)cls->pool_end,
+        hash, cls->size, 0, cls->decoded_length, cls->string_count, 0};
+    char name[64], temp_name[96];
+    uint8_t *entry = calloc(1, layout.size);
+
+    if (!entry)
+        return;
+    stats_alloc(layout.size);
+
+    memcpy(entry + layout.payload, cls->payload, slots * sizeof(uint32_t));
+    memcpy(entry + layout.strings, cls->strings, cls->string_count * sizeof(pool_string));
+    memcpy(entry + layout.resolved, cls->resolved, (slots + 1) * sizeof(resolved_constant));
+    memcpy(entry + layout.tags, cls->tags, slots);
+    if (cls->decoded_length)
+        memcpy(entry + layout.decoded, cls->decoded, cls->decoded_length);
+    header.checksum = hash_class_data(entry + sizeof(header), layout.size - sizeof(header));
+    memcpy(entry, &header, sizeof(header));
+
+    entry_name(name, sizeof(name), hash, cls->size);
+    snprintf(temp_name, sizeof(temp_name), ".%s.%d.%u", name, (int)getpid(),
+             __atomic_fetch_add(&sequence, 1, __ATOMIC_RELAXED));
+
+    int fd = openat(cache->dir_fd, temp_name, O_WRONLY | O_CREAT | O_EXCL, 0644);
+    if (fd >= 0)
+    {
+        bool ok = write(fd, entry, layout.size) == (ssize_t)layout.size;
+        ok = close(fd) == 0 && ok;
+
+        if (!ok || renameat(cache->dir_fd, temp_name, cache->dir_fd, name) != 0)
+            unlinkat(cache->dir_fd, temp_name, 0);
+    }
+
+    free(entry);
+}
@@ -0,0 +1,27 @@
+#ifndef PARSE_CACHE_H
+#define PARSE_CACHE_H
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "class_reader.h"
+
+/**
+ * Directory of parsed and resolved constant pools, one file per
+ * class content. Safe to share between threads and processes.
+ */
+struct parse_cache_s
+{
+    int dir_fd;
+    size_t hits;   // updated atomically
+    size_t misses; // updated atomically
+
+};
+
+bool open_parse_cache(parse_cache *cache, const char *path);
+void close_parse_cache(parse_cache *cache);
+uint64_t hash_class_data(const uint8_t *data, size_t size);
+bool load_cached_pool(parse_cache *cache, uint64_t hash, class *cls);
+void store_cached_pool(parse_cache *cache, uint64_t hash, const class *cls);
+
+#endif
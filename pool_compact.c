@@ -0,0 +1,1160 @@
+/**
+ * Constant pool compaction: writes a class back without the
+ * constants nothing refers to and with equal constants merged.
+ *
+ * Two constants are equal when their tags and values are, operands
+ * compared after they were merged themselves. A constant only refers
+ * to constants of a lower level (Utf8 and numbers; Class, String,
+ * MethodType and NameAndType; the Refs and InvokeDynamic;
+ * MethodHandle), so one pass per level over a hash table finds the
+ * first constant equal to each one.
+ *
+ * Everything after the pool is walked over its bytes twice: once to
+ * mark the constants its indices use, once to write the new indices
+ * into a copy. Indices are in the class header, the members, their
+ * attributes and the bytecode. The pool keeps its order, so an index
+ * can only get smaller: an ldc operand still fits its byte, and
+ * nothing after the pool changes its length, offsets in the code
+ * and the stack maps stay valid. A class with an attribute that is
+ * not known here, or doesn't parse, is written as it was, as its
+ * indices would go stale.
+ *
+ * Output, a line per input in order:
+ *
+ *   "name: 1234 -> 1180 bytes (-4.4%), 3 unreferenced and 2 duplicate constants removed"
+ *
+ * With a directory the classes are also written below it, at their
+ * path inside the tree or archive they were found in.
+ *
+ */
+
+#define _GNU_SOURCE
+#include "pool_compact.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include "bytecode.h"
+#include "file_list.h"
+#include "parse_cache.h"
+#include "thread_pool.h"
+
+typedef bool (*attribute_walker)(compactor *c, byte_reader *reader);
+
+typedef struct compact_run_s
+{
+    class_input *inputs;
+    const char **relative;  // path of each input inside its tree
+    const char *directory;  // where the classes are written, NULL to only report
+    compact_result *results;
+    char **errors;
+    arena *arenas;          // one per worker, reset after every file
+    out_buffer *outputs;    // one per worker
+
+} compact_run;
+
+/**
+ * Level of a constant, it only refers to constants of lower levels
+ */
+static int constant_level(uint8_t tag)
+{
+    switch (tag)
+    {
+    case CONSTANT_Class:
+    case CONSTANT_String:
+    case CONSTANT_MethodType:
+    case CONSTANT_NameAndType:
+        return 1;
+    case CONSTANT_Fieldref:
+    case CONSTANT_Methodref:
+    case CONSTANT_InterfaceMethodref:
+    case CONSTANT_InvokeDynamic:
+        return 2;
+    case CONSTANT_MethodHandle:
+        return 3;
+    default:
+        return 0;
+    }
+}
+
+/**
+ * Gets the size of a constant pool entry with its tag
+ */
+static uint32_t entry_size(const uint8_t *entry)
+{
+    switch (entry[0])
+    {
+    case CONSTANT_Utf8:
+        return 3 + read_u2(entry + 1);
+    case CONSTANT_Long:
+    case CONSTANT_Double:
+        return 9;
+    case CONSTANT_Class:
+    case CONSTANT_String:
+    case CONSTANT_MethodType:
+        return 3;
+    case CONSTANT_MethodHandle:
+        return 4;
+    default:
+        return 5;
+    }
+}
+
+static inline void write_u2(uint8_t *p, uint16_t value)
+{
+    p[0] = (uint8_t)(value >> 8);
+    p[1] = (uint8_t)value;
+}
+
+static inline bool skip(byte_reader *reader, size_t length)
+{
+    if (reader->size - reader->pos < length)
+        return false;
+
+    reader->pos += length;
+    return true;
+}
+
+/**
+ * Gets the canonical index of an operand
+ *
+ * @param c compactor
+ * @param index of the operand
+ * @param tag it must have, CONSTANT_Methodref stands for any Ref as in resolve.c
+ * @param value set to the first constant equal to the operand
+ * @return false if the operand has another tag
+ */
+static bool canonical_operand(const compactor *c, uint32_t index, uint8_t tag, uint32_t *value)
+{
+    const uint8_t found = index <= UINT16_MAX ? constant_tag(c->cls, (uint16_t)index) : 0;
+
+    if (found != tag &&
+        !(tag == CONSTANT_Methodref && (found == CONSTANT_Fieldref || found == CONSTANT_InterfaceMethodref)))
+        return false;
+
+    *value = c->canonical[index - 1];
+    return true;
+}
+
+/**
+ * Sets the value of a constant that equal constants share: the
+ * payload with the operands replaced by their canonical indices
+ *
+ * @param c compactor with the lower levels merged
+ * @param index of the constant
+ * @return false if an operand is not the constant it should be
+ */
+static bool canonical_value(compactor *c, uint16_t index)
+{
+    const uint8_t tag = c->cls->tags[index - 1];
+    constant_info info;
+    uint32_t first = 0, second = 0;
+    bool ok = true;
+
+    // Utf8 constants are compared by the text, getting one would check it
+    if (tag != CONSTANT_Utf8 && !get_constant(c->cls, index, &info))
+        ok = false;
+    else
+    {
+        switch (tag)
+        {
+        case CONSTANT_Class:
+        case CONSTANT_String:
+        case CONSTANT_MethodType:
+            ok = canonical_operand(c, info.class_i.name_index, CONSTANT_Utf8, &second);
+            break;
+        case CONSTANT_NameAndType:
+            ok = canonical_operand(c, info.ref_i.class_index, CONSTANT_Utf8, &first) &&
+                 canonical_operand(c, info.ref_i.name_and_type_index, CONSTANT_Utf8, &second);
+            break;
+        case CONSTANT_Fieldref:
+        case CONSTANT_Methodref:
+        case CONSTANT_InterfaceMethodref:
+            ok = canonical_operand(c, info.ref_i.class_index, CONSTANT_Class, &first) &&
+                 canonical_operand(c, info.ref_i.name_and_type_index, CONSTANT_NameAndType, &second);
+            break;
+        case CONSTANT_InvokeDynamic: // the bootstrap method is no constant
+            first = info.invoke_dynamic_i.bootstrap_method_attr_index;
+            ok = canonical_operand(c, info.invoke_dynamic_i.name_and_type_index, CONSTANT_NameAndType, &second);
+            break;
+        case CONSTANT_MethodHandle: // neither is the reference kind
+            first = info.method_handle_i.reference_kind;
+            ok = canonical_operand(c, info.method_handle_i.reference_index, CONSTANT_Methodref, &second);
+            break;
+        case CONSTANT_Integer:
+        case CONSTANT_Float:
+            first = info.int_float_i.bytes >> 16;
+            second = info.int_float_i.bytes & 0xffff;
+            break;
+        case CONSTANT_Long:
+        case CONSTANT_Double:
+            first = info.long_double_i.high_bytes >> 16;
+            second = info.long_double_i.high_bytes & 0xffff;
+            c->values[index] = info.long_double_i.low_bytes; // the gap slot is free
+            break;
+        }
+    }
+
+    if (!ok)
+        snprintf(c->kept, COMPACT_KEPT_MAX, "bad operand of constant #%u", index);
+    c->values[index - 1] = first << 16 | second;
+    return ok;
+}
+
+static uint64_t constant_hash(const compactor *c, uint16_t index)
+{
+    const uint8_t tag = c->cls->tags[index - 1];
+    const uint8_t *entry = c->cls->data + c->entries[index - 1];
+    uint32_t key[3] = {tag, c->values[index - 1], 0};
+
+    if (tag == CONSTANT_Utf8)
+        return hash_class_data(entry + 3, read_u2(entry + 1));
+    if (tag == CONSTANT_Long || tag == CONSTANT_Double)
+        key[2] = c->values[index];
+    return hash_class_data((const uint8_t *)key, sizeof(key));
+}
+
+static bool same_constant(const compactor *c, uint16_t a, uint16_t b)
+{
+    const uint8_t tag = c->cls->tags[a - 1];
+
+    if (tag != c->cls->tags[b - 1] || c->values[a - 1] != c->values[b - 1])
+        return false;
+
+    if (tag == CONSTANT_Long || tag == CONSTANT_Double)
+        return c->values[a] == c->values[b];
+
+    if (tag == CONSTANT_Utf8)
+    {
+        const uint8_t *x = c->cls->data + c->entries[a - 1], *y = c->cls->data + c->entries[b - 1];
+        return read_u2(x + 1) == read_u2(y + 1) && memcmp(x + 3, y + 3, read_u2(x + 1)) == 0;
+    }
+    return true;
+}
+
+/**
+ * Finds the first constant equal to each constant, level by level
+ *
+ * @param c compactor
+ * @return false if an operand is not the constant it should be
+ */
+static bool merge_constants(compactor *c)
+{
+    const uint16_t count = c->cls->constant_pool_count;
+    uint32_t slot_count = 16;
+
+    while (slot_count < (uint32_t)count * 2)
+        slot_count *= 2;
+
+    uint16_t *slots = arena_calloc(c->cls->arena, slot_count, sizeof(uint16_t)); // index, 0 for a free slot
+
+    for (int level = 0; level <= 3; level++)
+    {
+        for (uint32_t i = 1; i < count; i++)
+        {
+            const uint8_t tag = c->cls->tags[i - 1];
+
+            if (!tag || constant_level(tag) != level)
+                continue;
+            if (!canonical_value(c, (uint16_t)i))
+                return false;
+
+            uint32_t slot = (uint32_t)constant_hash(c, (uint16_t)i) & (slot_count - 1);
+            while (slots[slot] && !same_constant(c, slots[slot], (uint16_t)i))
+                slot = (slot + 1) & (slot_count - 1);
+
+            if (!slots[slot])
+                slots[slot] = (uint16_t)i;
+            c->canonical[i - 1] = slots[slot];
+        }
+    }
+    return true;
+}
+
+/**
+ * Marks the operands of a used constant as used
+ */
+static void mark_operands(compactor *c, uint16_t index)
+{
+    const uint32_t value = c->values[index - 1];
+
+    switch (c->cls->tags[index - 1])
+    {
+    case CONSTANT_NameAndType:
+    case CONSTANT_Fieldref:
+    case CONSTANT_Methodref:
+    case CONSTANT_InterfaceMethodref:
+        c->used[(value >> 16) - 1] = true;
+        c->used[(value & 0xffff) - 1] = true;
+        break;
+    case CONSTANT_Class:
+    case CONSTANT_String:
+    case CONSTANT_MethodType:
+    case CONSTANT_InvokeDynamic:
+    case CONSTANT_MethodHandle:
+        c->used[(value & 0xffff) - 1] = true;
+        break;
+    }
+}
+
+/**
+ * Marks or renumbers one constant index found in the class data
+ *
+ * @param c compactor, renumbers once it has an output
+ * @param offset of the index in the class data
+ * @param width 1 for an ldc operand, 2 otherwise
+ * @param optional whether 0, no constant, is allowed
+ * @return false for an index that is no constant
+ */
+static bool use_index(compactor *c, size_t offset, int width, bool optional)
+{
+    const uint8_t *p = c->cls->data + offset;
+    const uint16_t index = width == 1 ? p[0] : read_u2(p);
+
+    if (!index && optional)
+        return true;
+    if (!constant_tag(c->cls, index))
+        return false;
+
+    if (!c->output)
+        c->used[c->canonical[index - 1] - 1] = true;
+    else if (width == 1)
+        c->output[offset + c->shift] = (uint8_t)c->renumbered[index - 1];
+    else
+        write_u2(c->output + offset + c->shift, c->renumbered[index - 1]);
+    return true;
+}
+
+/**
+ * Reads a u2 constant index, see use_index
+ */
+static bool read_index(compactor *c, byte_reader *reader, bool optional)
+{
+    return skip(reader, 2) && use_index(c, reader->pos - 2, 2, optional);
+}
+
+static bool walk_attributes(compactor *c, byte_reader *reader);
+
+static bool walk_nothing(compactor *c, byte_reader *reader)
+{
+    (void)c;
+    reader->pos = reader->size;
+    return true;
+}
+
+static bool walk_index(compactor *c, byte_reader *reader)
+{
+    return read_index(c, reader, false);
+}
+
+static bool walk_index_list(compactor *c, byte_reader *reader)
+{
+    uint16_t count;
+
+    if (!parse_u2(reader, &count))
+        return false;
+    for (int i = 0; i < count; i++)
+    {
+        if (!read_index(c, reader, false))
+            return false;
+    }
+    return true;
+}
+
+static bool walk_code(compactor *c, byte_reader *reader)
+{
+    uint32_t code_length;
+    uint16_t count;
+    instruction ins;
+
+    if (!skip(reader, 4) || !parse_u4(reader, &code_length) || reader->size - reader->pos < code_length)
+        return false;
+
+    const uint8_t *code = reader->data + reader->pos;
+    for (uint32_t pc = 0; pc < code_length; pc += ins.length)
+    {
+        if (!decode_instruction(code, code_length, pc, &ins))
+            return false;
+        if (ins.wide)
+            continue;
+
+        switch (opcodes[ins.opcode].kind)
+        {
+        case OPERAND_CP1:
+            if (!use_index(c, reader->pos + pc + 1, 1, false))
+                return false;
+            break;
+        case OPERAND_CP2:
+        case OPERAND_INVOKEINTERFACE:
+        case OPERAND_INVOKEDYNAMIC:
+        case OPERAND_MULTIANEWARRAY:
+            if (!use_index(c, reader->pos + pc + 1, 2, false))
+                return false;
+            break;
+        }
+    }
+    reader->pos += code_length;
+
+    // Exception table: start_pc, end_pc, handler_pc, catch_type (0 catches all)
+    if (!parse_u2(reader, &count))
+        return false;
+    for (int i = 0; i < count; i++)
+    {
+        if (!skip(reader, 6) || !read_index(c, reader, true))
+            return false;
+    }
+    return walk_attributes(c, reader);
+}
+
+static bool walk_verification_types(compactor *c, byte_reader *reader, int count)
+{
+    for (int i = 0; i < count; i++)
+    {
+        uint8_t tag;
+
+        if (!parse_u1(reader, &tag) || tag > 8)
+            return false;
+        if (tag == 7 && !read_index(c, reader, false)) // Object
+            return false;
+        if (tag == 8 && !skip(reader, 2)) // Uninitialized, offset of the new
+            return false;
+    }
+    return true;
+}
+
+static bool walk_stack_map(compactor *c, byte_reader *reader)
+{
+    uint16_t count, locals, stack;
+
+    if (!parse_u2(reader, &count))
+        return false;
+    for (int i = 0; i < count; i++)
+    {
+        uint8_t type;
+        bool ok = parse_u1(reader, &type);
+
+        if (!ok || (type >= 128 && type < 247)) // reserved
+            return false;
+        if (type < 64) // same_frame
+            continue;
+
+        if (type < 128) // same_locals_1_stack_item_frame
+            ok = walk_verification_types(c, reader, 1);
+        else if (type == 247) // same_locals_1_stack_item_frame_extended
+            ok = skip(reader, 2) && walk_verification_types(c, reader, 1);
+        else if (type < 252) // chop_frame, same_frame_extended
+            ok = skip(reader, 2);
+        else if (type < 255) // append_frame
+            ok = skip(reader, 2) && walk_verification_types(c, reader, type - 251);
+        else // full_frame
+            ok = skip(reader, 2) && parse_u2(reader, &locals) && walk_verification_types(c, reader, locals) &&
+                 parse_u2(reader, &stack) && walk_verification_types(c, reader, stack);
+        if (!ok)
+            return false;
+    }
+    return true;
+}
+
+static bool walk_inner_classes(compactor *c, byte_reader *reader)
+{
+    uint16_t count;
+
+    if (!parse_u2(reader, &count))
+        return false;
+    for (int i = 0; i < count; i++)
+    {
+        // Inner class, outer class and simple name, the last two are 0 for anonymous classes
+        if (!read_index(c, reader, false) || !read_index(c, reader, true) || !read_index(c, reader, true) ||
+            !skip(reader, 2))
+            return false;
+    }
+    return true;
+}
+
+static bool walk_enclosing_method(compactor *c, byte_reader *reader)
+{
+    return read_index(c, reader, false) && read_index(c, reader, true);
+}
+
+static bool walk_local_variables(compactor *c, byte_reader *reader)
+{
+    uint16_t count;
+
+    if (!parse_u2(reader, &count))
+        return false;
+    for (int i = 0; i < count; i++)
+    {
+        // start_pc, length, name, descriptor or signature, index
+        if (!skip(reader, 4) || !read_index(c, reader, false) || !read_index(c, reader, false) || !skip(reader, 2))
+            return false;
+    }
+    return true;
+}
+
+static bool walk_annotation(compactor *c, byte_reader *reader, int depth);
+
+static bool walk_element_value(compactor *c, byte_reader *reader, int depth)
+{
+    uint8_t tag;
+    uint16_t count;
+
+    if (depth > COMPACT_MAX_DEPTH || !parse_u1(reader, &tag))
+        return false;
+
+    switch (tag)
+    {
+    case 'B':
+    case 'C':
+    case 'D':
+    case 'F':
+    case 'I':
+    case 'J':
+    case 'S':
+    case 'Z':
+    case 's':
+    case 'c':
+        return read_index(c, reader, false);
+    case 'e': // type name, constant name
+        return read_index(c, reader, false) && read_index(c, reader, false);
+    case '@':
+        return walk_annotation(c, reader, depth + 1);
+    case '[':
+        if (!parse_u2(reader, &count))
+            return false;
+        for (int i = 0; i < count; i++)
+        {
+            if (!walk_element_value(c, reader, depth + 1))
+                return false;
+        }
+        return true;
+    default:
+        return false;
+    }
+}
+
+static bool walk_annotation(compactor *c, byte_reader *reader, int depth)
+{
+    uint16_t count;
+
+    if (!read_index(c, reader, false) || !parse_u2(reader, &count))
+        return false;
+    for (int i = 0; i < count; i++)
+    {
+        if (!read_index(c, reader, false) || !walk_element_value(c, reader, depth))
+            return false;
+    }
+    return true;
+}
+
+static bool walk_annotations(compactor *c, byte_reader *reader)
+{
+    uint16_t count;
+
+    if (!parse_u2(reader, &count))
+        return false;
+    for (int i = 0; i < count; i++)
+    {
+        if (!walk_annotation(c, reader, 0))
+            return false;
+    }
+    return true;
+}
+
+static bool walk_parameter_annotations(compactor *c, byte_reader *reader)
+{
+    uint8_t count;
+
+    if (!parse_u1(reader, &count))
+        return false;
+    for (int i = 0; i < count; i++)
+    {
+        if (!walk_annotations(c, reader))
+            return false;
+    }
+    return true;
+}
+
+static bool walk_annotation_default(compactor *c, byte_reader *reader)
+{
+    return walk_element_value(c, reader, 0);
+}
+
+static bool walk_type_annotations(compactor *c, byte_reader *reader)
+{
+    uint16_t count, length;
+    uint8_t target, path_length;
+
+    if (!parse_u2(reader, &count))
+        return false;
+    for (int i = 0; i < count; i++)
+    {
+        bool ok = parse_u1(reader, &target);
+
+        // target_info, no constants in any of them
+        switch (target)
+        {
+        case 0x00: // type parameter
+        case 0x01:
+        case 0x16: // formal parameter
+            ok = ok && skip(reader, 1);
+            break;
+        case 0x10: // supertype
+        case 0x17: // throws
+        case 0x42: // catch
+        case 0x43: // offset
+        case 0x44:
+        case 0x45:
+        case 0x46:
+            ok = ok && skip(reader, 2);
+            break;
+        case 0x11: // type parameter bound
+        case 0x12:
+            ok = ok && skip(reader, 2);
+            break;
+        case 0x47: // type argument
+        case 0x48:
+        case 0x49:
+        case 0x4a:
+        case 0x4b:
+            ok = ok && skip(reader, 3);
+            break;
+        case 0x13: // empty
+        case 0x14:
+        case 0x15:
+            break;
+        case 0x40: // local variable
+        case 0x41:
+            ok = ok && parse_u2(reader, &length) && skip(reader, (size_t)length * 6);
+            break;
+        default:
+            return false;
+        }
+
+        ok = ok && parse_u1(reader, &path_length) && skip(reader, (size_t)path_length * 2) && walk_annotation(c, reader, 0);
+        if (!ok)
+            return false;
+    }
+    return true;
+}
+
+static bool walk_bootstrap_methods(compactor *c, byte_reader *reader)
+{
+    uint16_t count, arguments;
+
+    if (!parse_u2(reader, &count))
+        return false;
+    for (int i = 0; i < count; i++)
+    {
+        if (!read_index(c, reader, false) || !parse_u2(reader, &arguments))
+            return false;
+        for (int j = 0; j < arguments; j++)
+        {
+            if (!read_index(c, reader, false))
+                return false;
+        }
+    }
+    return true;
+}
+
+static bool walk_method_parameters(compactor *c, byte_reader *reader)
+{
+    uint8_t count;
+
+    if (!parse_u1(reader, &count))
+        return false;
+    for (int i = 0; i < count; i++)
+    {
+        if (!read_index(c, reader, true) || !skip(reader, 2)) // name, 0 for none; access flags
+            return false;
+    }
+    return true;
+}
+
+static bool walk_record(compactor *c, byte_reader *reader)
+{
+    uint16_t count;
+
+    if (!parse_u2(reader, &count))
+        return false;
+    for (int i = 0; i < count; i++)
+    {
+        if (!read_index(c, reader, false) || !read_index(c, reader, false) || !walk_attributes(c, reader))
+            return false;
+    }
+    return true;
+}
+
+/**
+ * Attributes whose constant indices are known, all of JVMS 4.7
+ * that can appear in a class without Module constants
+ */
+static const struct attribute_kind_s
+{
+    const char *name;
+    attribute_walker walk;
+
+} attribute_kinds[] =
+{
+    {"Code", walk_code},
+    {"ConstantValue", walk_index},
+    {"StackMapTable", walk_stack_map},
+    {"Exceptions", walk_index_list},
+    {"InnerClasses", walk_inner_classes},
+    {"EnclosingMethod", walk_enclosing_method},
+    {"Synthetic", walk_nothing},
+    {"Deprecated", walk_nothing},
+    {"Signature", walk_index},
+    {"SourceFile", walk_index},
+    {"SourceDebugExtension", walk_nothing},
+    {"LineNumberTable", walk_nothing},
+    {"LocalVariableTable", walk_local_variables},
+    {"LocalVariableTypeTable", walk_local_variables},
+    {"RuntimeVisibleAnnotations", walk_annotations},
+    {"RuntimeInvisibleAnnotations", walk_annotations},
+    {"RuntimeVisibleParameterAnnotations", walk_parameter_annotations},
+    {"RuntimeInvisibleParameterAnnotations", walk_parameter_annotations},
+    {"RuntimeVisibleTypeAnnotations", walk_type_annotations},
+    {"RuntimeInvisibleTypeAnnotations", walk_type_annotations},
+    {"AnnotationDefault", walk_annotation_default},
+    {"BootstrapMethods", walk_bootstrap_methods},
+    {"MethodParameters", walk_method_parameters},
+    {"NestHost", walk_index},
+    {"NestMembers", walk_index_list},
+    {"PermittedSubclasses", walk_index_list},
+    {"Record", walk_record},
+    {"CharacterRangeTable", walk_nothing}, // javac -Xjcov, code offsets and source positions only
+};
+
+static attribute_walker find_walker(const compactor *c, utf_view name)
+{
+    for (size_t i = 0; i < sizeof(attribute_kinds) / sizeof(attribute_kinds[0]); i++)
+    {
+        if (strlen(attribute_kinds[i].name) == name.length && memcmp(attribute_kinds[i].name, name.bytes, name.length) == 0)
+            return attribute_kinds[i].walk;
+    }
+
+    snprintf(c->kept, COMPACT_KEPT_MAX, "unknown attribute %.*s", name.length > 60 ? 60 : (int)name.length,
+             name.bytes);
+    return NULL;
+}
+
+/**
+ * Walks a table of attributes, the name of each and what is in it
+ *
+ * @param c compactor
+ * @param reader positioned at attributes_count
+ * @return false for an attribute not known or malformed, see kept
+ */
+static bool walk_attributes(compactor *c, byte_reader *reader)
+{
+    uint16_t count, name_index;
+    uint32_t length;
+
+    if (!parse_u2(reader, &count))
+        return false;
+    for (int i = 0; i < count; i++)
+    {
+        if (!parse_u2(reader, &name_index) || !parse_u4(reader, &length) || reader->size - reader->pos < length ||
+            constant_tag(c->cls, name_index) != CONSTANT_Utf8)
+            return false;
+        use_index(c, reader->pos - 6, 2, false);
+
+        // The names are plain ASCII, the raw text is the text
+        const uint8_t *entry = c->cls->data + c->entries[name_index - 1];
+        const utf_view name = {(const char *)entry + 3, read_u2(entry + 1)};
+        const attribute_walker walk = find_walker(c, name);
+        byte_reader body = {reader->data, reader->pos + length, reader->pos};
+
+        if (!walk)
+            return false;
+        if (!walk(c, &body) || body.pos != body.size)
+        {
+            if (!c->kept[0])
+                snprintf(c->kept, COMPACT_KEPT_MAX, "malformed %.*s attribute",
+                         name.length > 60 ? 60 : (int)name.length, name.bytes);
+            return false;
+        }
+        reader->pos += length;
+    }
+    return true;
+}
+
+/**
+ * Walks everything after the constant pool
+ *
+ * @param c compactor
+ * @return false for an attribute not known or malformed, see kept
+ */
+static bool walk_class(compactor *c)
+{
+    byte_reader reader = {c->cls->data, c->cls->size, c->cls->pool_end};
+    uint16_t count;
+
+    // access_flags, this_class, super_class (0 for java/lang/Object), interfaces
+    if (!skip(&reader, 2) || !read_index(c, &reader, false) || !read_index(c, &reader, true) || !walk_index_list(c, &reader))
+        return false;
+
+    for (int members = 0; members < 2; members++) // fields, then methods
+    {
+        if (!parse_u2(&reader, &count))
+            return false;
+        for (int i = 0; i < count; i++)
+        {
+            if (!skip(&reader, 2) || !read_index(c, &reader, false) || !read_index(c, &reader, false) ||
+                !walk_attributes(c, &reader))
+                return false;
+        }
+    }
+    return walk_attributes(c, &reader);
+}
+
+/**
+ * Writes a kept constant with its operands renumbered
+ */
+static void write_constant(const compactor *c, out_buffer *out, uint16_t index)
+{
+    const uint8_t *entry = c->cls->data + c->entries[index - 1];
+    uint8_t bytes[5] = {entry[0]};
+    constant_info info;
+
+    switch (entry[0])
+    {
+    case CONSTANT_Class:
+    case CONSTANT_String:
+    case CONSTANT_MethodType:
+        get_constant(c->cls, index, &info); // checked by canonical_value
+        write_u2(bytes + 1, c->renumbered[info.class_i.name_index - 1]);
+        out_bytes(out, (const char *)bytes, 3);
+        break;
+    case CONSTANT_NameAndType:
+    case CONSTANT_Fieldref:
+    case CONSTANT_Methodref:
+    case CONSTANT_InterfaceMethodref:
+        get_constant(c->cls, index, &info);
+        write_u2(bytes + 1, c->renumbered[info.ref_i.class_index - 1]);
+        write_u2(bytes + 3, c->renumbered[info.ref_i.name_and_type_index - 1]);
+        out_bytes(out, (const char *)bytes, 5);
+        break;
+    case CONSTANT_InvokeDynamic:
+        get_constant(c->cls, index, &info);
+        write_u2(bytes + 1, info.invoke_dynamic_i.bootstrap_method_attr_index);
+        write_u2(bytes + 3, c->renumbered[info.invoke_dynamic_i.name_and_type_index - 1]);
+        out_bytes(out, (const char *)bytes, 5);
+        break;
+    case CONSTANT_MethodHandle:
+        get_constant(c->cls, index, &info);
+        bytes[1] = info.method_handle_i.reference_kind;
+        write_u2(bytes + 2, c->renumbered[info.method_handle_i.reference_index - 1]);
+        out_bytes(out, (const char *)bytes, 4);
+        break;
+    default: // Utf8 and numbers as they were
+        out_bytes(out, (const char *)entry, entry_size(entry));
+        break;
+    }
+}
+
+/**
+ * Writes a class with the constants nothing refers to removed and
+ * equal constants merged, or as it was if that can't be done safely
+ *
+ * @param cls class parsed from its whole file, lazily is enough
+ * @param out to append the class file to
+ * @param result to fill
+ */
+void compact_class(class *cls, out_buffer *out, compact_result *result)
+{
+    const uint16_t count = cls->constant_pool_count;
+    const size_t slots = (size_t)count + 1;
+    compactor c = {0};
+    uint16_t next = 1;
+
+    memset(result, 0, sizeof(*result));
+    c.cls = cls;
+    result->old_size = result->new_size = cls->size;
+    c.kept = result->kept;
+    c.entries = arena_calloc(cls->arena, slots, sizeof(uint32_t));
+    c.values = arena_calloc(cls->arena, slots, sizeof(uint32_t));
+    c.canonical = arena_calloc(cls->arena, slots, sizeof(uint16_t));
+    c.renumbered = arena_calloc(cls->arena, slots, sizeof(uint16_t));
+    c.used = arena_calloc(cls->arena, slots, sizeof(bool));
+
+    // Offset of every entry, the pool parsed so they are all there
+    for (uint32_t i = 1, pos = 10; i < count; i++)
+    {
+        c.entries[i - 1] = pos;
+        pos += entry_size(cls->data + pos);
+        if (cls->tags[i - 1] == CONSTANT_Long || cls->tags[i - 1] == CONSTANT_Double)
+            i++;
+    }
+
+    if (!merge_constants(&c) || !walk_class(&c))
+    {
+        if (!result->kept[0])
+            snprintf(result->kept, sizeof(result->kept), "malformed after the constant pool");
+        out_bytes(out, (const char *)cls->data, cls->size);
+        return;
+    }
+
+    for (int level = 3; level > 0; level--)
+    {
+        for (uint32_t i = 1; i < count; i++)
+        {
+            if (c.used[i - 1] && constant_level(cls->tags[i - 1]) == level)
+                mark_operands(&c, (uint16_t)i);
+        }
+    }
+
+    // New indices in the old order, duplicates get the one of their first
+    for (uint32_t i = 1; i < count; i++)
+    {
+        const uint8_t tag = cls->tags[i - 1];
+        const uint16_t first = c.canonical[i - 1];
+
+        if (!tag)
+            continue;
+        if (first != i)
+        {
+            c.renumbered[i - 1] = c.renumbered[first - 1];
+            if (c.used[first - 1])
+                result->duplicates++;
+            else
+                result->unreferenced++;
+        }
+        else if (!c.used[i - 1])
+            result->unreferenced++;
+        else
+        {
+            c.renumbered[i - 1] = next;
+            next += tag == CONSTANT_Long || tag == CONSTANT_Double ? 2 : 1;
+        }
+    }
+
+    if (!result->unreferenced && !result->duplicates)
+    {
+        out_bytes(out, (const char *)cls->data, cls->size);
+        return;
+    }
+
+    const size_t start = out->length;
+    uint8_t pool_count[2];
+
+    write_u2(pool_count, next);
+    out_bytes(out, (const char *)cls->data, 8); // magic, minor and major version
+    out_bytes(out, (const char *)pool_count, 2);
+    for (uint32_t i = 1; i < count; i++)
+    {
+        if (cls->tags[i - 1] && c.canonical[i - 1] == i && c.used[i - 1])
+            write_constant(&c, out, (uint16_t)i);
+    }
+
+    const size_t pool_end = out->length - start;
+    out_bytes(out, (const char *)cls->data + cls->pool_end, cls->size - cls->pool_end);
+
+    // Same walk again, now writing the new indices into the copy
+    c.output = (uint8_t *)out->data + start;
+    c.shift = (ptrdiff_t)pool_end - (ptrdiff_t)cls->pool_end;
+    walk_class(&c);
+
+    result->new_size = out->length - start;
+}
+
+/**
+ * Writes a compacted class below the output directory, through a
+ * temporary file, so a class compacted in place is replaced whole
+ *
+ * @param directory to write below
+ * @param relative path of the class inside it
+ * @param out class file
+ * @return false on errors (see class_error)
+ */
+static bool write_class(const char *directory, const char *relative, const out_buffer *out)
+{
+    static unsigned sequence;
+    char *path, *temp;
+    bool ok = false;
+
+    if (!*relative || relative[0] == '/' || strcmp(relative, "..") == 0 || strncmp(relative, "../", 3) == 0 ||
+        strstr(relative, "/../") || (strlen(relative) >= 3 && strcmp(relative + strlen(relative) - 3, "/..") == 0))
+    {
+        set_class_error("Won't write outside of %s", directory);
+        return false;
+    }
+
+    if (asprintf(&path, "%s/%s", directory, relative) < 0)
+        return false;
+
+    // Parent directories, the output one too; other workers may be making them as well
+    for (char *slash = strchr(path + 1, '/'); slash; slash = strchr(slash + 1, '/'))
+    {
+        *slash = '\0';
+        const bool made = mkdir(path, 0777) == 0 || errno == EEXIST;
+        *slash = '/';
+
+        if (!made)
+        {
+            set_class_error("Can't create the directory of %s: %s", path, strerror(errno));
+            free(path);
+            return false;
+        }
+    }
+
+    if (asprintf(&temp, "%s.%d.%u.tmp", path, (int)getpid(), __atomic_fetch_add(&sequence, 1, __ATOMIC_RELAXED)) < 0)
+    {
+        free(path);
+        return false;
+    }
+
+    const int fd = open(temp, O_WRONLY | O_CREAT | O_EXCL | O_CLOEXEC, 0644);
+    if (fd >= 0)
+    {
+        ok = write(fd, out->data, out->length) == (ssize_t)out->length;
+        ok = close(fd) == 0 && ok;
+        ok = ok && rename(temp, path) == 0;
+    }
+
+    if (!ok)
+    {
+        set_class_error("Can't write %s: %s", path, strerror(errno));
+        if (fd >= 0)
+            unlink(temp);
+    }
+    free(temp);
+    free(path);
+    return ok;
+}
+
+/**
+ * Compacts one input and writes it out
+ *
+ * @param context run
+ * @param index of the input
+ * @param worker running the task
+ */
+static void compact_input(void *context, size_t index, int worker)
+{
+    compact_run *run = context;
+    arena *a = run->arenas + worker;
+    out_buffer *out = run->outputs + worker;
+    class *cls = parse_class_input(run->inputs + index, a, PARSE_LAZY, NULL);
+
+    out->length = 0;
+    if (!cls)
+        run->errors[index] = strdup(class_error());
+    else
+    {
+        compact_class(cls, out, run->results + index);
+        if (run->directory && !write_class(run->directory, run->relative[index], out))
+            run->errors[index] = strdup(class_error());
+    }
+
+    free_class(cls);
+    arena_reset(a);
+}
+
+/**
+ * Compacts the constant pools of classes, directory trees and
+ * archives and reports the bytes saved
+ *
+ * @param paths classes, directories or archives
+ * @param path_count number of paths
+ * @param glob filter for archive entries, NULL for all
+ * @param directory to write the compacted classes below, NULL to only report
+ * @param options threads of the run
+ * @return number of inputs that couldn't be compacted or written
+ */
+int run_compaction(char **paths, int path_count, const char *glob, const char *directory, const batch_options *options)
+{
+    file_list files = {0};
+    compact_run run = {0};
+    int thread_count = options->thread_count < 1 ? 1 : options->thread_count;
+    size_t compacted = 0, kept = 0, failed = 0;
+    uint64_t old_total = 0, new_total = 0;
+    out_buffer out;
+
+    // The inputs of a path are added one after another
+    size_t *ends = calloc(path_count ? path_count : 1, sizeof(size_t));
+    files.glob = glob;
+    for (int i = 0; i < path_count; i++)
+    {
+        add_path(&files, paths[i]);
+        ends[i] = files.count;
+    }
+
+    run.relative = calloc(files.count ? files.count : 1, sizeof(char *));
+    for (size_t i = 0, path = 0; i < files.count; i++)
+    {
+        while (i >= ends[path])
+            path++;
+        run.relative[i] = relative_name(files.inputs[i].name, paths[path]);
+    }
+    free(ends);
+
+    run.inputs = files.inputs;
+    run.directory = directory;
+    run.results = calloc(files.count ? files.count : 1, sizeof(compact_result));
+    run.errors = calloc(files.count ? files.count : 1, sizeof(char *));
+    run.arenas = calloc(thread_count, sizeof(arena));
+    run.outputs = calloc(thread_count, sizeof(out_buffer));
+    for (int i = 0; i < thread_count; i++)
+    {
+        arena_init(run.arenas + i, 1 << 16);
+        out_init(run.outputs + i, -1);
+    }
+
+    run_thread_pool(files.count, thread_count, compact_input, &run);
+
+    out_init(&out, STDOUT_FILENO);
+    for (size_t i = 0; i < files.count; i++)
+    {
+        const compact_result *r = run.results + i;
+
+        if (run.errors[i])
+        {
+            out_flush(&out); // keep the order of output and errors
+            fprintf(stderr, "%s: %s\n", files.inputs[i].name, run.errors[i]);
+            free(run.errors[i]);
+            failed++;
+            continue;
+        }
+
+        out_str(&out, files.inputs[i].name);
+        if (r->kept[0])
+            out_format(&out, ": %zu bytes, left as it is: %s\n", r->old_size, r->kept);
+        else if (r->new_size == r->old_size)
+            out_format(&out, ": %zu bytes, nothing to remove\n", r->old_size);
+        else
+            out_format(&out, ": %zu -> %zu bytes (-%.1f%%), %u unreferenced and %u duplicate constants removed\n",
+                       r->old_size, r->new_size, 100.0 * (r->old_size - r->new_size) / r->old_size, r->unreferenced,
+                       r->duplicates);
+
+        compacted += !r->kept[0] && r->new_size < r->old_size;
+        kept += r->kept[0] != '\0';
+        old_total += r->old_size;
+        new_total += r->new_size;
+    }
+    out_flush(&out);
+    out_free(&out);
+
+    fprintf(stderr, "Compaction: %zu classes, %zu smaller, %zu left as they were, %zu failed; %llu -> %llu bytes, %llu saved (%.1f%%)\n",
+            files.count, compacted, kept, failed, (unsigned long long)old_total, (unsigned long long)new_total,
+            (unsigned long long)(old_total - new_total), old_total ? 100.0 * (old_total - new_total) / old_total : 0.0);
+
+    for (int i = 0; i < thread_count; i++)
+    {
+        arena_release(run.arenas + i);
+        out_free(run.outputs + i);
+    }
+    free(run.arenas);
+    free(run.outputs);
+    free(run.results);
+    free(run.errors);
+    free(run.relative);
+    free_file_list(&files);
+
+    return (int)failed;
+}
@@ -0,0 +1,49 @@
+#ifndef POOL_COMPACT_H
+#define POOL_COMPACT_H
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "arena.h"
+#include "batch.h"
+#include "class_reader.h"
+#include "output.h"
+
+#define COMPACT_MAX_DEPTH 64 // nesting of annotation values walked before a class is left as it is
+#define COMPACT_KEPT_MAX 96  // length of the reason a class was left as it is
+
+/**
+ * What compacting one class did
+ */
+typedef struct compact_result_s
+{
+    size_t old_size;
+    size_t new_size;
+    uint32_t unreferenced; // constants nothing referred to
+    uint32_t duplicates;   // constants merged into an equal one before them
+    char kept[COMPACT_KEPT_MAX]; // why the class was left as it is, empty if it was compacted
+
+} compact_result;
+
+/**
+ * Offset in the class data of every constant and what the
+ * compaction decided about it, while one class is compacted
+ */
+typedef struct compactor_s
+{
+    class *cls;
+    uint32_t *entries;     // offset of the entry of each constant, by index - 1
+    uint32_t *values;      // payload with the operands made canonical, by index - 1
+    uint16_t *canonical;   // first constant equal to each one, by index - 1
+    uint16_t *renumbered;  // index in the compacted pool, by index - 1
+    bool *used;            // by index - 1, set for canonical constants only
+    uint8_t *output;       // copy of the class being renumbered, NULL while marking
+    ptrdiff_t shift;       // offset in the output minus offset in the class data
+    char *kept;            // of the result
+
+} compactor;
+
+void compact_class(class *cls, out_buffer *out, compact_result *result);
+int run_compaction(char **paths, int path_count, const char *glob, const char *directory, const batch_options *options);
+
+#endif
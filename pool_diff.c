@@ -0,0 +1,538 @@
+/**
+ * Semantic diff of constant pools.
+ *
+ * Recompiling a class renumbers its pool, so comparing dumps line
+ * by line reports nearly everything. Here every constant is reduced
+ * to its tag and resolved value (texts of the Utf8 entries it leads
+ * to, numbers, reference kinds) and the two pools are matched by a
+ * hash of that, whatever the indices. What is left is removed or
+ * added; a removed and an added constant naming the same member
+ * (owner and name of a Fieldref, Methodref or MethodHandle, name of
+ * a NameAndType or InvokeDynamic) are reported as one change.
+ * Both steps are one pass over each pool with a hash table.
+ *
+ * Two directory trees or archives are compared class by class,
+ * paired by their path inside the tree, on the thread pool. Pools
+ * that are byte for byte the same are not even resolved.
+ *
+ */
+
+#define _GNU_SOURCE
+#include "pool_diff.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "parse_cache.h"
+#include "pretty_printer.h"
+#include "thread_pool.h"
+
+#define VALUE_TEXTS 3
+
+/**
+ * Resolved value of a constant, what two constants must share to
+ * be the same
+ */
+typedef struct constant_value_s
+{
+    uint8_t tag;
+    uint8_t text_count;
+    uint8_t identity_count; // leading texts that name the constant
+    uint32_t numbers[2];    // bits of a number, reference or bootstrap method index
+    utf_view texts[VALUE_TEXTS];
+
+} constant_value;
+
+static inline uint64_t mix_hash(uint64_t hash, uint64_t value)
+{
+    hash = (hash ^ value) * 0x9e3779b97f4a7c15ull;
+    return hash ^ hash >> 29;
+}
+
+/**
+ * Gets the resolved value of a constant
+ *
+ * @param class struct with a loaded pool
+ * @param index of the constant, 1-based
+ * @param value to fill
+ */
+static void get_value(class *cls, uint16_t index, constant_value *value)
+{
+    const resolved_constant *resolved = cls->resolved + index - 1;
+    constant_info info;
+
+    memset(value, 0, sizeof(constant_value));
+    if (!cls->tags[index - 1] || !get_constant(cls, index, &info))
+        return; // Long/Double gap
+    value->tag = info.class_i.tag;
+
+    switch (value->tag)
+    {
+    case CONSTANT_Utf8:
+    case CONSTANT_String:
+    case CONSTANT_Class:
+        value->texts[0] = constant_utf(cls, resolved->utf);
+        value->text_count = 1;
+        break;
+    case CONSTANT_MethodHandle:
+        value->numbers[0] = info.method_handle_i.reference_kind;
+        // fall through
+    case CONSTANT_Fieldref:
+    case CONSTANT_Methodref:
+    case CONSTANT_InterfaceMethodref:
+        value->texts[0] = constant_utf(cls, resolved->owner);
+        value->texts[1] = constant_utf(cls, resolved->name);
+        value->texts[2] = constant_utf(cls, resolved->descriptor);
+        value->text_count = 3;
+        value->identity_count = 2;
+        break;
+    case CONSTANT_InvokeDynamic:
+        value->numbers[0] = info.invoke_dynamic_i.bootstrap_method_attr_index;
+        // fall through
+    case CONSTANT_NameAndType:
+        value->texts[0] = constant_utf(cls, resolved->name);
+        value->texts[1] = constant_utf(cls, resolved->descriptor);
+        value->text_count = 2;
+        value->identity_count = 1;
+        break;
+    case CONSTANT_MethodType:
+        value->texts[0] = constant_utf(cls, resolved->descriptor);
+        value->text_count = 1;
+        break;
+    case CONSTANT_Integer:
+    case CONSTANT_Float:
+        value->numbers[0] = info.int_float_i.bytes;
+        break;
+    case CONSTANT_Long:
+    case CONSTANT_Double:
+        value->numbers[0] = info.long_double_i.high_bytes;
+        value->numbers[1] = info.long_double_i.low_bytes;
+        break;
+    default:
+        break;
+    }
+}
+
+/**
+ * Compares the values of two constants
+ *
+ * @param a first value
+ * @param b second value
+ * @param identity_only compare only the texts that name the constants
+ * @return true if they are equal
+ */
+static bool same_value(const constant_value *a, const constant_value *b, bool identity_only)
+{
+    const int texts = identity_only ? a->identity_count : a->text_count;
+
+    if (a->tag != b->tag)
+        return false;
+    if (!identity_only && (a->numbers[0] != b->numbers[0] || a->numbers[1] != b->numbers[1]))
+        return false;
+
+    for (int t = 0; t < texts; t++)
+    {
+        if (a->texts[t].length != b->texts[t].length ||
+            (a->texts[t].length && memcmp(a->texts[t].bytes, b->texts[t].bytes, a->texts[t].length) != 0))
+            return false;
+    }
+    return true;
+}
+
+static bool same_constant(class *a, uint16_t i, class *b, uint16_t j, bool identity_only)
+{
+    constant_value x, y;
+
+    get_value(a, i, &x);
+    get_value(b, j, &y);
+    return same_value(&x, &y, identity_only);
+}
+
+/**
+ * Reduces every constant of a pool to its hashes
+ *
+ * @param class struct with a loaded pool
+ * @param keys to fill, one per constant
+ * @return number of keys, Long/Double gaps have none
+ */
+static size_t collect_keys(class *cls, pool_key *keys)
+{
+    size_t count = 0;
+
+    for (uint16_t i = 1; i < cls->constant_pool_count; i++)
+    {
+        if (!cls->tags[i - 1])
+            continue;
+
+        constant_value value;
+        pool_key *key = keys + count++;
+        uint64_t hash = mix_hash(0, (uint64_t)cls->tags[i - 1] << 56);
+
+        get_value(cls, i, &value);
+        key->identity = 0;
+        for (int t = 0; t < value.text_count; t++)
+        {
+            hash = mix_hash(hash, value.texts[t].length
+                                      ? hash_class_data((const uint8_t *)value.texts[t].bytes, value.texts[t].length)
+                                      : 0);
+            if (t + 1 == value.identity_count)
+                key->identity = hash ? hash : 1;
+        }
+
+        key->hash = mix_hash(mix_hash(hash, value.numbers[0]), value.numbers[1]);
+        key->index = i;
+        key->partner = 0;
+        key->changed = false;
+    }
+    return count;
+}
+
+/**
+ * Pairs constants of the new pool with unpaired ones of the old pool,
+ * by value or, with identity_only, by the texts naming them
+ *
+ * @param old_cls, old_keys, old_count old pool and its keys
+ * @param new_cls, new_keys, new_count new pool and its keys
+ * @param a arena for the hash table
+ * @param identity_only pair changed constants instead of equal ones
+ */
+static void pair_keys(class *old_cls, pool_key *old_keys, size_t old_count,
+                      class *new_cls, pool_key *new_keys, size_t new_count, arena *a, bool identity_only)
+{
+    uint32_t slot_count = 16;
+
+    while (slot_count < old_count * 2)
+        slot_count *= 2;
+
+    // Open addressing over the unpaired old keys, a slot holds position + 1
+    uint32_t *slots = arena_calloc(a, slot_count, sizeof(uint32_t));
+    const uint32_t mask = slot_count - 1;
+
+    for (size_t k = 0; k < old_count; k++)
+    {
+        const uint64_t hash = identity_only ? old_keys[k].identity : old_keys[k].hash;
+
+        if (old_keys[k].partner || !hash)
+            continue;
+
+        uint32_t slot = (uint32_t)hash & mask;
+        while (slots[slot])
+            slot = (slot + 1) & mask;
+        slots[slot] = (uint32_t)k + 1;
+    }
+
+    for (size_t k = 0; k < new_count; k++)
+    {
+        pool_key *key = new_keys + k;
+        const uint64_t hash = identity_only ? key->identity : key->hash;
+
+        if (key->partner || !hash)
+            continue;
+
+        for (uint32_t slot = (uint32_t)hash & mask; slots[slot]; slot = (slot + 1) & mask)
+        {
+            pool_key *old_key = old_keys + slots[slot] - 1;
+
+            if (!old_key->partner && (identity_only ? old_key->identity : old_key->hash) == hash &&
+                same_constant(old_cls, old_key->index, new_cls, key->index, identity_only))
+            {
+                old_key->partner = key->index;
+                key->partner = old_key->index;
+                old_key->changed = key->changed = identity_only;
+                break;
+            }
+        }
+    }
+}
+
+/**
+ * Print one line of the report: a marker and the constant like javap
+ */
+static void print_diff_line(out_buffer *out, const char *marker, class *cls, uint16_t index)
+{
+    out_str(out, marker);
+    print_constant(out, cls, index - 1);
+}
+
+/**
+ * Compares the pools of two classes by value, independent of indices
+ *
+ * Lines of the report, removed constants in the order of the old pool,
+ * then changed and added ones in the order of the new pool:
+ *   - #n = ...  only in the old pool
+ *   < #n = ...  old value of a changed constant
+ *   > #n = ...  its new value
+ *   + #n = ...  only in the new pool
+ *
+ * @param out report to write to, NULL to only count
+ * @param old_cls class with a loaded pool (see load_constant_pool)
+ * @param new_cls the same
+ * @param a arena for temporary tables
+ * @param diff counts to fill
+ */
+void diff_class_pools(out_buffer *out, class *old_cls, class *new_cls, arena *a, pool_diff *diff)
+{
+    pool_key *old_keys = arena_alloc(a, ((size_t)old_cls->constant_pool_count + 1) * sizeof(pool_key));
+    pool_key *new_keys = arena_alloc(a, ((size_t)new_cls->constant_pool_count + 1) * sizeof(pool_key));
+    const size_t old_count = collect_keys(old_cls, old_keys);
+    const size_t new_count = collect_keys(new_cls, new_keys);
+
+    pair_keys(old_cls, old_keys, old_count, new_cls, new_keys, new_count, a, false);
+    pair_keys(old_cls, old_keys, old_count, new_cls, new_keys, new_count, a, true);
+
+    memset(diff, 0, sizeof(pool_diff));
+    for (size_t k = 0; k < old_count; k++)
+    {
+        if (old_keys[k].partner)
+            continue;
+        diff->removed++;
+        if (out)
+            print_diff_line(out, "- ", old_cls, old_keys[k].index);
+    }
+
+    for (size_t k = 0; k < new_count; k++)
+    {
+        if (!new_keys[k].changed)
+            continue;
+        diff->changed++;
+        if (out)
+        {
+            print_diff_line(out, "< ", old_cls, new_keys[k].partner);
+            print_diff_line(out, "> ", new_cls, new_keys[k].index);
+        }
+    }
+
+    for (size_t k = 0; k < new_count; k++)
+    {
+        if (new_keys[k].partner)
+            continue;
+        diff->added++;
+        if (out)
+            print_diff_line(out, "+ ", new_cls, new_keys[k].index);
+    }
+}
+
+/**
+ * Checks if two pools are the same bytes, which needs no resolving
+ */
+static bool same_pool_bytes(const class *a, const class *b)
+{
+    const size_t start = 8; // magic and versions
+
+    return a->pool_end == b->pool_end && a->pool_end >= start &&
+           memcmp(a->data + start, b->data + start, a->pool_end - start) == 0;
+}
+
+/**
+ * Parses and compares the classes of one pair
+ *
+ * @param context diff being run
+ * @param index of the pair
+ * @param worker running the task
+ */
+static void diff_input_pair(void *context, size_t index, int worker)
+{
+    diff_run *run = context;
+    diff_pair *pair = run->pairs + index;
+    arena *a = run->arenas + worker;
+
+    out_init(&pair->text, -1);
+    if (!pair->old_input || !pair->new_input)
+        return;
+
+    // Lazily, so equal pools are compared before anything is resolved
+    class *old_cls = parse_class_input((class_input *)pair->old_input, a, PARSE_LAZY, NULL);
+    class *new_cls = old_cls ? parse_class_input((class_input *)pair->new_input, a, PARSE_LAZY, NULL) : NULL;
+    const class_input *failed = !old_cls ? pair->old_input : !new_cls ? pair->new_input : NULL;
+
+    if (!failed && !same_pool_bytes(old_cls, new_cls))
+    {
+        if (!load_constant_pool(old_cls))
+            failed = pair->old_input;
+        else if (!load_constant_pool(new_cls))
+            failed = pair->new_input;
+        else
+            diff_class_pools(run->brief ? NULL : &pair->text, old_cls, new_cls, a, &pair->diff);
+    }
+
+    if (failed && asprintf(&pair->error, "%s: %s", failed->name, class_error()) < 0)
+        pair->error = NULL;
+    if (failed && !pair->error)
+        pair->error = strdup(class_error());
+
+    free_class(new_cls);
+    free_class(old_cls);
+    arena_reset(a);
+}
+
+static int compare_pairs(const void *a, const void *b)
+{
+    return strcmp(((const diff_pair *)a)->relative, ((const diff_pair *)b)->relative);
+}
+
+/**
+ * Lists the inputs of one tree as pairs with one side, sorted by path
+ */
+static diff_pair *list_side(const file_list *files, const char *root, bool old_side)
+{
+    diff_pair *pairs = calloc(files->count ? files->count : 1, sizeof(diff_pair));
+
+    for (size_t i = 0; i < files->count; i++)
+    {
+        if (old_side)
+            pairs[i].old_input = files->inputs + i;
+        else
+            pairs[i].new_input = files->inputs + i;
+        pairs[i].relative = relative_name(files->inputs[i].name, root);
+    }
+    qsort(pairs, files->count, sizeof(diff_pair), compare_pairs);
+    return pairs;
+}
+
+/**
+ * Prints the result of one pair the way the run asked for
+ */
+static void print_pair(out_buffer *out, const diff_run *run, const diff_pair *pair)
+{
+    const bool changed = pair->diff.removed || pair->diff.added || pair->diff.changed;
+
+    if (pair->error)
+        return;
+
+    if (run->brief)
+    {
+        if (!pair->old_input || !pair->new_input || changed)
+        {
+            out_str(out, !pair->old_input ? "A " : !pair->new_input ? "D " : "M ");
+            out_str(out, pair->relative);
+            out_char(out, '\n');
+        }
+        return;
+    }
+
+    if (!pair->old_input || !pair->new_input)
+    {
+        out_str(out, "Only in ");
+        out_str(out, pair->old_input ? run->old_path : run->new_path);
+        out_str(out, ": ");
+        out_str(out, pair->relative);
+        out_char(out, '\n');
+    }
+    else if (changed)
+    {
+        out_str(out, "--- ");
+        out_str(out, pair->old_input->name);
+        out_str(out, "\n+++ ");
+        out_str(out, pair->new_input->name);
+        out_char(out, '\n');
+        out_bytes(out, pair->text.data, pair->text.length);
+    }
+}
+
+/**
+ * Compares the constant pools of two classes, or of every class of
+ * two directory trees or archives paired by their path inside them
+ *
+ * @param old_path class, directory or archive
+ * @param new_path class, directory or archive
+ * @param glob filter for archive entries, NULL for all
+ * @param options threads of the run
+ * @param brief print only which classes differ
+ * @return 0 if all pools are the same, 1 if some differ, 2 on errors
+ */
+int run_diff(const char *old_path, const char *new_path, const char *glob, const batch_options *options, bool brief)
+{
+    file_list old_files = {0}, new_files = {0};
+    diff_run run = {old_path, new_path, brief};
+    int thread_count = options->thread_count < 1 ? 1 : options->thread_count;
+    size_t identical = 0, changed = 0, only_old = 0, only_new = 0, failed = 0;
+
+    old_files.glob = new_files.glob = glob;
+    add_path(&old_files, old_path);
+    add_path(&new_files, new_path);
+
+    const bool old_single = old_files.count == 1 && strcmp(old_files.inputs[0].name, old_path) == 0;
+    const bool new_single = new_files.count == 1 && strcmp(new_files.inputs[0].name, new_path) == 0;
+
+    if (old_single != new_single)
+    {
+        fprintf(stderr, "Can't compare a class file with a directory or an archive\n");
+        free_file_list(&old_files);
+        free_file_list(&new_files);
+        return 2;
+    }
+
+    diff_pair *old_side = list_side(&old_files, old_path, true);
+    diff_pair *new_side = list_side(&new_files, new_path, false);
+    size_t o = 0, n = 0;
+
+    // Merge the sorted sides into pairs, single classes always pair up
+    run.pairs = calloc(old_files.count + new_files.count + 1, sizeof(diff_pair));
+    while (o < old_files.count || n < new_files.count)
+    {
+        const int order = old_single                ? 0
+                          : o == old_files.count    ? 1
+                          : n == new_files.count    ? -1
+                                                    : strcmp(old_side[o].relative, new_side[n].relative);
+        diff_pair *pair = run.pairs + run.count++;
+
+        if (order <= 0)
+            *pair = old_side[o++];
+        if (order >= 0)
+        {
+            pair->new_input = new_side[n].new_input;
+            pair->relative = old_single ? new_path : new_side[n].relative;
+            n++;
+        }
+    }
+    free(old_side);
+    free(new_side);
+
+    run.arenas = calloc(thread_count, sizeof(arena));
+    for (int i = 0; i < thread_count; i++)
+        arena_init(run.arenas + i, 1 << 16);
+
+    run_thread_pool(run.count, thread_count, diff_input_pair, &run);
+
+    out_buffer out;
+    out_init(&out, STDOUT_FILENO);
+    for (size_t i = 0; i < run.count; i++)
+    {
+        diff_pair *pair = run.pairs + i;
+
+        print_pair(&out, &run, pair);
+        if (pair->error)
+        {
+            out_flush(&out); // keep the order of output and errors
+            fprintf(stderr, "%s\n", pair->error);
+            failed++;
+        }
+        else if (!pair->old_input)
+            only_new++;
+        else if (!pair->new_input)
+            only_old++;
+        else if (pair->diff.removed || pair->diff.added || pair->diff.changed)
+            changed++;
+        else
+            identical++;
+
+        out_free(&pair->text);
+        free(pair->error);
+    }
+    out_free(&out);
+
+    if (!old_single)
+        fprintf(stderr, "Diff: %zu identical, %zu changed, %zu only in %s, %zu only in %s, %zu failed\n",
+                identical, changed, only_old, old_path, only_new, new_path, failed);
+
+    for (int i = 0; i < thread_count; i++)
+        arena_release(run.arenas + i);
+    free(run.arenas);
+    free(run.pairs);
+    free_file_list(&old_files);
+    free_file_list(&new_files);
+
+    return failed ? 2 : changed || only_old || only_new ? 1 : 0;
+}
@@ -0,0 +1,61 @@
+#ifndef POOL_DIFF_H
+#define POOL_DIFF_H
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "arena.h"
+#include "batch.h"
+#include "class_reader.h"
+#include "file_list.h"
+#include "output.h"
+
+/**
+ * Constant reduced to what it means, see constant_key in pool_diff.c
+ */
+typedef struct pool_key_s
+{
+    uint64_t hash;     // of the tag and the resolved value
+    uint64_t identity; // of the part that names the constant (owner and name of a member), 0 if none
+    uint16_t index;    // 1-based
+    uint16_t partner;  // index of the matched constant in the other pool, 0 if none
+    bool changed;      // partner has the same identity but another value
+
+} pool_key;
+
+typedef struct pool_diff_s
+{
+    size_t removed;
+    size_t added;
+    size_t changed;
+
+} pool_diff;
+
+typedef struct diff_pair_s
+{
+    const class_input *old_input; // NULL if only in the new tree
+    const class_input *new_input; // NULL if only in the old tree
+    const char *relative;         // path inside the trees
+
+    out_buffer text; // report of the pair
+    char *error;     // why a class couldn't be parsed, NULL on success
+    pool_diff diff;
+
+} diff_pair;
+
+typedef struct diff_run_s
+{
+    const char *old_path;
+    const char *new_path;
+    bool brief; // list the classes that differ instead of their constants
+
+    diff_pair *pairs; // sorted by relative path
+    size_t count;
+    arena *arenas;    // one per worker, reset after every pair
+
+} diff_run;
+
+void diff_class_pools(out_buffer *out, class *old_cls, class *new_cls, arena *a, pool_diff *diff);
+int run_diff(const char *old_path, const char *new_path, const char *glob, const batch_options *options, bool brief);
+
+#endif
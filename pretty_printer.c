@@ -11,202 +11,909 @@
  */
 
 #include "pretty_printer.h"
+#include "bytecode.h"
+#include "java_number.h"
 
 /**
- * Converts .class double representation to C double as it specified
- * oracle specification.
+ * Print "#id = Kind" prefix of a constant line
  * 
- * @param bits from .class file
- * @return converted double
+ * @param buffer to write to
+ * @param id of constant_pool info, 1-based
+ * @param kind of the constant, padded to the next column
  */
-double long_bits_to_double(long bits)
+static inline void print_entry_head(out_buffer *out, int id, const char *kind, size_t kind_length)
 {
-    int s = ((bits >> 63) == 0) ? 2 : 1;
-    int e = (int)((bits >> 52) & 0x7ffL);
-    long m = (e == 0)
-                 ? (bits & 0xfffffffffffffL) << 1
-                 : (bits & 0xfffffffffffffL) | 0x10000000000000L;
+    out_char(out, '#');
+    out_u32(out, id);
+    out_bytes(out, " = ", 3);
+    out_bytes(out, kind, kind_length);
+}
 
-    double_cast d_cast; // Create double via struct + union
-    d_cast.parts.sign = s;
-    d_cast.parts.exponent = e;
-    d_cast.parts.mantisa = m;
+#define PRINT_HEAD(out, id, kind) print_entry_head((out), (id), (kind), sizeof(kind) - 1)
 
-    return d_cast.d;
+/**
+ * Print a string cut at the first newline
+ * 
+ * @param buffer to write to
+ * @param view of the string
+ */
+static inline void print_view(out_buffer *out, utf_view view)
+{
+    const char *newline = memchr(view.bytes, '\n', view.length);
+    out_bytes(out, view.bytes, newline ? (size_t)(newline - view.bytes) : view.length);
 }
 
 /**
- * Check .class double representation for positive/negative infinity and NaN
+ * Print utf string of the constant
  * 
- * @param bits from .class file
- * @return inf_nan field
+ * @param buffer to write to
+ * @param class struct
+ * @param id of constant_pool info, 0-based
  */
-inf_nan check_long_bits_for_inf_nan(long bits)
+static inline void print_utf(out_buffer *out, class *cls, int id)
 {
-    if (bits == 0x7ff0000000000000L)
-        return POSITIVE_INFINITY;
-    else if (bits == 0xfff0000000000000L)
-        return NEGATIVE_INFINITY;
-    else if ((bits > 0x7ff0000000000000L && bits < 0x7fffffffffffffffL) || (bits > 0xfff0000000000001L && bits < 0xffffffffffffffffL))
-        return NAN;
-    else
-        return NORMAL;
+    print_view(out, constant_utf(cls, cls->resolved[id].utf));
+}
+
+/**
+ * Print "#a.#b" or "#a:#b" pair of indices
+ * 
+ * @param buffer to write to
+ * @param first index
+ * @param separator between the indices
+ * @param second index
+ */
+static inline void print_index_pair(out_buffer *out, uint16_t first, char separator, uint16_t second)
+{
+    out_char(out, '#');
+    out_u32(out, first);
+    out_char(out, separator);
+    out_char(out, '#');
+    out_u32(out, second);
+}
+
+/**
+ * Print "name:type" of a resolved NameAndType/InvokeDynamic
+ * 
+ * @param buffer to write to
+ * @param class struct
+ * @param resolved constant
+ */
+static inline void print_name_and_type(out_buffer *out, class *cls, const resolved_constant *resolved)
+{
+    print_view(out, constant_utf(cls, resolved->name));
+    out_char(out, ':');
+    print_view(out, constant_utf(cls, resolved->descriptor));
+}
+
+/**
+ * Print "class.name:type" of a resolved Ref/MethodHandle
+ * 
+ * @param buffer to write to
+ * @param class struct
+ * @param resolved constant
+ */
+static inline void print_member(out_buffer *out, class *cls, const resolved_constant *resolved)
+{
+    print_view(out, constant_utf(cls, resolved->owner));
+    out_char(out, '.');
+    print_name_and_type(out, cls, resolved);
+}
+
+/**
+ * Print a Fieldref/Methodref/InterfaceMethodref constant
+ * 
+ * @param buffer to write to
+ * @param class struct
+ * @param id of constant_pool info, 0-based
+ * @param ref the constant
+ */
+static void print_ref(out_buffer *out, class *cls, int id, const CONSTANT_Ref_info *ref)
+{
+    print_index_pair(out, ref->class_index, '.', ref->name_and_type_index);
+    out_bytes(out, "\t\t// ", 5);
+    print_member(out, cls, cls->resolved + id);
+    out_char(out, '\n');
 }
 
 /**
- * Get utf string from constant_pool
+ * Print the value of a Float/Long/Double constant
  * 
- * @param class struct where to seatch
- * @param id of constant_pool info
- * @return utf8 string
+ * @param buffer to write to
+ * @param info of the constant
  */
-char *get_utf(class *cls, int id)
+static void print_number(out_buffer *out, const constant_info *info)
 {
-    constant_info *cur_constant_info = cls->constant_pool + id;
-    char *utf;
+    const uint64_t bits = ((uint64_t)info->long_double_i.high_bytes << 32) | info->long_double_i.low_bytes;
+    char text[JAVA_NUMBER_MAX];
 
-    while (cur_constant_info->class_i.tag != CONSTANT_Utf8)
+    switch (info->class_i.tag)
     {
-        cur_constant_info = cls->constant_pool + (cur_constant_info->class_i.name_index - 1);
-    }
+    case CONSTANT_Float:
+        out_bytes(out, text, format_java_float(text, info->int_float_i.bytes));
+        out_char(out, 'f');
+        break;
+
+    case CONSTANT_Long:
+        out_i64(out, (int64_t)bits);
+        out_char(out, 'l');
+        break;
+
+    case CONSTANT_Double:
+        out_bytes(out, text, format_java_double(text, bits));
+        out_char(out, 'd');
+        break;
 
-    cur_constant_info->utf_i.bytes[strcspn(cur_constant_info->utf_i.bytes, "\n")] = 0;
-    return cur_constant_info->utf_i.bytes;
+    default:
+        break;
+    }
 }
 
 /**
  * Print .class minor and major versions
- * @param stream to write for
+ * @param buffer to write to
  * @param class struct with specified versions 
  */
-void print_version_info(FILE *stream, class *cls)
+void print_version_info(out_buffer *out, class *cls)
 {
-    fprintf(stream, "minor version: %d\n", cls->minor_version);
-    fprintf(stream, "major version: %d\n\n", cls->major_version);
+    out_str(out, "minor version: ");
+    out_u32(out, cls->minor_version);
+    out_str(out, "\nmajor version: ");
+    out_u32(out, cls->major_version);
+    out_bytes(out, "\n\n", 2);
+}
+
+/**
+ * Print one constant as it prints in javap tool. The constant
+ * has to be decoded and resolved already.
+ * 
+ * @param buffer to write to
+ * @param class struct
+ * @param i index of constant_pool info, 0-based
+ */
+void print_constant(out_buffer *out, class *cls, int i)
+{
+    constant_info constant, *cur_constant_info = &constant;
+
+    if (!get_constant(cls, i + 1, cur_constant_info))
+        return;
+
+    switch (cur_constant_info->class_i.tag)
+    {
+    case CONSTANT_Class: // done
+        PRINT_HEAD(out, i + 1, "Class\t\t#");
+        out_u32(out, cur_constant_info->class_i.name_index);
+        out_bytes(out, "\t\t// ", 5);
+        print_utf(out, cls, i);
+        out_char(out, '\n');
+        break;
+
+    case CONSTANT_Fieldref: // done 1-st, done 2-nd
+        PRINT_HEAD(out, i + 1, "Fieldref\t\t");
+        print_ref(out, cls, i, &cur_constant_info->ref_i);
+        break;
+
+    case CONSTANT_InterfaceMethodref: // done 1-st, done 2-nd
+        PRINT_HEAD(out, i + 1, "InterfaceMethodRef\t");
+        print_ref(out, cls, i, &cur_constant_info->ref_i);
+        break;
+
+    case CONSTANT_Methodref: // done 1-st, done 2-nd
+        PRINT_HEAD(out, i + 1, "MethodRef\t\t");
+        print_ref(out, cls, i, &cur_constant_info->ref_i);
+        break;
+
+    case CONSTANT_NameAndType: // done 1-st, done 2-nd
+        PRINT_HEAD(out, i + 1, "NameAndType\t");
+        print_index_pair(out, cur_constant_info->ref_i.class_index, ':', cur_constant_info->ref_i.name_and_type_index);
+        out_bytes(out, "\t\t// ", 5);
+        print_name_and_type(out, cls, cls->resolved + i);
+        out_char(out, '\n');
+        break;
+
+    case CONSTANT_String: // done
+        PRINT_HEAD(out, i + 1, "String\t\t#");
+        out_u32(out, cur_constant_info->string_i.string_index);
+        out_bytes(out, "\t\t// ", 5);
+        print_utf(out, cls, i);
+        out_char(out, '\n');
+        break;
+
+    case CONSTANT_Integer: // done
+        PRINT_HEAD(out, i + 1, "Integer\t\t");
+        out_i32(out, (int32_t)cur_constant_info->int_float_i.bytes);
+        out_char(out, '\n');
+        break;
+
+    case CONSTANT_Float: // done
+        PRINT_HEAD(out, i + 1, "Float\t\t");
+        print_number(out, cur_constant_info);
+        out_char(out, '\n');
+        break;
+
+    case CONSTANT_Long: // done
+        PRINT_HEAD(out, i + 1, "Long\t\t");
+        print_number(out, cur_constant_info);
+        out_char(out, '\n');
+        break;
+
+    case CONSTANT_Double: // done
+        PRINT_HEAD(out, i + 1, "Double\t\t");
+        print_number(out, cur_constant_info);
+        out_char(out, '\n');
+        break;
+
+    case CONSTANT_Utf8: // done
+        PRINT_HEAD(out, i + 1, "Utf8\t\t");
+        print_utf(out, cls, i);
+        out_char(out, '\n');
+        break;
+
+    case CONSTANT_MethodHandle: // done
+    {
+        const CONSTANT_MethodHandle_info *handle = &cur_constant_info->method_handle_i;
+
+        PRINT_HEAD(out, i + 1, "MethodHandle\t");
+        out_u32(out, handle->reference_kind);
+        out_bytes(out, ":#", 2);
+        out_u32(out, handle->reference_index);
+        out_bytes(out, "\t\t// ", 5);
+        out_str(out, reference_kind[handle->reference_kind - 1]);
+        out_char(out, ' ');
+        print_member(out, cls, cls->resolved + i);
+        out_char(out, '\n');
+        break;
+    }
+
+    case CONSTANT_MethodType: // done
+        PRINT_HEAD(out, i + 1, "MethodType\t\t");
+        out_u32(out, cur_constant_info->method_type_i.descriptor_index);
+        out_bytes(out, "\t\t// ", 5);
+        print_view(out, constant_utf(cls, cls->resolved[i].descriptor));
+        out_char(out, '\n');
+        break;
+
+    case CONSTANT_InvokeDynamic: // done
+    {
+        const CONSTANT_InvokeDynamic_info *invoke = &cur_constant_info->invoke_dynamic_i;
+
+        PRINT_HEAD(out, i + 1, "InvokeDynamic\t");
+        print_index_pair(out, invoke->bootstrap_method_attr_index, ':', invoke->name_and_type_index);
+        out_bytes(out, "\t\t// #", 6);
+        out_u32(out, invoke->bootstrap_method_attr_index);
+        out_char(out, ':');
+        print_name_and_type(out, cls, cls->resolved + i);
+        out_char(out, '\n');
+        break;
+    }
+
+    default:
+        break;
+    }
 }
 
 /**
  * Print constant_pool info as it prints in javap tool
  * 
- * @param stream to write for
+ * @param buffer to write to
  * @param class struct
  */
-void print_constant_pool(FILE *stream, class *cls)
+void print_constant_pool(out_buffer *out, class *cls)
 {
-    const uint16_t total_constants_count = cls->constant_pool_count - 1;
+    const uint16_t total_constants_count = cls->constant_pool_count ? cls->constant_pool_count - 1 : 0;
 
     for (int i = 0; i < total_constants_count; i++)
     {
-        constant_info *cur_constant_info = cls->constant_pool + i;
-        switch (cur_constant_info->class_i.tag)
+        if (cls->tags[i]) // Long/Double gaps print nothing
+            print_constant(out, cls, i);
+    }
+}
+
+/**
+ * Print a class name in internal form as a Java name
+ * (java/lang/Object -> java.lang.Object)
+ * 
+ * @param buffer to write to
+ * @param name in internal form
+ */
+static void print_java_name(out_buffer *out, utf_view name)
+{
+    const char *p = name.bytes, *end = name.bytes + name.length;
+
+    out_reserve(out, name.length);
+    while (p < end)
+    {
+        const char *slash = memchr(p, '/', end - p);
+        const char *stop = slash ? slash : end;
+
+        out_bytes(out, p, stop - p);
+        if (slash)
+            out_char(out, '.');
+        p = stop + 1;
+    }
+}
+
+/**
+ * Finds the end of one field type in a descriptor
+ * 
+ * @param p start of the type
+ * @param end of the descriptor
+ * @return pointer right after the type
+ */
+static const char *skip_field_type(const char *p, const char *end)
+{
+    while (p < end && *p == '[')
+        p++;
+
+    if (p < end && *p == 'L')
+    {
+        const char *semicolon = memchr(p, ';', end - p);
+        return semicolon ? semicolon + 1 : end;
+    }
+
+    return p < end ? p + 1 : end;
+}
+
+/**
+ * Print one field type of a descriptor as a Java type
+ * (Ljava/lang/String; -> java.lang.String, [I -> int[])
+ * 
+ * @param buffer to write to
+ * @param p start of the type
+ * @param end of the descriptor
+ * @param varargs print the last array dimension as "..."
+ */
+static void print_field_type(out_buffer *out, const char *p, const char *end, bool varargs)
+{
+    int dimensions = 0;
+    utf_view name;
+
+    while (p < end && *p == '[')
+        dimensions++, p++;
+
+    switch (p < end ? *p : 'V')
+    {
+    case 'B': out_str(out, "byte"); break;
+    case 'C': out_str(out, "char"); break;
+    case 'D': out_str(out, "double"); break;
+    case 'F': out_str(out, "float"); break;
+    case 'I': out_str(out, "int"); break;
+    case 'J': out_str(out, "long"); break;
+    case 'S': out_str(out, "short"); break;
+    case 'Z': out_str(out, "boolean"); break;
+    case 'V': out_str(out, "void"); break;
+    case 'L':
+    {
+        const char *semicolon = memchr(p, ';', end - p);
+
+        if (semicolon)
         {
-        case CONSTANT_Class: // done
-            fprintf(stream, "#%d = Class\t\t#%d\t\t// %s\n", i + 1,
-                    cur_constant_info->class_i.name_index, get_utf(cls, i));
-            break;
-
-        case CONSTANT_Fieldref: // done 1-st, done 2-nd
-            fprintf(stream, "#%d = Fieldref\t\t#%d.#%d\t\t// %s.%s:%s\n", i + 1,
-                    cur_constant_info->ref_i.class_index, cur_constant_info->ref_i.name_and_type_index,
-                    get_utf(cls, cur_constant_info->ref_i.class_index - 1),
-                    get_utf(cls, (cls->constant_pool + (cur_constant_info->ref_i.name_and_type_index - 1))->ref_i.class_index - 1),
-                    get_utf(cls, (cls->constant_pool + (cur_constant_info->ref_i.name_and_type_index - 1))->ref_i.name_and_type_index - 1));
-            break;
-
-        case CONSTANT_InterfaceMethodref: // done 1-st, done 2-nd
-            fprintf(stream, "#%d = InterfaceMethodRef\t#%d.#%d\t\t// %s.%s:%s\n", i + 1,
-                    cur_constant_info->ref_i.class_index, cur_constant_info->ref_i.name_and_type_index,
-                    get_utf(cls, cur_constant_info->ref_i.class_index - 1),
-                    get_utf(cls, (cls->constant_pool + (cur_constant_info->ref_i.name_and_type_index - 1))->ref_i.class_index - 1),
-                    get_utf(cls, (cls->constant_pool + (cur_constant_info->ref_i.name_and_type_index - 1))->ref_i.name_and_type_index - 1));
-            break;
-
-        case CONSTANT_Methodref: // done 1-st, done 2-nd
-            fprintf(stream, "#%d = MethodRef\t\t#%d.#%d\t\t// %s.%s:%s\n", i + 1,
-                    cur_constant_info->ref_i.class_index, cur_constant_info->ref_i.name_and_type_index,
-                    get_utf(cls, cur_constant_info->ref_i.class_index - 1),
-                    get_utf(cls, (cls->constant_pool + (cur_constant_info->ref_i.name_and_type_index - 1))->ref_i.class_index - 1),
-                    get_utf(cls, (cls->constant_pool + (cur_constant_info->ref_i.name_and_type_index - 1))->ref_i.name_and_type_index - 1));
-            break;
-
-        case CONSTANT_NameAndType: // done 1-st, done 2-nd
-            fprintf(stream, "#%d = NameAndType\t#%d:#%d\t\t// %s:%s\n", i + 1,
-                    cur_constant_info->ref_i.class_index, cur_constant_info->ref_i.name_and_type_index,
-                    get_utf(cls, cur_constant_info->ref_i.class_index - 1),
-                    get_utf(cls, cur_constant_info->ref_i.name_and_type_index - 1));
-            break;
-
-        case CONSTANT_String: // done
-            fprintf(stream, "#%d = String\t\t#%d\t\t// %s\n", i + 1,
-                    cur_constant_info->string_i.string_index, get_utf(cls, i));
-            break;
-
-        case CONSTANT_Integer: // done
-            fprintf(stream, "#%d = Integer\t\t%d\n", i + 1,
-                    cur_constant_info->int_float_i.bytes);
-            break;
-
-        case CONSTANT_Float: // done
-            fprintf(stream, "#%d = Float\t\t%f\n", i + 1,
-                    (float)cur_constant_info->int_float_i.bytes);
-            break;
-
-        case CONSTANT_Long: // done
-            fprintf(stream, "#%d = Long\t\t%ldl\n", i + 1,
-                    ((long)cur_constant_info->long_double_i.high_bytes << 32) + cur_constant_info->long_double_i.low_bytes);
-            i++;
-            break;
-
-        case CONSTANT_Double: // done
-            switch (check_long_bits_for_inf_nan(((long)cur_constant_info->long_double_i.high_bytes << 32) + cur_constant_info->long_double_i.low_bytes))
-            {
-            case POSITIVE_INFINITY:
-                fprintf(stream, "#%d = Double\t\tInfinityd\n", i + 1);
-                break;
-            case NEGATIVE_INFINITY:
-                fprintf(stream, "#%d = Double\t\t-Infinityd\n", i + 1);
-                break;
-            case NAN:
-                fprintf(stream, "#%d = Double\t\tNaNd\n", i + 1);
-                break;
-            case NORMAL:
-                fprintf(stream, "#%d = Double\t\t%lfd\n", i + 1,
-                        long_bits_to_double(((long)cur_constant_info->long_double_i.high_bytes << 32) + cur_constant_info->long_double_i.low_bytes));
-                break;
-            }
-            i++;
-            break;
-
-        case CONSTANT_Utf8: // done
-            fprintf(stream, "#%d = Utf8\t\t%s\n", i + 1, cur_constant_info->utf_i.bytes);
-            break;
-
-        case CONSTANT_MethodHandle: // done
-            fprintf(stream, "#%d = MethodHandle\t%d:#%d\t\t// %s %s.%s:%s\n", i + 1,
-                    cur_constant_info->method_handle_i.reference_kind, cur_constant_info->method_handle_i.reference_index,
-                    reference_kind[cur_constant_info->method_handle_i.reference_kind - 1],
-                    get_utf(cls, (cls->constant_pool + (cur_constant_info->method_handle_i.reference_index - 1))->ref_i.class_index - 1),
-                    get_utf(cls, (cls->constant_pool + (cls->constant_pool + (cur_constant_info->method_handle_i.reference_index - 1))->ref_i.name_and_type_index - 1)->ref_i.class_index - 1),
-                    get_utf(cls, (cls->constant_pool + (cls->constant_pool + (cur_constant_info->method_handle_i.reference_index - 1))->ref_i.name_and_type_index - 1)->ref_i.name_and_type_index - 1));
-            break;
-
-        case CONSTANT_MethodType: // done
-            fprintf(stream, "#%d = MethodType\t\t%d\t\t// %s\n", i + 1,
-                    cur_constant_info->method_type_i.descriptor_index,
-                    get_utf(cls, cur_constant_info->method_type_i.descriptor_index - 1));
-            break;
-
-        case CONSTANT_InvokeDynamic: // done
-            fprintf(stream, "#%d = InvokeDynamic\t#%d:#%d\t\t// #%d:%s:%s\n", i + 1,
-                    cur_constant_info->invoke_dynamic_i.bootstrap_method_attr_index,
-                    cur_constant_info->invoke_dynamic_i.name_and_type_index,
-                    cur_constant_info->invoke_dynamic_i.bootstrap_method_attr_index,
-                    get_utf(cls, (cls->constant_pool + (cur_constant_info->invoke_dynamic_i.name_and_type_index - 1))->ref_i.class_index - 1),
-                    get_utf(cls, (cls->constant_pool + (cur_constant_info->invoke_dynamic_i.name_and_type_index - 1))->ref_i.name_and_type_index - 1));
-            break;
-
-        default:
-            break;
+            name.bytes = p + 1;
+            name.length = (uint16_t)(semicolon - p - 1);
+            print_java_name(out, name);
         }
+        else
+            out_bytes(out, p, end - p); // unterminated, printed as it is
+        break;
+    }
+    default:
+        out_char(out, *p);
+        break;
     }
-}
\ No newline at end of file
+
+    if (varargs && dimensions)
+        dimensions--;
+    while (dimensions--)
+        out_bytes(out, "[]", 2);
+    if (varargs)
+        out_bytes(out, "...", 3);
+}
+
+/**
+ * Print modifiers of a field or a method in javap order
+ * 
+ * @param buffer to write to
+ * @param access_flags of the member
+ * @param is_method true for methods, false for fields
+ * @param in_interface true if the member belongs to an interface
+ */
+static void print_member_modifiers(out_buffer *out, uint16_t access_flags, bool is_method, bool in_interface)
+{
+    if (access_flags & ACC_PUBLIC)
+        out_str(out, "public ");
+    if (access_flags & ACC_PRIVATE)
+        out_str(out, "private ");
+    if (access_flags & ACC_PROTECTED)
+        out_str(out, "protected ");
+    if (is_method && in_interface && !(access_flags & (ACC_ABSTRACT | ACC_STATIC | ACC_PRIVATE)))
+        out_str(out, "default ");
+    if (access_flags & ACC_STATIC)
+        out_str(out, "static ");
+    if (access_flags & ACC_FINAL)
+        out_str(out, "final ");
+    if (is_method && (access_flags & ACC_SYNCHRONIZED))
+        out_str(out, "synchronized ");
+    if (!is_method && (access_flags & ACC_VOLATILE))
+        out_str(out, "volatile ");
+    if (!is_method && (access_flags & ACC_TRANSIENT))
+        out_str(out, "transient ");
+    if (is_method && (access_flags & ACC_NATIVE))
+        out_str(out, "native ");
+    if (is_method && (access_flags & ACC_ABSTRACT))
+        out_str(out, "abstract ");
+    if (is_method && (access_flags & ACC_STRICT))
+        out_str(out, "strictfp ");
+}
+
+/**
+ * Gets a Utf8 constant by index, works for lazy classes too
+ * 
+ * @param class struct
+ * @param index of the Utf8 constant, 1-based
+ * @return string or an empty view on a bad index
+ */
+static utf_view member_utf(class *cls, uint16_t index)
+{
+    utf_view empty = {"", 0};
+
+    if (constant_tag(cls, index) != CONSTANT_Utf8 || !check_constant(cls, index))
+        return empty;
+    return constant_utf(cls, index);
+}
+
+/**
+ * Print a field declaration
+ * 
+ * @param buffer to write to
+ * @param class struct
+ * @param field to print
+ */
+static void print_field(out_buffer *out, class *cls, const member_info *field)
+{
+    utf_view descriptor = member_utf(cls, field->descriptor_index);
+
+    out_bytes(out, "  ", 2);
+    print_member_modifiers(out, field->access_flags, false, cls->access_flags & ACC_INTERFACE);
+    print_field_type(out, descriptor.bytes, descriptor.bytes + descriptor.length, false);
+    out_char(out, ' ');
+    print_view(out, member_utf(cls, field->name_index));
+    out_bytes(out, ";\n", 2);
+}
+
+/**
+ * Print "throws ..." of a method, decoding its Exceptions attribute
+ * 
+ * @param buffer to write to
+ * @param class struct
+ * @param method to print
+ */
+static void print_method_exceptions(out_buffer *out, class *cls, const member_info *method)
+{
+    const attribute_info *exceptions = find_attribute(cls, method->attributes, method->attributes_count, "Exceptions");
+    uint16_t count, index;
+
+    if (!exceptions)
+        return;
+
+    byte_reader reader = attribute_reader(cls, exceptions);
+    if (!parse_u2(&reader, &count))
+        return;
+
+    for (int i = 0; i < count && parse_u2(&reader, &index); i++)
+    {
+        out_str(out, i ? ", " : " throws ");
+        print_java_name(out, class_name(cls, index));
+    }
+}
+
+/**
+ * Print a method declaration
+ * 
+ * @param buffer to write to
+ * @param class struct
+ * @param method to print
+ */
+static void print_method(out_buffer *out, class *cls, const member_info *method)
+{
+    utf_view name = member_utf(cls, method->name_index);
+    utf_view descriptor = member_utf(cls, method->descriptor_index);
+    const char *p = descriptor.bytes, *end = descriptor.bytes + descriptor.length;
+    const char *parameters_end = memchr(p, ')', descriptor.length);
+
+    out_bytes(out, "  ", 2);
+
+    if (name.length == 8 && memcmp(name.bytes, "<clinit>", 8) == 0)
+    {
+        out_str(out, "static {};\n");
+        return;
+    }
+
+    print_member_modifiers(out, method->access_flags, true, cls->access_flags & ACC_INTERFACE);
+
+    if (name.length == 6 && memcmp(name.bytes, "<init>", 6) == 0)
+        print_java_name(out, class_name(cls, cls->this_class));
+    else
+    {
+        if (parameters_end)
+            print_field_type(out, parameters_end + 1, end, false);
+        out_char(out, ' ');
+        print_view(out, name);
+    }
+
+    out_char(out, '(');
+    if (parameters_end && p < end && *p == '(')
+    {
+        for (p++; p < parameters_end;)
+        {
+            const char *next = skip_field_type(p, parameters_end);
+            bool last = next >= parameters_end;
+
+            print_field_type(out, p, next, last && (method->access_flags & ACC_VARARGS) && *p == '[');
+            if (!last)
+                out_bytes(out, ", ", 2);
+            p = next;
+        }
+    }
+    out_char(out, ')');
+
+    print_method_exceptions(out, cls, method);
+    out_bytes(out, ";\n", 2);
+}
+
+#define CODE_COMMENT_COLUMN 44
+
+static const char *array_types[] = {"boolean", "char", "float", "double", "byte", "short", "int", "long"};
+
+/**
+ * Print a member name, quoted if it is <init> or <clinit>
+ * 
+ * @param buffer to write to
+ * @param name of the member
+ */
+static void print_member_name(out_buffer *out, utf_view name)
+{
+    if (name.length && name.bytes[0] == '<')
+    {
+        out_char(out, '"');
+        print_view(out, name);
+        out_char(out, '"');
+    }
+    else
+        print_view(out, name);
+}
+
+/**
+ * Print the comment of an instruction operand that refers
+ * to the constant pool, as javap -c does
+ * 
+ * @param buffer to write to
+ * @param class struct
+ * @param index of the constant, 1-based
+ * @return false on a bad constant pool reference (see class_error)
+ */
+static bool print_code_constant(out_buffer *out, class *cls, uint16_t index)
+{
+    const resolved_constant *resolved = resolve_constant(cls, index);
+    constant_info constant, *info = &constant;
+    utf_view owner, this_name;
+
+    if (!resolved || !get_constant(cls, index, info))
+        return false;
+
+    switch (info->class_i.tag)
+    {
+    case CONSTANT_Class:
+        owner = constant_utf(cls, resolved->utf);
+        out_str(out, "class ");
+        if (owner.length && owner.bytes[0] == '[')
+        {
+            out_char(out, '"');
+            print_view(out, owner);
+            out_char(out, '"');
+        }
+        else
+            print_view(out, owner);
+        break;
+
+    case CONSTANT_Fieldref:
+    case CONSTANT_Methodref:
+    case CONSTANT_InterfaceMethodref:
+        out_str(out, info->class_i.tag == CONSTANT_Fieldref ? "Field " : info->class_i.tag == CONSTANT_Methodref ? "Method " : "InterfaceMethod ");
+
+        owner = constant_utf(cls, resolved->owner);
+        this_name = class_name(cls, cls->this_class);
+        if (owner.length != this_name.length || memcmp(owner.bytes, this_name.bytes, owner.length) != 0)
+        {
+            print_view(out, owner);
+            out_char(out, '.');
+        }
+        print_member_name(out, constant_utf(cls, resolved->name));
+        out_char(out, ':');
+        print_view(out, constant_utf(cls, resolved->descriptor));
+        break;
+
+    case CONSTANT_String:
+        out_str(out, "String ");
+        print_view(out, constant_utf(cls, resolved->utf));
+        break;
+
+    case CONSTANT_Integer:
+        out_str(out, "int ");
+        out_i32(out, (int32_t)info->int_float_i.bytes);
+        break;
+
+    case CONSTANT_Float:
+    case CONSTANT_Long:
+    case CONSTANT_Double:
+        out_str(out, info->class_i.tag == CONSTANT_Float ? "float " : info->class_i.tag == CONSTANT_Long ? "long " : "double ");
+        print_number(out, info);
+        break;
+
+    case CONSTANT_MethodType:
+        out_str(out, "MethodType ");
+        print_view(out, constant_utf(cls, resolved->descriptor));
+        break;
+
+    case CONSTANT_MethodHandle:
+        out_str(out, "MethodHandle ");
+        out_str(out, reference_kind[info->method_handle_i.reference_kind - 1]);
+        out_char(out, ' ');
+        print_member(out, cls, resolved);
+        break;
+
+    case CONSTANT_InvokeDynamic:
+        out_str(out, "InvokeDynamic #");
+        out_u32(out, info->invoke_dynamic_i.bootstrap_method_attr_index);
+        out_char(out, ':');
+        print_member_name(out, constant_utf(cls, resolved->name));
+        out_char(out, ':');
+        print_view(out, constant_utf(cls, resolved->descriptor));
+        break;
+
+    default:
+        break;
+    }
+    return true;
+}
+
+/**
+ * Print one decoded instruction as javap -c does, without
+ * the trailing newline
+ * 
+ * @param buffer to write to
+ * @param class struct
+ * @param ins decoded instruction
+ * @return false on a bad constant pool reference (see class_error)
+ */
+static bool print_instruction(out_buffer *out, class *cls, const instruction *ins)
+{
+    const opcode_info *info = opcodes + ins->opcode;
+    int constant = 0;
+
+    out_reserve(out, 64); // the line up to the comment never gets flushed in the middle
+    const size_t line_start = out->length;
+
+    out_bytes(out, "    ", 4);
+    for (uint32_t width = ins->pc < 10 ? 1 : ins->pc < 100 ? 2 : ins->pc < 1000 ? 3 : 4; width < 4; width++)
+        out_char(out, ' ');
+    out_u32(out, ins->pc);
+    out_bytes(out, ": ", 2);
+
+    if (ins->wide)
+        out_str(out, "wide ");
+    out_str(out, info->mnemonic);
+    if (info->kind == OPERAND_NONE)
+        return true;
+
+    for (size_t length = strlen(info->mnemonic) + (ins->wide ? 5 : 0); length < 13; length++)
+        out_char(out, ' ');
+    out_char(out, ' ');
+
+    switch (info->kind)
+    {
+    case OPERAND_BYTE:
+    case OPERAND_SHORT:
+    case OPERAND_LOCAL:
+    case OPERAND_BRANCH2:
+    case OPERAND_BRANCH4:
+        out_i32(out, ins->operand);
+        break;
+
+    case OPERAND_IINC:
+        out_i32(out, ins->operand);
+        out_bytes(out, ", ", 2);
+        out_i32(out, ins->operand2);
+        break;
+
+    case OPERAND_NEWARRAY:
+        if (ins->operand >= 4 && ins->operand <= 11)
+            out_str(out, array_types[ins->operand - 4]);
+        else
+            out_i32(out, ins->operand);
+        break;
+
+    case OPERAND_CP1:
+    case OPERAND_CP2:
+        constant = ins->operand;
+        out_char(out, '#');
+        out_u32(out, ins->operand);
+        break;
+
+    case OPERAND_INVOKEINTERFACE:
+    case OPERAND_INVOKEDYNAMIC:
+    case OPERAND_MULTIANEWARRAY:
+        constant = ins->operand;
+        out_char(out, '#');
+        out_u32(out, ins->operand);
+        out_bytes(out, ",  ", 3);
+        out_i32(out, info->kind == OPERAND_INVOKEDYNAMIC ? 0 : ins->operand2);
+        break;
+
+    case OPERAND_TABLESWITCH:
+    case OPERAND_LOOKUPSWITCH:
+    {
+        int32_t key, target;
+
+        out_str(out, "{ // ");
+        if (info->kind == OPERAND_TABLESWITCH)
+        {
+            out_i32(out, ins->operand2);
+            out_str(out, " to ");
+            out_i32(out, ins->operand2 + ins->count - 1);
+        }
+        else
+            out_i32(out, ins->count);
+        out_char(out, '\n');
+
+        for (int32_t i = 0; i < ins->count; i++)
+        {
+            switch_case(ins, i, &key, &target);
+            out_format(out, "%22d: %d\n", key, target);
+        }
+        out_format(out, "%22s: %d\n", "default", ins->operand);
+        out_str(out, "          }");
+        break;
+    }
+
+    default:
+        break;
+    }
+
+    if (!constant)
+        return true;
+
+    for (size_t column = out->length - line_start; column < CODE_COMMENT_COLUMN; column++)
+        out_char(out, ' ');
+    out_str(out, out->length - line_start > CODE_COMMENT_COLUMN ? " // " : "// ");
+    return print_code_constant(out, cls, (uint16_t)constant);
+}
+
+/**
+ * Print the bytecode and the exception table of a method
+ * as javap -c does. Methods without code print nothing.
+ * 
+ * @param buffer to write to
+ * @param class struct
+ * @param method to print
+ * @return false on malformed code (see class_error)
+ */
+static bool print_code(out_buffer *out, class *cls, const member_info *method)
+{
+    const attribute_info *attribute = find_attribute(cls, method->attributes, method->attributes_count, "Code");
+    code_attribute code;
+    instruction ins;
+
+    if (!attribute)
+        return true;
+    if (!parse_code_attribute(cls, attribute, &code))
+        return false;
+
+    out_str(out, "    Code:\n");
+    for (uint32_t pc = 0; pc < code.code_length; pc += ins.length)
+    {
+        if (!decode_instruction(code.code, code.code_length, pc, &ins) ||
+            !print_instruction(out, cls, &ins))
+            return false;
+        out_char(out, '\n');
+    }
+
+    if (!code.exception_table_length)
+        return true;
+
+    out_str(out, "    Exception table:\n       from    to  target type\n");
+    for (int i = 0; i < code.exception_table_length; i++)
+    {
+        const uint8_t *entry = code.exception_table + 8 * i;
+        const uint16_t catch_type = read_u2(entry + 6);
+
+        out_format(out, "       %5u %5u %5u   ", read_u2(entry), read_u2(entry + 2), read_u2(entry + 4));
+        if (catch_type)
+        {
+            out_str(out, "Class ");
+            print_view(out, class_name(cls, catch_type));
+        }
+        else
+            out_str(out, "any");
+        out_char(out, '\n');
+    }
+    return true;
+}
+
+/**
+ * Print the class declaration and its non-private members as 
+ * javap does. Only the SourceFile and Exceptions attributes
+ * get decoded, and Code ones when the bytecode is asked for;
+ * all the other ones are never touched.
+ * 
+ * @param buffer to write to
+ * @param class struct
+ * @param with_code disassemble method bytecode as javap -c does
+ * @return false on malformed code (see class_error)
+ */
+bool print_class_summary(out_buffer *out, class *cls, bool with_code)
+{
+    bool first = true;
+
+    const attribute_info *source_file = find_attribute(cls, cls->attributes, cls->attributes_count, "SourceFile");
+    const bool is_interface = cls->access_flags & ACC_INTERFACE;
+    uint16_t index;
+
+    if (source_file)
+    {
+        byte_reader reader = attribute_reader(cls, source_file);
+        if (parse_u2(&reader, &index))
+        {
+            out_str(out, "Compiled from \"");
+            print_view(out, member_utf(cls, index));
+            out_str(out, "\"\n");
+        }
+    }
+
+    if (cls->access_flags & ACC_PUBLIC)
+        out_str(out, "public ");
+    if (cls->access_flags & ACC_FINAL)
+        out_str(out, "final ");
+    if ((cls->access_flags & ACC_ABSTRACT) && !is_interface)
+        out_str(out, "abstract ");
+    out_str(out, is_interface ? "interface " : "class ");
+    print_java_name(out, class_name(cls, cls->this_class));
+
+    utf_view super_name = cls->super_class ? class_name(cls, cls->super_class) : (utf_view){"", 0};
+    if (!is_interface && super_name.length && !(super_name.length == 16 && memcmp(super_name.bytes, "java/lang/Object", 16) == 0))
+    {
+        out_str(out, " extends ");
+        print_java_name(out, super_name);
+    }
+
+    for (int i = 0; i < cls->interfaces_count; i++)
+    {
+        out_str(out, i ? ", " : is_interface ? " extends " : " implements ");
+        print_java_name(out, class_name(cls, cls->interfaces[i]));
+    }
+    out_str(out, " {\n");
+
+    for (int i = 0; i < cls->fields_count; i++)
+    {
+        if (cls->fields[i].access_flags & ACC_PRIVATE)
+            continue;
+        if (with_code && !first)
+            out_char(out, '\n');
+        print_field(out, cls, cls->fields + i);
+        first = false;
+    }
+
+    for (int i = 0; i < cls->methods_count; i++)
+    {
+        if (cls->methods[i].access_flags & ACC_PRIVATE)
+            continue;
+        if (with_code && !first)
+            out_char(out, '\n');
+        print_method(out, cls, cls->methods + i);
+        if (with_code && !print_code(out, cls, cls->methods + i))
+            return false;
+        first = false;
+    }
+
+    out_str(out, "}\n");
+    return true;
+}
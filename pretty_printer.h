@@ -2,8 +2,11 @@
 #define PRETTY_PRINTER_H
 
 #include "class_reader.h"
+#include "output.h"
 
-void print_constant_pool(FILE *stream, class *cls);
-void print_version_info(FILE *stream, class *cls);
+void print_constant_pool(out_buffer *out, class *cls);
+void print_constant(out_buffer *out, class *cls, int i);
+bool print_class_summary(out_buffer *out, class *cls, bool with_code);
+void print_version_info(out_buffer *out, class *cls);
 
 #endif
\ No newline at end of file
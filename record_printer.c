@@ -0,0 +1,569 @@
+/**
+ * Machine-readable output of the constant pool, for pipelines
+ * that would otherwise have to parse the javap-like text back.
+ *
+ * JSON Lines (--format=jsonl): one object per line, a class record
+ * followed by one record per constant. Texts are complete and
+ * escaped, references come resolved, Float and Double values are
+ * written as Java's toString() writes them:
+ *
+ *   {"file":"Main.class","minor_version":0,"major_version":55,"constant_pool_count":34}
+ *   {"file":"Main.class","index":1,"tag":"Methodref","class_index":6,"name_and_type_index":20,
+ *    "owner":"java/lang/Object","name":"<init>","descriptor":"()V"}
+ *
+ * --watch puts {"file":"Main.class","event":"modified"} (or "added",
+ * "deleted") before the records of every class that changed.
+ *
+ * Binary (--format=bin): a stream of records, numbers little-endian:
+ *
+ *   u4 length of the record after this field
+ *   u1 kind: 'C' class, 'K' constant or 'E' event
+ *   'C': u2 minor_version, u2 major_version, u2 constant_pool_count,
+ *        u2 name_length, name
+ *   'K': u2 index, u1 tag, u1 reference_kind (MethodHandle, else 0),
+ *        u4 first, u4 second operand as in the class file
+ *        (Long/Double: high and low bytes), u1 text_count, then
+ *        text_count times u2 length and the text in UTF-8
+ *   'E': u1 change 'A' added, 'M' modified or 'D' deleted,
+ *        u2 name_length, name (--watch, before the records of the
+ *        class unless it was deleted)
+ *
+ * Texts of a constant record, in order:
+ *   Utf8, String        - the value
+ *   Class               - the name
+ *   Ref, MethodHandle   - owner, name, descriptor
+ *   NameAndType, InvokeDynamic - name, descriptor
+ *   MethodType          - descriptor
+ *
+ * Both are written straight into the output buffer, nothing is
+ * allocated per constant.
+ *
+ */
+
+#include "record_printer.h"
+#include "java_number.h"
+
+#define RECORD_TEXTS_MAX 3
+
+static const char *tag_names[] =
+{
+    [CONSTANT_Utf8] = "Utf8",
+    [CONSTANT_Integer] = "Integer",
+    [CONSTANT_Float] = "Float",
+    [CONSTANT_Long] = "Long",
+    [CONSTANT_Double] = "Double",
+    [CONSTANT_Class] = "Class",
+    [CONSTANT_String] = "String",
+    [CONSTANT_Fieldref] = "Fieldref",
+    [CONSTANT_Methodref] = "Methodref",
+    [CONSTANT_InterfaceMethodref] = "InterfaceMethodref",
+    [CONSTANT_NameAndType] = "NameAndType",
+    [CONSTANT_MethodHandle] = "MethodHandle",
+    [CONSTANT_MethodType] = "MethodType",
+    [CONSTANT_InvokeDynamic] = "InvokeDynamic"
+};
+
+/**
+ * Operands of a constant as two numbers, see the binary layout
+ *
+ * @param info of the constant
+ * @param first operand
+ * @param second operand, 0 if there is one
+ */
+static void constant_operands(const constant_info *info, uint32_t *first, uint32_t *second)
+{
+    *second = 0;
+
+    switch (info->class_i.tag)
+    {
+    case CONSTANT_Class:
+        *first = info->class_i.name_index;
+        break;
+    case CONSTANT_String:
+        *first = info->string_i.string_index;
+        break;
+    case CONSTANT_MethodType:
+        *first = info->method_type_i.descriptor_index;
+        break;
+    case CONSTANT_Fieldref:
+    case CONSTANT_Methodref:
+    case CONSTANT_InterfaceMethodref:
+    case CONSTANT_NameAndType:
+    case CONSTANT_InvokeDynamic:
+        *first = info->ref_i.class_index;
+        *second = info->ref_i.name_and_type_index;
+        break;
+    case CONSTANT_MethodHandle:
+        *first = info->method_handle_i.reference_index;
+        break;
+    case CONSTANT_Integer:
+    case CONSTANT_Float:
+        *first = info->int_float_i.bytes;
+        break;
+    case CONSTANT_Long:
+    case CONSTANT_Double:
+        *first = info->long_double_i.high_bytes;
+        *second = info->long_double_i.low_bytes;
+        break;
+    default:
+        *first = 0;
+        break;
+    }
+}
+
+/**
+ * Collects the resolved texts of a constant
+ *
+ * @param class struct
+ * @param i index of the constant, 0-based
+ * @param tag of the constant
+ * @param texts to fill, RECORD_TEXTS_MAX at most
+ * @return number of texts
+ */
+static int constant_texts(class *cls, int i, uint8_t tag, utf_view *texts)
+{
+    const resolved_constant *resolved = cls->resolved + i;
+
+    switch (tag)
+    {
+    case CONSTANT_Utf8:
+    case CONSTANT_String:
+    case CONSTANT_Class:
+        texts[0] = constant_utf(cls, resolved->utf);
+        return 1;
+    case CONSTANT_Fieldref:
+    case CONSTANT_Methodref:
+    case CONSTANT_InterfaceMethodref:
+    case CONSTANT_MethodHandle:
+        texts[0] = constant_utf(cls, resolved->owner);
+        texts[1] = constant_utf(cls, resolved->name);
+        texts[2] = constant_utf(cls, resolved->descriptor);
+        return 3;
+    case CONSTANT_NameAndType:
+    case CONSTANT_InvokeDynamic:
+        texts[0] = constant_utf(cls, resolved->name);
+        texts[1] = constant_utf(cls, resolved->descriptor);
+        return 2;
+    case CONSTANT_MethodType:
+        texts[0] = constant_utf(cls, resolved->descriptor);
+        return 1;
+    default:
+        return 0;
+    }
+}
+
+/**
+ * Finds the first byte of a text that print_json_string can't copy
+ * as is, 8 bytes at a time
+ *
+ * @param p start of the text
+ * @param end of the text
+ * @return first control character, quote, backslash or 0xED, end if none
+ */
+static inline const uint8_t *skip_json_plain(const uint8_t *p, const uint8_t *end)
+{
+    const uint64_t ones = 0x0101010101010101ull, highs = 0x8080808080808080ull;
+
+    while (end - p >= 8)
+    {
+        uint64_t word;
+        memcpy(&word, p, 8);
+
+        const uint64_t quote = word ^ (ones * '"'), backslash = word ^ (ones * '\\'), ed = word ^ (ones * 0xed);
+        // High bit set for bytes below 0x20 and for the zero bytes of the XORs
+        const uint64_t special = ((word - ones * 0x20) & ~word) | ((quote - ones) & ~quote) |
+                                 ((backslash - ones) & ~backslash) | ((ed - ones) & ~ed);
+
+        if (special & highs)
+            break;
+        p += 8;
+    }
+
+    while (p < end && *p >= 0x20 && *p != '"' && *p != '\\' && *p != 0xed)
+        p++;
+    return p;
+}
+
+/**
+ * Print a JSON string. Runs of plain bytes are copied at once,
+ * control characters, quotes and backslashes are escaped. A lone
+ * surrogate, which modified UTF-8 allows, is written as \uXXXX
+ * so that the line stays valid UTF-8.
+ *
+ * @param buffer to write to
+ * @param bytes of the UTF-8 text
+ * @param length of the text
+ */
+void print_json_string(out_buffer *out, const char *bytes, size_t length)
+{
+    static const char hex[] = "0123456789abcdef";
+    const uint8_t *p = (const uint8_t *)bytes, *end = p + length;
+
+    out_char(out, '"');
+    for (;;)
+    {
+        const uint8_t *run = p;
+
+        p = skip_json_plain(p, end);
+        out_bytes(out, (const char *)run, p - run);
+        if (p == end)
+            break;
+
+        const uint8_t c = *p;
+        if (c == 0xed && end - p >= 3 && p[1] >= 0xa0)
+        {
+            const unsigned unit = 0xd000 | (p[1] & 0x3f) << 6 | (p[2] & 0x3f);
+            const char escape[6] = {'\\', 'u', 'd', hex[unit >> 8 & 0xf], hex[unit >> 4 & 0xf], hex[unit & 0xf]};
+
+            out_bytes(out, escape, sizeof(escape));
+            p += 3;
+            continue;
+        }
+
+        switch (c)
+        {
+        case 0xed: // an ordinary character from U+D000 to U+D7FF
+            out_char(out, (char)c);
+            break;
+        case '"': out_bytes(out, "\\\"", 2); break;
+        case '\\': out_bytes(out, "\\\\", 2); break;
+        case '\n': out_bytes(out, "\\n", 2); break;
+        case '\r': out_bytes(out, "\\r", 2); break;
+        case '\t': out_bytes(out, "\\t", 2); break;
+        case '\b': out_bytes(out, "\\b", 2); break;
+        case '\f': out_bytes(out, "\\f", 2); break;
+        default:
+        {
+            const char escape[6] = {'\\', 'u', '0', '0', hex[c >> 4], hex[c & 0xf]};
+            out_bytes(out, escape, sizeof(escape));
+            break;
+        }
+        }
+        p++;
+    }
+    out_char(out, '"');
+}
+
+/**
+ * Print ,"key":number
+ */
+static inline void print_json_number(out_buffer *out, const char *key, uint32_t value)
+{
+    out_bytes(out, ",\"", 2);
+    out_str(out, key);
+    out_bytes(out, "\":", 2);
+    out_u32(out, value);
+}
+
+/**
+ * Print ,"key":"text"
+ */
+static inline void print_json_text(out_buffer *out, const char *key, utf_view text)
+{
+    out_bytes(out, ",\"", 2);
+    out_str(out, key);
+    out_bytes(out, "\":", 2);
+    print_json_string(out, text.bytes, text.length);
+}
+
+/**
+ * Print a floating point value as Java's toString() writes it,
+ * infinities and NaN as strings since JSON has no literals for them
+ *
+ * @param buffer to write to
+ * @param text of the value
+ * @param length of the text
+ */
+static void print_json_float(out_buffer *out, const char *text, size_t length)
+{
+    const bool special = text[length - 1] == 'N' || text[length - 1] == 'y'; // NaN, [-]Infinity
+
+    if (special)
+        out_char(out, '"');
+    out_bytes(out, text, length);
+    if (special)
+        out_char(out, '"');
+}
+
+/**
+ * Print the "value" member of a number constant
+ *
+ * @param buffer to write to
+ * @param info of the constant
+ */
+static void print_json_value(out_buffer *out, const constant_info *info)
+{
+    const uint64_t bits = (uint64_t)info->long_double_i.high_bytes << 32 | info->long_double_i.low_bytes;
+    char text[JAVA_NUMBER_MAX];
+
+    out_str(out, ",\"value\":");
+    switch (info->class_i.tag)
+    {
+    case CONSTANT_Integer:
+        out_i32(out, (int32_t)info->int_float_i.bytes);
+        break;
+    case CONSTANT_Float:
+        print_json_float(out, text, format_java_float(text, info->int_float_i.bytes));
+        break;
+    case CONSTANT_Long:
+        out_i64(out, (int64_t)bits);
+        break;
+    case CONSTANT_Double:
+        print_json_float(out, text, format_java_double(text, bits));
+        break;
+    default:
+        break;
+    }
+}
+
+/**
+ * Print one constant as a JSON line
+ *
+ * @param buffer to write to
+ * @param class struct
+ * @param i index of the constant, 0-based
+ * @param info of the constant
+ * @param name of the class file
+ * @param name_length of the name
+ */
+static void print_constant_jsonl(out_buffer *out, class *cls, int i, const constant_info *info,
+                                 const char *name, size_t name_length)
+{
+    const uint8_t tag = info->class_i.tag;
+    utf_view texts[RECORD_TEXTS_MAX];
+    const int text_count = constant_texts(cls, i, tag, texts);
+    uint32_t first, second;
+
+    constant_operands(info, &first, &second);
+
+    out_str(out, "{\"file\":");
+    print_json_string(out, name, name_length);
+    print_json_number(out, "index", i + 1);
+    out_str(out, ",\"tag\":\"");
+    out_str(out, tag_names[tag]);
+    out_char(out, '"');
+
+    switch (tag)
+    {
+    case CONSTANT_Utf8:
+        print_json_text(out, "value", texts[0]);
+        break;
+    case CONSTANT_Integer:
+    case CONSTANT_Float:
+    case CONSTANT_Long:
+    case CONSTANT_Double:
+        print_json_value(out, info);
+        break;
+    case CONSTANT_Class:
+        print_json_number(out, "name_index", first);
+        print_json_text(out, "name", texts[0]);
+        break;
+    case CONSTANT_String:
+        print_json_number(out, "string_index", first);
+        print_json_text(out, "value", texts[0]);
+        break;
+    case CONSTANT_MethodType:
+        print_json_number(out, "descriptor_index", first);
+        break;
+    case CONSTANT_NameAndType:
+        print_json_number(out, "name_index", first);
+        print_json_number(out, "descriptor_index", second);
+        break;
+    case CONSTANT_InvokeDynamic:
+        print_json_number(out, "bootstrap_method_attr_index", first);
+        print_json_number(out, "name_and_type_index", second);
+        break;
+    case CONSTANT_MethodHandle:
+        out_str(out, ",\"reference_kind\":\"");
+        out_str(out, reference_kind[info->method_handle_i.reference_kind - 1]);
+        out_char(out, '"');
+        print_json_number(out, "reference_index", first);
+        break;
+    default: // Fieldref, Methodref, InterfaceMethodref
+        print_json_number(out, "class_index", first);
+        print_json_number(out, "name_and_type_index", second);
+        break;
+    }
+
+    if (text_count == 3)
+        print_json_text(out, "owner", texts[0]);
+    if (text_count >= 2)
+    {
+        print_json_text(out, "name", texts[text_count - 2]);
+        print_json_text(out, "descriptor", texts[text_count - 1]);
+    }
+    else if (tag == CONSTANT_MethodType)
+    {
+        print_json_text(out, "descriptor", texts[0]);
+    }
+    out_bytes(out, "}\n", 2);
+}
+
+/**
+ * Append little-endian numbers of a binary record
+ */
+static inline void out_le16(out_buffer *out, uint16_t value)
+{
+    const char bytes[2] = {(char)value, (char)(value >> 8)};
+    out_bytes(out, bytes, 2);
+}
+
+static inline void out_le32(out_buffer *out, uint32_t value)
+{
+    const char bytes[4] = {(char)value, (char)(value >> 8), (char)(value >> 16), (char)(value >> 24)};
+    out_bytes(out, bytes, 4);
+}
+
+/**
+ * Print one constant as a binary record
+ *
+ * @param buffer to write to
+ * @param class struct
+ * @param i index of the constant, 0-based
+ * @param info of the constant
+ */
+static void print_constant_binary(out_buffer *out, class *cls, int i, const constant_info *info)
+{
+    const uint8_t tag = info->class_i.tag;
+    utf_view texts[RECORD_TEXTS_MAX];
+    const int text_count = constant_texts(cls, i, tag, texts);
+    uint32_t first, second, length = 1 + 2 + 1 + 1 + 4 + 4 + 1;
+
+    constant_operands(info, &first, &second);
+    for (int t = 0; t < text_count; t++)
+        length += 2 + texts[t].length;
+
+    out_reserve(out, 4 + length);
+    out_le32(out, length);
+    out_char(out, RECORD_CONSTANT);
+    out_le16(out, (uint16_t)(i + 1));
+    out_char(out, (char)tag);
+    out_char(out, tag == CONSTANT_MethodHandle ? (char)info->method_handle_i.reference_kind : 0);
+    out_le32(out, first);
+    out_le32(out, second);
+    out_char(out, (char)text_count);
+    for (int t = 0; t < text_count; t++)
+    {
+        out_le16(out, texts[t].length);
+        out_bytes(out, texts[t].bytes, texts[t].length);
+    }
+}
+
+/**
+ * Print the class record: versions and the pool size
+ *
+ * @param buffer to write to
+ * @param format FORMAT_JSONL or FORMAT_BINARY
+ * @param class struct
+ * @param name of the class file
+ */
+void print_class_record(out_buffer *out, output_format format, class *cls, const char *name)
+{
+    size_t name_length = strlen(name);
+
+    if (format == FORMAT_BINARY)
+    {
+        if (name_length > UINT16_MAX)
+            name_length = UINT16_MAX;
+
+        out_le32(out, (uint32_t)(1 + 2 + 2 + 2 + 2 + name_length));
+        out_char(out, RECORD_CLASS);
+        out_le16(out, cls->minor_version);
+        out_le16(out, cls->major_version);
+        out_le16(out, cls->constant_pool_count);
+        out_le16(out, (uint16_t)name_length);
+        out_bytes(out, name, name_length);
+        return;
+    }
+
+    out_str(out, "{\"file\":");
+    print_json_string(out, name, name_length);
+    print_json_number(out, "minor_version", cls->minor_version);
+    print_json_number(out, "major_version", cls->major_version);
+    print_json_number(out, "constant_pool_count", cls->constant_pool_count);
+    out_bytes(out, "}\n", 2);
+}
+
+/**
+ * Print the record of a change found by --watch
+ *
+ * @param buffer to write to
+ * @param format FORMAT_JSONL or FORMAT_BINARY
+ * @param event what happened to the class file
+ * @param name of the class file
+ */
+void print_event_record(out_buffer *out, output_format format, change_event event, const char *name)
+{
+    size_t name_length = strlen(name);
+
+    if (format == FORMAT_BINARY)
+    {
+        if (name_length > UINT16_MAX)
+            name_length = UINT16_MAX;
+
+        out_le32(out, (uint32_t)(1 + 1 + 2 + name_length));
+        out_char(out, RECORD_EVENT);
+        out_char(out, (char)event);
+        out_le16(out, (uint16_t)name_length);
+        out_bytes(out, name, name_length);
+        return;
+    }
+
+    out_str(out, "{\"file\":");
+    print_json_string(out, name, name_length);
+    out_str(out, event == CHANGE_ADDED ? ",\"event\":\"added\"}\n"
+                 : event == CHANGE_MODIFIED ? ",\"event\":\"modified\"}\n"
+                                            : ",\"event\":\"deleted\"}\n");
+}
+
+/**
+ * Print one record of a constant
+ */
+static void print_record(out_buffer *out, output_format format, class *cls, int i, const char *name, size_t name_length)
+{
+    constant_info info;
+
+    if (!get_constant(cls, i + 1, &info))
+        return;
+
+    if (format == FORMAT_BINARY)
+        print_constant_binary(out, cls, i, &info);
+    else
+        print_constant_jsonl(out, cls, i, &info, name, name_length);
+}
+
+/**
+ * Print one record of a constant. The constant has to be decoded
+ * and resolved already.
+ *
+ * @param buffer to write to
+ * @param format FORMAT_JSONL or FORMAT_BINARY
+ * @param class struct
+ * @param i index of the constant, 0-based
+ * @param name of the class file
+ */
+void print_constant_record(out_buffer *out, output_format format, class *cls, int i, const char *name)
+{
+    print_record(out, format, cls, i, name, strlen(name));
+}
+
+/**
+ * Print the class record and a record for every constant
+ *
+ * @param buffer to write to
+ * @param format FORMAT_JSONL or FORMAT_BINARY
+ * @param class struct, loaded and resolved
+ * @param name of the class file
+ */
+void print_pool_records(out_buffer *out, output_format format, class *cls, const char *name)
+{
+    const uint16_t total_constants_count = cls->constant_pool_count ? cls->constant_pool_count - 1 : 0;
+    const size_t name_length = strlen(name);
+
+    print_class_record(out, format, cls, name);
+    for (int i = 0; i < total_constants_count; i++)
+    {
+        if (cls->tags[i]) // Long/Double gaps have no record
+            print_record(out, format, cls, i, name, name_length);
+    }
+}
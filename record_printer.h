@@ -0,0 +1,43 @@
+#ifndef RECORD_PRINTER_H
+#define RECORD_PRINTER_H
+
+#include "class_reader.h"
+#include "output.h"
+
+typedef enum output_format_e
+{
+    FORMAT_TEXT = 0, // javap-like text of pretty_printer
+    FORMAT_JSONL,    // one JSON object per line
+    FORMAT_BINARY    // length-prefixed binary records
+
+} output_format;
+
+/**
+ * Kinds of binary records, the byte after the record length
+ */
+typedef enum record_kind_e
+{
+    RECORD_CLASS = 'C',
+    RECORD_CONSTANT = 'K',
+    RECORD_EVENT = 'E'
+
+} record_kind;
+
+/**
+ * Changes reported by --watch, as in --diff=brief
+ */
+typedef enum change_event_e
+{
+    CHANGE_ADDED = 'A',
+    CHANGE_MODIFIED = 'M',
+    CHANGE_DELETED = 'D'
+
+} change_event;
+
+void print_class_record(out_buffer *out, output_format format, class *cls, const char *name);
+void print_constant_record(out_buffer *out, output_format format, class *cls, int i, const char *name);
+void print_pool_records(out_buffer *out, output_format format, class *cls, const char *name);
+void print_json_string(out_buffer *out, const char *bytes, size_t length);
+void print_event_record(out_buffer *out, output_format format, change_event event, const char *name);
+
+#endif
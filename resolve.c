@@ -0,0 +1,275 @@
+/**
+ * Resolution of symbolic references in the constant pool.
+ * 
+ * Every constant is resolved once down to the Utf8 entries the
+ * printers need, so formatting a reference is O(1) no matter how
+ * deep the chain behind it is. Indices are checked for range and
+ * the name_index chains for cycles, so a malformed class is
+ * rejected instead of sending the printers into a loop.
+ * 
+ */
+
+#include "class_reader.h"
+#include "stats.h"
+
+/**
+ * Gets the constant a name_index chain continues with
+ * 
+ * @param class struct
+ * @param index of the constant, 1-based
+ * @param next index of the constant, 1-based
+ * @return false if the constant has no such reference
+ */
+static bool next_in_chain(const class *cls, uint16_t index, uint16_t *next)
+{
+    const uint32_t payload = cls->payload[index - 1];
+
+    switch (cls->tags[index - 1])
+    {
+    case CONSTANT_Class:
+    case CONSTANT_String:
+    case CONSTANT_MethodHandle: // reference_index
+    case CONSTANT_MethodType:
+        *next = (uint16_t)payload;
+        return true;
+    case CONSTANT_Fieldref:
+    case CONSTANT_Methodref:
+    case CONSTANT_InterfaceMethodref:
+    case CONSTANT_NameAndType: // class_index/name_index
+        *next = (uint16_t)(payload >> 16);
+        return true;
+    default:
+        return false;
+    }
+}
+
+/**
+ * Checks that the index points to an existing constant,
+ * validates it if it is an unchecked Utf8
+ * 
+ * @param class struct
+ * @param index to check, 1-based
+ * @param from index of the constant holding the reference
+ * @return false if the index is out of range, hits the gap after Long/Double
+ *         or the text is malformed
+ */
+static bool check_index(class *cls, uint16_t index, uint16_t from)
+{
+    if (index == 0 || index >= cls->constant_pool_count || !cls->tags[index - 1])
+    {
+        set_class_error("Bad constant pool reference #%d in #%d", index, from);
+        return false;
+    }
+
+    return check_constant(cls, index);
+}
+
+/**
+ * Follows the name_index chain from the constant down to a Utf8
+ * 
+ * @param class struct
+ * @param index of the constant, 1-based
+ * @return false on a broken or cyclic chain
+ */
+static bool resolve_chain(class *cls, uint16_t index)
+{
+    uint16_t current = index, utf;
+    uint32_t length = 0;
+
+    // Mark the way down until a Utf8 or an already resolved constant
+    for (;; length++)
+    {
+        resolved_constant *resolved = cls->resolved + current - 1;
+        uint16_t next;
+
+        if (resolved->utf)
+        {
+            utf = resolved->utf;
+            break;
+        }
+        if (cls->tags[current - 1] == CONSTANT_Utf8)
+        {
+            utf = current;
+            break;
+        }
+        if (resolved->state == RESOLVING)
+        {
+            set_class_error("Constant pool reference cycle at #%d", current);
+            return false;
+        }
+        if (!next_in_chain(cls, current, &next))
+        {
+            set_class_error("Constant #%d has no name, referenced from #%d", current, index);
+            return false;
+        }
+        if (!check_index(cls, next, current))
+            return false;
+
+        resolved->state = RESOLVING;
+        current = next;
+    }
+
+    if (thread_stats)
+        record_chain(length, index);
+
+    // Walk the same way again and remember the result
+    for (current = index; cls->resolved[current - 1].utf == 0;)
+    {
+        cls->resolved[current - 1].utf = utf;
+        if (!next_in_chain(cls, current, &current))
+            break;
+    }
+
+    return true;
+}
+
+/**
+ * Resolves the Utf8 a reference ends with
+ * 
+ * @param class struct
+ * @param index of the referenced constant, 1-based
+ * @param from index of the constant holding the reference
+ * @param utf resolved Utf8 index
+ * @return false on a broken reference
+ */
+static bool resolve_utf(class *cls, uint16_t index, uint16_t from, uint16_t *utf)
+{
+    if (!check_index(cls, index, from))
+        return false;
+
+    if (!cls->resolved[index - 1].utf && !resolve_chain(cls, index))
+        return false;
+
+    *utf = cls->resolved[index - 1].utf;
+    return true;
+}
+
+/**
+ * Checks the tag of a referenced constant
+ * 
+ * @param class struct
+ * @param index of the referenced constant, 1-based
+ * @param from index of the constant holding the reference
+ * @param tag expected, CONSTANT_Methodref stands for any Ref
+ * @return false if the constant is of another kind
+ */
+static bool check_tag(class *cls, uint16_t index, uint16_t from, uint8_t tag)
+{
+    if (!check_index(cls, index, from))
+        return false;
+
+    uint8_t actual = cls->tags[index - 1];
+    bool ok = actual == tag ||
+              (tag == CONSTANT_Methodref && (actual == CONSTANT_Fieldref || actual == CONSTANT_InterfaceMethodref));
+
+    if (!ok)
+        set_class_error("Constant #%d referenced from #%d has wrong kind %d", index, from, actual);
+    return ok;
+}
+
+/**
+ * Resolves a single constant (and whatever it depends on) on demand
+ * 
+ * @param class struct
+ * @param index of the constant, 1-based
+ * @return resolved references or NULL on a malformed pool (see class_error)
+ */
+const resolved_constant *resolve_constant(class *cls, uint16_t index)
+{
+    constant_info constant, *info = &constant;
+    const resolved_constant *target;
+    uint16_t unused;
+
+    if (index && index < cls->constant_pool_count && cls->resolved[index - 1].state == RESOLVED)
+        return cls->resolved + index - 1;
+
+    if (!get_constant(cls, index, info))
+        return NULL;
+
+    resolved_constant *resolved = cls->resolved + index - 1;
+
+    switch (info->class_i.tag)
+    {
+    case CONSTANT_Utf8:
+    case CONSTANT_Class:
+    case CONSTANT_String:
+        if (!resolve_utf(cls, index, index, &unused))
+            return NULL;
+        break;
+
+    case CONSTANT_MethodType:
+        if (!resolve_utf(cls, index, index, &resolved->descriptor))
+            return NULL;
+        break;
+
+    case CONSTANT_NameAndType:
+        if (!resolve_utf(cls, index, index, &unused) ||
+            !resolve_utf(cls, info->ref_i.class_index, index, &resolved->name) ||
+            !resolve_utf(cls, info->ref_i.name_and_type_index, index, &resolved->descriptor))
+            return NULL;
+        break;
+
+    case CONSTANT_Fieldref:
+    case CONSTANT_Methodref:
+    case CONSTANT_InterfaceMethodref:
+        if (!resolve_utf(cls, index, index, &unused) ||
+            !check_tag(cls, info->ref_i.name_and_type_index, index, CONSTANT_NameAndType) ||
+            !(target = resolve_constant(cls, info->ref_i.name_and_type_index)))
+            return NULL;
+        resolved->owner = resolved->utf;
+        resolved->name = target->name;
+        resolved->descriptor = target->descriptor;
+        break;
+
+    case CONSTANT_MethodHandle:
+        if (info->method_handle_i.reference_kind < 1 || info->method_handle_i.reference_kind > 9)
+        {
+            set_class_error("Bad reference kind %d in #%d", info->method_handle_i.reference_kind, index);
+            return NULL;
+        }
+        if (!resolve_utf(cls, index, index, &unused) ||
+            !check_tag(cls, info->method_handle_i.reference_index, index, CONSTANT_Methodref) ||
+            !(target = resolve_constant(cls, info->method_handle_i.reference_index)))
+            return NULL;
+        resolved->owner = target->owner;
+        resolved->name = target->name;
+        resolved->descriptor = target->descriptor;
+        break;
+
+    case CONSTANT_InvokeDynamic:
+        if (!check_tag(cls, info->invoke_dynamic_i.name_and_type_index, index, CONSTANT_NameAndType) ||
+            !(target = resolve_constant(cls, info->invoke_dynamic_i.name_and_type_index)))
+            return NULL;
+        resolved->name = target->name;
+        resolved->descriptor = target->descriptor;
+        break;
+
+    default:
+        break;
+    }
+
+    resolved->state = RESOLVED;
+    return resolved;
+}
+
+/**
+ * Resolves every constant of the pool
+ * 
+ * @param class struct with a parsed constant pool
+ * @return false on a malformed pool (see class_error)
+ */
+bool resolve_constant_pool(class *cls)
+{
+    const uint16_t total_constants_count = cls->constant_pool_count ? cls->constant_pool_count - 1 : 0;
+
+    if (!cls->resolved)
+        cls->resolved = arena_calloc(cls->arena, total_constants_count + 1, sizeof(resolved_constant));
+
+    for (int i = 1; i <= total_constants_count; i++)
+    {
+        if (cls->tags[i - 1] && !resolve_constant(cls, i))
+            return false;
+    }
+
+    return true;
+}
@@ -0,0 +1,546 @@
+/**
+ * Daemon mode: parses classes on request over a Unix domain socket.
+ *
+ * Starting the tool for every class pays for the process, mapping
+ * and first-touch of every buffer again and again. The server keeps
+ * one thread per -j, each with its arena, output and request buffers
+ * warm across requests. The listening socket and all connections are
+ * in one epoll set; a connection is armed for one request at a time,
+ * so whichever thread is free answers the next request and requests
+ * on one connection are answered in order.
+ *
+ * The protocol is described in class_client.h. Requests name a file
+ * the server maps itself, or carry the class bytes; either way the
+ * answer is exactly what the batch would print for the class.
+ *
+ */
+
+#define _GNU_SOURCE
+#include "server.h"
+
+#include <errno.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+
+#include "class_client.h"
+#include "class_reader.h"
+#include "jar_reader.h"
+#include "thread_pool.h"
+
+#define RESPONSE_HEADER 5                  // u32 length + u8 status
+#define SERVER_KEEP_BYTES ((size_t)16 << 20) // buffers grown past this are given back after the request
+
+static const char *listening_path; // removed when the server is stopped
+
+static void stop_server(int signal)
+{
+    (void)signal;
+    unlink(listening_path);
+    _exit(0);
+}
+
+static uint16_t read_u16_le(const uint8_t *p)
+{
+    return (uint16_t)(p[0] | p[1] << 8);
+}
+
+/**
+ * Reads exactly size bytes
+ *
+ * @return false on an error or if the connection is closed first
+ */
+static bool read_full(int fd, void *buffer, size_t size)
+{
+    for (size_t done = 0; done < size;)
+    {
+        ssize_t count = read(fd, (char *)buffer + done, size - done);
+
+        if (count < 0 && errno == EINTR)
+            continue;
+        if (count <= 0)
+            return false;
+        done += count;
+    }
+    return true;
+}
+
+/**
+ * Writes the whole response, a client that went away doesn't raise SIGPIPE
+ *
+ * @return false if the connection is gone
+ */
+static bool write_full(int fd, const char *data, size_t size)
+{
+    while (size)
+    {
+        ssize_t count = send(fd, data, size, MSG_NOSIGNAL);
+
+        if (count < 0 && errno == EINTR)
+            continue;
+        if (count < 0)
+            return false;
+        data += count;
+        size -= count;
+    }
+    return true;
+}
+
+/**
+ * Replaces the response with an error message
+ *
+ * @param out response being built
+ * @param message NUL-terminated
+ */
+static void set_error_response(out_buffer *out, const char *message)
+{
+    out->length = RESPONSE_HEADER;
+    out_str(out, message);
+    out->data[4] = RESPONSE_ERROR;
+}
+
+/**
+ * Parses and formats the class of one request into the response
+ *
+ * @param server the request came to
+ * @param worker serving it
+ * @param frame of the request after its length, NUL-terminated
+ * @param length of the frame
+ */
+static void handle_request(class_server *server, server_worker *worker, uint8_t *frame, size_t length)
+{
+    batch_options options = *server->options;
+    const request_kind kind = frame[0];
+    const request_mode mode = frame[2];
+    const size_t name_length = read_u16_le(frame + 6);
+    char *payload = (char *)frame + CLASS_REQUEST_HEADER + name_length;
+    const size_t payload_length = length - CLASS_REQUEST_HEADER - name_length;
+    out_buffer *out = &worker->out;
+
+    out->length = RESPONSE_HEADER;
+    out->data[4] = RESPONSE_OK;
+
+    if (name_length > length - CLASS_REQUEST_HEADER)
+    {
+        set_error_response(out, "Bad request: name longer than the request");
+        return;
+    }
+    if ((kind != REQUEST_PATH && kind != REQUEST_DATA) || frame[1] > FORMAT_BINARY || mode > MODE_CODE)
+    {
+        set_error_response(out, "Bad request: unknown kind, format or mode");
+        return;
+    }
+    if (frame[1] != FORMAT_TEXT && mode != MODE_POOL)
+    {
+        set_error_response(out, "Bad request: the format applies to the constant pool output only");
+        return;
+    }
+    if (memchr(frame + CLASS_REQUEST_HEADER, '\0', name_length) ||
+        (kind == REQUEST_PATH && memchr(payload, '\0', payload_length)))
+    {
+        set_error_response(out, "Bad request: NUL in the name or path");
+        return;
+    }
+
+    options.format = frame[1];
+    options.summary = mode == MODE_SUMMARY;
+    options.code = mode == MODE_CODE;
+    options.constant_index = read_u16_le(frame + 4);
+
+    const unsigned flags = batch_parse_flags(&options);
+    parse_cache *cache = flags & PARSE_LAZY ? NULL : options.cache;
+    const char *name = kind == REQUEST_PATH ? payload : "-";
+
+    if (name_length)
+    {
+        char *copy = arena_alloc(&worker->arena, name_length + 1);
+
+        memcpy(copy, frame + CLASS_REQUEST_HEADER, name_length);
+        copy[name_length] = '\0';
+        name = copy;
+    }
+    class *cls = kind == REQUEST_PATH
+                     ? map_class_file(payload, &worker->arena, flags, cache)
+                     : parse_class_buffer((const uint8_t *)payload, payload_length, &worker->arena, flags, cache);
+
+    if (!cls || !print_class(out, cls, name, &options))
+        set_error_response(out, class_error());
+    free_class(cls);
+}
+
+/**
+ * Answers the next request of a connection
+ *
+ * @param server the connection came to
+ * @param worker serving it
+ * @param fd of the connection
+ * @return false if the connection is to be closed
+ */
+static bool serve_request(class_server *server, server_worker *worker, int fd)
+{
+    uint8_t prefix[4];
+
+    if (!read_full(fd, prefix, sizeof(prefix)))
+        return false;
+
+    const size_t length = prefix[0] | prefix[1] << 8 | prefix[2] << 16 | (size_t)prefix[3] << 24;
+    bool framed = length >= CLASS_REQUEST_HEADER && length <= CLASS_REQUEST_MAX;
+    bool allocated = true;
+
+    if (framed && worker->request_capacity < length + 1)
+    {
+        free(worker->request);
+        worker->request = malloc(length + 1);
+        worker->request_capacity = worker->request ? length + 1 : 0;
+        allocated = worker->request != NULL;
+    }
+
+    if (!framed)
+    {
+        // The next request can't be found, answer and hang up
+        set_error_response(&worker->out, "Bad request length");
+    }
+    else if (!allocated)
+    {
+        // The request is not read, so the next one can't be found either
+        set_error_response(&worker->out, "Request too large for the server's memory");
+        framed = false;
+    }
+    else
+    {
+        if (!read_full(fd, worker->request, length))
+            return false;
+        worker->request[length] = '\0'; // paths are used as they are
+        handle_request(server, worker, worker->request, length);
+    }
+
+    const size_t size = worker->out.length - 4;
+    worker->out.data[0] = (char)size;
+    worker->out.data[1] = (char)(size >> 8);
+    worker->out.data[2] = (char)(size >> 16);
+    worker->out.data[3] = (char)(size >> 24);
+    const bool written = write_full(fd, worker->out.data, worker->out.length);
+
+    // Keep the buffers warm, but don't hold on to what a huge class needed
+    arena_reset(&worker->arena);
+    if (worker->arena.total_size > SERVER_KEEP_BYTES)
+    {
+        arena_release(&worker->arena);
+        arena_init(&worker->arena, 1 << 16);
+    }
+    if (worker->out.capacity > SERVER_KEEP_BYTES)
+    {
+        out_free(&worker->out);
+        out_init(&worker->out, -1);
+    }
+    if (worker->request_capacity > SERVER_KEEP_BYTES)
+    {
+        free(worker->request);
+        worker->request = NULL;
+        worker->request_capacity = 0;
+    }
+
+    return written && framed;
+}
+
+/**
+ * Takes all waiting connections and adds them to the epoll set,
+ * each armed for its first request
+ *
+ * @param server to accept on
+ */
+static void accept_connections(class_server *server)
+{
+    int fd;
+
+    while ((fd = accept4(server->listener, NULL, NULL, SOCK_CLOEXEC)) >= 0 || errno == EINTR || errno == ECONNABORTED)
+    {
+        struct epoll_event event = {EPOLLIN | EPOLLONESHOT, {.fd = fd}};
+
+        if (fd >= 0 && epoll_ctl(server->epoll, EPOLL_CTL_ADD, fd, &event) < 0)
+            close(fd);
+    }
+}
+
+/**
+ * Server thread: answers requests for as long as the server runs
+ *
+ * @param context the server
+ * @param index of the thread
+ * @param worker running the task
+ */
+static void serve_connections(void *context, size_t index, int worker_index)
+{
+    class_server *server = context;
+    server_worker worker = {0};
+    struct epoll_event event;
+
+    (void)index;
+    (void)worker_index;
+    arena_init(&worker.arena, 1 << 16);
+    out_init(&worker.out, -1);
+
+    for (;;)
+    {
+        int count = epoll_wait(server->epoll, &event, 1, -1);
+
+        if (count < 0 && errno != EINTR)
+            break;
+        if (count <= 0)
+            continue;
+
+        if (event.data.fd == server->listener)
+        {
+            accept_connections(server);
+        }
+        else if (serve_request(server, &worker, event.data.fd))
+        {
+            // Ready for the next request, which any thread may take
+            event.events = EPOLLIN | EPOLLONESHOT;
+            epoll_ctl(server->epoll, EPOLL_CTL_MOD, event.data.fd, &event);
+        }
+        else
+        {
+            close(event.data.fd);
+        }
+    }
+
+    out_free(&worker.out);
+    arena_release(&worker.arena);
+    free(worker.request);
+}
+
+/**
+ * Opens the listening socket. A socket file left behind by a server
+ * that is gone is replaced, one that still answers is not.
+ *
+ * @return socket, -1 on error (see class_error)
+ */
+static int listen_on(const char *socket_path)
+{
+    struct sockaddr_un address = {.sun_family = AF_UNIX};
+    struct stat status;
+
+    if (strlen(socket_path) >= sizeof(address.sun_path))
+    {
+        set_class_error("Socket path too long: %s", socket_path);
+        return -1;
+    }
+    strcpy(address.sun_path, socket_path);
+
+    if (lstat(socket_path, &status) == 0)
+    {
+        int other = S_ISSOCK(status.st_mode) ? connect_class_server(socket_path) : -1;
+
+        if (other >= 0 || !S_ISSOCK(status.st_mode))
+        {
+            if (other >= 0)
+                close(other);
+            set_class_error("%s: %s", socket_path, other >= 0 ? "a server is running there" : "not a socket");
+            return -1;
+        }
+        unlink(socket_path);
+    }
+
+    // Non-blocking, so threads woken for the same connection don't wait in accept
+    int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC | SOCK_NONBLOCK, 0);
+    if (fd < 0 || bind(fd, (struct sockaddr *)&address, sizeof(address)) < 0 || listen(fd, SOMAXCONN) < 0)
+    {
+        set_class_error("%s: %s", socket_path, strerror(errno));
+        if (fd >= 0)
+            close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+/**
+ * Serves requests on a Unix domain socket until SIGINT or SIGTERM
+ *
+ * @param socket_path to listen on
+ * @param options threads and parse cache; the output is picked per request
+ * @return false if the socket couldn't be opened (see class_error)
+ */
+bool run_server(const char *socket_path, const batch_options *options)
+{
+    class_server server = {listen_on(socket_path), epoll_create1(EPOLL_CLOEXEC), options};
+    const int thread_count = options->thread_count < 1 ? 1 : options->thread_count;
+    struct sigaction action = {.sa_handler = stop_server};
+    struct epoll_event event = {EPOLLIN, {.fd = server.listener}};
+
+    if (server.listener < 0 || server.epoll < 0 || epoll_ctl(server.epoll, EPOLL_CTL_ADD, server.listener, &event) < 0)
+    {
+        if (server.listener >= 0)
+        {
+            set_class_error("%s: %s", socket_path, strerror(errno));
+            unlink(socket_path);
+            close(server.listener);
+        }
+        if (server.epoll >= 0)
+            close(server.epoll);
+        return false;
+    }
+
+    listening_path = socket_path;
+    sigemptyset(&action.sa_mask);
+    sigaction(SIGINT, &action, NULL);
+    sigaction(SIGTERM, &action, NULL);
+
+    fprintf(stderr, "Listening on %s with %d threads\n", socket_path, thread_count);
+    // One task per thread, each runs for the life of the server
+    run_thread_pool(thread_count, thread_count, serve_connections, &server);
+
+    unlink(socket_path);
+    close(server.listener);
+    close(server.epoll);
+    set_class_error("%s: %s", socket_path, strerror(errno));
+    return false;
+}
+
+/**
+ * Reads everything from a file descriptor
+ *
+ * @param fd to read
+ * @param size read
+ * @return malloc'ed data, NULL on error
+ */
+static uint8_t *read_all(int fd, size_t *size)
+{
+    size_t capacity = 1 << 16;
+    uint8_t *data = malloc(capacity);
+
+    *size = 0;
+    for (ssize_t count; data; *size += count)
+    {
+        if (*size == capacity)
+        {
+            uint8_t *grown = realloc(data, capacity *= 2);
+            if (!grown)
+                free(data);
+            data = grown;
+            if (!data)
+                break;
+        }
+
+        count = read(fd, data + *size, capacity - *size);
+        if (count < 0 && errno == EINTR)
+            count = 0;
+        else if (count < 0)
+        {
+            free(data);
+            return NULL;
+        }
+        else if (count == 0)
+            break;
+    }
+    return data;
+}
+
+/**
+ * Client of run_server: has every input parsed and printed by the
+ * server, printing what it answers as the batch would. Files are sent
+ * by absolute path, archive entries and the standard input as data.
+ *
+ * @param socket_path of the server
+ * @param files to process
+ * @param options of the output
+ * @return number of inputs that could not be parsed
+ */
+int run_client(const char *socket_path, file_list *files, const batch_options *options)
+{
+    const bool headers = files->count > 1 && options->format == FORMAT_TEXT;
+    class_response response = {0};
+    out_buffer out;
+    arena a;
+    int failed = 0;
+
+    int fd = connect_class_server(socket_path);
+    if (fd < 0)
+    {
+        fprintf(stderr, "%s: %s\n", socket_path, strerror(errno));
+        return (int)files->count;
+    }
+
+    class_request request = {REQUEST_PATH, (uint8_t)options->format,
+                             options->code ? MODE_CODE : options->summary ? MODE_SUMMARY : MODE_POOL,
+                             options->constant_index, NULL};
+    out_init(&out, STDOUT_FILENO);
+    arena_init(&a, 1 << 16);
+
+    for (size_t i = 0; i < files->count; i++)
+    {
+        class_input *input = files->inputs + i;
+        char *path = NULL;
+        uint8_t *data = NULL;
+        const char *error = input->error;
+
+        request.kind = input->jar || strcmp(input->name, "-") == 0 ? REQUEST_DATA : REQUEST_PATH;
+        request.name = input->name;
+        if (!error && input->jar)
+        {
+            if (!(request.payload = read_jar_entry(input->jar, input->entry, &a, &request.length)))
+                error = class_error();
+        }
+        else if (!error && request.kind == REQUEST_DATA)
+        {
+            if (!(request.payload = data = read_all(STDIN_FILENO, &request.length)))
+                error = strerror(errno);
+        }
+        else if (!error)
+        {
+            // The server may run in another directory
+            path = realpath(input->name, NULL);
+            request.payload = path ? path : input->name;
+            request.length = strlen(request.payload);
+        }
+
+        if (!error && !send_class_request(fd, &request, &response))
+        {
+            fprintf(stderr, "%s: %s\n", socket_path, strerror(errno));
+            failed += (int)(files->count - i);
+            free(path);
+            free(data);
+            break;
+        }
+        if (!error && response.status != RESPONSE_OK)
+            error = response.body;
+
+        if (error)
+        {
+            out_flush(&out); // keep the order of output and errors
+            if (files->count > 1)
+                fprintf(stderr, "%s: %s\n", input->name, error);
+            else
+                fprintf(stderr, "%s\n", error);
+            failed++;
+        }
+        else
+        {
+            if (headers)
+            {
+                out_str(&out, "Classfile ");
+                out_str(&out, input->name);
+                out_char(&out, '\n');
+            }
+            out_bytes(&out, response.body, response.length);
+            if (headers)
+                out_char(&out, '\n');
+        }
+
+        free(path);
+        free(data);
+        arena_reset(&a);
+    }
+
+    out_free(&out);
+    arena_release(&a);
+    free_class_response(&response);
+    close(fd);
+    return failed;
+}
@@ -0,0 +1,35 @@
+#ifndef SERVER_H
+#define SERVER_H
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "arena.h"
+#include "batch.h"
+#include "file_list.h"
+#include "output.h"
+
+typedef struct class_server_s
+{
+    int listener;                 // listening Unix domain socket
+    int epoll;                    // the listener and every connection waiting for a request
+    const batch_options *options; // threads and cache; requests pick the output
+
+} class_server;
+
+/**
+ * What a server thread keeps warm between requests
+ */
+typedef struct server_worker_s
+{
+    arena arena;      // reset after every request
+    out_buffer out;   // response being built, starting with its header
+    uint8_t *request; // frame being read, without its length
+    size_t request_capacity;
+
+} server_worker;
+
+bool run_server(const char *socket_path, const batch_options *options);
+int run_client(const char *socket_path, file_list *files, const batch_options *options);
+
+#endif
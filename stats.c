@@ -0,0 +1,225 @@
+/**
+ * Run statistics for --stats: time per phase, bytes read,
+ * allocations, the mix of constants and the longest reference
+ * chains resolution had to follow.
+ *
+ * The hooks in the parser only look at thread_stats, which is NULL
+ * unless statistics are collected, so a normal run pays one branch
+ * per phase. Allocations are counted where the program allocates for
+ * classes and output: arena blocks, output buffers, stream, request
+ * and cache buffers; malloc itself is left alone. Each worker counts
+ * into its own run_stats without any locking, the batch sums them up
+ * once all files are done.
+ *
+ */
+
+#include "stats.h"
+
+#include <stdio.h>
+#include <string.h>
+
+#include "class_reader.h"
+
+__thread run_stats *thread_stats;
+
+static const char *phase_names[PHASE_COUNT] =
+{
+    [PHASE_OPEN] = "open",
+    [PHASE_MAGIC] = "magic",
+    [PHASE_HEADER] = "header",
+    [PHASE_POOL] = "pool",
+    [PHASE_CACHE] = "cache",
+    [PHASE_RESOLVE] = "resolve",
+    [PHASE_MEMBERS] = "members",
+    [PHASE_PRINT] = "print"
+};
+
+static const char *tag_names[STATS_TAGS] =
+{
+    [CONSTANT_Utf8] = "Utf8",
+    [CONSTANT_Integer] = "Integer",
+    [CONSTANT_Float] = "Float",
+    [CONSTANT_Long] = "Long",
+    [CONSTANT_Double] = "Double",
+    [CONSTANT_Class] = "Class",
+    [CONSTANT_String] = "String",
+    [CONSTANT_Fieldref] = "Fieldref",
+    [CONSTANT_Methodref] = "Methodref",
+    [CONSTANT_InterfaceMethodref] = "InterfaceMethodref",
+    [CONSTANT_NameAndType] = "NameAndType",
+    [CONSTANT_MethodHandle] = "MethodHandle",
+    [CONSTANT_MethodType] = "MethodType",
+    [CONSTANT_InvokeDynamic] = "InvokeDynamic"
+};
+
+/**
+ * Keeps a reference chain if it is among the longest ones
+ *
+ * @param length of the chain in constants
+ * @param index of the constant the chain starts at
+ */
+void record_chain(uint32_t length, uint16_t index)
+{
+    chain_record *chains = thread_stats->chains;
+    int i = STATS_CHAINS;
+
+    while (i > 0 && chains[i - 1].length < length)
+        i--;
+    if (i == STATS_CHAINS)
+        return;
+
+    memmove(chains + i + 1, chains + i, (STATS_CHAINS - i - 1) * sizeof(chain_record));
+    chains[i] = (chain_record){length, index, thread_stats->file};
+}
+
+/**
+ * Adds the constants of a class to the histogram
+ *
+ * @param cls class struct
+ */
+void count_constants(const class *cls)
+{
+    for (uint16_t i = 1; i < cls->constant_pool_count; i++)
+    {
+        const uint8_t tag = cls->tags[i - 1];
+
+        if (tag) // not a Long/Double gap
+        {
+            thread_stats->constants++;
+            thread_stats->tags[tag < STATS_TAGS ? tag : 0]++;
+        }
+    }
+}
+
+/**
+ * Adds the counters of one worker to the total
+ *
+ * @param total to add to
+ * @param part to add
+ */
+void merge_stats(run_stats *total, const run_stats *part)
+{
+    for (int p = 0; p < PHASE_COUNT; p++)
+    {
+        total->phase_ns[p] += part->phase_ns[p];
+        total->phase_calls[p] += part->phase_calls[p];
+    }
+    for (int t = 0; t < STATS_TAGS; t++)
+        total->tags[t] += part->tags[t];
+
+    total->files += part->files;
+    total->failed += part->failed;
+    total->bytes_read += part->bytes_read;
+    total->allocations += part->allocations;
+    total->allocated_bytes += part->allocated_bytes;
+    total->constants += part->constants;
+
+    run_stats *saved = thread_stats; // record_chain works on thread_stats
+
+    thread_stats = total;
+    for (int c = 0; c < STATS_CHAINS && part->chains[c].length; c++)
+    {
+        total->file = part->chains[c].file;
+        record_chain(part->chains[c].length, part->chains[c].index);
+    }
+    total->file = NULL;
+    thread_stats = saved;
+}
+
+/**
+ * Print a JSON string, file names may have quotes and backslashes
+ */
+static void print_json_name(const char *s)
+{
+    fputc('"', stderr);
+    for (; *s; s++)
+    {
+        if (*s == '"' || *s == '\\')
+            fputc('\\', stderr);
+        if ((unsigned char)*s >= 0x20)
+            fputc(*s, stderr);
+    }
+    fputc('"', stderr);
+}
+
+static void print_stats_json(const run_stats *stats)
+{
+    const char *separator = "";
+
+    fprintf(stderr, "{\"files\": %zu, \"failed\": %zu, \"bytes_read\": %zu, \"allocations\": %zu, "
+                    "\"allocated_bytes\": %zu, \"constants\": %zu, \"phases\": {",
+            stats->files, stats->failed, stats->bytes_read, stats->allocations, stats->allocated_bytes,
+            stats->constants);
+    for (int p = 0; p < PHASE_COUNT; p++, separator = ", ")
+        fprintf(stderr, "%s\"%s\": {\"ns\": %llu, \"calls\": %llu}", separator, phase_names[p],
+                (unsigned long long)stats->phase_ns[p], (unsigned long long)stats->phase_calls[p]);
+
+    fprintf(stderr, "}, \"tags\": {");
+    separator = "";
+    for (int t = 0; t < STATS_TAGS; t++)
+    {
+        if (stats->tags[t])
+        {
+            fprintf(stderr, "%s\"%s\": %zu", separator, tag_names[t] ? tag_names[t] : "unknown", stats->tags[t]);
+            separator = ", ";
+        }
+    }
+
+    fprintf(stderr, "}, \"chains\": [");
+    for (int c = 0; c < STATS_CHAINS && stats->chains[c].length; c++)
+    {
+        fprintf(stderr, "%s{\"file\": ", c ? ", " : "");
+        print_json_name(stats->chains[c].file ? stats->chains[c].file : "");
+        fprintf(stderr, ", \"index\": %u, \"length\": %u}", stats->chains[c].index, stats->chains[c].length);
+    }
+    fprintf(stderr, "]}\n");
+}
+
+static void print_stats_text(const run_stats *stats)
+{
+    uint64_t total_ns = 0;
+
+    for (int p = 0; p < PHASE_COUNT; p++)
+        total_ns += stats->phase_ns[p];
+
+    fprintf(stderr, "Files: %zu, %zu failed, %.2f MB read\n", stats->files, stats->failed, stats->bytes_read / 1e6);
+    fprintf(stderr, "Allocations: %zu, %.2f MB\n", stats->allocations, stats->allocated_bytes / 1e6);
+
+    fprintf(stderr, "Time by phase, summed over threads:\n");
+    for (int p = 0; p < PHASE_COUNT; p++)
+    {
+        if (stats->phase_calls[p])
+            fprintf(stderr, "  %-8s %10.3f ms %5.1f%% %10llu calls\n", phase_names[p], stats->phase_ns[p] / 1e6,
+                    total_ns ? 100.0 * stats->phase_ns[p] / total_ns : 0.0, (unsigned long long)stats->phase_calls[p]);
+    }
+
+    fprintf(stderr, "Constants: %zu\n", stats->constants);
+    for (int t = 0; t < STATS_TAGS; t++)
+    {
+        if (stats->tags[t])
+            fprintf(stderr, "  %-18s %10zu %5.1f%%\n", tag_names[t] ? tag_names[t] : "unknown", stats->tags[t],
+                    100.0 * stats->tags[t] / stats->constants);
+    }
+
+    if (stats->chains[0].length)
+    {
+        fprintf(stderr, "Longest reference chains:\n");
+        for (int c = 0; c < STATS_CHAINS && stats->chains[c].length; c++)
+            fprintf(stderr, "  %u  %s #%u\n", stats->chains[c].length,
+                    stats->chains[c].file ? stats->chains[c].file : "", stats->chains[c].index);
+    }
+}
+
+/**
+ * Print the statistics of a run to stderr
+ *
+ * @param stats to print
+ * @param json one JSON object instead of text
+ */
+void print_stats(const run_stats *stats, bool json)
+{
+    if (json)
+        print_stats_json(stats);
+    else
+        print_stats_text(stats);
+}
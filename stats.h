@@ -0,0 +1,119 @@
+#ifndef STATS_H
+#define STATS_H
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <time.h>
+
+#define STATS_TAGS 32   // constant tags are below
+#define STATS_CHAINS 5  // longest reference chains kept
+
+typedef enum stats_phase_e
+{
+    PHASE_OPEN = 0, // open and map a file, inflate an archive entry
+    PHASE_MAGIC,
+    PHASE_HEADER,
+    PHASE_POOL,     // parse the constant pool
+    PHASE_CACHE,    // load the pool from the parse cache instead
+    PHASE_RESOLVE,  // check Utf8 and resolve references
+    PHASE_MEMBERS,  // locate fields, methods and attributes
+    PHASE_PRINT,
+    PHASE_COUNT
+
+} stats_phase;
+
+typedef struct chain_record_s
+{
+    uint32_t length; // constants followed down to the Utf8
+    uint16_t index;  // constant the chain starts at
+    const char *file;
+
+} chain_record;
+
+/**
+ * Counters of a run. Every worker thread fills its own, they are
+ * summed up with merge_stats at the end.
+ */
+typedef struct run_stats_s
+{
+    uint64_t phase_ns[PHASE_COUNT];
+    uint64_t phase_calls[PHASE_COUNT];
+    size_t files;
+    size_t failed;
+    size_t bytes_read;
+    size_t allocations;     // arena blocks, output, stream and cache buffers
+    size_t allocated_bytes;
+    size_t constants;
+    size_t tags[STATS_TAGS];
+    chain_record chains[STATS_CHAINS]; // longest first
+    const char *file; // being processed, for chain records
+
+} run_stats;
+
+/**
+ * Where the current thread counts, NULL when nothing is collected.
+ * That is all the hooks check, so they cost a branch when disabled.
+ */
+extern __thread run_stats *thread_stats;
+
+typedef struct class_s class; // see class_reader.h
+
+void record_chain(uint32_t length, uint16_t index);
+void count_constants(const class *cls);
+void merge_stats(run_stats *total, const run_stats *part);
+void print_stats(const run_stats *stats, bool json);
+
+static inline uint64_t stats_clock(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000u + ts.tv_nsec;
+}
+
+/**
+ * Starts timing a phase
+ *
+ * @return start time, 0 when nothing is collected
+ */
+static inline uint64_t stats_start(void)
+{
+    return thread_stats ? stats_clock() : 0;
+}
+
+/**
+ * Adds the time since stats_start to a phase
+ *
+ * @param phase to add to
+ * @param start returned by stats_start
+ */
+static inline void stats_stop(stats_phase phase, uint64_t start)
+{
+    if (thread_stats)
+    {
+        thread_stats->phase_ns[phase] += stats_clock() - start;
+        thread_stats->phase_calls[phase]++;
+    }
+}
+
+/**
+ * Counts a heap allocation made for class data, an arena or output
+ */
+static inline void stats_alloc(size_t bytes)
+{
+    if (thread_stats)
+    {
+        thread_stats->allocations++;
+        thread_stats->allocated_bytes += bytes;
+    }
+}
+
+/**
+ * Counts bytes of class data read
+ */
+static inline void stats_read(size_t bytes)
+{
+    if (thread_stats)
+        thread_stats->bytes_read += bytes;
+}
+
+#endif
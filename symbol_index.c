@@ -0,0 +1,805 @@
+/**
+ * Cross-class symbol index: which classes reference a class, a
+ * field, a method or a string literal.
+ *
+ * Building walks the inputs on the thread pool. Every worker interns
+ * the symbols of its classes in its own hash table and records a
+ * posting per constant, the tables are merged and sorted at the end.
+ *
+ * The index file is used in place through mmap:
+ *
+ *   header
+ *   classes   u4 text offset of every input name
+ *   symbols   index_symbol sorted by group, owner, name, descriptor, kind
+ *   by_name   u4 symbol positions sorted by group, name, descriptor, owner
+ *   postings  index_posting grouped by symbol, by class and index within
+ *   text      input names (NUL-terminated) and symbol texts
+ *
+ * Classes and members form the first group, string literals the
+ * second, so an exact or prefix owner is a binary search in the
+ * symbols, an exact or prefix name with any owner one in by_name.
+ * Only a query on the descriptor alone scans a whole group.
+ *
+ */
+
+#define _GNU_SOURCE
+#include "symbol_index.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "class_reader.h"
+#include "intern_table.h"
+#include "output.h"
+#include "record_printer.h"
+#include "thread_pool.h"
+
+#define INDEX_MAGIC 0x5849534a // "JSIX"
+#define INDEX_VERSION 1
+
+typedef struct index_header_s
+{
+    uint32_t magic;
+    uint16_t version;
+    uint16_t reserved;
+    uint32_t class_count;
+    uint32_t symbol_count;
+    uint64_t posting_count;
+    uint64_t text_size;
+
+} index_header;
+
+/**
+ * Symbol while the index is being built
+ */
+typedef struct build_symbol_s
+{
+    intern_entry key; // owner, name and descriptor, key.id is the position in the index once merged
+    uint16_t owner_length;
+    uint16_t name_length;
+    uint16_t descriptor_length;
+    uint8_t kind;
+    uint32_t posting_count;
+
+} build_symbol;
+
+typedef struct build_posting_s
+{
+    uint32_t symbol; // of the worker, of the index after the merge
+    uint32_t class_id;
+    uint16_t index;
+
+} build_posting;
+
+typedef struct index_worker_s
+{
+    intern_table symbols; // of build_symbol records
+
+    build_posting *postings;
+    size_t posting_count;
+    size_t posting_capacity;
+
+} index_worker;
+
+typedef struct index_build_s
+{
+    class_input *inputs;
+    index_worker *workers;
+    arena *arenas; // one per worker, reset after every file
+    char **errors; // why an input couldn't be indexed, NULL on success
+
+} index_build;
+
+typedef struct text_pattern_s
+{
+    const char *text;
+    size_t length;
+    bool prefix; // a pattern ending with '*', empty and "*" match anything
+
+} text_pattern;
+
+typedef struct symbol_query_s
+{
+    uint8_t group;
+    bool members_only; // the query names a member, skip Class symbols
+    text_pattern owner;
+    text_pattern name;
+    text_pattern descriptor;
+
+} symbol_query;
+
+typedef struct loaded_index_s
+{
+    const uint8_t *data;
+    size_t size;
+    index_header header;
+    const uint32_t *classes;
+    const index_symbol *symbols;
+    const uint32_t *by_name;
+    const index_posting *postings;
+    const char *text;
+
+} loaded_index;
+
+static const char *kind_names[] =
+{
+    [CONSTANT_Class] = "Class",
+    [CONSTANT_String] = "String",
+    [CONSTANT_Fieldref] = "Fieldref",
+    [CONSTANT_Methodref] = "Methodref",
+    [CONSTANT_InterfaceMethodref] = "InterfaceMethodref",
+};
+
+static inline uint8_t symbol_group(uint8_t kind)
+{
+    return kind == CONSTANT_String;
+}
+
+/**
+ * Compares two texts like strcmp would if they had no NULs
+ */
+static inline int compare_text(const char *a, size_t a_length, const char *b, size_t b_length)
+{
+    const size_t length = a_length < b_length ? a_length : b_length;
+    int result = length ? memcmp(a, b, length) : 0;
+
+    if (result)
+        return result;
+    return a_length < b_length ? -1 : a_length > b_length;
+}
+
+static inline build_symbol *worker_symbol(index_worker *w, uint32_t symbol)
+{
+    return (build_symbol *)w->symbols.records + symbol;
+}
+
+/**
+ * Finds a symbol of the worker or adds a new one
+ *
+ * @param w worker
+ * @param kind constant tag
+ * @param owner class name, or the text of a string
+ * @param name of the member, empty for classes and strings
+ * @param descriptor of the member, empty for classes and strings
+ * @return symbol of the worker
+ */
+static uint32_t intern_symbol(index_worker *w, uint8_t kind, utf_view owner, utf_view name, utf_view descriptor)
+{
+    const utf_view parts[] = {owner, name, descriptor};
+    // Where the owner and the name end is part of the key
+    const uint64_t extra = (uint64_t)kind << 32 | (uint32_t)owner.length << 16 | name.length;
+    const uint32_t id = intern_text(&w->symbols, parts, 3, extra);
+    build_symbol *symbol = worker_symbol(w, id);
+
+    symbol->owner_length = owner.length;
+    symbol->name_length = name.length;
+    symbol->descriptor_length = descriptor.length;
+    symbol->kind = kind;
+    return id;
+}
+
+/**
+ * Records that a constant of a class refers to a symbol
+ */
+static void add_posting(index_worker *w, uint32_t symbol, uint32_t class_id, uint16_t index)
+{
+    if (w->posting_count == w->posting_capacity)
+    {
+        w->posting_capacity = w->posting_capacity ? w->posting_capacity * 2 : 4096;
+        w->postings = realloc(w->postings, w->posting_capacity * sizeof(build_posting));
+    }
+
+    w->postings[w->posting_count++] = (build_posting){symbol, class_id, index};
+    worker_symbol(w, symbol)->posting_count++;
+}
+
+/**
+ * Records every Class, String and member reference of a class
+ *
+ * @param w worker
+ * @param cls class struct, parsed lazily
+ * @param class_id position of the class in the index
+ * @return false on a malformed pool (see class_error), nothing is recorded then
+ */
+static bool index_class(index_worker *w, class *cls, uint32_t class_id)
+{
+    const size_t first_posting = w->posting_count;
+    const utf_view none = {NULL, 0};
+
+    for (uint16_t i = 1; i < cls->constant_pool_count; i++)
+    {
+        const uint8_t tag = cls->tags[i - 1];
+        const resolved_constant *resolved;
+        uint32_t symbol;
+
+        if (tag != CONSTANT_Class && tag != CONSTANT_String && tag != CONSTANT_Fieldref &&
+            tag != CONSTANT_Methodref && tag != CONSTANT_InterfaceMethodref)
+            continue;
+
+        if (!(resolved = resolve_constant(cls, i)))
+        {
+            for (size_t p = first_posting; p < w->posting_count; p++)
+                worker_symbol(w, w->postings[p].symbol)->posting_count--;
+            w->posting_count = first_posting;
+            return false;
+        }
+
+        if (tag == CONSTANT_Class || tag == CONSTANT_String)
+            symbol = intern_symbol(w, tag, constant_utf(cls, resolved->utf), none, none);
+        else
+            symbol = intern_symbol(w, tag, constant_utf(cls, resolved->owner),
+                                   constant_utf(cls, resolved->name), constant_utf(cls, resolved->descriptor));
+        add_posting(w, symbol, class_id, i);
+    }
+
+    return true;
+}
+
+/**
+ * Parses and indexes one input
+ *
+ * @param context index being built
+ * @param index of the input
+ * @param worker running the task
+ */
+static void index_input(void *context, size_t index, int worker)
+{
+    index_build *b = context;
+    arena *a = b->arenas + worker;
+    class *cls = parse_class_input(b->inputs + index, a, PARSE_LAZY, NULL);
+
+    if (!cls || !index_class(b->workers + worker, cls, (uint32_t)index))
+        b->errors[index] = strdup(class_error());
+
+    free_class(cls);
+    arena_reset(a);
+}
+
+static int compare_entries(const void *a, const void *b)
+{
+    const intern_ref *x = a, *y = b;
+    const build_symbol *s = (const build_symbol *)x->entry, *t = (const build_symbol *)y->entry;
+    int result;
+
+    if (symbol_group(s->kind) != symbol_group(t->kind))
+        return symbol_group(s->kind) - symbol_group(t->kind);
+    if ((result = compare_text(x->text, s->owner_length, y->text, t->owner_length)) ||
+        (result = compare_text(x->text + s->owner_length, s->name_length,
+                               y->text + t->owner_length, t->name_length)) ||
+        (result = compare_text(x->text + s->owner_length + s->name_length, s->descriptor_length,
+                               y->text + t->owner_length + t->name_length, t->descriptor_length)))
+        return result;
+    return s->kind - t->kind;
+}
+
+/**
+ * Orders positions of merged symbols by name, the by_name order
+ */
+static int compare_names(const void *a, const void *b, void *context)
+{
+    const intern_ref *x = (const intern_ref *)context + *(const uint32_t *)a;
+    const intern_ref *y = (const intern_ref *)context + *(const uint32_t *)b;
+    const build_symbol *s = (const build_symbol *)x->entry, *t = (const build_symbol *)y->entry;
+    int result;
+
+    if (symbol_group(s->kind) != symbol_group(t->kind))
+        return symbol_group(s->kind) - symbol_group(t->kind);
+    if ((result = compare_text(x->text + s->owner_length, s->name_length,
+                               y->text + t->owner_length, t->name_length)) ||
+        (result = compare_text(x->text + s->owner_length + s->name_length, s->descriptor_length,
+                               y->text + t->owner_length + t->name_length, t->descriptor_length)) ||
+        (result = compare_text(x->text, s->owner_length, y->text, t->owner_length)))
+        return result;
+    return s->kind - t->kind;
+}
+
+static bool has_postings(const intern_entry *entry)
+{
+    return ((const build_symbol *)entry)->posting_count != 0;
+}
+
+static int compare_postings(const void *a, const void *b)
+{
+    const build_posting *x = a, *y = b;
+
+    if (x->symbol != y->symbol)
+        return x->symbol < y->symbol ? -1 : 1;
+    if (x->class_id != y->class_id)
+        return x->class_id < y->class_id ? -1 : 1;
+    return x->index - y->index;
+}
+
+/**
+ * Merges the symbols of all workers and writes the index file
+ *
+ * @param path of the index file
+ * @param inputs indexed
+ * @param count of inputs
+ * @param workers with their symbols and postings
+ * @param worker_count number of workers
+ * @return false if the file can't be written (see class_error)
+ */
+static bool write_index(const char *path, const class_input *inputs, size_t count,
+                        index_worker *workers, int worker_count)
+{
+    intern_table **tables = malloc(worker_count * sizeof(intern_table *));
+    size_t posting_count = 0, text_size = 0;
+    intern_ref *entries;
+
+    for (int i = 0; i < worker_count; i++)
+    {
+        tables[i] = &workers[i].symbols;
+        posting_count += workers[i].posting_count;
+    }
+
+    // Equal symbols of all workers get one id, the ones only a class
+    // that failed to index refers to are left out
+    const uint32_t symbol_count = merge_interned(tables, worker_count, compare_entries, has_postings, &entries);
+    free(tables);
+
+    for (size_t i = 0; i < count; i++)
+        text_size += strlen(inputs[i].name) + 1;
+    for (uint32_t i = 0; i < symbol_count; i++)
+        text_size += entries[i].entry->length;
+
+    build_posting *postings = malloc((posting_count ? posting_count : 1) * sizeof(build_posting));
+    size_t n = 0;
+    for (int i = 0; i < worker_count; i++)
+    {
+        for (size_t p = 0; p < workers[i].posting_count; p++)
+        {
+            postings[n] = workers[i].postings[p];
+            postings[n++].symbol = worker_symbol(workers + i, workers[i].postings[p].symbol)->key.id;
+        }
+    }
+    qsort(postings, posting_count, sizeof(build_posting), compare_postings);
+
+    if (text_size > UINT32_MAX || posting_count > UINT32_MAX)
+    {
+        set_class_error("Too many symbols for one index");
+        free(entries);
+        free(postings);
+        return false;
+    }
+
+    FILE *file = fopen(path, "wb");
+    if (!file)
+    {
+        set_class_error("Can't create %s: %s", path, strerror(errno));
+        free(entries);
+        free(postings);
+        return false;
+    }
+
+    const index_header header = {INDEX_MAGIC, INDEX_VERSION, 0, (uint32_t)count, symbol_count, posting_count, text_size};
+    uint32_t text = 0, first_posting = 0;
+
+    fwrite(&header, sizeof(header), 1, file);
+    for (size_t i = 0; i < count; i++)
+    {
+        fwrite(&text, sizeof(text), 1, file);
+        text += strlen(inputs[i].name) + 1;
+    }
+
+    for (uint32_t i = 0; i < symbol_count; i++)
+    {
+        const build_symbol *s = (const build_symbol *)entries[i].entry;
+        index_symbol symbol = {text, s->owner_length, s->name_length, s->descriptor_length, s->kind, 0, first_posting, 0};
+
+        while (first_posting + symbol.posting_count < posting_count && postings[first_posting + symbol.posting_count].symbol == i)
+            symbol.posting_count++;
+        first_posting += symbol.posting_count;
+        text += s->owner_length + s->name_length + s->descriptor_length;
+        fwrite(&symbol, sizeof(symbol), 1, file);
+    }
+
+    uint32_t *by_name = malloc((symbol_count ? symbol_count : 1) * sizeof(uint32_t));
+    for (uint32_t i = 0; i < symbol_count; i++)
+        by_name[i] = i;
+    qsort_r(by_name, symbol_count, sizeof(uint32_t), compare_names, entries);
+    fwrite(by_name, sizeof(uint32_t), symbol_count, file);
+    free(by_name);
+
+    for (size_t i = 0; i < posting_count; i++)
+    {
+        const index_posting posting = {postings[i].class_id, postings[i].index, 0};
+        fwrite(&posting, sizeof(posting), 1, file);
+    }
+
+    for (size_t i = 0; i < count; i++)
+        fwrite(inputs[i].name, strlen(inputs[i].name) + 1, 1, file);
+    for (uint32_t i = 0; i < symbol_count; i++)
+    {
+        fwrite(entries[i].text, 1, entries[i].entry->length, file);
+    }
+
+    bool ok = !ferror(file);
+    ok = fclose(file) == 0 && ok;
+    if (!ok)
+        set_class_error("Can't write %s: %s", path, strerror(errno));
+    else
+        fprintf(stderr, "Indexed %zu classes: %u symbols, %zu references\n", count, symbol_count, posting_count);
+
+    free(entries);
+    free(postings);
+    return ok;
+}
+
+/**
+ * Indexes the Class, String and member references of all inputs
+ * and saves the index
+ *
+ * @param files to index
+ * @param options of the run, only thread_count is used
+ * @param path of the index file to write
+ * @return number of inputs that could not be indexed, or all of them
+ *         if the file could not be written
+ */
+int build_symbol_index(file_list *files, const batch_options *options, const char *path)
+{
+    const size_t count = files->count;
+    int thread_count = options->thread_count < 1 ? 1 : options->thread_count;
+    index_build b = {files->inputs};
+    int failed = 0;
+
+    b.workers = calloc(thread_count, sizeof(index_worker));
+    b.arenas = calloc(thread_count, sizeof(arena));
+    b.errors = calloc(count ? count : 1, sizeof(char *));
+    for (int i = 0; i < thread_count; i++)
+    {
+        arena_init(b.arenas + i, 1 << 16);
+        b.workers[i].symbols.record_size = sizeof(build_symbol);
+    }
+
+    run_thread_pool(count, thread_count, index_input, &b);
+
+    for (size_t i = 0; i < count; i++)
+    {
+        if (b.errors[i])
+        {
+            fprintf(stderr, "%s: %s\n", files->inputs[i].name, b.errors[i]);
+            free(b.errors[i]);
+            failed++;
+        }
+    }
+
+    if (!write_index(path, files->inputs, count, b.workers, thread_count))
+    {
+        fprintf(stderr, "%s\n", class_error());
+        failed = count ? (int)count : 1;
+    }
+
+    for (int i = 0; i < thread_count; i++)
+    {
+        arena_release(b.arenas + i);
+        free_intern_table(&b.workers[i].symbols);
+        free(b.workers[i].postings);
+    }
+    free(b.workers);
+    free(b.arenas);
+    free(b.errors);
+
+    return failed;
+}
+
+/**
+ * Maps an index file and checks that its parts fit in it
+ *
+ * @param path of the index file
+ * @param index to fill
+ * @return false if the file is not a usable index (see class_error)
+ */
+static bool load_index(const char *path, loaded_index *index)
+{
+    struct stat st;
+    int fd = open(path, O_RDONLY);
+
+    if (fd < 0 || fstat(fd, &st) != 0)
+    {
+        set_class_error("Can't open %s: %s", path, strerror(errno));
+        if (fd >= 0)
+            close(fd);
+        return false;
+    }
+
+    index->size = st.st_size;
+    index->data = index->size >= sizeof(index_header) ? mmap(NULL, index->size, PROT_READ, MAP_PRIVATE, fd, 0) : MAP_FAILED;
+    close(fd);
+
+    if (index->data == MAP_FAILED)
+    {
+        set_class_error("%s is not a symbol index", path);
+        return false;
+    }
+
+    memcpy(&index->header, index->data, sizeof(index_header));
+    const index_header *h = &index->header;
+    const uint64_t text_offset = sizeof(index_header) + (uint64_t)h->class_count * sizeof(uint32_t) +
+                                 (uint64_t)h->symbol_count * (sizeof(index_symbol) + sizeof(uint32_t)) + h->posting_count * sizeof(index_posting);
+
+    if (h->magic != INDEX_MAGIC || h->version != INDEX_VERSION || h->posting_count > UINT32_MAX ||
+        h->text_size > UINT32_MAX || text_offset + h->text_size != index->size)
+    {
+        set_class_error("%s is not a symbol index", path);
+        munmap((void *)index->data, index->size);
+        return false;
+    }
+
+    index->classes = (const uint32_t *)(index->data + sizeof(index_header));
+    index->symbols = (const index_symbol *)(index->classes + h->class_count);
+    index->by_name = (const uint32_t *)(index->symbols + h->symbol_count);
+    index->postings = (const index_posting *)(index->by_name + h->symbol_count);
+    index->text = (const char *)index->data + text_offset;
+    return true;
+}
+
+/**
+ * Checks that a symbol read from the file stays within it
+ */
+static inline bool check_symbol(const loaded_index *index, const index_symbol *symbol)
+{
+    return (uint64_t)symbol->text + symbol->owner_length + symbol->name_length + symbol->descriptor_length <= index->header.text_size &&
+           (uint64_t)symbol->first_posting + symbol->posting_count <= index->header.posting_count &&
+           symbol->kind < sizeof(kind_names) / sizeof(kind_names[0]) && kind_names[symbol->kind];
+}
+
+/**
+ * Parses "text", "text*", "*" or an empty pattern
+ */
+static text_pattern parse_pattern(const char *text, size_t length)
+{
+    text_pattern pattern = {text, length, false};
+
+    if (length && text[length - 1] == '*')
+    {
+        pattern.length--;
+        pattern.prefix = true;
+    }
+    if (!pattern.length)
+        pattern.prefix = true;
+    return pattern;
+}
+
+static inline bool match_pattern(const text_pattern *pattern, const char *text, size_t length)
+{
+    return pattern->prefix ? length >= pattern->length && memcmp(text, pattern->text, pattern->length) == 0
+                           : length == pattern->length && memcmp(text, pattern->text, length) == 0;
+}
+
+/**
+ * Parses a query:
+ *   owner                  a class and everything referenced through it
+ *   owner.name[:descriptor] fields and methods
+ *   "text                  string literals, a closing quote is optional
+ * Every part may end with '*' to match a prefix, a missing or empty part matches anything.
+ *
+ * @param text of the query
+ * @return parsed query
+ */
+static symbol_query parse_query(const char *text)
+{
+    symbol_query query = {0};
+    const char *dot, *colon;
+
+    query.name = query.descriptor = parse_pattern("", 0);
+
+    if (text[0] == '"')
+    {
+        size_t length = strlen(++text);
+        if (length && text[length - 1] == '"')
+            length--;
+        query.group = symbol_group(CONSTANT_String);
+        query.owner = parse_pattern(text, length);
+        return query;
+    }
+
+    if (!(dot = strchr(text, '.')))
+    {
+        query.owner = parse_pattern(text, strlen(text));
+        return query;
+    }
+
+    query.members_only = true;
+    query.owner = parse_pattern(text, dot - text);
+    if ((colon = strchr(dot + 1, ':')))
+    {
+        query.name = parse_pattern(dot + 1, colon - dot - 1);
+        query.descriptor = parse_pattern(colon + 1, strlen(colon + 1));
+    }
+    else
+    {
+        query.name = parse_pattern(dot + 1, strlen(dot + 1));
+    }
+    return query;
+}
+
+/**
+ * Finds the first symbol not below (group, owner)
+ *
+ * @return position of the symbol, symbol_count if there is none, -1 for a damaged index
+ */
+static int64_t lower_bound(const loaded_index *index, uint8_t group, const char *owner, size_t length)
+{
+    uint32_t low = 0, high = index->header.symbol_count;
+
+    while (low < high)
+    {
+        const uint32_t middle = low + (high - low) / 2;
+        const index_symbol *symbol = index->symbols + middle;
+
+        if (!check_symbol(index, symbol))
+            return -1;
+
+        const uint8_t symbol_group_id = symbol_group(symbol->kind);
+        const int result = symbol_group_id != group ? symbol_group_id - group
+                                                    : compare_text(index->text + symbol->text, symbol->owner_length, owner, length);
+        if (result < 0)
+            low = middle + 1;
+        else
+            high = middle;
+    }
+    return low;
+}
+
+/**
+ * Finds the first by_name entry not below (group, name)
+ *
+ * @return position in by_name, symbol_count if there is none, -1 for a damaged index
+ */
+static int64_t lower_bound_by_name(const loaded_index *index, uint8_t group, const char *name, size_t length)
+{
+    uint32_t low = 0, high = index->header.symbol_count;
+
+    while (low < high)
+    {
+        const uint32_t middle = low + (high - low) / 2;
+        const index_symbol *symbol = index->symbols + index->by_name[middle];
+
+        if (index->by_name[middle] >= index->header.symbol_count || !check_symbol(index, symbol))
+            return -1;
+
+        const uint8_t symbol_group_id = symbol_group(symbol->kind);
+        const int result = symbol_group_id != group ? symbol_group_id - group
+                                                    : compare_text(index->text + symbol->text + symbol->owner_length, symbol->name_length, name, length);
+        if (result < 0)
+            low = middle + 1;
+        else
+            high = middle;
+    }
+    return low;
+}
+
+/**
+ * Prints the references of one symbol
+ */
+static void print_postings(out_buffer *out, const loaded_index *index, const index_symbol *symbol)
+{
+    const char *owner = index->text + symbol->text;
+    const char *name = owner + symbol->owner_length;
+    const char *descriptor = name + symbol->name_length;
+
+    for (uint32_t i = 0; i < symbol->posting_count; i++)
+    {
+        const index_posting *posting = index->postings + symbol->first_posting + i;
+        const char *class_name = posting->class_id < index->header.class_count &&
+                                         index->classes[posting->class_id] < index->header.text_size
+                                     ? index->text + index->classes[posting->class_id]
+                                     : "?";
+
+        out_bytes(out, class_name, strnlen(class_name, index->text + index->header.text_size - class_name));
+        out_str(out, " #");
+        out_u32(out, posting->index);
+        out_char(out, ' ');
+        out_str(out, kind_names[symbol->kind]);
+        out_char(out, ' ');
+
+        if (symbol->kind == CONSTANT_String) // escaped like in --format=jsonl, a newline would split the line
+            print_json_string(out, owner, symbol->owner_length);
+        else
+        {
+            out_bytes(out, owner, symbol->owner_length);
+            if (symbol->kind != CONSTANT_Class)
+            {
+                out_char(out, '.');
+                out_bytes(out, name, symbol->name_length);
+                out_char(out, ':');
+                out_bytes(out, descriptor, symbol->descriptor_length);
+            }
+        }
+        out_char(out, '\n');
+    }
+}
+
+/**
+ * Prints every reference matching a query
+ *
+ * @param out buffer to print to
+ * @param index loaded index
+ * @param query parsed query
+ * @return number of matching symbols, -1 for a damaged index
+ */
+static int64_t run_query(out_buffer *out, const loaded_index *index, const symbol_query *query)
+{
+    // An owner narrows the search down the most, a name is next best
+    const bool by_name = !query->owner.length && query->name.length;
+    const text_pattern *key = by_name ? &query->name : &query->owner;
+    int64_t position = by_name ? lower_bound_by_name(index, query->group, key->text, key->length)
+                               : lower_bound(index, query->group, key->text, key->length);
+    int64_t matched = 0;
+
+    for (; position >= 0 && position < index->header.symbol_count; position++)
+    {
+        const uint32_t id = by_name ? index->by_name[position] : (uint32_t)position;
+        const index_symbol *symbol = index->symbols + id;
+
+        if (id >= index->header.symbol_count || !check_symbol(index, symbol))
+            return -1;
+
+        const char *owner = index->text + symbol->text;
+        const char *name = owner + symbol->owner_length;
+        const char *descriptor = name + symbol->name_length;
+
+        if (symbol_group(symbol->kind) != query->group ||
+            !(by_name ? match_pattern(key, name, symbol->name_length) : match_pattern(key, owner, symbol->owner_length)))
+            break; // past the keys that can match
+
+        if ((query->members_only && symbol->kind == CONSTANT_Class) ||
+            !match_pattern(&query->owner, owner, symbol->owner_length) ||
+            !match_pattern(&query->name, name, symbol->name_length) ||
+            !match_pattern(&query->descriptor, descriptor, symbol->descriptor_length))
+            continue;
+
+        print_postings(out, index, symbol);
+        matched++;
+    }
+
+    return position < 0 ? -1 : matched;
+}
+
+/**
+ * Prints every class and constant that references the queried symbols
+ *
+ * @param path of the index file
+ * @param queries to run, see parse_query
+ * @param query_count number of queries
+ * @return number of queries that matched nothing, all of them if the index can't be read
+ */
+int query_symbol_index(const char *path, char **queries, int query_count)
+{
+    loaded_index index;
+    out_buffer out;
+    int failed = 0;
+
+    if (!load_index(path, &index))
+    {
+        fprintf(stderr, "%s\n", class_error());
+        return query_count ? query_count : 1;
+    }
+
+    out_init(&out, STDOUT_FILENO);
+    for (int i = 0; i < query_count; i++)
+    {
+        const symbol_query query = parse_query(queries[i]);
+        const int64_t matched = run_query(&out, &index, &query);
+
+        if (matched < 0)
+        {
+            out_flush(&out);
+            fprintf(stderr, "%s is damaged\n", path);
+            failed = query_count;
+            break;
+        }
+        if (!matched)
+            failed++;
+    }
+
+    out_free(&out);
+    munmap((void *)index.data, index.size);
+    return failed;
+}
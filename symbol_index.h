@@ -0,0 +1,40 @@
+#ifndef SYMBOL_INDEX_H
+#define SYMBOL_INDEX_H
+#include <stdint.h>
+
+#include "batch.h"
+#include "file_list.h"
+
+/**
+ * Symbol of the index file. Texts follow each other in the text
+ * area: owner, name, descriptor. A String constant keeps its text
+ * as the owner, a Class constant has no name and descriptor.
+ */
+typedef struct index_symbol_s
+{
+    uint32_t text;
+    uint16_t owner_length;
+    uint16_t name_length;
+    uint16_t descriptor_length;
+    uint8_t kind; // constant tag
+    uint8_t reserved;
+    uint32_t first_posting;
+    uint32_t posting_count;
+
+} index_symbol;
+
+/**
+ * Reference to a symbol: a constant of one class
+ */
+typedef struct index_posting_s
+{
+    uint32_t class_id; // position of the class in the index
+    uint16_t index;    // constant pool index
+    uint16_t reserved;
+
+} index_posting;
+
+int build_symbol_index(file_list *files, const batch_options *options, const char *path);
+int query_symbol_index(const char *path, char **queries, int query_count);
+
+#endif
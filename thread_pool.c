@@ -0,0 +1,190 @@
+/**
+ * Work-stealing thread pool for a fixed range of tasks.
+ * 
+ * Every worker starts with its own contiguous slice of indices
+ * and pops them in order. A worker that runs dry steals the upper
+ * half of the fullest slice it can find, so a few huge files
+ * don't leave the other threads idle.
+ * 
+ */
+
+#include "thread_pool.h"
+
+#include <stdbool.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+typedef struct pool_s
+{
+    pool_deque *deques;
+    int thread_count;
+    pool_task task;
+    void *context;
+
+} pool;
+
+typedef struct pool_worker_s
+{
+    pool *pool;
+    int id;
+
+} pool_worker;
+
+/**
+ * Number of threads to use when the user didn't ask for any
+ * 
+ * @return count of online processors
+ */
+int default_thread_count(void)
+{
+    long count = sysconf(_SC_NPROCESSORS_ONLN);
+    return count > 0 ? (int)count : 1;
+}
+
+/**
+ * Takes the next task from the worker's own deque
+ * 
+ * @param deque of the worker
+ * @param index of the task
+ * @return false if the deque is empty
+ */
+static bool pop_task(pool_deque *deque, size_t *index)
+{
+    bool found = false;
+
+    pthread_mutex_lock(&deque->lock);
+    if (deque->begin < deque->end)
+    {
+        *index = deque->begin++;
+        found = true;
+    }
+    pthread_mutex_unlock(&deque->lock);
+
+    return found;
+}
+
+/**
+ * Moves the upper half of the fullest other deque into the
+ * worker's own deque and takes its first task
+ * 
+ * @param pool to steal in
+ * @param id of the stealing worker
+ * @param index of the stolen task
+ * @return false if there is nothing left to steal
+ */
+static bool steal_task(pool *p, int id, size_t *index)
+{
+    for (;;)
+    {
+        int victim = -1;
+        size_t victim_size = 0;
+
+        for (int i = 1; i < p->thread_count; i++)
+        {
+            pool_deque *deque = p->deques + (id + i) % p->thread_count;
+
+            pthread_mutex_lock(&deque->lock);
+            size_t size = deque->end - deque->begin;
+            pthread_mutex_unlock(&deque->lock);
+
+            if (size > victim_size)
+            {
+                victim = (id + i) % p->thread_count;
+                victim_size = size;
+            }
+        }
+
+        if (victim < 0)
+            return false;
+
+        pool_deque *deque = p->deques + victim;
+        size_t begin = 0, end = 0;
+
+        pthread_mutex_lock(&deque->lock);
+        if (deque->begin < deque->end)
+        {
+            end = deque->end;
+            begin = deque->begin + (deque->end - deque->begin) / 2;
+            deque->end = begin;
+        }
+        pthread_mutex_unlock(&deque->lock);
+
+        if (begin == end)
+            continue; // the owner was faster, look again
+
+        pool_deque *own = p->deques + id;
+        pthread_mutex_lock(&own->lock);
+        own->begin = begin + 1;
+        own->end = end;
+        pthread_mutex_unlock(&own->lock);
+
+        *index = begin;
+        return true;
+    }
+}
+
+/**
+ * Worker thread body
+ * 
+ * @param argument pool_worker of this thread
+ * @return NULL
+ */
+static void *pool_worker_main(void *argument)
+{
+    pool_worker *worker = argument;
+    pool *p = worker->pool;
+    size_t index;
+
+    while (pop_task(p->deques + worker->id, &index) || steal_task(p, worker->id, &index))
+    {
+        p->task(p->context, index, worker->id);
+    }
+
+    return NULL;
+}
+
+/**
+ * Runs task for every index in [0, task_count) on a pool of
+ * threads and returns when all of them are done. The calling
+ * thread works as one of the workers.
+ * 
+ * @param task_count number of tasks
+ * @param thread_count number of workers
+ * @param task to run
+ * @param context passed to every task
+ */
+void run_thread_pool(size_t task_count, int thread_count, pool_task task, void *context)
+{
+    if (thread_count < 1)
+        thread_count = 1;
+    if ((size_t)thread_count > task_count)
+        thread_count = task_count ? (int)task_count : 1;
+
+    pool p = {calloc(thread_count, sizeof(pool_deque)), thread_count, task, context};
+    pool_worker *workers = calloc(thread_count, sizeof(pool_worker));
+    pthread_t *threads = calloc(thread_count, sizeof(pthread_t));
+
+    for (int i = 0; i < thread_count; i++)
+    {
+        pthread_mutex_init(&p.deques[i].lock, NULL);
+        p.deques[i].begin = task_count * i / thread_count;
+        p.deques[i].end = task_count * (i + 1) / thread_count;
+        workers[i].pool = &p;
+        workers[i].id = i;
+    }
+
+    for (int i = 1; i < thread_count; i++)
+        pthread_create(threads + i, NULL, pool_worker_main, workers + i);
+
+    pool_worker_main(workers);
+
+    for (int i = 1; i < thread_count; i++)
+        pthread_join(threads[i], NULL);
+
+    for (int i = 0; i < thread_count; i++)
+        pthread_mutex_destroy(&p.deques[i].lock);
+
+    free(threads);
+    free(workers);
+    free(p.deques);
+}
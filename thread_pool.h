@@ -0,0 +1,24 @@
+#ifndef THREAD_POOL_H
+#define THREAD_POOL_H
+#include <stddef.h>
+#include <pthread.h>
+
+/**
+ * Task body, called once for every index in [0, task_count).
+ * worker is in [0, thread_count) and may be used to pick
+ * per-thread state such as an arena.
+ */
+typedef void (*pool_task)(void *context, size_t index, int worker);
+
+typedef struct pool_deque_s
+{
+    pthread_mutex_t lock;
+    size_t begin; // the owner pops from here
+    size_t end;   // thieves steal from here
+
+} pool_deque;
+
+int default_thread_count(void);
+void run_thread_pool(size_t task_count, int thread_count, pool_task task, void *context);
+
+#endif
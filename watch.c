@@ -0,0 +1,571 @@
+/**
+ * Watch mode: dump a tree of .class files once, then only what
+ * changes in it.
+ *
+ * Every directory of the tree gets an inotify watch, directories
+ * created later get one as soon as they show up. An event on a
+ * .class file only puts its path on the pending list; once no event
+ * came for the debounce time (or the changes go on for too long),
+ * the pending files are looked at again as one batch on the thread
+ * pool. A file written a thousand times during a rebuild is read
+ * once, a file rewritten with the same bytes is hashed and dropped.
+ *
+ * The watcher remembers the hash of every file and whether it has
+ * been reported, and emits the difference to that, in path order:
+ *
+ *   text:        "A path", "M path" or "D path", then the output of
+ *                the class as without --watch and an empty line
+ *   jsonl / bin: an event record (see record_printer.c), then the
+ *                records of the class
+ *
+ * The first batch reports every class as added. With brief only the
+ * events are written. A queue overflow rescans the whole tree.
+ *
+ */
+
+#define _GNU_SOURCE
+#include "watch.h"
+
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/inotify.h>
+#include <sys/stat.h>
+
+#include "parse_cache.h"
+#include "thread_pool.h"
+
+#define WATCH_MASK (IN_CLOSE_WRITE | IN_MODIFY | IN_CREATE | IN_DELETE | IN_MOVED_FROM | IN_MOVED_TO | IN_ONLYDIR)
+#define WATCH_BUFFER_SIZE (1 << 16)
+
+static uint64_t now_ms(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+static bool has_class_extension(const char *name)
+{
+    size_t length = strlen(name);
+    return length > 6 && strcmp(name + length - 6, ".class") == 0;
+}
+
+/**
+ * Joins a directory and a name the way file_list does
+ *
+ * @return new path, to be freed
+ */
+static char *join_path(const char *directory, const char *name)
+{
+    const size_t length = strlen(directory) + strlen(name) + 2;
+    const bool has_slash = directory[0] && directory[strlen(directory) - 1] == '/';
+    char *path = malloc(length);
+
+    snprintf(path, length, has_slash ? "%s%s" : "%s/%s", directory, name);
+    return path;
+}
+
+/**
+ * Checks if a path is the directory or inside it
+ */
+static bool is_under(const char *path, const char *directory)
+{
+    const size_t length = strlen(directory);
+    return strncmp(path, directory, length) == 0 && (path[length] == '\0' || path[length] == '/');
+}
+
+/**
+ * Finds the entry of a path
+ *
+ * @param w watcher
+ * @param path of the file
+ * @param slot set to the slot of the entry, or the free slot for it
+ * @return entry or NULL if the path is not known
+ */
+static watch_entry *find_entry(watch_state *w, const char *path, size_t *slot)
+{
+    if (!w->slot_count)
+        return NULL;
+
+    size_t i = hash_class_data((const uint8_t *)path, strlen(path)) & (w->slot_count - 1);
+    for (; w->slots[i]; i = (i + 1) & (w->slot_count - 1))
+    {
+        if (strcmp(w->slots[i]->path, path) == 0)
+            break;
+    }
+
+    if (slot)
+        *slot = i;
+    return w->slots[i];
+}
+
+/**
+ * Adds an entry for a path seen for the first time
+ */
+static watch_entry *add_entry(watch_state *w, const char *path)
+{
+    size_t slot;
+
+    if (w->entry_count * 2 >= w->slot_count)
+    {
+        watch_entry **old = w->slots;
+        const size_t old_count = w->slot_count;
+
+        w->slot_count = w->slot_count ? w->slot_count * 2 : 1024;
+        w->slots = calloc(w->slot_count, sizeof(watch_entry *));
+        for (size_t i = 0; i < old_count; i++)
+        {
+            if (old[i])
+            {
+                find_entry(w, old[i]->path, &slot);
+                w->slots[slot] = old[i];
+            }
+        }
+        free(old);
+    }
+
+    find_entry(w, path, &slot);
+    watch_entry *entry = calloc(1, sizeof(watch_entry));
+    entry->path = strdup(path);
+    w->slots[slot] = entry;
+    w->entry_count++;
+    return entry;
+}
+
+/**
+ * Puts a file on the list of the next batch
+ *
+ * @param w watcher
+ * @param path of the file, the list takes ownership
+ */
+static void add_pending(watch_state *w, char *path)
+{
+    if (w->pending_count == w->pending_capacity)
+    {
+        w->pending_capacity = w->pending_capacity ? w->pending_capacity * 2 : 256;
+        w->pending = realloc(w->pending, w->pending_capacity * sizeof(char *));
+    }
+    w->pending[w->pending_count++] = path;
+}
+
+/**
+ * Watches a directory and everything below it, the .class files
+ * found go to the next batch
+ *
+ * @param w watcher
+ * @param path of the directory
+ */
+static void watch_tree(watch_state *w, const char *path)
+{
+    const int wd = inotify_add_watch(w->inotify, path, WATCH_MASK);
+    struct dirent **entries;
+
+    if (wd < 0)
+    {
+        if (errno != ENOENT && errno != ENOTDIR)
+            fprintf(stderr, "%s: can't watch: %s%s\n", path, strerror(errno),
+                    errno == ENOSPC ? " (see fs.inotify.max_user_watches)" : "");
+        return;
+    }
+
+    if (wd >= w->directory_capacity)
+    {
+        const int capacity = wd * 2 + 16;
+        w->directories = realloc(w->directories, capacity * sizeof(char *));
+        memset(w->directories + w->directory_capacity, 0, (capacity - w->directory_capacity) * sizeof(char *));
+        w->directory_capacity = capacity;
+    }
+    if (!w->directories[wd])
+        w->directory_count++;
+    free(w->directories[wd]); // the same directory under another name
+    w->directories[wd] = strdup(path);
+
+    // Files may have been written before the watch was there
+    const int count = scandir(path, &entries, NULL, alphasort);
+    for (int i = 0; i < count; i++)
+    {
+        const char *name = entries[i]->d_name;
+
+        if (strcmp(name, ".") != 0 && strcmp(name, "..") != 0)
+        {
+            char *child = join_path(path, name);
+            struct stat st;
+
+            if (lstat(child, &st) == 0 && S_ISDIR(st.st_mode)) // not through symlinks, see file_list.c
+            {
+                watch_tree(w, child);
+                free(child);
+            }
+            else if (has_class_extension(name))
+                add_pending(w, child);
+            else
+                free(child);
+        }
+        free(entries[i]);
+    }
+    if (count >= 0)
+        free(entries);
+}
+
+/**
+ * Handles a directory that was deleted or moved away: the classes
+ * in it go to the next batch to be reported as deleted
+ *
+ * @param w watcher
+ * @param path of the directory
+ * @param moved whether it was moved, its watches still follow it then
+ */
+static void forget_tree(watch_state *w, const char *path, bool moved)
+{
+    for (size_t i = 0; i < w->slot_count; i++)
+    {
+        if (w->slots[i] && w->slots[i]->exists && is_under(w->slots[i]->path, path))
+            add_pending(w, strdup(w->slots[i]->path));
+    }
+
+    if (!moved)
+        return; // deleted directories lose their watches by themselves
+
+    for (int wd = 0; wd < w->directory_capacity; wd++)
+    {
+        if (w->directories[wd] && is_under(w->directories[wd], path))
+        {
+            inotify_rm_watch(w->inotify, wd);
+            free(w->directories[wd]);
+            w->directories[wd] = NULL;
+            w->directory_count--;
+        }
+    }
+}
+
+/**
+ * Looks at the whole tree again, after events were lost
+ */
+static void rescan(watch_state *w)
+{
+    for (size_t i = 0; i < w->slot_count; i++)
+    {
+        if (w->slots[i] && w->slots[i]->exists)
+            add_pending(w, strdup(w->slots[i]->path));
+    }
+    for (int i = 0; i < w->root_count; i++)
+        watch_tree(w, w->roots[i]);
+}
+
+/**
+ * Reads the queued inotify events and turns them into pending files
+ *
+ * @param w watcher
+ */
+static void read_events(watch_state *w)
+{
+    char buffer[WATCH_BUFFER_SIZE] __attribute__((aligned(__alignof__(struct inotify_event))));
+    ssize_t length;
+
+    while ((length = read(w->inotify, buffer, sizeof(buffer))) > 0)
+    {
+        for (char *p = buffer; p < buffer + length; p += sizeof(struct inotify_event) + ((struct inotify_event *)p)->len)
+        {
+            const struct inotify_event *event = (const struct inotify_event *)p;
+            const char *directory = event->wd >= 0 && event->wd < w->directory_capacity ? w->directories[event->wd] : NULL;
+
+            w->events++;
+            if (event->mask & IN_Q_OVERFLOW)
+            {
+                fprintf(stderr, "Watch: events were lost, rescanning\n");
+                rescan(w);
+                continue;
+            }
+            if (event->mask & IN_IGNORED)
+            {
+                if (directory)
+                {
+                    free(w->directories[event->wd]);
+                    w->directories[event->wd] = NULL;
+                    w->directory_count--;
+                }
+                continue;
+            }
+            if (!directory || !event->len)
+                continue;
+
+            char *path = join_path(directory, event->name);
+            if (event->mask & IN_ISDIR)
+            {
+                if (event->mask & (IN_CREATE | IN_MOVED_TO))
+                    watch_tree(w, path);
+                else if (event->mask & (IN_DELETE | IN_MOVED_FROM))
+                    forget_tree(w, path, event->mask & IN_MOVED_FROM);
+                free(path);
+            }
+            else if (has_class_extension(event->name))
+                add_pending(w, path);
+            else
+                free(path);
+        }
+    }
+}
+
+/**
+ * Reads a pending file again and formats it if it changed
+ *
+ * @param context watcher
+ * @param index of the change
+ * @param worker running the task
+ */
+static void check_change(void *context, size_t index, int worker)
+{
+    watch_state *w = context;
+    watch_change *c = w->changes + index;
+    const watch_entry *entry = c->entry;
+    const int fd = open(c->path, O_RDONLY | O_CLOEXEC);
+    struct stat st;
+
+    if (fd < 0 || fstat(fd, &st) != 0 || !S_ISREG(st.st_mode))
+    {
+        if (fd >= 0 || errno == ENOENT || errno == ENOTDIR)
+            c->event = entry && entry->reported ? CHANGE_DELETED : 0;
+        else
+        {
+            c->error = strdup(strerror(errno));
+            c->keep = true;
+        }
+        if (fd >= 0)
+            close(fd);
+        return;
+    }
+
+    uint8_t *data = malloc(st.st_size ? st.st_size : 1);
+    size_t size = 0;
+    ssize_t got;
+
+    while (size < (size_t)st.st_size && (got = pread(fd, data + size, st.st_size - size, size)) > 0)
+        size += got;
+    close(fd);
+
+    c->exists = true;
+    c->size = size;
+    c->hash = hash_class_data(data, size);
+
+    if (!entry || !entry->exists || entry->hash != c->hash || entry->size != c->size)
+    {
+        arena *a = w->arenas + worker;
+        class *cls = parse_class_buffer(data, size, a, batch_parse_flags(w->options), NULL);
+
+        out_init(&c->text, -1);
+        if (cls && (w->brief || print_class(&c->text, cls, c->path, w->options)))
+            c->event = entry && entry->reported ? CHANGE_MODIFIED : CHANGE_ADDED;
+        else
+            c->error = strdup(class_error());
+
+        free_class(cls);
+        arena_reset(a);
+    }
+
+    free(data);
+}
+
+static int compare_paths(const void *a, const void *b)
+{
+    return strcmp(*(char *const *)a, *(char *const *)b);
+}
+
+/**
+ * Writes the event of a change and the output of its class
+ */
+static void print_change(out_buffer *out, const watch_change *c, const watch_state *w)
+{
+    if (w->options->format == FORMAT_TEXT)
+    {
+        out_char(out, (char)c->event);
+        out_char(out, ' ');
+        out_str(out, c->path);
+        out_char(out, '\n');
+    }
+    else
+    {
+        print_event_record(out, w->options->format, c->event, c->path);
+    }
+
+    if (c->event != CHANGE_DELETED && !w->brief)
+    {
+        out_bytes(out, c->text.data, c->text.length);
+        if (w->options->format == FORMAT_TEXT)
+            out_char(out, '\n');
+    }
+}
+
+/**
+ * Looks at every pending file and reports what changed, in path order
+ *
+ * @param w watcher
+ * @return number of files that could not be read or parsed
+ */
+static size_t process_pending(watch_state *w)
+{
+    const uint64_t start = now_ms();
+    size_t count = 0, counts[3] = {0}, unchanged = 0, failed = 0;
+    out_buffer out;
+
+    qsort(w->pending, w->pending_count, sizeof(char *), compare_paths);
+    for (size_t i = 0; i < w->pending_count; i++)
+    {
+        if (count && strcmp(w->pending[count - 1], w->pending[i]) == 0)
+            free(w->pending[i]);
+        else
+            w->pending[count++] = w->pending[i];
+    }
+
+    w->changes = calloc(count ? count : 1, sizeof(watch_change));
+    for (size_t i = 0; i < count; i++)
+    {
+        w->changes[i].path = w->pending[i];
+        w->changes[i].entry = find_entry(w, w->pending[i], NULL);
+    }
+
+    run_thread_pool(count, w->options->thread_count < 1 ? 1 : w->options->thread_count, check_change, w);
+
+    out_init(&out, STDOUT_FILENO);
+    for (size_t i = 0; i < count; i++)
+    {
+        watch_change *c = w->changes + i;
+        watch_entry *entry = c->entry;
+
+        if (c->error)
+        {
+            fprintf(stderr, "%s: %s\n", c->path, c->error);
+            failed++;
+        }
+        if (c->event)
+        {
+            print_change(&out, c, w);
+            counts[c->event == CHANGE_ADDED ? 0 : c->event == CHANGE_MODIFIED ? 1 : 2]++;
+        }
+        else if (!c->error)
+        {
+            unchanged++;
+        }
+
+        if (!c->keep && (c->exists || entry))
+        {
+            if (!entry)
+                entry = add_entry(w, c->path);
+            entry->exists = c->exists;
+            entry->hash = c->hash;
+            entry->size = c->size;
+            if (c->event)
+                entry->reported = c->event != CHANGE_DELETED;
+            else if (!c->exists)
+                entry->reported = false;
+        }
+
+        out_free(&c->text);
+        free(c->error);
+        free(c->path);
+    }
+    out_flush(&out);
+    out_free(&out);
+
+    fprintf(stderr, "Watch: %zu events, %zu files: %zu added, %zu modified, %zu deleted, %zu unchanged, %zu failed (%llu ms)\n",
+            w->events, count, counts[0], counts[1], counts[2], unchanged, failed, (unsigned long long)(now_ms() - start));
+
+    free(w->changes);
+    w->changes = NULL;
+    w->pending_count = 0;
+    w->events = 0;
+    return failed;
+}
+
+/**
+ * Dumps the .class files under the directories, then keeps dumping
+ * the ones that change until the process is stopped
+ *
+ * @param roots directories to watch
+ * @param root_count number of directories
+ * @param options of the run, the output is picked as without --watch
+ * @param brief report only the events, not the classes
+ * @param debounce_ms quiet time before a batch of changes runs
+ * @return EXIT_FAILURE if the watch can't be set up, doesn't return otherwise
+ */
+int run_watch(char **roots, int root_count, const batch_options *options, bool brief, int debounce_ms)
+{
+    watch_state w = {0};
+    uint64_t first_change = 0, last_change = 0;
+
+    w.roots = roots;
+    w.root_count = root_count;
+    w.options = options;
+    w.brief = brief;
+
+    for (int i = 0; i < root_count; i++)
+    {
+        struct stat st;
+
+        if (stat(roots[i], &st) != 0 || !S_ISDIR(st.st_mode))
+        {
+            fprintf(stderr, "%s: --watch takes directories\n", roots[i]);
+            return EXIT_FAILURE;
+        }
+    }
+
+    if ((w.inotify = inotify_init1(IN_NONBLOCK | IN_CLOEXEC)) < 0)
+    {
+        fprintf(stderr, "Can't start watching: %s\n", strerror(errno));
+        return EXIT_FAILURE;
+    }
+
+    const int thread_count = options->thread_count < 1 ? 1 : options->thread_count;
+    w.arenas = calloc(thread_count, sizeof(arena));
+    for (int i = 0; i < thread_count; i++)
+        arena_init(w.arenas + i, 1 << 16);
+
+    for (int i = 0; i < root_count; i++)
+        watch_tree(&w, roots[i]);
+    fprintf(stderr, "Watching %d directories\n", w.directory_count);
+    process_pending(&w);
+
+    for (;;)
+    {
+        struct pollfd poll_fd = {w.inotify, POLLIN, 0};
+        int timeout = -1;
+
+        if (w.pending_count)
+        {
+            const uint64_t quiet = last_change + debounce_ms, latest = first_change + (uint64_t)debounce_ms * WATCH_MAX_DELAY;
+            const uint64_t due = quiet < latest ? quiet : latest, now = now_ms();
+
+            timeout = due > now ? (int)(due - now) : 0;
+        }
+
+        const int ready = poll(&poll_fd, 1, timeout);
+        if (ready < 0 && errno != EINTR)
+        {
+            fprintf(stderr, "Watch: %s\n", strerror(errno));
+            return EXIT_FAILURE;
+        }
+
+        if (ready > 0)
+        {
+            const size_t pending = w.pending_count;
+
+            read_events(&w);
+            if (w.pending_count != pending)
+            {
+                last_change = now_ms();
+                if (!pending)
+                    first_change = last_change;
+            }
+        }
+        else if (ready == 0 && w.pending_count)
+        {
+            process_pending(&w);
+        }
+    }
+}
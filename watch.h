@@ -0,0 +1,73 @@
+#ifndef WATCH_H
+#define WATCH_H
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "arena.h"
+#include "batch.h"
+#include "output.h"
+#include "record_printer.h"
+
+#define WATCH_DEBOUNCE_MS 200 // quiet time after the last change before a batch runs
+#define WATCH_MAX_DELAY 10    // debounce intervals a batch waits at most for the changes to stop
+
+/**
+ * What the watcher knows about a .class file
+ */
+typedef struct watch_entry_s
+{
+    char *path;
+    uint64_t hash; // of the contents last read
+    uint64_t size;
+    bool exists;   // the file was there when last read, hash and size are valid
+    bool reported; // an added or modified event was sent and no deleted one since
+
+} watch_entry;
+
+/**
+ * A file to look at again in the next batch
+ */
+typedef struct watch_change_s
+{
+    char *path;
+    watch_entry *entry; // NULL for a file not seen before
+    change_event event; // 0 if nothing is reported
+    bool exists;
+    bool keep;          // couldn't be read, leave the entry as it is
+    uint64_t hash;
+    uint64_t size;
+    out_buffer text;    // output for the class unless the run is brief
+    char *error;        // why the class couldn't be parsed, NULL on success
+
+} watch_change;
+
+typedef struct watch_state_s
+{
+    int inotify;
+    char **roots;
+    int root_count;
+    const batch_options *options;
+    bool brief; // report the events only, not the classes
+
+    char **directories; // watched directory per watch descriptor, NULL if none
+    int directory_capacity;
+    int directory_count;
+
+    watch_entry **slots; // open addressing by path, NULL for a free slot
+    size_t slot_count;
+    size_t entry_count;
+
+    char **pending; // paths changed since the last batch, may repeat
+    size_t pending_count;
+    size_t pending_capacity;
+    size_t events;  // inotify events since the last batch
+
+    watch_change *changes; // of the batch being processed
+    arena *arenas;         // one per worker, reset after every file
+
+} watch_state;
+
+int run_watch(char **roots, int root_count, const batch_options *options, bool brief, int debounce_ms);
+
+#endif